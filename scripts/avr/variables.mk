@@ -11,6 +11,10 @@ ifdef NEED_I2C
 	SRC += avr/softi2c.c
 endif
 
+ifeq ($(CONFIG_CRC_NIBBLE),y)
+	SRC += avr/crc.c
+endif
+
 #---------------- Toolchain ----------------
 CC = avr-gcc
 OBJCOPY = avr-objcopy
@@ -175,3 +179,14 @@ ifeq ($(CONFIG_STACK_TRACKING),y)
 	ARCH_CFLAGS += -finstrument-functions
 endif
 
+# External SRAM starts right after the internal RAM and ends with the
+# 64KB data address space, xmem.ld fails the link if it overflows
+ifeq ($(CONFIG_XMEM),y)
+  ifeq ($(MCU),atmega128)
+	ARCH_LDFLAGS += -Wl,--section-start=xmem=0x801100,--defsym=__xmem_size=0xef00
+  else
+	ARCH_LDFLAGS += -Wl,--section-start=xmem=0x802200,--defsym=__xmem_size=0xde00
+  endif
+	ARCH_LDFLAGS += scripts/avr/xmem.ld
+endif
+
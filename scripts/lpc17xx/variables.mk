@@ -16,6 +16,10 @@ SRC += lpc17xx/llfl-geos.c
 SRC += lpc17xx/llfl-parallel.c
 SRC += lpc17xx/llfl-n0sdos.c
 
+ifeq ($(CONFIG_IEC_ENGINE),y)
+  SRC += iec-engine.c lpc17xx/iec-engine-ll.c
+endif
+
 ifeq ($(CONFIG_UART_DEBUG),y)
   SRC += lpc17xx/printf.c
 endif
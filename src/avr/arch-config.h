@@ -1411,6 +1411,13 @@ static inline void buttons_init(void)
 #define SOFTI2C_BIT_INTRQ PC6
 #define SOFTI2C_DELAY   6
 
+// The external memory interface uses PORTA, PORTC and PG0-PG2, so the
+// I2C lines above and the buttons can't be used together with CONFIG_XMEM.
+#if defined(CONFIG_XMEM) && \
+    (defined(CONFIG_RTC_PCF8583) || defined(CONFIG_RTC_DSRTC) || defined(CONFIG_REMOTE_DISPLAY))
+#  error "The software I2C lines on PORTC are needed by CONFIG_XMEM!"
+#endif
+
 
 /*** board-specific initialisation ***/
 /* Currently used on uIEC/CF and uIEC/SD only */
@@ -1684,6 +1691,19 @@ static inline uint8_t display_intrq_active(void) {
 }
 #endif
 
+/* External SRAM: the data buffers and caches are placed in the xmem */
+/* section, which the linker puts behind the internal RAM. Its size  */
+/* is checked at link time by scripts/avr/xmem.ld.                   */
+#ifdef CONFIG_XMEM
+#  ifndef XMCRA
+#    error "CONFIG_XMEM enabled on a chip without external memory interface!"
+#  endif
+#  define XMEM_ATTRIB     __attribute__((section("xmem")))
+#  define BUFFER_ATTRIB   XMEM_ATTRIB
+#  define CACHE_ATTRIB    XMEM_ATTRIB
+#  define P00CACHE_ATTRIB XMEM_ATTRIB
+#endif
+
 /* P00 name cache is in bss by default */
 #ifndef P00CACHE_ATTRIB
 #  define P00CACHE_ATTRIB
@@ -37,3 +37,25 @@ void timer_init(void) {
   TCCR1B = _BV(WGM12) | _BV(CS10) | _BV(CS11);
   TIMSK1 |= _BV(OCIE1A);
 }
+
+/**
+ * getmicros - return the current time in microseconds
+ *
+ * This function returns the time since timer_init in microseconds,
+ * calculated from the tick counter and timer 1. The value wraps
+ * after MICROS_WRAP microseconds. The resolution is 64 clock cycles.
+ */
+uint32_t getmicros(void) {
+  tick_t   t;
+  uint16_t count;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    t     = ticks;
+    count = TCNT1;
+    /* timer 1 has wrapped, but the tick interrupt hasn't run yet */
+    if ((TIFR1 & _BV(OCF1A)) && count < OCR1A / 2)
+      t++;
+  }
+
+  return (uint32_t)t * 10000 + (uint32_t)count * 64 / (F_CPU / 1000000);
+}
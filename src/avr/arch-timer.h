@@ -35,6 +35,11 @@
 typedef uint16_t tick_t;
 typedef int16_t stick_t;
 
+/* getmicros wraps together with the 16 bit tick counter */
+#define MICROS_WRAP (65536UL * 10000)
+
+uint32_t getmicros(void);
+
 /**
  * start_timeout - start a timeout using timer0
  * @usecs: number of microseconds before timeout (maximum 256 for 8MHz clock)
@@ -27,16 +27,29 @@
 #define CRC_H
 
 #include <util/crc16.h>
+#include "progmem.h"
 
 uint8_t crc7update(uint8_t crc, uint8_t data);
 
-#define crc_xmodem_update(crc, data) _crc_xmodem_update(crc, data)
+#ifdef CONFIG_CRC_NIBBLE
+/* CRC of each nibble value shifted through the polynomial, see crc.c */
+extern const PROGMEM uint16_t crc_xmodem_nibbles[16];
+
+/* CRC-XModem with two table lookups per byte instead of bit operations */
+static inline uint16_t crc_xmodem_update(uint16_t crc, uint8_t data) {
+  crc = (crc << 4) ^ pgm_read_word(crc_xmodem_nibbles + ((crc >> 12) ^ (data >> 4)));
+  crc = (crc << 4) ^ pgm_read_word(crc_xmodem_nibbles + ((crc >> 12) ^ (data & 0x0f)));
+  return crc;
+}
+#else
+#  define crc_xmodem_update(crc, data) _crc_xmodem_update(crc, data)
+#endif
 #define crc16_update(crc, data) _crc16_update(crc, data)
 
 /* Calculate a CRC over a block of data - more efficient if inlined */
 static inline uint16_t crc_xmodem_block(uint16_t crc, const uint8_t *data, unsigned int length) {
   while (length--) {
-    crc = _crc_xmodem_update(crc, *data++);
+    crc = crc_xmodem_update(crc, *data++);
   }
   return crc;
 }
@@ -47,6 +47,29 @@ void get_mcusr(void)
   wdt_disable();
 }
 
+#ifdef CONFIG_XMEM
+/* Enable the external memory interface before anything uses it and */
+/* clear the xmem section, the startup code only clears .bss.        */
+/* This function is merged into the startup and doesn't need to be called explicitly */
+void xmem_init(void) \
+  __attribute__((naked)) \
+  __attribute__((section(".init3")));
+void xmem_init(void) {
+  extern uint8_t __start_xmem[], __stop_xmem[];
+  register uint8_t *ptr;
+
+  XMCRB = 0;   /* all of PORTC is used for A8-A15 */
+#  ifdef CONFIG_XMEM_WAITSTATES
+  XMCRA = _BV(SRE) | (CONFIG_XMEM_WAITSTATES << SRW10);
+#  else
+  XMCRA = _BV(SRE);
+#  endif
+
+  for (ptr = __start_xmem; ptr != __stop_xmem; ptr++)
+    *ptr = 0;
+}
+#endif
+
 #ifdef CONFIG_MEMPOISON
 void poison_memory(void) \
   __attribute__((naked)) \
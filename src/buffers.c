@@ -30,6 +30,7 @@
 #include "ff.h"
 #include "led.h"
 #include "buffers.h"
+#include "d64ops.h"
 
 dh_t    matchdh;
 uint8_t ops_scratch[33];
@@ -38,10 +39,10 @@ uint8_t ops_scratch[33];
 buffer_t buffers[CONFIG_BUFFER_COUNT+1];
 
 /// The actual data buffers
-static uint8_t bufferdata[CONFIG_BUFFER_COUNT*256];
+static BUFFER_ATTRIB uint8_t bufferdata[CONFIG_BUFFER_COUNT*256];
 
-/// Number of active data buffers + 16 * number of dirty buffers
-uint8_t active_buffers;
+/// Number of active data buffers + DIRTY_BUFFER_UNIT * number of dirty buffers
+active_buffers_t active_buffers;
 
 /**
  * callback_dummy - dummy function for the buffer callbacks
@@ -91,6 +92,10 @@ static void alloc_specific_buffer(uint8_t bufnum)
 	if (!buffers[bufnum].allocated) {
 		/* Clear everything except the data pointer */
 		memset(sizeof(uint8_t *) + (char*)&(buffers[bufnum]), 0, sizeof(buffer_t) - sizeof(uint8_t *));
+#ifdef CONFIG_WRITE_BATCH
+		/* A batched write may have moved the data pointer */
+		buffers[bufnum].data      = bufferdata + 256*bufnum;
+#endif
 		buffers[bufnum].allocated = 1;
 		buffers[bufnum].secondary = BUFFER_SEC_SYSTEM;
 		buffers[bufnum].refill    = callback_dummy;
@@ -99,12 +104,14 @@ static void alloc_specific_buffer(uint8_t bufnum)
 }
 
 /**
- * alloc_system_buffer - allocate a buffer for system use
+ * alloc_spare_buffer - allocate a buffer for system use if one is free
  *
- * This function allocates a buffer and marks it as used. Returns a
- * pointer to the buffer structure or NULL of no buffer is free.
+ * This function allocates a buffer and marks it as used. Unlike
+ * alloc_system_buffer it doesn't set an error if no buffer is free,
+ * so it can be used for optional work areas. Returns a pointer to
+ * the buffer structure or NULL if no buffer is free.
  */
-buffer_t* alloc_system_buffer(void)
+buffer_t* alloc_spare_buffer(void)
 {
 	uint8_t i;
 
@@ -115,10 +122,65 @@ buffer_t* alloc_system_buffer(void)
 		}
 	}
 
-	set_error(ERROR_NO_CHANNEL);
 	return NULL;
 }
 
+#ifdef CONFIG_WRITE_BATCH
+/**
+ * reclaim_buffer - take back borrowed buffers
+ *
+ * This function calls the cleanup function of borrowed buffers (see
+ * alloc_next_buffer) until one of them is freed, which makes its
+ * owner continue without the buffers it borrowed. Returns 1 if a
+ * buffer was freed, 0 otherwise.
+ */
+static uint8_t reclaim_buffer(void)
+{
+	uint8_t i;
+
+	for (i=0;i<CONFIG_BUFFER_COUNT;i++) {
+		if (buffers[i].allocated && buffers[i].borrowed) {
+			buffers[i].cleanup(&buffers[i]);
+			if (!buffers[i].allocated)
+				return 1;
+		}
+	}
+
+	return 0;
+}
+#else
+#  define reclaim_buffer() 0
+#endif
+
+/**
+ * alloc_system_buffer - allocate a buffer for system use
+ *
+ * This function allocates a buffer and marks it as used. If no buffer
+ * is free, sectors queued for a disk image are written and buffers
+ * borrowed by open files are taken back. Returns a pointer to the
+ * buffer structure or NULL of no buffer is free.
+ */
+buffer_t* alloc_system_buffer(void)
+{
+	buffer_t *buf = alloc_spare_buffer();
+
+#ifdef CONFIG_D64_WRITEBEHIND
+	/* Sectors queued for an image only wait for a good time to be written */
+	if (buf == NULL) {
+		if (d64_writebehind_flush(255, 0))
+			return NULL;
+		buf = alloc_spare_buffer();
+	}
+#endif
+
+	if (buf == NULL && reclaim_buffer())
+		buf = alloc_spare_buffer();
+
+	if (buf == NULL)
+		set_error(ERROR_NO_CHANNEL);
+	return buf;
+}
+
 /**
  * alloc_buffer - allocates a buffer
  *
@@ -144,13 +206,17 @@ buffer_t* alloc_buffer(void)
  * This function allocates count buffers, marks them as used and
  * links them. It will also turn on the busy LED to notify the user.
  * Returns a pointer to the first buffer structure or NULL if
- * not enough buffers are free. The data segments of the allocated
+ * not enough buffers are free. Sectors queued for a disk image are
+ * written first if that could help. The data segments of the allocated
  * buffers are guaranteed to be continuous.
  */
 buffer_t *alloc_linked_buffers(uint8_t count)
 {
 	uint8_t i,freebufs,start;
 
+#ifdef CONFIG_D64_WRITEBEHIND
+ retry:
+#endif
 	freebufs = 0;
 	start    = 0;
 	for (i=0;i<CONFIG_BUFFER_COUNT;i++) {
@@ -169,6 +235,15 @@ buffer_t *alloc_linked_buffers(uint8_t count)
 	}
 
 	if (freebufs < count) {
+#ifdef CONFIG_D64_WRITEBEHIND
+		/* Write queued image sectors and try again */
+		for (i=0;i<CONFIG_BUFFER_COUNT;i++)
+			if (buffers[i].allocated && buffers[i].secondary == BUFFER_SYS_WRITEBEHIND) {
+				if (d64_writebehind_flush(255, 0))
+					return NULL;
+				goto retry;
+			}
+#endif
 		set_error(ERROR_NO_CHANNEL);
 		return NULL;
 	}
@@ -190,6 +265,38 @@ buffer_t *alloc_linked_buffers(uint8_t count)
 	return &buffers[start];
 }
 
+#ifdef CONFIG_WRITE_BATCH
+/**
+ * alloc_next_buffer - allocates the buffer following another one
+ * @buf: buffer whose data segment should be extended
+ *
+ * This function allocates the buffer whose data segment directly
+ * follows the one of buf, so both can be used as a single area of
+ * 512 bytes. The new buffer is sticky and uses a chained secondary
+ * address, so it is freed together with buf but never found by
+ * find_buffer. It is marked as borrowed: the caller must set its
+ * cleanup callback to a function that makes the owner continue
+ * without it, which is called when alloc_system_buffer runs out of
+ * buffers. Returns a pointer to the buffer structure or NULL if
+ * it is not available, no error is set in that case.
+ */
+buffer_t *alloc_next_buffer(buffer_t *buf)
+{
+	uint8_t i = buf - buffers + 1;
+
+	if (i >= CONFIG_BUFFER_COUNT || buffers[i].allocated)
+		return NULL;
+
+	alloc_specific_buffer(i);
+	active_buffers++;
+	buffers[i].secondary = BUFFER_SEC_CHAIN - buf->secondary;
+	buffers[i].sticky    = 1;
+	buffers[i].borrowed  = 1;
+
+	return &buffers[i];
+}
+#endif
+
 /**
  * cleanup_and_free_buffer - cleanup and deallocate a buffer
  * @buffer: pointer to the buffer structure to cleanup and mark as free
@@ -219,7 +326,7 @@ void free_buffer(buffer_t *buffer) {
 	buffer->allocated = 0;
 
 	if (buffer->dirty)
-		active_buffers -= 16;
+		active_buffers -= DIRTY_BUFFER_UNIT;
 	if (buffer->secondary < BUFFER_SEC_SYSTEM)
 		active_buffers--;
 
@@ -288,7 +395,7 @@ void mark_buffer_dirty(buffer_t *buf)
 {
 	if(!buf->dirty) {
 		buf->dirty = 1;
-		active_buffers += 16;
+		active_buffers += DIRTY_BUFFER_UNIT;
 		set_dirty_led(1);
 	}
 }
@@ -304,7 +411,7 @@ void mark_buffer_clean(buffer_t *buf)
 {
 	if (buf->dirty) {
 		buf->dirty = 0;
-		active_buffers -= 16;
+		active_buffers -= DIRTY_BUFFER_UNIT;
 		if (get_dirty_buffer_count() == 0)
 			set_dirty_led(0);
 	}
@@ -39,6 +39,9 @@
 #define BUFFER_SYS_CAPTURE2 (BUFFER_SEC_SYSTEM+3)
 #define BUFFER_SYS_CAPTURE3 (BUFFER_SEC_SYSTEM+4)
 
+// disk image sectors waiting to be written
+#define BUFFER_SYS_WRITEBEHIND (BUFFER_SEC_SYSTEM+5)
+
 /* chained buffers use (BUFFER_SEC_CHAIN-14)..BUFFER_SEC_CHAIN */
 /* to distinguish secondary addresses */
 #define BUFFER_SEC_CHAIN    (BUFFER_SEC_SYSTEM-1)
@@ -69,6 +72,7 @@ typedef enum { DIR_FMT_CBM, DIR_FMT_CMD_SHORT, DIR_FMT_CMD_LONG } dirformat_t;
  * @write    : Flags if the buffer was opened for writing
  * @sendeoi  : Flags if the last byte should be sent with EOI
  * @sticky   : Flags if the buffer will survive garbage collection
+ * @borrowed : Flags if the buffer extends the data area of the one before it
  * @refill   : Callback to refill/write out the buffer, returns true on error
  * @cleanup  : Callback to clean up and save remaining data, returns true on error
  *
@@ -94,6 +98,7 @@ typedef struct buffer_s {
   int     dirty:1;
   int     sendeoi:1;
   int     sticky:1;
+  int     borrowed:1;
   uint8_t (*seek) (struct buffer_s *buffer, uint32_t position, uint8_t index);
   uint8_t (*refill)(struct buffer_s *buffer);
   uint8_t (*cleanup)(struct buffer_s *buffer);
@@ -112,6 +117,13 @@ typedef struct buffer_s {
     struct {
       FIL fh;              /* File access via FAT */
       uint8_t headersize;  /* offset to start of file data */
+#ifdef CONFIG_WRITE_BATCH
+      uint8_t batch;       /* number of buffers in the write batch area, 0 if unused */
+      uint16_t pending;    /* bytes collected in the write batch area */
+#endif
+#ifdef CONFIG_FAT_RESERVE
+      uint32_t reserved;   /* end of the reserved clusters, 0 if not reserving */
+#endif
     } fat;
     d64fh_t d64;           /* File access on D64  */
     eefs_fh_t eefh;        /* File handle for eepromfs */
@@ -147,6 +159,9 @@ uint8_t callback_dummy(buffer_t *buf);
 /* Allocates a buffer for internal use */
 buffer_t *alloc_system_buffer(void);
 
+/* Allocates a buffer for internal use if one is free, without an error */
+buffer_t *alloc_spare_buffer(void);
+
 /* Allocates a buffer - returns pointer to buffer or NULL if failure */
 buffer_t *alloc_buffer(void);
 
@@ -154,6 +169,11 @@ buffer_t *alloc_buffer(void);
 /* Buffers are guranteed to have continuous data segments. */
 buffer_t *alloc_linked_buffers(uint8_t count);
 
+#ifdef CONFIG_WRITE_BATCH
+/* Allocates the buffer whose data segment follows the one of buf */
+buffer_t *alloc_next_buffer(buffer_t *buf);
+#endif
+
 /* Call the cleanup function and deallocate a buffer */
 void cleanup_and_free_buffer(buffer_t *buffer);
 
@@ -177,14 +197,24 @@ static void inline unstick_buffer(buffer_t *buf) {
 /* Returns pointer to buffer on success or NULL on failure */
 buffer_t *find_buffer(uint8_t secondary);
 
-/* Number of currently allocated buffers + 16 * number of write buffers */
-extern uint8_t active_buffers;
+/* active_buffers needs more bits if there are more than 15 buffers */
+#if CONFIG_BUFFER_COUNT > 15
+typedef uint16_t active_buffers_t;
+#  define DIRTY_BUFFER_SHIFT 8
+#else
+typedef uint8_t active_buffers_t;
+#  define DIRTY_BUFFER_SHIFT 4
+#endif
+#define DIRTY_BUFFER_UNIT (1 << DIRTY_BUFFER_SHIFT)
+
+/* Number of currently allocated buffers + DIRTY_BUFFER_UNIT * number of write buffers */
+extern active_buffers_t active_buffers;
 
 /* Check if any buffers are free */
-#define check_free_buffers() ((active_buffers & 0x0f) < CONFIG_BUFFER_COUNT)
+#define check_free_buffers() ((active_buffers & (DIRTY_BUFFER_UNIT - 1)) < CONFIG_BUFFER_COUNT)
 
 /* Return the number of dirty buffers */
-#define get_dirty_buffer_count() (active_buffers >> 4)
+#define get_dirty_buffer_count() (active_buffers >> DIRTY_BUFFER_SHIFT)
 
 /* Mark a buffer as write-buffer and sticky it */
 // Note: inline function is smaller than external on AVR with gcc 4.8.2
@@ -72,6 +72,15 @@ static inline void board_init(void)
 /* Hardcoded maximum - reducing this won't save any ram */
 #define MAX_DRIVES 8
 
+/* Data buffers and large caches are in bss unless the arch moves them */
+#ifndef BUFFER_ATTRIB
+#  define BUFFER_ATTRIB
+#endif
+
+#ifndef CACHE_ATTRIB
+#  define CACHE_ATTRIB
+#endif
+
 /* SD access LED dummy */
 #ifndef HAVE_SD_LED
 # define set_sd_led(x) do {} while (0)
@@ -82,6 +91,30 @@ static inline void board_init(void)
 #  error "CONFIG_LOADER_GEOS must be enabled for Wheels support!"
 #endif
 
+#if defined(CONFIG_CRC_SLICES) && CONFIG_CRC_SLICES != 4 && CONFIG_CRC_SLICES != 8
+#  error "CONFIG_CRC_SLICES must be 4 or 8!"
+#endif
+
+#if defined(CONFIG_CRC_NIBBLE) && !defined(__AVR__)
+#  error "CONFIG_CRC_NIBBLE is only available on AVR!"
+#endif
+
+#if defined(CONFIG_IEC_ENGINE) && defined(__AVR__)
+#  error "CONFIG_IEC_ENGINE is not available on AVR!"
+#endif
+
+#if defined(CONFIG_WRITE_BATCH) && CONFIG_WRITE_BATCH < 3
+#  error "CONFIG_WRITE_BATCH must be at least 3!"
+#endif
+
+#if defined(CONFIG_FAT_DIRHASH) && (CONFIG_FAT_DIRHASH & (CONFIG_FAT_DIRHASH - 1))
+#  error "CONFIG_FAT_DIRHASH must be a power of two!"
+#endif
+
+#if defined(CONFIG_XMEM_WAITSTATES) && CONFIG_XMEM_WAITSTATES > 3
+#  error "CONFIG_XMEM_WAITSTATES must be between 0 and 3!"
+#endif
+
 #if defined(CONFIG_PARALLEL_DOLPHIN)
 #  if !defined(HAVE_PARALLEL)
 #    error "CONFIG_PARALLEL_DOLPHIN enabled on a hardware without parallel port!"
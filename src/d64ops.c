@@ -35,6 +35,7 @@
 #include "progmem.h"
 #include "rtc.h"
 #include "ustring.h"
+#include "utils.h"
 #include "wrapops.h"
 #include "d64ops.h"
 
@@ -88,10 +89,69 @@ struct {
   uint8_t errors[MAX_SECTORS_PER_TRACK];
 } errorcache;
 
-static buffer_t *bam_buffer;  // recently-used buffer
-static buffer_t *bam_buffer2; // secondary buffer
+#ifdef CONFIG_D64_READAHEAD
+#  if CONFIG_D64_READAHEAD > 255
+#    error "CONFIG_D64_READAHEAD must not be larger than 255!"
+#  endif
+
+/* Sectors read ahead from the track that was accessed last */
+static struct {
+  uint8_t part;
+  uint8_t track;
+  uint8_t first;
+  uint8_t count;
+  uint8_t data[CONFIG_D64_READAHEAD * 256];
+} readahead;
+
+cachestats_t d64_readahead_stats;
+#endif
+
+#ifdef CONFIG_D64_DIRCACHE
+#  if CONFIG_D64_DIRCACHE > 255
+#    error "CONFIG_D64_DIRCACHE must not be larger than 255!"
+#  endif
+
+/* Non-deleted entries of the directory opened last */
+static struct {
+  uint8_t      part;
+  uint8_t      count;
+  uint8_t      last;     // entry returned most recently
+  uint8_t      complete; // all entries of the directory are cached
+  uint8_t      full;     // at least one entry did not fit
+  struct d64dh start;    // first directory sector
+  struct {
+    struct d64dh dh;
+    uint8_t      data[30]; // directory entry without the sector link
+  } entries[CONFIG_D64_DIRCACHE];
+} dircache;
+
+cachestats_t d64_dircache_stats;
+#endif
+
+#ifdef CONFIG_D64_FREEMAP
+/* Summary of the free sectors of one partition */
+static struct {
+  uint8_t  part;
+  uint16_t blocks;        // free blocks as reported in the directory
+  uint8_t  tracks[256/8]; // bit set if the track has free sectors
+} freemap;
+#endif
+
+#ifdef CONFIG_D64_BAM_BUFFERS
+#  define BAM_BUFFERS CONFIG_D64_BAM_BUFFERS
+#  if BAM_BUFFERS < 1
+#    error "CONFIG_D64_BAM_BUFFERS must be at least 1!"
+#  endif
+#else
+#  define BAM_BUFFERS 2
+#endif
+
+static buffer_t *bam_buffers[BAM_BUFFERS]; // sorted by last use
 static uint8_t   bam_refcount;
 
+/* most recently used BAM buffer */
+#define bam_buffer (bam_buffers[0])
+
 /* ------------------------------------------------------------------------- */
 /*  Forward declarations                                                     */
 /* ------------------------------------------------------------------------- */
@@ -216,6 +276,355 @@ static uint16_t sectors_per_track(uint8_t part, uint8_t track) {
   }
 }
 
+#ifdef CONFIG_D64_READAHEAD
+/**
+ * cached_read - read part of a sector through the read-ahead cache
+ * @part  : partition number
+ * @track : track number to be read
+ * @sector: sector number to be read
+ * @offset: offset of the first byte within the sector
+ * @buf   : pointer to where the data should be read to
+ * @len   : number of bytes to be read, must not cross the sector end
+ *
+ * This function returns data from the read-ahead cache if the
+ * requested sector is in it. Otherwise it reloads the cache with
+ * a single image_read call: with the whole track if it fits, or
+ * with the requested sector and those following it if it doesn't.
+ * If the cache can't be filled completely, the data is read
+ * directly from the image instead. Assumes that it is never
+ * called with an invalid track/sector.
+ * Returns the same as image_read.
+ */
+static uint8_t cached_read(uint8_t part, uint8_t track, uint8_t sector,
+                           uint8_t offset, uint8_t *buf, uint16_t len) {
+  if (readahead.count == 0 ||
+      readahead.part  != part || readahead.track != track ||
+      sector < readahead.first ||
+      sector >= readahead.first + readahead.count) {
+    uint16_t spt   = sectors_per_track(part, track);
+    uint8_t  first = 0;
+    uint8_t  res;
+
+    d64_readahead_stats.misses++;
+
+    if (spt > CONFIG_D64_READAHEAD)
+      first = sector;
+
+    readahead.count = 0;
+    spt = min(spt - first, CONFIG_D64_READAHEAD);
+    res = image_read(part, sector_offset(part, track, first),
+                     readahead.data, spt * 256);
+    if (res == 1)
+      /* truncated image, read just the requested part */
+      return image_read(part, sector_offset(part, track, sector) + offset,
+                        buf, len);
+    if (res)
+      return res;
+
+    readahead.part  = part;
+    readahead.track = track;
+    readahead.first = first;
+    readahead.count = spt;
+  } else {
+    d64_readahead_stats.hits++;
+  }
+
+  memcpy(buf, readahead.data + 256 * (sector - readahead.first) + offset, len);
+  return 0;
+}
+
+#endif
+
+#ifdef HAVE_D64_CACHES
+/**
+ * d64_cache_invalidate - invalidate cached image contents
+ * @part: partition number
+ *
+ * This function discards the contents of the read-ahead and
+ * directory caches if they were read from partition @part.
+ * It must be called whenever the image on this partition
+ * is modified.
+ */
+void d64_cache_invalidate(uint8_t part) {
+#ifdef CONFIG_D64_READAHEAD
+  if (readahead.part == part)
+    readahead.count = 0;
+#endif
+#ifdef CONFIG_D64_DIRCACHE
+  if (dircache.part == part)
+    dircache.part = 255;
+#endif
+}
+#endif
+
+#ifdef CONFIG_D64_WRITEBEHIND
+/* Data sectors waiting to be written, sorted by their offset in the image */
+static struct {
+  uint8_t   part;
+  uint8_t   count;
+  uint8_t   stored;                       // counts writebehind_store calls
+  uint8_t   age[CONFIG_D64_WRITEBEHIND];  // value of stored when queued
+  buffer_t *bufs[CONFIG_D64_WRITEBEHIND];
+} writebehind;
+
+/**
+ * writebehind_swap - exchange the data of two sectors
+ * @bufs: array of buffers holding the sectors
+ * @a   : index of the first sector
+ * @b   : index of the second sector
+ *
+ * This function swaps the data and offsets of the sectors in bufs[a]
+ * and bufs[b], then swaps the buffers in the array. The result is
+ * that both sectors keep their place in the array while their data
+ * moves to the data area of the other buffer.
+ */
+static void writebehind_swap(buffer_t **bufs, uint8_t a, uint8_t b) {
+  buffer_t *bufa = bufs[a];
+  buffer_t *bufb = bufs[b];
+  uint8_t  *pa   = bufa->data;
+  uint8_t  *pb   = bufb->data;
+  uint32_t  fptr;
+  uint8_t   tmp, i = 0;
+
+  do {
+    tmp   = pa[i];
+    pa[i] = pb[i];
+    pb[i] = tmp;
+  } while (++i);
+
+  fptr       = bufa->fptr;
+  bufa->fptr = bufb->fptr;
+  bufb->fptr = fptr;
+
+  bufs[a] = bufb;
+  bufs[b] = bufa;
+}
+
+/**
+ * writebehind_write - write queued sectors to the image
+ * @part : partition number of the image
+ * @bufs : array of buffers holding the sectors, sorted by offset
+ * @count: number of sectors
+ * @sync : sync the image file after writing
+ *
+ * This function writes the sectors in bufs to the image and frees
+ * their buffers. The data is first moved so that the buffers are in
+ * memory in the same order as the sectors in the image. A run of
+ * sectors that follow each other in both is then written with a
+ * single call to image_write, so both halves of a card sector or
+ * adjacent card sectors reach the card with one command.
+ * Returns 0 if successful or != 0 if an error occured.
+ */
+static uint8_t writebehind_write(uint8_t part, buffer_t **bufs, uint8_t count, uint8_t sync) {
+  uint8_t i, j, res = 0;
+
+  /* Sort the data areas by address, keeping the sectors in image order */
+  for (i = 0; i < count; i++) {
+    uint8_t lowest = i;
+
+    for (j = i + 1; j < count; j++)
+      if (bufs[j]->data < bufs[lowest]->data)
+        lowest = j;
+
+    if (lowest != i)
+      writebehind_swap(bufs, i, lowest);
+  }
+
+  for (i = 0; i < count; i = j) {
+    for (j = i + 1; j < count; j++)
+      if (bufs[j]->fptr != bufs[j-1]->fptr + 256 ||
+          bufs[j]->data != bufs[j-1]->data + 256)
+        break;
+
+    if (!res)
+      res = image_write(part, bufs[i]->fptr, bufs[i]->data,
+                        (uint16_t)(j - i) * 256, sync && j == count);
+  }
+
+  for (i = 0; i < count; i++)
+    free_buffer(bufs[i]);
+
+  return res;
+}
+
+/**
+ * d64_writebehind_flush - write all queued sectors to the image
+ * @part: partition number, 255 for any
+ * @sync: sync the image file after writing
+ *
+ * This function writes the data sectors queued by writebehind_store
+ * to the image in the order of their offsets and frees their buffers.
+ * Returns 0 if successful or != 0 if an error occured.
+ */
+uint8_t d64_writebehind_flush(uint8_t part, uint8_t sync) {
+  uint8_t count;
+
+  if (writebehind.count == 0 ||
+      (part != 255 && part != writebehind.part))
+    return 0;
+
+  /* Clear the queue first, image_write calls d64_writebehind_access */
+  count = writebehind.count;
+  writebehind.count = 0;
+
+  return writebehind_write(writebehind.part, writebehind.bufs, count, sync);
+}
+
+/**
+ * writebehind_make_room - write some of the queued sectors
+ *
+ * This function is called when the queue is full. It writes the
+ * sectors whose card sector is completely queued, because these need
+ * no read from the card and their partner will not arrive anymore.
+ * If there are none, only the sector queued first is written, so the
+ * other halves have more time to find their partner in the
+ * interleaved order a file is saved in.
+ * Returns 0 if successful or != 0 if an error occured.
+ */
+static uint8_t writebehind_make_room(void) {
+  buffer_t *done[CONFIG_D64_WRITEBEHIND];
+  uint8_t i, j, oldest, count = 0, keep = 0;
+
+  for (i = 0; i < writebehind.count; i++) {
+    buffer_t *buf = writebehind.bufs[i];
+
+    if ((i > 0 &&
+         writebehind.bufs[i-1]->fptr == (buf->fptr & ~(uint32_t)256)) ||
+        (i + 1 < writebehind.count &&
+         writebehind.bufs[i+1]->fptr == (buf->fptr | 256))) {
+      done[count++] = buf;
+    } else {
+      writebehind.age[keep]    = writebehind.age[i];
+      writebehind.bufs[keep++] = buf;
+    }
+  }
+
+  if (count == 0) {
+    oldest = 0;
+    for (i = 1; i < keep; i++)
+      if ((uint8_t)(writebehind.stored - writebehind.age[i]) >
+          (uint8_t)(writebehind.stored - writebehind.age[oldest]))
+        oldest = i;
+
+    done[count++] = writebehind.bufs[oldest];
+    for (j = oldest + 1; j < keep; j++) {
+      writebehind.age[j-1]  = writebehind.age[j];
+      writebehind.bufs[j-1] = writebehind.bufs[j];
+    }
+    keep--;
+  }
+
+  writebehind.count = keep;
+  return writebehind_write(writebehind.part, done, count, 0);
+}
+
+/**
+ * d64_writebehind_access - prepare an access to the image
+ * @part  : partition number
+ * @offset: offset of the access in the image, -1 if unknown
+ * @bytes : number of bytes accessed
+ *
+ * This function must be called before the image in partition @part
+ * is accessed. It writes the queued sectors if any of them overlaps
+ * the accessed area.
+ */
+void d64_writebehind_access(uint8_t part, uint32_t offset, uint16_t bytes) {
+  uint8_t i;
+
+  if (writebehind.count == 0 || part != writebehind.part)
+    return;
+
+  for (i = 0; i < writebehind.count; i++) {
+    uint32_t start = writebehind.bufs[i]->fptr;
+
+    if (offset == (uint32_t)-1 ||
+        (offset < start + 256 && offset + bytes > start)) {
+      d64_writebehind_flush(part, 0);
+      return;
+    }
+  }
+}
+
+/**
+ * writebehind_cleanup - cleanup-callback of queued sectors
+ * @buf: buffer holding a queued sector
+ *
+ * This function is called when buffers are freed with FMB_CLEAN
+ * and writes the complete queue to the image.
+ */
+static uint8_t writebehind_cleanup(buffer_t *buf) {
+  return d64_writebehind_flush(255, 1);
+}
+
+/**
+ * writebehind_store - queue a data sector for writing
+ * @part  : partition number
+ * @track : track of the sector
+ * @sector: sector number
+ * @data  : pointer to the 256 bytes of data
+ *
+ * This function copies the data into a free buffer and queues it
+ * for writing by d64_writebehind_flush. If the queue is full it is
+ * flushed first, if no buffer is free the sector is written
+ * immediately. Returns the same as image_write.
+ */
+static uint8_t writebehind_store(uint8_t part, uint8_t track, uint8_t sector, uint8_t *data) {
+  uint32_t offset = sector_offset(part, track, sector);
+  buffer_t *buf;
+  uint8_t i;
+
+  if (writebehind.count && writebehind.part != part)
+    if (d64_writebehind_flush(255, 0))
+      return 2;
+
+  /* Find the sector in the queue or its place in the sort order */
+  for (i = 0; i < writebehind.count; i++)
+    if (writebehind.bufs[i]->fptr >= offset)
+      break;
+
+  if (i < writebehind.count && writebehind.bufs[i]->fptr == offset) {
+    buf = writebehind.bufs[i];
+  } else {
+    if (writebehind.count == CONFIG_D64_WRITEBEHIND ||
+        (buf = alloc_spare_buffer()) == NULL) {
+      if (writebehind.count && writebehind_make_room())
+        return 2;
+
+      buf = alloc_spare_buffer();
+      if (buf == NULL)
+        return image_write(part, offset, data, 256, 0);
+
+      /* Find the place in the sort order again */
+      for (i = 0; i < writebehind.count; i++)
+        if (writebehind.bufs[i]->fptr > offset)
+          break;
+    }
+
+    buf->secondary = BUFFER_SYS_WRITEBEHIND;
+    buf->cleanup   = writebehind_cleanup;
+    buf->fptr      = offset;
+    stick_buffer(buf);
+
+    memmove(writebehind.bufs + i + 1, writebehind.bufs + i,
+            (writebehind.count - i) * sizeof(buffer_t *));
+    memmove(writebehind.age + i + 1, writebehind.age + i,
+            writebehind.count - i);
+    writebehind.bufs[i] = buf;
+    writebehind.age[i]  = writebehind.stored++;
+    writebehind.part    = part;
+    writebehind.count++;
+  }
+
+  memcpy(buf->data, data, 256);
+  d64_cache_invalidate(part);
+
+  return 0;
+}
+#else
+#  define writebehind_store(part,track,sector,data) \
+  image_write(part, sector_offset(part,track,sector), data, 256, 1)
+#endif
+
 /**
  * checked_read - read a specified sector after range-checking
  * @part  : partition number
@@ -286,7 +695,11 @@ static uint8_t checked_read(uint8_t part, uint8_t track, uint8_t sector, uint8_t
     /* 1 is OK, unknown values are accepted too */
   }
 
+#ifdef CONFIG_D64_READAHEAD
+  return cached_read(part, track, sector, 0, buf, len);
+#else
   return image_read(part, sector_offset(part,track,sector), buf, len);
+#endif
 }
 
 /**
@@ -345,8 +758,12 @@ static uint8_t write_entry(uint8_t part, struct d64dh *dh, uint8_t *buf, uint8_t
  * Returns the same as image_read (0 success, 1 partial read, 2 failed)
  */
 static uint8_t read_entry(uint8_t part, struct d64dh *dh, uint8_t *buf) {
+#ifdef CONFIG_D64_READAHEAD
+  return cached_read(part, dh->track, dh->sector, dh->entry * 32, buf, 32);
+#else
   return image_read(part, sector_offset(part, dh->track, dh->sector) +
                           dh->entry * 32, buf, 32);
+#endif
 }
 
 /**
@@ -413,15 +830,15 @@ static uint8_t bam_buffer_flush(buffer_t *buf) {
  * contents to disk. Returns 0 if successful, != 0 otherwise.
  */
 uint8_t d64_bam_commit(void) {
-  uint8_t res = 0;
+  uint8_t i, res;
 
-  if (bam_buffer)
-    res |= bam_buffer->cleanup(bam_buffer);
+  /* Data sectors go first so the BAM never points to missing data */
+  res = d64_writebehind_flush(255, 1);
 
-  if (bam_buffer2)
-    res |= bam_buffer2->cleanup(bam_buffer2);
+  for (i = 0; i < BAM_BUFFERS && bam_buffers[i]; i++)
+    res |= bam_buffers[i]->cleanup(bam_buffers[i]);
 
-  return 0;
+  return res;
 }
 
 /**
@@ -446,14 +863,20 @@ static uint8_t bam_buffer_alloc(buffer_t **buf) {
 }
 
 /**
- * bam_buffer_swap - swap the two BAM buffers
+ * bam_buffer_invalidate - mark BAM buffers as unused
+ * @part: partition whose buffers should be invalidated, 255 for all
  *
- * Thus function swaps the pointers to the two BAM buffers
+ * This function writes the BAM buffers holding sectors of partition
+ * @part to disk and marks them as unused.
  */
-static void bam_buffer_swap(void) {
-  buffer_t *tmp = bam_buffer;
-  bam_buffer    = bam_buffer2;
-  bam_buffer2   = tmp;
+static void bam_buffer_invalidate(uint8_t part) {
+  uint8_t i;
+
+  for (i = 0; i < BAM_BUFFERS && bam_buffers[i]; i++) {
+    bam_buffers[i]->cleanup(bam_buffers[i]);
+    if (part == 255 || bam_buffers[i]->pvt.bam.part == part)
+      bam_buffers[i]->pvt.bam.part = 255;
+  }
 }
 
 /**
@@ -489,8 +912,10 @@ static uint8_t bam_buffer_match(buffer_t *buf, uint8_t part,
  * calculates the correct pointer into the BAM sector for the appropriate
  * track.  Since the BAM contains both sector counts and sector allocation
  * bitmaps, type is used to signal which reference is desired.
- * This function may swap the BAM buffer pointers, after it returns
- * bam_buffer is always the buffer with the requested sector.
+ * The BAM buffers are kept in least-recently-used order, an unused
+ * buffer or a newly allocated one is preferred over replacing the
+ * least recently used sector. After it returns bam_buffer is always
+ * the buffer with the requested sector.
  * Returns 0 if successful, != 0 otherwise.
  */
 static uint8_t move_bam_window(uint8_t part, uint8_t track, bamdata_t type, uint8_t **ptr) {
@@ -537,38 +962,50 @@ static uint8_t move_bam_window(uint8_t part, uint8_t track, bamdata_t type, uint
   }
 
   if (!bam_buffer_match(bam_buffer, part, t, s)) {
-    /* check if the second BAM buffer exists */
-    if (bam_buffer2) {
-      /* unconditionally swap to the other BAM buffer        */
-      /* either it has the data or it was less-recently used */
-
-      /* Note for future optimization:
-       * If buf1 is invalid and buf2 valid but not matching this will swap and
-       * use buf2 for the data instead of buf1 - using buf1
-       * while keeping buf2 without swapping would be better.
-       */
-      bam_buffer_swap();
-
-      /* check again, now in the other buffer */
-      if (bam_buffer_match(bam_buffer, part, t, s))
-        goto found;
-    } else {
-      /* allocate and swap to the second BAM buffer if the first one is valid */
-      if (bam_buffer->pvt.bam.part != 255) {
-        if (bam_buffer_alloc(&bam_buffer2)) {
-          /* allocation failed, reset error and continue with just one buffer */
+    buffer_t *buf;
+    uint8_t i, hit, unused = 255;
+
+    /* check the other BAM buffers */
+    for (i = 1; i < BAM_BUFFERS && bam_buffers[i]; i++) {
+      if (bam_buffer_match(bam_buffers[i], part, t, s))
+        break;
+      if (bam_buffers[i]->pvt.bam.part == 255)
+        unused = i;
+    }
+    if (bam_buffer->pvt.bam.part == 255)
+      unused = 0;
+
+    hit = (i < BAM_BUFFERS && bam_buffers[i]);
+    if (!hit) {
+      if (unused != 255) {
+        /* reuse a buffer that holds nothing */
+        i = unused;
+      } else if (i < BAM_BUFFERS) {
+        /* allocate another buffer */
+        if (bam_buffer_alloc(&bam_buffers[i])) {
+          /* allocation failed, reset error and continue without it */
           set_error(ERROR_OK);
-        } else {
-          /* switch to the new buffer */
-          bam_buffer_swap();
+          i--;
         }
+      } else {
+        /* replace the least recently used sector */
+        i--;
       }
     }
 
+    /* move the buffer to the front */
+    buf = bam_buffers[i];
+    memmove(bam_buffers + 1, bam_buffers, i * sizeof(buffer_t *));
+    bam_buffer = buf;
+
+    if (hit)
+      goto found;
+
     /* Need to read the BAM sector - flush only the target buffer */
     if (bam_buffer->cleanup(bam_buffer))
       return 1;
 
+    bam_buffer->pvt.bam.part = 255;
     res = image_read(part, sector_offset(part, t, s), bam_buffer->data, 256);
     if(res)
       return res;
@@ -646,6 +1083,110 @@ static uint16_t sectors_free(uint8_t part, uint8_t track) {
   }
 }
 
+/**
+ * track_is_counted - check if a track counts towards the free blocks
+ * @part : partition
+ * @track: track number
+ *
+ * This function returns 0 if the free sectors of the given track
+ * are not included in the number of free blocks reported in the
+ * directory, i.e. for the directory track. Returns 1 otherwise.
+ */
+static uint8_t track_is_counted(uint8_t part, uint8_t track) {
+  switch (partition[part].imagetype & D64_TYPE_MASK) {
+  case D64_TYPE_D81:
+    return track != D81_BAM_TRACK;
+
+  case D64_TYPE_DNP:
+    // DNP doesn't exclude anything
+    return 1;
+
+  case D64_TYPE_D41:
+  case D64_TYPE_D71:
+  default:
+    return track != D41_BAM_TRACK && track != D71_BAM2_TRACK;
+  }
+}
+
+#ifdef CONFIG_D64_FREEMAP
+/**
+ * freemap_build - set up the free sector summary for a partition
+ * @part: partition
+ *
+ * This function scans the BAM of partition @part to build the
+ * summary of free sectors if it doesn't hold that partition yet.
+ * Returns 0 if successful, 1 if the BAM couldn't be read.
+ */
+static uint8_t freemap_build(uint8_t part) {
+  uint16_t count;
+  uint8_t t;
+
+  if (freemap.part == part)
+    return 0;
+
+  freemap.part   = 255;
+  freemap.blocks = 0;
+  memset(freemap.tracks, 0, sizeof(freemap.tracks));
+
+  for (t = 1; t != 0 && t <= get_param(part, LAST_TRACK); t++) {
+    count = sectors_free(part, t);
+    if (count)
+      freemap.tracks[t / 8] |= 1 << (t & 7);
+    if (track_is_counted(part, t))
+      freemap.blocks += count;
+  }
+
+  /* sectors_free returns 0 on errors, don't keep the result then */
+  if (current_error >= 20)
+    return 1;
+
+  freemap.part = part;
+  return 0;
+}
+
+/**
+ * freemap_update - update the free sector summary after a BAM change
+ * @part  : partition
+ * @track : track number whose BAM entry was changed
+ * @change: change of the number of free sectors on the track
+ *
+ * This function updates the summary of free sectors if it is
+ * set up for partition @part. Must be called after the BAM entry
+ * of the track has been changed.
+ */
+static void freemap_update(uint8_t part, uint8_t track, int8_t change) {
+  if (freemap.part != part)
+    return;
+
+  if (sectors_free(part, track))
+    freemap.tracks[track / 8] |= 1 << (track & 7);
+  else
+    freemap.tracks[track / 8] &= (uint8_t)~(1 << (track & 7));
+
+  if (track_is_counted(part, track))
+    freemap.blocks += change;
+}
+
+/**
+ * track_has_free - check if a track has free sectors
+ * @part : partition
+ * @track: track number
+ *
+ * This function returns non-zero if the given track of partition
+ * @part has at least one free sector, 0 otherwise. Uses the free
+ * sector summary unless it cannot be set up.
+ */
+static uint8_t track_has_free(uint8_t part, uint8_t track) {
+  if (freemap_build(part))
+    return sectors_free(part, track) != 0;
+
+  return freemap.tracks[track / 8] & (1 << (track & 7));
+}
+#else
+#  define freemap_update(part, track, change) do {} while (0)
+#  define track_has_free(part, track) sectors_free(part, track)
+#endif
+
 /**
  * allocate_sector - mark a sector as used
  * @part  : partitoin
@@ -670,11 +1211,15 @@ static uint8_t allocate_sector(uint8_t part, uint8_t track, uint8_t sector) {
 
     bam_buffer->mustflush = 1;
 
+    /* The BAM in the image no longer matches the buffered copy */
+    d64_cache_invalidate(part);
+
     if (partition[part].imagetype == D64_TYPE_DNP) {
       /* For some reason DNP has its bitfield reversed */
       trackmap[sector>>3] &= (uint8_t)~(0x80>>(sector&7));
 
       /* DNP has no counter in its BAM */
+      freemap_update(part, track, -1);
       return 0;
     }
 
@@ -686,6 +1231,7 @@ static uint8_t allocate_sector(uint8_t part, uint8_t track, uint8_t sector) {
     if (trackmap[0] > 0) {
       trackmap[0]--;
       bam_buffer->mustflush = 1;
+      freemap_update(part, track, -1);
     }
   }
   return 0;
@@ -720,6 +1266,7 @@ static uint8_t free_sector(uint8_t part, uint8_t track, uint8_t sector) {
       trackmap[sector>>3] |= 0x80>>(sector&7);
 
       /* DNP has no counter in its BAM */
+      freemap_update(part, track, 1);
       return 0;
     }
 
@@ -731,6 +1278,7 @@ static uint8_t free_sector(uint8_t part, uint8_t track, uint8_t sector) {
     if(trackmap[0] < sectors_per_track(part, track)) {
       trackmap[0]++;
       bam_buffer->mustflush = 1;
+      freemap_update(part, track, 1);
     }
   }
   return 0;
@@ -759,7 +1307,7 @@ static uint8_t get_first_sector(uint8_t part, uint8_t *track, uint8_t *sector) {
   /* CMD drives, but track 1 seems to be semi-reserved for directory sectors.*/
   if (partition[part].imagetype == D64_TYPE_DNP) {
     *track = 2;
-    while (sectors_free(part, *track) == 0) {
+    while (!track_has_free(part, *track)) {
       (*track)++;
 
       if (*track == get_param(part, LAST_TRACK) ||
@@ -775,7 +1323,7 @@ static uint8_t get_first_sector(uint8_t part, uint8_t *track, uint8_t *sector) {
   } else {
     /* Look for a track with free sectors close to the directory */
     while (distance < get_param(part, LAST_TRACK)) {
-      if (sectors_free(part, get_param(part, DIR_TRACK)-distance))
+      if (track_has_free(part, get_param(part, DIR_TRACK)-distance))
         break;
 
       /* Invert sign */
@@ -823,7 +1371,7 @@ static uint8_t get_next_sector(uint8_t part, uint8_t *track, uint8_t *sector) {
     uint8_t newtrack = *track;
 
     /* Find a track with free sectors */
-    while (sectors_free(part, newtrack) == 0) {
+    while (!track_has_free(part, newtrack)) {
       newtrack++;
 
       if (newtrack == get_param(part, LAST_TRACK) ||
@@ -859,7 +1407,7 @@ static uint8_t get_next_sector(uint8_t part, uint8_t *track, uint8_t *sector) {
   uint8_t interleave,tries;
 
   if (*track == get_param(part, DIR_TRACK)) {
-    if (sectors_free(part, get_param(part, DIR_TRACK)) == 0) {
+    if (!track_has_free(part, get_param(part, DIR_TRACK))) {
       if (current_error == ERROR_OK)
         set_error(ERROR_DISK_FULL);
       return 1;
@@ -870,7 +1418,7 @@ static uint8_t get_next_sector(uint8_t part, uint8_t *track, uint8_t *sector) {
 
   /* Look for a track with free sectors */
   tries = 0;
-  while (tries < 3 && !sectors_free(part, *track)) {
+  while (tries < 3 && !track_has_free(part, *track)) {
     /* No more space on current track, try another */
     if (*track < get_param(part, DIR_TRACK))
       *track -= 1;
@@ -1133,11 +1681,10 @@ static uint8_t d64_write(buffer_t *buf) {
 
  storedata:
   /* Store data in the already-reserved sector */
-  if (image_write(buf->pvt.d64.part,
-                  sector_offset(buf->pvt.d64.part,
-                                buf->pvt.d64.track,
-                                buf->pvt.d64.sector),
-                  buf->data, 256, 1)) {
+  if (writebehind_store(buf->pvt.d64.part,
+                        buf->pvt.d64.track,
+                        buf->pvt.d64.sector,
+                        buf->data)) {
     free_buffer(buf);
     return 1;
   }
@@ -1171,6 +1718,10 @@ static uint8_t d64_write_cleanup(buffer_t *buf) {
   if (t == 0)
     return 1;
 
+  /* Write the queued sectors before the file is marked as closed */
+  if (d64_writebehind_flush(buf->pvt.d64.part, 0))
+    return 1;
+
   /* Store data */
   if (image_write(buf->pvt.d64.part, sector_offset(buf->pvt.d64.part,t,s), buf->data, 256, 1))
     return 1;
@@ -1193,61 +1744,752 @@ static uint8_t d64_write_cleanup(buffer_t *buf) {
   return 0;
 }
 
-
 /* ------------------------------------------------------------------------- */
-/*  fileops-API                                                              */
+/*  REL files                                                                */
 /* ------------------------------------------------------------------------- */
 
-uint8_t d64_mount(path_t *path, uint8_t *name) {
-  uint8_t imagetype;
-  uint8_t part = path->part;
-  uint32_t fsize = partition[part].imagehandle.fsize;
-
-  switch (fsize) {
-  case 174848:
-    imagetype = D64_TYPE_D41;
-    memcpy_P(&partition[part].d64data, &d41param, sizeof(struct param_s));
-    break;
+/* Side sector layout */
+#define SS_OFS_NUMBER     2
+#define SS_OFS_RECORDLEN  3
+#define SS_OFS_GROUP      4   /* T/S of all side sectors in the group */
+#define SS_OFS_DATA       16  /* T/S of the data sectors */
+#define SS_PER_GROUP      6
+#define SS_ENTRIES        120
+#define SS_NONE           0xffff
 
-  case 175531:
-    imagetype = D64_TYPE_D41 | D64_HAS_ERRORINFO;
-    memcpy_P(&partition[part].d64data, &d41param, sizeof(struct param_s));
-    break;
+/* Super side sector layout (1581/CMD native only) */
+#define SUPER_OFS_GROUPS  3
+#define SUPER_GROUPS      126
 
-  case 349696:
-    imagetype = D64_TYPE_D71;
-    memcpy_P(&partition[part].d64data, &d71param, sizeof(struct param_s));
-    break;
+/* Number of record bytes in a data sector */
+#define REL_BLOCK_SIZE    254
 
-  case 351062:
-    imagetype = D64_TYPE_D71 | D64_HAS_ERRORINFO;
-    memcpy_P(&partition[part].d64data, &d71param, sizeof(struct param_s));
-    break;
+/**
+ * rel_has_super - check if REL files use a super side sector
+ * @part: partition number
+ *
+ * Returns true if REL files on the image in partition @part start
+ * with a super side sector, i.e. for D81 and DNP images.
+ */
+static uint8_t rel_has_super(uint8_t part) {
+  uint8_t type = partition[part].imagetype & D64_TYPE_MASK;
 
-  case 819200:
-    imagetype = D64_TYPE_D81;
-    memcpy_P(&partition[part].d64data, &d81param, sizeof(struct param_s));
-    break;
+  return type == D64_TYPE_D81 || type == D64_TYPE_DNP;
+}
 
-  case 822400:
-    imagetype = D64_TYPE_D81 | D64_HAS_ERRORINFO;
-    memcpy_P(&partition[part].d64data, &d81param, sizeof(struct param_s));
-    break;
+/**
+ * rel_size - calculate the number of record bytes in a REL file
+ * @buf: buffer of the REL file
+ */
+static uint32_t rel_size(buffer_t *buf) {
+  return (uint32_t)(buf->pvt.d64.blocks - 1) * REL_BLOCK_SIZE +
+    buf->pvt.d64.lastbyte - 1;
+}
 
-  default:
-    if ((fsize % (256*256L)) != 0) {
-      set_error(ERROR_IMAGE_INVALID);
-      return 1;
-    }
+/**
+ * rel_ss_load - load a side sector into the side sector cache
+ * @buf  : buffer of the REL file
+ * @ssnum: number of the side sector, counted across all groups
+ *
+ * This function makes sure that side sector @ssnum of the REL file
+ * is held in its side sector cache. If it isn't, it is found via
+ * the first side sector of its group (whose location is read from
+ * the super side sector if the group changes) or directly from the
+ * group list of the cached side sector if it is in the same group.
+ * Returns 0 if successful or 1 if an error occured.
+ */
+static uint8_t rel_ss_load(buffer_t *buf, uint16_t ssnum) {
+  d64fh_t *fh   = &buf->pvt.d64;
+  uint8_t *ss   = fh->ssbuf->data;
+  uint8_t group = ssnum / SS_PER_GROUP;
+  uint8_t idx   = ssnum % SS_PER_GROUP;
+  uint8_t t, s;
+
+  if (fh->ssnum == ssnum)
+    return 0;
 
-    /* sanity check: ignore 40-track D64 images */
-    if (fsize == 196608) {
-      uint8_t *ptr = ustrrchr(name, '.');
+  if (fh->ssnum == SS_NONE || fh->ssnum / SS_PER_GROUP != group) {
+    /* Start at the first side sector of the group */
+    t = fh->ss_track;
+    s = fh->ss_sector;
+    fh->ssnum = SS_NONE;
 
-      if (ptr[2] == '6' && ptr[3] == '4') {
-        set_error(ERROR_IMAGE_INVALID);
+    if (rel_has_super(fh->part)) {
+      if (checked_read(fh->part, t, s, ss, 256, ERROR_ILLEGAL_TS_LINK))
         return 1;
-      }
+
+      t = ss[SUPER_OFS_GROUPS + 2*group];
+      s = ss[SUPER_OFS_GROUPS + 2*group + 1];
+    }
+
+    if (checked_read(fh->part, t, s, ss, 256, ERROR_ILLEGAL_TS_LINK))
+      return 1;
+
+    fh->ssnum = group * SS_PER_GROUP;
+    if (idx == 0)
+      return 0;
+  }
+
+  t = ss[SS_OFS_GROUP + 2*idx];
+  s = ss[SS_OFS_GROUP + 2*idx + 1];
+  fh->ssnum = SS_NONE;
+
+  if (checked_read(fh->part, t, s, ss, 256, ERROR_ILLEGAL_TS_LINK))
+    return 1;
+
+  fh->ssnum = ssnum;
+  return 0;
+}
+
+/**
+ * rel_ss_store - write the cached side sector
+ * @buf: buffer of the REL file
+ *
+ * Returns the same as image_write.
+ */
+static uint8_t rel_ss_store(buffer_t *buf) {
+  d64fh_t *fh = &buf->pvt.d64;
+  uint8_t *ss = fh->ssbuf->data;
+  uint8_t *ts = ss + SS_OFS_GROUP + 2 * (fh->ssnum % SS_PER_GROUP);
+
+  return image_write(fh->part, sector_offset(fh->part, ts[0], ts[1]), ss, 256, 0);
+}
+
+/**
+ * rel_block_ts - find the location of a data sector of a REL file
+ * @buf  : buffer of the REL file
+ * @block: number of the data sector in the file
+ * @ts   : pointer to two bytes for the track/sector
+ *
+ * This function looks up track and sector of data sector @block
+ * in the side sectors of the REL file.
+ * Returns 0 if successful or 1 if an error occured.
+ */
+static uint8_t rel_block_ts(buffer_t *buf, uint16_t block, uint8_t *ts) {
+  uint8_t part = buf->pvt.d64.part;
+  uint8_t *ptr;
+
+  if (rel_ss_load(buf, block / SS_ENTRIES))
+    return 1;
+
+  ptr   = buf->pvt.d64.ssbuf->data + SS_OFS_DATA + 2 * (block % SS_ENTRIES);
+  ts[0] = ptr[0];
+  ts[1] = ptr[1];
+
+  if (ts[0] < 1 || ts[0] > get_param(part, LAST_TRACK) ||
+      ts[1] >= sectors_per_track(part, ts[0])) {
+    set_error_ts(ERROR_ILLEGAL_TS_LINK, ts[0], ts[1]);
+    return 1;
+  }
+
+  return 0;
+}
+
+/**
+ * rel_transfer - read or write record data of a REL file
+ * @buf  : buffer of the REL file
+ * @pos  : offset in the record data of the file
+ * @data : pointer to the data
+ * @len  : number of bytes to transfer
+ * @write: transfer direction, 0 reads and 1 writes
+ *
+ * This function transfers @len bytes between @data and the file,
+ * splitting the access where it crosses a sector boundary.
+ * Returns 0 if successful or 1 if an error occured.
+ */
+static uint8_t rel_transfer(buffer_t *buf, uint32_t pos, uint8_t *data, uint8_t len, uint8_t write) {
+  uint8_t  part   = buf->pvt.d64.part;
+  uint16_t block  = pos / REL_BLOCK_SIZE;
+  uint8_t  offset = pos % REL_BLOCK_SIZE + 2;
+  uint8_t  ts[2];
+
+  while (len) {
+    uint8_t chunk = min(len, 256 - offset);
+    uint8_t res;
+
+    if (rel_block_ts(buf, block, ts))
+      return 1;
+
+    if (write)
+      res = image_write(part, sector_offset(part, ts[0], ts[1]) + offset,
+                        data, chunk, 0);
+    else
+#ifdef CONFIG_D64_READAHEAD
+      res = cached_read(part, ts[0], ts[1], offset, data, chunk);
+#else
+      res = image_read(part, sector_offset(part, ts[0], ts[1]) + offset,
+                       data, chunk);
+#endif
+    if (res)
+      return 1;
+
+    data  += chunk;
+    len   -= chunk;
+    block++;
+    offset = 2;
+  }
+
+  return 0;
+}
+
+/**
+ * rel_add_ss - add a side sector to a REL file
+ * @buf   : buffer of the REL file
+ * @ssnum : number of the new side sector
+ * @datats: track/sector of the first data sector it lists
+ *
+ * This function allocates a new side sector close to @datats, links
+ * it to the previous one and adds it to the group list of all side
+ * sectors in its group or, if it starts a new group, to the super
+ * side sector. The new side sector is left in the cache.
+ * Returns 0 if successful or 1 if an error occured.
+ */
+static uint8_t rel_add_ss(buffer_t *buf, uint16_t ssnum, uint8_t *datats) {
+  d64fh_t *fh   = &buf->pvt.d64;
+  uint8_t *ss   = fh->ssbuf->data;
+  uint8_t group = ssnum / SS_PER_GROUP;
+  uint8_t idx   = ssnum % SS_PER_GROUP;
+  uint8_t ts[2], i;
+
+  if (group >= (rel_has_super(fh->part) ? SUPER_GROUPS : 1)) {
+    set_error(ERROR_FILE_TOO_LARGE);
+    return 1;
+  }
+
+  ts[0] = datats[0];
+  ts[1] = datats[1];
+  if (get_next_sector(fh->part, &ts[0], &ts[1]) ||
+      allocate_sector(fh->part, ts[0], ts[1]))
+    return 1;
+
+  /* Link the previous side sector to the new one */
+  if (rel_ss_load(buf, ssnum - 1))
+    return 1;
+
+  ss[0] = ts[0];
+  ss[1] = ts[1];
+  if (rel_ss_store(buf))
+    return 1;
+
+  if (idx) {
+    /* Add it to the group list of the other side sectors in its group */
+    for (i = 0; i < idx; i++)
+      if (image_write(fh->part,
+                      sector_offset(fh->part, ss[SS_OFS_GROUP + 2*i],
+                                    ss[SS_OFS_GROUP + 2*i + 1]) +
+                      SS_OFS_GROUP + 2*idx, ts, 2, 0))
+        return 1;
+  } else {
+    /* Start a new group in the super side sector */
+    memset(ss + SS_OFS_GROUP, 0, 2 * SS_PER_GROUP);
+    if (image_write(fh->part,
+                    sector_offset(fh->part, fh->ss_track, fh->ss_sector) +
+                    SUPER_OFS_GROUPS + 2*group, ts, 2, 0))
+      return 1;
+  }
+
+  /* Build the new side sector in the cache, the group list is inherited */
+  ss[0] = 0;
+  ss[1] = SS_OFS_DATA + 1;
+  ss[SS_OFS_NUMBER]    = idx;
+  ss[SS_OFS_RECORDLEN] = buf->recordlen;
+  ss[SS_OFS_GROUP + 2*idx]     = ts[0];
+  ss[SS_OFS_GROUP + 2*idx + 1] = ts[1];
+  memset(ss + SS_OFS_DATA, 0, 256 - SS_OFS_DATA);
+  ss[SS_OFS_DATA]     = datats[0];
+  ss[SS_OFS_DATA + 1] = datats[1];
+  fh->ssnum = ssnum;
+
+  return image_write(fh->part, sector_offset(fh->part, ts[0], ts[1]), ss, 256, 0);
+}
+
+/**
+ * rel_add_block - add a data sector to a REL file
+ * @buf: buffer of the REL file
+ * @ts : track/sector of the current last data sector
+ *
+ * This function allocates a data sector after the one at @ts and
+ * registers it in the cached side sector, which must be written
+ * by the caller with rel_ss_store. The track/sector of the new
+ * sector is returned in @ts, linking and writing both data sectors
+ * is left to the caller too.
+ * Returns 0 if successful or 1 if an error occured.
+ */
+static uint8_t rel_add_block(buffer_t *buf, uint8_t *ts) {
+  d64fh_t *fh    = &buf->pvt.d64;
+  uint8_t *ss    = fh->ssbuf->data;
+  uint16_t block = fh->blocks;
+  uint8_t  idx   = block % SS_ENTRIES;
+
+  if (get_next_sector(fh->part, &ts[0], &ts[1]) ||
+      allocate_sector(fh->part, ts[0], ts[1]))
+    return 1;
+
+  if (idx == 0) {
+    if (rel_add_ss(buf, block / SS_ENTRIES, ts)) {
+      free_sector(fh->part, ts[0], ts[1]);
+      return 1;
+    }
+  } else {
+    if (rel_ss_load(buf, block / SS_ENTRIES)) {
+      free_sector(fh->part, ts[0], ts[1]);
+      return 1;
+    }
+
+    ss[1] = SS_OFS_DATA + 2*idx + 1;
+    ss[SS_OFS_DATA + 2*idx]     = ts[0];
+    ss[SS_OFS_DATA + 2*idx + 1] = ts[1];
+  }
+
+  fh->blocks++;
+  return 0;
+}
+
+/**
+ * rel_expand - expand a REL file
+ * @buf : buffer of the REL file
+ * @size: minimum number of record bytes
+ *
+ * This function adds empty records to the REL file until it holds
+ * at least @size bytes. Like the 1541 it fills the last data sector
+ * with as many records as fit completely. Each sector is assembled
+ * in a temporary buffer, starting with the current last one, and
+ * written once when the next one has been allocated. The side sector
+ * entries are collected in the side sector cache.
+ * Returns 0 if successful or 1 if an error occured.
+ */
+static uint8_t rel_expand(buffer_t *buf, uint32_t size) {
+  d64fh_t  *fh     = &buf->pvt.d64;
+  uint16_t  blocks = (size + REL_BLOCK_SIZE - 1) / REL_BLOCK_SIZE;
+  uint16_t  block  = fh->blocks - 1;
+  uint32_t  pos    = rel_size(buf);
+  uint32_t  start  = (uint32_t)block * REL_BLOCK_SIZE;
+  uint8_t   res    = 0;
+  uint8_t   ts[2], next[2];
+  buffer_t *tmp;
+  uint8_t  *data;
+
+  tmp = alloc_system_buffer();
+  if (tmp == NULL)
+    return 1;
+  data = tmp->data;
+
+  /* Start with the current last sector, minus anything behind its end */
+  if (rel_block_ts(buf, block, ts) ||
+      checked_read(fh->part, ts[0], ts[1], data, 256, ERROR_ILLEGAL_TS_LINK)) {
+    free_buffer(tmp);
+    return 1;
+  }
+  memset(data + 2 + (pos - start), 0, REL_BLOCK_SIZE - (pos - start));
+
+  /* First new record */
+  pos = (pos + buf->recordlen - 1) / buf->recordlen * buf->recordlen;
+
+  fh->changed = 1;
+  while (1) {
+    uint32_t end = start + REL_BLOCK_SIZE;
+
+    next[0] = ts[0];
+    next[1] = ts[1];
+    if (fh->blocks == blocks || rel_add_block(buf, next)) {
+      /* Last sector, possibly early to keep the file consistent */
+      if (fh->blocks != blocks)
+        res = 1;
+
+      end          = (uint32_t)fh->blocks * REL_BLOCK_SIZE / buf->recordlen * buf->recordlen;
+      fh->lastbyte = end - start + 1;
+      next[0]      = 0;
+      next[1]      = fh->lastbyte;
+    }
+
+    /* Mark the start of all new records in this sector */
+    while (pos < end) {
+      data[2 + (pos - start)] = 0xff;
+      pos += buf->recordlen;
+    }
+
+    data[0] = next[0];
+    data[1] = next[1];
+    if (writebehind_store(fh->part, ts[0], ts[1], data)) {
+      res = 1;
+      break;
+    }
+
+    if (next[0] == 0)
+      break;
+
+    ts[0]  = next[0];
+    ts[1]  = next[1];
+    start += REL_BLOCK_SIZE;
+    memset(data, 0, 256);
+  }
+
+  free_buffer(tmp);
+
+  /* Write the data sectors before the side sector that points to them */
+  if (d64_writebehind_flush(fh->part, 0) ||
+      fh->ssnum == SS_NONE || rel_ss_store(buf))
+    return 1;
+
+  return res;
+}
+
+/**
+ * rel_write_record - write the current record of a REL file
+ * @buf: buffer of the REL file
+ *
+ * This function pads the data in the buffer with zeroes to a full
+ * record and writes it, expanding the file if required.
+ * Returns 0 if successful or 1 if an error occured.
+ */
+static uint8_t rel_write_record(buffer_t *buf) {
+  uint8_t res = 0;
+
+  mark_buffer_clean(buf);
+
+  if (!(partition[buf->pvt.d64.part].imagehandle.flag & FA_WRITE)) {
+    set_error(ERROR_WRITE_PROTECT);
+    return 1;
+  }
+
+  if (!buf->mustflush)
+    buf->lastused = buf->position - 1;
+  buf->mustflush = 0;
+
+  if (buf->lastused - 1 > buf->recordlen)
+    set_error(ERROR_RECORD_OVERFLOW);
+  else
+    memset(buf->data + buf->lastused + 1, 0, buf->recordlen - (buf->lastused - 1));
+
+  if (buf->fptr + buf->recordlen > rel_size(buf))
+    res = rel_expand(buf, buf->fptr + buf->recordlen);
+
+  if (!res)
+    res = rel_transfer(buf, buf->fptr, buf->data + 2, buf->recordlen, 1);
+
+  buf->pvt.d64.changed = 1;
+  return res;
+}
+
+/**
+ * d64_rel_seek - seek-callback for REL files
+ * @buf     : target buffer
+ * @position: offset of the record to seek to
+ * @index   : offset within the record to seek to
+ *
+ * This function writes the current record if it was changed and
+ * reads the record at @position. Returns 1 if an error occured,
+ * 0 otherwise.
+ */
+static uint8_t d64_rel_seek(buffer_t *buf, uint32_t position, uint8_t index) {
+  if (buf->dirty)
+    if (rel_write_record(buf))
+      return 1;
+
+  buf->fptr    = position;
+  buf->sendeoi = 1;
+
+  if (position + buf->recordlen > rel_size(buf)) {
+    buf->data[2]  = 255;
+    buf->lastused = 2;
+    set_error(ERROR_RECORD_MISSING);
+  } else {
+    if (rel_transfer(buf, position, buf->data + 2, buf->recordlen, 0))
+      return 1;
+
+    /* strip nulls from end of record */
+    buf->lastused = buf->recordlen + 1;
+    while (!buf->data[buf->lastused] && --(buf->lastused) > 1) ;
+  }
+
+  buf->position = index + 2;
+  if (index + 2 > buf->lastused)
+    buf->position = buf->lastused;
+
+  return 0;
+}
+
+/**
+ * d64_rel_sync - refill-callback for REL files
+ * @buf: target buffer
+ *
+ * This function writes the current record if required and
+ * advances to the next one.
+ */
+static uint8_t d64_rel_sync(buffer_t *buf) {
+  return d64_rel_seek(buf, buf->fptr + buf->recordlen, 0);
+}
+
+/**
+ * d64_rel_cleanup - cleanup-callback for REL files
+ * @buf: target buffer
+ *
+ * This function writes the current record if required, updates the
+ * directory entry if the file was changed and frees the side sector
+ * cache.
+ */
+static uint8_t d64_rel_cleanup(buffer_t *buf) {
+  d64fh_t *fh = &buf->pvt.d64;
+  uint8_t res = 0;
+
+  if (buf->dirty)
+    res = rel_write_record(buf);
+
+  if (fh->changed) {
+    uint16_t blocks = fh->blocks + (fh->blocks + SS_ENTRIES - 1) / SS_ENTRIES +
+                      rel_has_super(fh->part);
+
+    if (read_entry(fh->part, &fh->dh, ops_scratch))
+      res = 1;
+    else {
+      ops_scratch[DIR_OFS_FILE_TYPE] |= FLAG_SPLAT;
+      ops_scratch[DIR_OFS_SIZE_LOW]   = blocks & 0xff;
+      ops_scratch[DIR_OFS_SIZE_HI]    = blocks >> 8;
+      update_timestamp(ops_scratch);
+
+      if (write_entry(fh->part, &fh->dh, ops_scratch, 1))
+        res = 1;
+    }
+  }
+
+  free_buffer(fh->ssbuf);
+  buf->cleanup = callback_dummy;
+
+  return res;
+}
+
+/**
+ * rel_open - prepare access to an existing REL file
+ * @buf: buffer of the REL file, with part and dh set
+ *
+ * This function reads the directory entry of the REL file and
+ * determines its size from the last side sector and the link
+ * bytes of the last data sector.
+ * Returns 0 if successful or 1 if an error occured.
+ */
+static uint8_t rel_open(buffer_t *buf) {
+  d64fh_t *fh    = &buf->pvt.d64;
+  uint8_t *ss    = fh->ssbuf->data;
+  uint16_t ssnum = 0;
+  uint8_t  count, ts[2];
+
+  if (read_entry(fh->part, &fh->dh, ops_scratch))
+    return 1;
+
+  fh->ss_track   = ops_scratch[DIR_OFS_SS_TRACK];
+  fh->ss_sector  = ops_scratch[DIR_OFS_SS_SECTOR];
+  buf->recordlen = ops_scratch[DIR_OFS_RECORD_LEN];
+
+  /* Find the last side sector */
+  ts[0] = fh->ss_track;
+  ts[1] = fh->ss_sector;
+
+  if (rel_has_super(fh->part)) {
+    if (checked_read(fh->part, ts[0], ts[1], ss, 256, ERROR_ILLEGAL_TS_LINK))
+      return 1;
+
+    count = 1;
+    while (count < SUPER_GROUPS && ss[SUPER_OFS_GROUPS + 2*count])
+      count++;
+
+    ssnum = (count - 1) * SS_PER_GROUP;
+    ts[0] = ss[SUPER_OFS_GROUPS + 2*(count-1)];
+    ts[1] = ss[SUPER_OFS_GROUPS + 2*(count-1) + 1];
+  }
+
+  if (checked_read(fh->part, ts[0], ts[1], ss, 256, ERROR_ILLEGAL_TS_LINK))
+    return 1;
+
+  count = 1;
+  while (count < SS_PER_GROUP && ss[SS_OFS_GROUP + 2*count])
+    count++;
+
+  if (count > 1 &&
+      checked_read(fh->part, ss[SS_OFS_GROUP + 2*(count-1)],
+                   ss[SS_OFS_GROUP + 2*(count-1) + 1],
+                   ss, 256, ERROR_ILLEGAL_TS_LINK))
+    return 1;
+
+  ssnum    += count - 1;
+  fh->ssnum = ssnum;
+
+  /* Count its data sectors */
+  count = 0;
+  while (count < SS_ENTRIES && ss[SS_OFS_DATA + 2*count])
+    count++;
+
+  if (count == 0 || buf->recordlen == 0) {
+    set_error(ERROR_RECORD_MISSING);
+    return 1;
+  }
+
+  fh->blocks = ssnum * SS_ENTRIES + count;
+
+  /* The link bytes of the last data sector hold the size of its contents */
+  if (rel_block_ts(buf, fh->blocks - 1, ts) ||
+      checked_read(fh->part, ts[0], ts[1], ts, 2, ERROR_ILLEGAL_TS_LINK))
+    return 1;
+
+  fh->lastbyte = max(ts[1], 1);
+
+  return 0;
+}
+
+/**
+ * rel_create - create a new REL file
+ * @path  : path of the file
+ * @dent  : name of the file
+ * @buf   : buffer of the REL file, with part and recordlen set
+ *
+ * This function creates a REL file with a single data sector
+ * filled with empty records.
+ * Returns 0 if successful or 1 if an error occured.
+ */
+static uint8_t rel_create(path_t *path, cbmdirent_t *dent, buffer_t *buf) {
+  d64fh_t *fh   = &buf->pvt.d64;
+  uint8_t *data = fh->ssbuf->data;
+  uint8_t *name = dent->name;
+  uint8_t *ptr;
+  uint8_t  dts[2], sts[2], i;
+  dh_t dh;
+
+  /* Search for an empty directory entry */
+  if (find_empty_entry(path, &dh))
+    return 1;
+
+  /* Create directory entry in ops_scratch */
+  memset(ops_scratch + 2, 0, sizeof(ops_scratch) - 2);  /* Don't overwrite the link pointer! */
+  memset(ops_scratch + DIR_OFS_FILE_NAME, 0xa0, CBM_NAME_LENGTH);
+  ptr = ops_scratch + DIR_OFS_FILE_NAME;
+  while (*name) *ptr++ = *name++;
+  ops_scratch[DIR_OFS_FILE_TYPE]  = TYPE_REL;
+  ops_scratch[DIR_OFS_RECORD_LEN] = buf->recordlen;
+
+  /* Allocate the first data sector and side sector */
+  if (get_first_sector(fh->part, &dts[0], &dts[1]) ||
+      allocate_sector(fh->part, dts[0], dts[1]))
+    return 1;
+
+  sts[0] = dts[0];
+  sts[1] = dts[1];
+  if (get_next_sector(fh->part, &sts[0], &sts[1]) ||
+      allocate_sector(fh->part, sts[0], sts[1]))
+    return 1;
+
+  fh->ss_track  = sts[0];
+  fh->ss_sector = sts[1];
+
+  if (rel_has_super(fh->part)) {
+    /* Allocate and write the super side sector */
+    if (get_next_sector(fh->part, &fh->ss_track, &fh->ss_sector) ||
+        allocate_sector(fh->part, fh->ss_track, fh->ss_sector))
+      return 1;
+
+    memset(data, 0, 256);
+    data[0] = sts[0];
+    data[1] = sts[1];
+    data[2] = 0xfe;
+    data[SUPER_OFS_GROUPS]     = sts[0];
+    data[SUPER_OFS_GROUPS + 1] = sts[1];
+    if (image_write(fh->part, sector_offset(fh->part, fh->ss_track, fh->ss_sector),
+                    data, 256, 0))
+      return 1;
+  }
+
+  /* Write the data sector, filled with empty records */
+  memset(data, 0, 256);
+  for (i = 0; i < REL_BLOCK_SIZE / buf->recordlen; i++)
+    data[2 + i * buf->recordlen] = 0xff;
+
+  fh->blocks   = 1;
+  fh->lastbyte = i * buf->recordlen + 1;
+  data[1]      = fh->lastbyte;
+  if (image_write(fh->part, sector_offset(fh->part, dts[0], dts[1]), data, 256, 0))
+    return 1;
+
+  /* Write the side sector, it stays in the cache */
+  memset(data, 0, 256);
+  data[1] = SS_OFS_DATA + 1;
+  data[SS_OFS_RECORDLEN] = buf->recordlen;
+  data[SS_OFS_GROUP]     = sts[0];
+  data[SS_OFS_GROUP + 1] = sts[1];
+  data[SS_OFS_DATA]      = dts[0];
+  data[SS_OFS_DATA + 1]  = dts[1];
+  if (image_write(fh->part, sector_offset(fh->part, sts[0], sts[1]), data, 256, 0))
+    return 1;
+
+  fh->ssnum = 0;
+
+  /* Write the directory entry */
+  ops_scratch[DIR_OFS_TRACK]     = dts[0];
+  ops_scratch[DIR_OFS_SECTOR]    = dts[1];
+  ops_scratch[DIR_OFS_SS_TRACK]  = fh->ss_track;
+  ops_scratch[DIR_OFS_SS_SECTOR] = fh->ss_sector;
+  update_timestamp(ops_scratch);
+  if (write_entry(fh->part, &dh.dir.d64, ops_scratch, 1))
+    return 1;
+
+  fh->dh      = dh.dir.d64;
+  fh->changed = 1;
+
+  return 0;
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*  fileops-API                                                              */
+/* ------------------------------------------------------------------------- */
+
+uint8_t d64_mount(path_t *path, uint8_t *name) {
+  uint8_t imagetype;
+  uint8_t part = path->part;
+  uint32_t fsize = partition[part].imagehandle.fsize;
+
+  switch (fsize) {
+  case 174848:
+    imagetype = D64_TYPE_D41;
+    memcpy_P(&partition[part].d64data, &d41param, sizeof(struct param_s));
+    break;
+
+  case 175531:
+    imagetype = D64_TYPE_D41 | D64_HAS_ERRORINFO;
+    memcpy_P(&partition[part].d64data, &d41param, sizeof(struct param_s));
+    break;
+
+  case 349696:
+    imagetype = D64_TYPE_D71;
+    memcpy_P(&partition[part].d64data, &d71param, sizeof(struct param_s));
+    break;
+
+  case 351062:
+    imagetype = D64_TYPE_D71 | D64_HAS_ERRORINFO;
+    memcpy_P(&partition[part].d64data, &d71param, sizeof(struct param_s));
+    break;
+
+  case 819200:
+    imagetype = D64_TYPE_D81;
+    memcpy_P(&partition[part].d64data, &d81param, sizeof(struct param_s));
+    break;
+
+  case 822400:
+    imagetype = D64_TYPE_D81 | D64_HAS_ERRORINFO;
+    memcpy_P(&partition[part].d64data, &d81param, sizeof(struct param_s));
+    break;
+
+  default:
+    if ((fsize % (256*256L)) != 0) {
+      set_error(ERROR_IMAGE_INVALID);
+      return 1;
+    }
+
+    /* sanity check: ignore 40-track D64 images */
+    if (fsize == 196608) {
+      uint8_t *ptr = ustrrchr(name, '.');
+
+      if (ptr[2] == '6' && ptr[3] == '4') {
+        set_error(ERROR_IMAGE_INVALID);
+        return 1;
+      }
     }
 
     imagetype = D64_TYPE_DNP;
@@ -1274,8 +2516,117 @@ uint8_t d64_mount(path_t *path, uint8_t *name) {
   return 0;
 }
 
+/**
+ * next_file_entry - read the next non-deleted dir entry to ops_scratch
+ * @dh: directory handle
+ *
+ * This function reads the next directory entry that is not marked
+ * as deleted into ops_scratch. Returns the same as nextdirentry.
+ */
+static int8_t next_file_entry(dh_t *dh) {
+  int8_t res;
+
+  do {
+    res = nextdirentry(dh);
+    if (res)
+      return res;
+  } while (ops_scratch[DIR_OFS_FILE_TYPE] == 0);
+
+  return 0;
+}
+
+#ifdef CONFIG_D64_DIRCACHE
+/**
+ * dircache_next - find the cached entry following a directory position
+ * @dh: directory handle
+ *
+ * This function returns the index of the cached entry that would be
+ * read next from the position of @dh, which may be the number of
+ * cached entries if they are all before it. Returns -1 if @dh
+ * doesn't point into the cached directory.
+ */
+static int16_t dircache_next(dh_t *dh) {
+  struct d64dh *pos = &dh->dir.d64;
+  struct d64dh *ent;
+  uint8_t i;
+
+  if (dircache.part != dh->part)
+    return -1;
+
+  if (pos->entry == 0 &&
+      pos->track  == dircache.start.track &&
+      pos->sector == dircache.start.sector)
+    return 0;
+
+  /* usually the directory is read sequentially */
+  i = dircache.last;
+  if (i >= dircache.count)
+    i = 0;
+
+  for (uint8_t n = 0; n < dircache.count; n++) {
+    ent = &dircache.entries[i].dh;
+    if (ent->track     == pos->track  &&
+        ent->sector    == pos->sector &&
+        ent->entry + 1 == pos->entry)
+      return i + 1;
+
+    if (++i == dircache.count)
+      i = 0;
+  }
+
+  return -1;
+}
+
+/**
+ * dircache_read - read the next non-deleted dir entry using the cache
+ * @dh: directory handle
+ *
+ * This function works like next_file_entry, but returns the entry
+ * from the directory cache if it is there. Entries read from the
+ * image are added to the cache if they are the next ones missing
+ * from it. Returns the same as nextdirentry.
+ */
+static int8_t dircache_read(dh_t *dh) {
+  int16_t next = dircache_next(dh);
+  int8_t res;
+
+  if (next >= 0 && (next < dircache.count || dircache.complete)) {
+    d64_dircache_stats.hits++;
+    if (next == dircache.count)
+      return -1;
+
+    dh->dir.d64 = dircache.entries[next].dh;
+    dh->dir.d64.entry++;
+    memcpy(ops_scratch + 2, dircache.entries[next].data, 30);
+    dircache.last = next;
+    return 0;
+  }
+
+  d64_dircache_stats.misses++;
+  res = next_file_entry(dh);
+
+  if (next >= 0) {
+    if (res < 0 && !dircache.full) {
+      dircache.complete = 1;
+    } else if (res == 0) {
+      if (dircache.count < CONFIG_D64_DIRCACHE) {
+        next = dircache.count++;
+        dircache.entries[next].dh = dh->dir.d64;
+        dircache.entries[next].dh.entry -= 1; /* undo increment in nextdirentry */
+        memcpy(dircache.entries[next].data, ops_scratch + 2, 30);
+        dircache.last = next;
+      } else
+        dircache.full = 1;
+    }
+  }
+
+  return res;
+}
+#endif
+
 static uint8_t d64_opendir(dh_t *dh, path_t *path) {
   dh->part = path->part;
+  reset_match(dh);
   dh->dir.d64.track  = path->dir.dxx.track;
   dh->dir.d64.sector = path->dir.dxx.sector;
   dh->dir.d64.entry  = 0;
@@ -1291,20 +2642,32 @@ static uint8_t d64_opendir(dh_t *dh, path_t *path) {
     dh->dir.d64.track  = tmp[0];
     dh->dir.d64.sector = tmp[1];
   }
+
+#ifdef CONFIG_D64_DIRCACHE
+  if (dircache.part != dh->part ||
+      dircache.start.track  != dh->dir.d64.track ||
+      dircache.start.sector != dh->dir.d64.sector) {
+    /* start caching this directory instead */
+    dircache.part     = dh->part;
+    dircache.start    = dh->dir.d64;
+    dircache.count    = 0;
+    dircache.complete = 0;
+    dircache.full     = 0;
+  }
+#endif
   return 0;
 }
 
 static int8_t d64_readdir(dh_t *dh, cbmdirent_t *dent) {
   int8_t res;
 
-  do {
-    res = nextdirentry(dh);
-    if (res)
-      return res;
-
-    if (ops_scratch[DIR_OFS_FILE_TYPE] != 0)
-      break;
-  } while (1);
+#ifdef CONFIG_D64_DIRCACHE
+  res = dircache_read(dh);
+#else
+  res = next_file_entry(dh);
+#endif
+  if (res)
+    return res;
 
   memset(dent, 0, sizeof(cbmdirent_t));
 
@@ -1392,28 +2755,15 @@ static uint16_t d64_freeblocks(uint8_t part) {
   uint16_t blocks = 0;
   uint8_t i;
 
+#ifdef CONFIG_D64_FREEMAP
+  if (!freemap_build(part))
+    return freemap.blocks;
+#endif
+
   for (i = 1; i != 0 && i <= get_param(part, LAST_TRACK); i++) {
     /* Skip directory track */
-    switch (partition[part].imagetype & D64_TYPE_MASK) {
-    case D64_TYPE_D81:
-      if (i == D81_BAM_TRACK)
-        continue;
-      break;
-
-    case D64_TYPE_DNP:
-      // DNP doesn't exclude anything
-      break;
-
-    case D64_TYPE_D41:
-    case D64_TYPE_D71:
-    default:
-      if (i == D41_BAM_TRACK || i == D71_BAM2_TRACK)
-        continue; // continue the for loop
-      break;      // break out of the switch
-
-    }
-
-    blocks += sectors_free(part,i);
+    if (track_is_counted(part, i))
+      blocks += sectors_free(part,i);
   }
 
   return blocks;
@@ -1522,26 +2872,98 @@ static void d64_open_write(path_t *path, cbmdirent_t *dent, uint8_t type, buffer
 }
 
 static void d64_open_rel(path_t *path, cbmdirent_t *dent, buffer_t *buf, uint8_t length, uint8_t mode) {
-  set_error(ERROR_SYNTAX_UNABLE);
+  buffer_t *ssbuf;
+  uint8_t res;
+
+  if (!mode) {
+    /* Check for read-only image file */
+    if (!(partition[path->part].imagehandle.flag & FA_WRITE)) {
+      set_error(ERROR_WRITE_PROTECT);
+      return;
+    }
+
+    if (length == 0 || length > REL_BLOCK_SIZE) {
+      set_error(ERROR_SYNTAX_UNABLE);
+      return;
+    }
+  }
+
+  /* Grab a buffer for the side sector cache, freed together with buf */
+  ssbuf = alloc_buffer();
+  if (!ssbuf)
+    return;
+
+  ssbuf->secondary = BUFFER_SEC_CHAIN - buf->secondary;
+  stick_buffer(ssbuf);
+
+  buf->pvt.d64.part  = path->part;
+  buf->pvt.d64.ssbuf = ssbuf;
+  buf->pvt.d64.ssnum = SS_NONE;
+
+  if (mode) {
+    buf->pvt.d64.dh = dent->pvt.dxx.dh;
+    res = rel_open(buf);
+  } else {
+    buf->recordlen = length;
+    res = rel_create(path, dent, buf);
+  }
+
+  if (res) {
+    free_buffer(ssbuf);
+    free_buffer(buf);
+    return;
+  }
+
+  mark_write_buffer(buf);
+  buf->read    = 1;
+  buf->cleanup = d64_rel_cleanup;
+  buf->refill  = d64_rel_sync;
+  buf->seek    = d64_rel_seek;
+
+  /* read the first record */
+  if (!d64_rel_seek(buf, 0, 0) && length && length != buf->recordlen)
+    set_error(ERROR_RECORD_MISSING);
 }
 
-static uint8_t d64_delete(path_t *path, cbmdirent_t *dent) {
+/**
+ * free_chain - free a chain of sectors
+ * @part  : partition
+ * @track : track of the first sector
+ * @sector: sector of the first sector
+ *
+ * This function marks all sectors of the chain starting at
+ * @track/@sector as free in the BAM.
+ * Returns 0 if successful or 1 if an error occured.
+ */
+static uint8_t free_chain(uint8_t part, uint8_t track, uint8_t sector) {
   uint8_t linkbuf[2];
 
+  linkbuf[0] = track;
+  linkbuf[1] = sector;
+
+  do {
+    free_sector(part, linkbuf[0], linkbuf[1]);
+
+    if (checked_read(part, linkbuf[0], linkbuf[1], linkbuf, 2, ERROR_ILLEGAL_TS_LINK))
+      return 1;
+  } while (linkbuf[0]);
+
+  return 0;
+}
+
+static uint8_t d64_delete(path_t *path, cbmdirent_t *dent) {
   /* Read the directory entry of the file */
   if (read_entry(path->part, &dent->pvt.dxx.dh, ops_scratch))
     return 255;
 
   /* Free the sector chain in the BAM */
-  linkbuf[0] = ops_scratch[DIR_OFS_TRACK];
-  linkbuf[1] = ops_scratch[DIR_OFS_SECTOR];
-
-  do {
-    free_sector(path->part, linkbuf[0], linkbuf[1]);
+  if (free_chain(path->part, ops_scratch[DIR_OFS_TRACK], ops_scratch[DIR_OFS_SECTOR]))
+    return 255;
 
-    if (checked_read(path->part, linkbuf[0], linkbuf[1], linkbuf, 2, ERROR_ILLEGAL_TS_LINK))
-      return 255;
-  } while (linkbuf[0]);
+  /* REL files: free the side sectors, super side sector included */
+  if ((ops_scratch[DIR_OFS_FILE_TYPE] & TYPE_MASK) == TYPE_REL &&
+      free_chain(path->part, ops_scratch[DIR_OFS_SS_TRACK], ops_scratch[DIR_OFS_SS_SECTOR]))
+    return 255;
 
   /* Clear directory entry */
   ops_scratch[DIR_OFS_FILE_TYPE] = 0;
@@ -1559,8 +2981,14 @@ static void d64_write_sector(buffer_t *buf, uint8_t part, uint8_t track, uint8_t
   if (track < 1 || track > get_param(part, LAST_TRACK) ||
       sector >= sectors_per_track(part, track)) {
     set_error_ts(ERROR_ILLEGAL_TS_COMMAND,track,sector);
-  } else
+  } else {
+#ifdef CONFIG_D64_FREEMAP
+    /* the sector may be part of the BAM */
+    if (freemap.part == part)
+      freemap.part = 255;
+#endif
     image_write(part, sector_offset(part,track,sector), buf->data, 256, 1);
+  }
 }
 
 static void d64_rename(path_t *path, cbmdirent_t *dent, uint8_t *newname) {
@@ -1779,11 +3207,29 @@ static void d64_mkdir(path_t *path, uint8_t *dirname) {
  * a card change is detected.
  */
 void d64_invalidate(void) {
-  free_buffer(bam_buffer);
-  bam_buffer   = NULL;
-  free_buffer(bam_buffer2);
-  bam_buffer2  = NULL;
+#ifdef CONFIG_D64_READAHEAD
+  readahead.count = 0;
+#endif
+#ifdef CONFIG_D64_DIRCACHE
+  dircache.part = 255;
+#endif
+  uint8_t i;
+
+#ifdef CONFIG_D64_WRITEBEHIND
+  /* The queued sectors can't be written anymore */
+  for (i = 0; i < writebehind.count; i++)
+    free_buffer(writebehind.bufs[i]);
+  writebehind.count = 0;
+#endif
+
+  for (i = 0; i < BAM_BUFFERS; i++) {
+    free_buffer(bam_buffers[i]);
+    bam_buffers[i] = NULL;
+  }
   bam_refcount = 0;
+#ifdef CONFIG_D64_FREEMAP
+  freemap.part = 255;
+#endif
 }
 
 /**
@@ -1794,25 +3240,26 @@ void d64_invalidate(void) {
  * refcounting for the BAM buffers.
  */
 void d64_unmount(uint8_t part) {
-  /* invalidate BAM buffers that point to the current partition */
-  if (bam_buffer) {
-    bam_buffer->cleanup(bam_buffer);
-    if (bam_buffer->pvt.bam.part == part)
-      bam_buffer->pvt.bam.part = 255;
-  }
+#ifdef CONFIG_D64_WRITEBEHIND
+  d64_writebehind_flush(part, 1);
+#endif
+  d64_cache_invalidate(part);
 
-  if (bam_buffer2) {
-    bam_buffer2->cleanup(bam_buffer2);
-    if (bam_buffer2->pvt.bam.part == part)
-      bam_buffer2->pvt.bam.part = 255;
-  }
+  uint8_t i;
+
+  /* invalidate BAM buffers that point to the current partition */
+  bam_buffer_invalidate(part);
+#ifdef CONFIG_D64_FREEMAP
+  if (freemap.part == part)
+    freemap.part = 255;
+#endif
 
   /* decrease BAM buffer refcounter - it can never be zero while a Dxx is mounted*/
-  if (--bam_refcount) {
-    free_buffer(bam_buffer);
-    free_buffer(bam_buffer2);
-    bam_buffer  = NULL;
-    bam_buffer2 = NULL;
+  if (--bam_refcount == 0) {
+    for (i = 0; i < BAM_BUFFERS; i++) {
+      free_buffer(bam_buffers[i]);
+      bam_buffers[i] = NULL;
+    }
   }
 }
 
@@ -1973,10 +3420,10 @@ static void d64_format(uint8_t part, uint8_t *name, uint8_t *id) {
   memset(buf->data, 0, 256);
 
   /* Flush BAM buffers and mark their contents as invalid */
-  d64_bam_commit();
-  bam_buffer->pvt.bam.part = 0xff;
-  if (bam_buffer2)
-    bam_buffer2->pvt.bam.part = 0xff;
+  bam_buffer_invalidate(255);
+#ifdef CONFIG_D64_FREEMAP
+  freemap.part = 255;
+#endif
 
   if (id != NULL) {
     /* Clear the data area of the disk image */
@@ -33,6 +33,9 @@
 #define DIR_OFS_TRACK           3
 #define DIR_OFS_SECTOR          4
 #define DIR_OFS_FILE_NAME       5
+#define DIR_OFS_SS_TRACK        0x15
+#define DIR_OFS_SS_SECTOR       0x16
+#define DIR_OFS_RECORD_LEN      0x17
 #define DIR_OFS_YEAR            0x19
 #define DIR_OFS_MONTH           0x1a
 #define DIR_OFS_DAY             0x1b
@@ -58,7 +61,39 @@ void    d64_unmount(uint8_t part);
 /* commit BAM buffer contents to storage medium */
 uint8_t d64_bam_commit(void);
 
+#ifdef CONFIG_D64_WRITEBEHIND
+/* write queued data sectors to the image */
+uint8_t d64_writebehind_flush(uint8_t part, uint8_t sync);
+
+/* flush the queue before an overlapping image access */
+void d64_writebehind_access(uint8_t part, uint32_t offset, uint16_t bytes);
+#else
+#  define d64_writebehind_flush(part, sync) 0
+#  define d64_writebehind_access(part, offset, bytes) do {} while (0)
+#endif
+
 void d64_raw_directory(path_t *path, buffer_t *buf);
 void d64_invalidate(void);
 
+#if defined(CONFIG_D64_READAHEAD) || defined(CONFIG_D64_DIRCACHE)
+#  define HAVE_D64_CACHES
+
+/* hit/miss counters of a cache */
+typedef struct {
+  uint16_t hits;
+  uint16_t misses;
+} cachestats_t;
+
+#  ifdef CONFIG_D64_READAHEAD
+extern cachestats_t d64_readahead_stats;
+#  endif
+#  ifdef CONFIG_D64_DIRCACHE
+extern cachestats_t d64_dircache_stats;
+#  endif
+
+void d64_cache_invalidate(uint8_t part);
+#else
+#  define d64_cache_invalidate(part) do {} while (0)
+#endif
+
 #endif
@@ -188,6 +188,13 @@ typedef struct {
  * @track : current track
  * @sector: current sector
  * @blocks: number of sectors allocated before the current
+ *          (REL files: number of data sectors)
+ * @ss_track : REL files: track of the (super) side sector in the dir entry
+ * @ss_sector: REL files: sector of the (super) side sector in the dir entry
+ * @lastbyte : REL files: last used byte in the final data sector
+ * @changed  : REL files: directory entry needs an update on close
+ * @ssnum    : REL files: side sector held in @ssbuf, SS_NONE if none
+ * @ssbuf    : REL files: side sector cache
  *
  * This structure holds the information required to write to a file
  * in a D64 image and update its directory entry upon close.
@@ -198,14 +205,46 @@ typedef struct d64fh {
   uint8_t track;
   uint8_t sector;
   uint16_t blocks;
+  uint8_t ss_track;
+  uint8_t ss_sector;
+  uint8_t lastbyte;
+  uint8_t changed;
+  uint16_t ssnum;
+  struct buffer_s *ssbuf;
 } d64fh_t;
 
+/**
+ * struct namematch_t - file name pattern compiled by next_match
+ * @compiled: 0 if the pattern has not been compiled yet
+ * @plen    : characters before the first '*'
+ * @star    : pattern continues with '*' after plen
+ * @slen    : characters after it, 0xff if too many
+ * @pwild   : bit n set: prefix character n is '?'
+ * @swild   : bit n set: suffix character n is '?'
+ * @prefix  : case-folded copy of the characters before the first '*'
+ *
+ * The case-sensitive prefix and the suffix are read from the pattern
+ * itself, which stays the same for all next_match calls on a handle.
+ */
+typedef struct {
+  uint8_t  compiled;
+  uint8_t  plen;
+  uint8_t  star;
+  uint8_t  slen;
+  uint16_t pwild;
+  uint16_t swild;
+  uint8_t  prefix[CBM_NAME_LENGTH];
+} namematch_t;
+
 /**
  * struct dh_t - union of all directory handles
- * @part: partition number for the handle
- * @fat : fat directory handle
- * @m2i : m2i directory handle (offset of entry in the file)
- * @d64 : d64 directory handle
+ * @part : partition number for the handle
+ * @match: pattern of next_match, reset by opendir (CONFIG_MATCH_CACHE only)
+ * @fat  : fat directory handle
+ * @m2i  : m2i directory handle (offset of entry in the file)
+ * @d64  : d64 directory handle
+ * @lookup  : FAT only: exact names are looked up through the hash next
+ * @skipname: FAT only: name returned by that lookup, skipped by readdir
  *
  * This is a union of directory handles for all supported file types
  * which is used as an opaque type to be passed between openddir and
@@ -213,6 +252,13 @@ typedef struct d64fh {
  */
 typedef struct dh_s {
   uint8_t part;
+#ifdef CONFIG_MATCH_CACHE
+  namematch_t match;
+#endif
+#ifdef CONFIG_FAT_DIRHASH
+  uint8_t lookup;
+  uint8_t skipname[8+1+3+1];
+#endif
   union {
     DIR          fat;
     uint16_t     m2i;
@@ -221,6 +267,13 @@ typedef struct dh_s {
   } dir;
 } dh_t;
 
+/* Called by opendir: the handle needs a new compiled pattern */
+#ifdef CONFIG_MATCH_CACHE
+#  define reset_match(dh) (dh)->match.compiled = 0
+#else
+#  define reset_match(dh) do {} while (0)
+#endif
+
 /* This enum must match the struct param_s below! */
 typedef enum { DIR_TRACK = 0, DIR_START_SECTOR,
                LAST_TRACK, LABEL_OFFSET, ID_OFFSET,
@@ -269,6 +322,12 @@ typedef struct partition_s {
   dir_t                  current_dir;
   const struct fileops_s *fop;
   FIL                    imagehandle;
+#if _USE_FASTSEEK
+  CLMAP                  imagemap;
+#endif
+#ifdef CONFIG_IMAGE_DIRECT
+  DWORD                  imagelba;
+#endif
   uint8_t                imagetype;
   struct param_s         d64data;
 } partition_t;
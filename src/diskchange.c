@@ -49,6 +49,12 @@ static FIL     swaplist;
 static path_t  swappath;
 static uint8_t linenum;
 
+#ifdef CONFIG_SWAPLIST_INDEX
+/* Offsets of the entries in the swap list, linenum 255 means "last entry" */
+static CACHE_ATTRIB uint16_t swapindex[255];
+static uint8_t  swaplines;
+#endif
+
 #define BLINK_BACKWARD 1
 #define BLINK_FORWARD  2
 #define BLINK_HOME     3
@@ -77,11 +83,61 @@ static void confirm_blink(uint8_t type) {
   }
 }
 
+#ifdef CONFIG_SWAPLIST_INDEX
+/**
+ * index_swaplist - build the line offset index of the swap list
+ *
+ * This function reads the swap list once and stores the offset of
+ * every entry in swapindex, so mount_line can read any entry directly.
+ * It also determines if the list is in ASCII or PETSCII. Entries after
+ * the 255th can't be selected and are ignored.
+ */
+static void index_swaplist(void) {
+  FRESULT res;
+  UINT bytesread, i;
+  uint16_t curpos = 0;
+  bool newline = true;
+
+  swaplines = 0;
+  globalflags |= SWAPLIST_ASCII;
+
+  do {
+    res = f_read(&swaplist, command_buffer, CONFIG_COMMAND_BUFFER_SIZE, &bytesread);
+    if (res != FR_OK) {
+      parse_error(res,1);
+      return;
+    }
+
+    /* check for PETSCII marker */
+    if (curpos == 0 && bytesread >= sizeof(petscii_marker) &&
+        !memcmp_P(command_buffer, petscii_marker, sizeof(petscii_marker))) {
+      /* swaplist is in PETSCII, ignore this line */
+      globalflags &= ~SWAPLIST_ASCII;
+      newline = false;
+    }
+
+    for (i=0; i<bytesread; i++, curpos++) {
+      if (command_buffer[i] == '\r' || command_buffer[i] == '\n') {
+        newline = true;
+      } else if (newline) {
+        newline = false;
+        swapindex[swaplines++] = curpos;
+        if (swaplines == sizeof(swapindex)/sizeof(swapindex[0]))
+          return;
+      }
+    }
+  } while (bytesread == CONFIG_COMMAND_BUFFER_SIZE);
+}
+#endif
+
 static uint8_t mount_line(void) {
   FRESULT res;
   UINT bytesread;
-  uint8_t i,*str,*strend, *buffer_start;
+  uint8_t *str,*strend, *buffer_start;
+#ifndef CONFIG_SWAPLIST_INDEX
+  uint8_t i;
   uint16_t curpos;
+#endif
   bool got_colon = false;
   uint8_t olderror = current_error;
   current_error = ERROR_OK;
@@ -89,9 +145,44 @@ static uint8_t mount_line(void) {
   /* Kill all buffers */
   free_multiple_buffers(FMB_USER_CLEAN);
 
+  buffer_start = command_buffer + 1;
+
+#ifdef CONFIG_SWAPLIST_INDEX
+  if (swaplines == 0)
+    return 0;
+
+  if (linenum == 255) {
+    /* Last entry requested */
+    linenum = swaplines - 1;
+  } else if (linenum >= swaplines) {
+    /* End of file - restart with the first entry */
+    linenum = 0;
+  }
+
+  res = f_lseek(&swaplist, swapindex[linenum]);
+  if (res != FR_OK) {
+    parse_error(res,1);
+    return 0;
+  }
+
+  res = f_read(&swaplist, buffer_start, CONFIG_COMMAND_BUFFER_SIZE - 1, &bytesread);
+  if (res != FR_OK) {
+    parse_error(res,1);
+    return 0;
+  }
+
+  /* Find the end of the name */
+  str = buffer_start;
+  while (str < buffer_start + bytesread && *str != '\r' && *str != '\n') {
+    if (*str == ':')
+      got_colon = true;
+    str++;
+  }
+
+  strend = str;
+#else
   curpos = 0;
   strend = NULL;
-  buffer_start = command_buffer + 1;
   globalflags |= SWAPLIST_ASCII;
 
   for (i=0;i<=linenum;i++) {
@@ -151,6 +242,7 @@ static uint8_t mount_line(void) {
 
     curpos += str - buffer_start;
   }
+#endif
 
   /* Terminate file name */
   *strend = 0;
@@ -281,6 +373,10 @@ static void set_changelist_internal(path_t *path, uint8_t *filename, uint8_t at_
   /* Remember its directory so relative paths work */
   swappath = *path;
 
+#ifdef CONFIG_SWAPLIST_INDEX
+  index_swaplist();
+#endif
+
   if (at_end)
     linenum = 255;
   else
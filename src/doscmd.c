@@ -45,6 +45,7 @@
 #include "iec.h"
 #include "led.h"
 #include "parser.h"
+#include "perfcount.h"
 #include "system.h"
 #include "time.h"
 #include "rtc.h"
@@ -1975,6 +1976,38 @@ static void parse_xcommand(void) {
     }
     break;
 
+#ifdef HAVE_D64_CACHES
+  case 'C':
+    /* cache statistics */
+    if (command_buffer[2] == '-') {
+# ifdef CONFIG_D64_READAHEAD
+      memset(&d64_readahead_stats, 0, sizeof(d64_readahead_stats));
+# endif
+# ifdef CONFIG_D64_DIRCACHE
+      memset(&d64_dircache_stats, 0, sizeof(d64_dircache_stats));
+# endif
+    }
+    set_error_ts(ERROR_STATUS,device_address,2);
+    break;
+#endif
+
+#ifdef CONFIG_PERFCOUNTERS
+  case 'P':
+    /* performance counters, XP- resets them */
+    str = command_buffer + 2;
+    if (*str == '-') {
+      perf_reset();
+      str++;
+    }
+    num = parse_number(&str);
+    if (num <= 2) {
+      set_error_ts(ERROR_STATUS,device_address,3+num);
+    } else {
+      set_error(ERROR_SYNTAX_UNKNOWN);
+    }
+    break;
+#endif
+
   case 'W':
     /* Write configuration */
     write_configuration();
@@ -321,6 +321,7 @@ static void eefs_format(uint8_t drv, uint8_t *name, uint8_t *id) {
 
 static uint8_t eefs_opendir(dh_t *dh, path_t *path) {
   dh->part = path->part;
+  reset_match(dh);
   eepromfs_opendir(&dh->dir.eefs);
   return 0;
 }
@@ -28,12 +28,14 @@
 #include <string.h>
 #include "config.h"
 #include "buffers.h"
+#include "d64ops.h"
 #include "diskio.h"
 #include "display.h"
 #include "eeprom-conf.h"
 #include "fatops.h"
 #include "flags.h"
 #include "led.h"
+#include "perfcount.h"
 #include "progmem.h"
 #include "ustring.h"
 #include "utils.h"
@@ -178,6 +180,32 @@ static uint8_t *appendbool(uint8_t *msg, uint8_t ch, uint8_t value) {
   return msg;
 }
 
+#if defined(HAVE_D64_CACHES) || defined(CONFIG_PERFCOUNTERS)
+static uint8_t *appendpair(uint8_t *msg, uint8_t ch, uint32_t a, uint32_t b) {
+  *msg++ = ':';
+  *msg++ = ch;
+  msg = appendlong(msg, a);
+  *msg++ = '/';
+  msg = appendlong(msg, b);
+
+  return msg;
+}
+#endif
+
+#ifdef HAVE_D64_CACHES
+static uint8_t *appendstats(uint8_t *msg, uint8_t ch, cachestats_t *stats) {
+  return appendpair(msg, ch, stats->hits, stats->misses);
+}
+#endif
+
+#ifdef CONFIG_PERFCOUNTERS
+static uint8_t *appendcounter(uint8_t *msg, uint8_t ch, uint32_t value) {
+  *msg++ = ':';
+  *msg++ = ch;
+  return appendlong(msg, value);
+}
+#endif
+
 void set_error(uint8_t errornum) {
   set_error_ts(errornum,0,0);
 }
@@ -226,6 +254,54 @@ void set_error_ts(uint8_t errornum, uint8_t track, uint8_t sector) {
         i++;
       }
       break;
+
+#ifdef HAVE_D64_CACHES
+    case 2: // Cache statistics
+      *msg++ = 'C';
+# ifdef CONFIG_D64_READAHEAD
+      msg = appendstats(msg, 'R', &d64_readahead_stats);
+# endif
+# ifdef CONFIG_D64_DIRCACHE
+      msg = appendstats(msg, 'D', &d64_dircache_stats);
+# endif
+      break;
+#endif
+
+#ifdef CONFIG_PERFCOUNTERS
+    case 3: // SD card counters
+      *msg++ = 'P';
+      msg = appendpair(msg, 'R', perfcounters.sd_read_sectors,
+                                 perfcounters.sd_read_cmds);
+      msg = appendpair(msg, 'W', perfcounters.sd_write_sectors,
+                                 perfcounters.sd_write_cmds);
+      msg = appendpair(msg, 'E', perfcounters.sd_crc_errors,
+                                 perfcounters.sd_retries);
+      break;
+
+    case 4: // File system counters
+      *msg++ = 'P';
+      msg = appendpair(msg, 'F', perfcounters.window_hits,
+                                 perfcounters.window_misses);
+      msg = appendcounter(msg, 'I', perfcounters.image_reads);
+      msg = appendcounter(msg, 'B', perfcounters.refills);
+      break;
+
+    case 5: // Bus counters
+      *msg++ = 'P';
+# ifdef CONFIG_HAVE_IEC
+      msg = appendcounter(msg, 'S', perfcounters.bus_bytes[PERF_BUS_IEC]);
+      msg = appendcounter(msg, 'J', perfcounters.bus_bytes[PERF_BUS_JIFFY]);
+#  ifdef CONFIG_PARALLEL_DOLPHIN
+      msg = appendcounter(msg, 'D', perfcounters.bus_bytes[PERF_BUS_DOLPHIN]);
+#  endif
+# endif
+# ifdef CONFIG_HAVE_IEEE
+      msg = appendcounter(msg, 'E', perfcounters.bus_bytes[PERF_BUS_IEEE]);
+# endif
+      msg = appendpair(msg, 'T', perfcounters.refill_us,
+                                 perfcounters.bus_us);
+      break;
+#endif
     }
 
   } else if (errornum == ERROR_LONGVERSION || errornum == ERROR_DOSVERSION) {
@@ -43,6 +43,7 @@
 #include "m2iops.h"
 #include "p00cache.h"
 #include "parser.h"
+#include "perfcount.h"
 #include "progmem.h"
 #include "uart.h"
 #include "utils.h"
@@ -63,6 +64,19 @@ typedef enum { EXT_UNKNOWN, EXT_IS_X00, EXT_IS_TYPE } exttype_t;
 
 uint8_t file_extension_mode;
 
+#ifdef CONFIG_IMAGE_DIRECT
+/* Sector buffer for direct image access, tagged with drive and sector */
+static CACHE_ATTRIB BYTE imagesector[512];
+static BYTE  imagesector_drive;
+static DWORD imagesector_lba;
+#endif
+
+#if _USE_FASTSEEK
+/* Cluster run map of the REL file opened last */
+static CLMAP     relmap;
+static buffer_t *relmap_buf;
+#endif
+
 /* ------------------------------------------------------------------------- */
 /*  Utility functions                                                        */
 /* ------------------------------------------------------------------------- */
@@ -353,10 +367,300 @@ static uint8_t* build_name(uint8_t *name, uint8_t type) {
   return NULL;
 }
 
+#if _USE_FASTSEEK
+/**
+ * relmap_update - (re)build the cluster run map of a REL file
+ * @buf: buffer of the REL file
+ * @pos: file offset that is about to be accessed
+ *
+ * This function builds the cluster run map for the REL file associated
+ * with buf if it is not the owner of the map yet or if pos lies beyond
+ * the part of the file covered by it, so positioning to a record does
+ * not need to follow the FAT chain. A map that is full or can't be
+ * built is left alone, f_lseek falls back to the chain then.
+ */
+static void relmap_update(buffer_t *buf, DWORD pos) {
+  FIL *fh = &buf->pvt.fat.fh;
+  DWORD csize = (DWORD)fh->fs->csize * 512;
+
+  if (pos == 0)
+    return;
+
+  if (relmap_buf == buf) {
+    if (fh->map != NULL &&
+        (relmap.runs >= _FASTSEEK_RUNS || (pos - 1) / csize < relmap.end))
+      return;
+  } else if (relmap_buf != NULL && relmap_buf->allocated &&
+             relmap_buf->pvt.fat.fh.map == &relmap) {
+    /* Take the map away from the previous REL file */
+    relmap_buf->pvt.fat.fh.map = NULL;
+  }
+
+  relmap_buf = buf;
+  l_mkmap(fh, &relmap);
+}
+#else
+#  define relmap_update(buf, pos) do {} while (0)
+#endif
+
 /* ------------------------------------------------------------------------- */
 /*  Callbacks                                                                */
 /* ------------------------------------------------------------------------- */
 
+#ifdef CONFIG_FAT_RESERVE
+/**
+ * reserve_size - size of the cluster reservation for a new file
+ * @name: FAT name of the file
+ *
+ * This function returns the number of bytes that are reserved when a
+ * file is created. Disk images get the size of the smallest image of
+ * their type, so they end up in a single cluster run, everything else
+ * gets CONFIG_FAT_RESERVE bytes.
+ */
+static uint32_t reserve_size(uint8_t *name) {
+  if (check_imageext(name) == IMG_IS_DISK) {
+    switch (toupper(ustrrchr(name, '.')[2])) {
+    case '6': /* D64 */
+    case '4': /* D41 */
+      return 174848;
+
+    case '7': /* D71 */
+      return 349696;
+
+    case '8': /* D81 */
+      return 819200;
+
+    default:
+      break;
+    }
+  }
+
+  return CONFIG_FAT_RESERVE;
+}
+
+/**
+ * extend_reservation - make sure the next write uses reserved clusters
+ * @buf  : buffer to be worked on
+ * @bytes: number of bytes that will be written
+ *
+ * This function reserves another CONFIG_FAT_RESERVE bytes (or more if
+ * required) for the file if the next write would go beyond the clusters
+ * that are already reserved. If no contiguous run is found, the file
+ * continues to grow one cluster at a time.
+ */
+static void extend_reservation(buffer_t *buf, UINT bytes) {
+  FIL *fh = &buf->pvt.fat.fh;
+
+  if (buf->pvt.fat.reserved && fh->fptr + bytes > buf->pvt.fat.reserved)
+    buf->pvt.fat.reserved =
+      l_reserve(fh, (bytes > CONFIG_FAT_RESERVE ? bytes : CONFIG_FAT_RESERVE));
+}
+#else
+#  define extend_reservation(buf, bytes) do {} while (0)
+#endif
+
+/**
+ * close_file - close the file associated with a buffer
+ * @buf: buffer to be worked on
+ *
+ * This function releases the clusters reserved behind the end of the
+ * file if it was written and closes it, even if trimming failed.
+ * Returns the first error that occured.
+ */
+static FRESULT close_file(buffer_t *buf) {
+  FRESULT res = FR_OK, closeres;
+
+#ifdef CONFIG_FAT_RESERVE
+  if (buf->write && buf->pvt.fat.reserved)
+    res = l_trim(&buf->pvt.fat.fh);
+#endif
+
+  closeres = f_close(&buf->pvt.fat.fh);
+  if (res == FR_OK)
+    res = closeres;
+  return res;
+}
+
+#ifdef CONFIG_WRITE_BATCH
+/* Start of the data area of a batched write, the first block starts at +2 */
+#define batch_area(buf) ((buf+1)->data - 256)
+
+/**
+ * free_batch - free the buffers of a batched write
+ * @buf: buffer to be worked on
+ *
+ * This function frees the buffers allocated by start_batch and
+ * moves the data pointer of buf back to its own data segment.
+ */
+static void free_batch(buffer_t *buf) {
+  uint8_t i;
+
+  buf->data = batch_area(buf);
+  for (i = 1; i < buf->pvt.fat.batch; i++)
+    free_buffer(buf + i);
+  buf->pvt.fat.batch = 0;
+}
+
+/**
+ * flush_batch - write the data collected by a batched write
+ * @buf  : buffer to be worked on
+ * @final: write everything if true, only up to a sector boundary otherwise
+ *
+ * This function writes the data collected in the batch area of buf
+ * to its file. Unless final is set, the bytes following the last
+ * sector boundary are kept and moved to the start of the area, so
+ * all further writes start at a sector boundary and FatFs sends
+ * whole sectors straight to the disk. Returns 0 if successful or 1
+ * if an error occured, the file is closed and the buffer freed in
+ * that case.
+ */
+static uint8_t flush_batch(buffer_t *buf, uint8_t final) {
+  FRESULT res;
+  UINT count, byteswritten;
+  uint8_t *area = batch_area(buf) + 2;
+
+  count = buf->pvt.fat.pending;
+  if (!final)
+    count = ((buf->pvt.fat.fh.fptr + count) & ~(uint32_t)(SS(buf->pvt.fat.fh.fs) - 1)) -
+            buf->pvt.fat.fh.fptr;
+
+  extend_reservation(buf, count);
+  res = f_write(&buf->pvt.fat.fh, area, count, &byteswritten);
+  if (res != FR_OK || byteswritten != count) {
+    if (res != FR_OK) {
+      uart_putc('r');
+      parse_error(res,1);
+    } else {
+      uart_putc('l');
+      set_error(ERROR_DISK_FULL);
+    }
+    close_file(buf);
+    free_batch(buf);
+    free_buffer(buf);
+    return 1;
+  }
+
+  buf->pvt.fat.pending -= count;
+  memmove(area, area + count, buf->pvt.fat.pending);
+
+  return 0;
+}
+
+/**
+ * write_batch - add the current buffer data to a batched write
+ * @buf: buffer to be worked on
+ *
+ * This function adds the current contents of the given buffer to
+ * the batch area and writes the area if there is no space left
+ * for another block. Returns 0 if successful, 1 if an error occured.
+ */
+static uint8_t write_batch(buffer_t *buf) {
+  uart_putc('/');
+
+  if (!buf->mustflush)
+    buf->lastused = buf->position - 1;
+
+  buf->pvt.fat.pending += buf->lastused - 1;
+  if (buf->pvt.fat.pending + 254 > 256 * buf->pvt.fat.batch - 2)
+    if (flush_batch(buf, 0))
+      return 1;
+
+  /* The next block is placed directly behind the collected data */
+  buf->data = batch_area(buf) + buf->pvt.fat.pending;
+
+  mark_buffer_clean(buf);
+  buf->mustflush = 0;
+  buf->position  = 2;
+  buf->lastused  = 2;
+  buf->fptr      = buf->pvt.fat.fh.fptr + buf->pvt.fat.pending -
+                   buf->pvt.fat.headersize;
+
+  return 0;
+}
+
+/**
+ * end_batch - finish a batched write
+ * @buf: buffer to be worked on
+ *
+ * This function writes all data collected in the batch area of buf
+ * and frees the additional buffers, so the file can be accessed
+ * without batching again. Returns 0 if successful, 1 if an error
+ * occured.
+ */
+static uint8_t end_batch(buffer_t *buf) {
+  if (!buf->pvt.fat.batch)
+    return 0;
+
+  if (flush_batch(buf, 1))
+    return 1;
+
+  free_batch(buf);
+  return 0;
+}
+/**
+ * return_batch_buffers - continue a file without batched writes
+ * @borrowed: one of the buffers allocated by start_batch
+ *
+ * Cleanup callback of the buffers of a batched write, which
+ * alloc_system_buffer calls when it runs out of buffers. The data
+ * collected so far is written, the current block is moved to the
+ * data segment of the file's own buffer and all other buffers of
+ * the batch are freed. Returns 1 if an error occured, 0 otherwise.
+ */
+static uint8_t return_batch_buffers(buffer_t *borrowed) {
+  buffer_t *buf = borrowed;
+  uint8_t *block;
+
+  /* The file uses the first buffer in front of the borrowed ones */
+  while (buf->borrowed)
+    buf--;
+
+  block = buf->data;
+  if (flush_batch(buf, 1))
+    return 1;
+
+  memmove(batch_area(buf), block, 256);
+  free_batch(buf);
+  return 0;
+}
+
+/**
+ * start_batch - set up batched writing for a buffer
+ * @buf: buffer to be worked on
+ *
+ * This function allocates the free buffers following buf (up to
+ * CONFIG_WRITE_BATCH including buf itself) to collect the data
+ * written to the file. Batching isn't used if fewer than three
+ * buffers are available because the collected data must always
+ * cross a sector boundary when it is written. The buffers can be
+ * taken back by alloc_system_buffer at any time, see
+ * return_batch_buffers.
+ */
+static void start_batch(buffer_t *buf) {
+  uint8_t count = 1;
+
+  while (count < CONFIG_WRITE_BATCH &&
+         alloc_next_buffer(buf + count - 1) != NULL) {
+    /* All of them belong to the channel of buf */
+    buf[count].secondary = buf[1].secondary;
+    buf[count].cleanup   = return_batch_buffers;
+    count++;
+  }
+
+  if (count < 3) {
+    while (--count)
+      free_buffer(buf + count);
+    return;
+  }
+
+  buf->pvt.fat.batch   = count;
+  buf->pvt.fat.pending = 0;
+}
+
+#else
+#  define end_batch(buf) 0
+#endif
+
 /**
  * fat_file_read - read the next data block into the buffer
  * @buf: buffer to be worked on
@@ -423,11 +727,12 @@ static uint8_t write_data(buffer_t *buf) {
   if(buf->recordlen)
     buf->lastused = buf->recordlen + 1;
 
+  extend_reservation(buf, buf->lastused-1);
   res = f_write(&buf->pvt.fat.fh, buf->data+2, buf->lastused-1, &byteswritten);
   if (res != FR_OK) {
     uart_putc('r');
     parse_error(res,1);
-    f_close(&buf->pvt.fat.fh);
+    close_file(buf);
     free_buffer(buf);
     return 1;
   }
@@ -435,7 +740,7 @@ static uint8_t write_data(buffer_t *buf) {
   if (byteswritten != buf->lastused-1U) {
     uart_putc('l');
     set_error(ERROR_DISK_FULL);
-    f_close(&buf->pvt.fat.fh);
+    close_file(buf);
     free_buffer(buf);
     return 1;
   }
@@ -460,14 +765,22 @@ static uint8_t fat_file_write(buffer_t *buf) {
   uint32_t fptr;
   uint32_t i = 0;
 
+#ifdef CONFIG_WRITE_BATCH
+  if (buf->pvt.fat.batch)
+    return write_batch(buf);
+#endif
+
   fptr = buf->pvt.fat.fh.fsize - buf->pvt.fat.headersize;
 
   // on a REL file, the fptr will be be at the end of the record we just read.  Reposition.
   if (buf->fptr != fptr) {
+    if (buf->recordlen)
+      relmap_update(buf, buf->pvt.fat.headersize + buf->fptr);
+
     res = f_lseek(&buf->pvt.fat.fh, buf->pvt.fat.headersize + buf->fptr);
     if (res != FR_OK) {
       parse_error(res,1);
-      f_close(&buf->pvt.fat.fh);
+      close_file(buf);
       free_buffer(buf);
       return 1;
     }
@@ -505,7 +818,7 @@ static uint8_t fat_file_write(buffer_t *buf) {
     if (res != FR_OK) {
       uart_putc('r');
       parse_error(res,1);
-      f_close(&buf->pvt.fat.fh);
+      close_file(buf);
       free_buffer(buf);
       return 1;
     }
@@ -533,11 +846,20 @@ uint8_t fat_file_seek(buffer_t *buf, uint32_t position, uint8_t index) {
     if (fat_file_write(buf))
       return 1;
 
+  /* The file isn't written sequentially anymore */
+  if (end_batch(buf))
+    return 1;
+
   if (buf->pvt.fat.fh.fsize >= pos) {
-    FRESULT res = f_lseek(&buf->pvt.fat.fh, pos);
+    FRESULT res;
+
+    if (buf->recordlen)
+      relmap_update(buf, pos);
+
+    res = f_lseek(&buf->pvt.fat.fh, pos);
     if (res != FR_OK) {
       parse_error(res,0);
-      f_close(&buf->pvt.fat.fh);
+      close_file(buf);
       free_buffer(buf);
       return 1;
     }
@@ -585,12 +907,20 @@ static uint8_t fat_file_close(buffer_t *buf) {
     /* Write the remaining data using the callback */
     if (buf->refill(buf))
       return 1;
+
+    if (end_batch(buf))
+      return 1;
   }
 
-  res = f_close(&buf->pvt.fat.fh);
+  res = close_file(buf);
   parse_error(res,1);
   buf->cleanup = callback_dummy;
 
+#if _USE_FASTSEEK
+  if (relmap_buf == buf)
+    relmap_buf = NULL;
+#endif
+
   if (res != FR_OK)
     return 1;
   else
@@ -693,6 +1023,12 @@ FRESULT create_file(path_t *path, cbmdirent_t *dent, uint8_t type, buffer_t *buf
   if (res != FR_OK)
     return res;
 
+#ifdef CONFIG_FAT_RESERVE
+  /* Allocate the clusters for the start of the file in a single run */
+  if (!recordlen)
+    buf->pvt.fat.reserved = l_reserve(&buf->pvt.fat.fh, reserve_size(name));
+#endif
+
   if (x00ext != NULL || recordlen) {
     UINT byteswritten;
 
@@ -759,6 +1095,11 @@ void fat_open_write(path_t *path, cbmdirent_t *dent, uint8_t type, buffer_t *buf
 
   /* If no data is written the file should end up with a single 0x0d byte */
   buf->data[2] = 13;
+
+#ifdef CONFIG_WRITE_BATCH
+  /* Collect the data in the following buffers too if they are free */
+  start_batch(buf);
+#endif
 }
 
 /**
@@ -823,6 +1164,11 @@ uint8_t fat_opendir(dh_t *dh, path_t *path) {
 
   res = l_opendir(&partition[path->part].fatfs, path->dir.fat, &dh->dir.fat);
   dh->part = path->part;
+  reset_match(dh);
+#ifdef CONFIG_FAT_DIRHASH
+  dh->lookup = 1;
+  dh->skipname[0] = 0;
+#endif
   if (res != FR_OK) {
     parse_error(res,1);
     return 1;
@@ -857,6 +1203,9 @@ int8_t fat_readdir(dh_t *dh, cbmdirent_t *dent) {
       return 1;
     }
   } while ((finfo.fname[0] && (finfo.fattrib & AM_VOL)) ||
+#ifdef CONFIG_FAT_DIRHASH
+           (finfo.fname[0] && !ustrcmp(finfo.fname, dh->skipname)) ||
+#endif
            (finfo.fname[0] == '.' && finfo.fname[1] == 0) ||
            (finfo.fname[0] == '.' && finfo.fname[1] == '.' && finfo.fname[2] == 0));
 
@@ -1003,6 +1352,52 @@ int8_t fat_readdir(dh_t *dh, cbmdirent_t *dent) {
   return 0;
 }
 
+#ifdef CONFIG_FAT_DIRHASH
+/**
+ * fat_readname - read the directory entry of an exact name
+ * @dh  : directory handle as set up by opendir
+ * @name: CBM file name without wildcards
+ * @dent: CBM directory entry for returning data
+ *
+ * This function looks up the FAT name a file called name would have
+ * through the directory hash and reads its entry into dent. If type
+ * extensions are hidden, the name with each of them is tried as well.
+ * Names stored in P00 headers can't be found this way. Afterwards dh
+ * is back at the start of the directory and readdir skips the entry
+ * that was returned. Returns 0 if the entry was found, 1 if an error
+ * occured, -1 if no entry of the directory can have this name or -2 if
+ * only a scan of the directory can tell (e.g. it has P00 files).
+ */
+int8_t fat_readname(dh_t *dh, uint8_t *name, cbmdirent_t *dent) {
+  uint8_t fatname[CBM_NAME_LENGTH+TYPE_LENGTH+2];
+  uint8_t *ext;
+  uint8_t type = TYPE_SEQ;
+  FRESULT res;
+  int8_t found;
+
+  ustrcpy(fatname, name);
+  pet2asc(fatname);
+  ext = fatname + ustrlen(fatname);
+
+  while ((res = l_seekname(&dh->dir.fat, fatname)) != FR_OK) {
+    /* Errors are reported by the directory scan that follows */
+    if (res != FR_NO_FILE)
+      return -2;
+    if (!(globalflags & EXTENSION_HIDING) || type > TYPE_REL)
+      return l_hasalias(&dh->dir.fat) ? -2 : -1;
+    *ext = '.';
+    memcpy_P(ext+1, filetypes + TYPE_LENGTH * type++, TYPE_LENGTH);
+    ext[TYPE_LENGTH+1] = 0;
+  }
+
+  found = fat_readdir(dh, dent);
+  l_opendir(dh->dir.fat.fs, dh->dir.fat.sclust, &dh->dir.fat);
+  if (found == 0)
+    ustrcpy(dh->skipname, dent->pvt.fat.realname);
+  return found;
+}
+#endif
+
 /**
  * fat_delete - Delete a file/directory on FAT
  * @path: path to the file/directory
@@ -1018,7 +1413,7 @@ uint8_t fat_delete(path_t *path, cbmdirent_t *dent) {
   set_dirty_led(1);
   if (dent->pvt.fat.realname[0]) {
     name = dent->pvt.fat.realname;
-    p00cache_invalidate();
+    p00cache_remove(path->part, dent->pvt.fat.cluster);
   } else {
     name = dent->name;
     pet2asc(name);
@@ -1099,12 +1494,27 @@ uint8_t fat_chdir(path_t *path, cbmdirent_t *dent) {
         return 1;
       }
 
+#if _USE_FASTSEEK
+      /* Remember where the image is stored so seeks skip the FAT */
+      res = l_mkmap(&partition[path->part].imagehandle,
+                    &partition[path->part].imagemap);
+      if (res != FR_OK) {
+        parse_error(res,1);
+        return 1;
+      }
+#endif
+
 #ifdef CONFIG_M2I
       if (check_imageext(dent->pvt.fat.realname) == IMG_IS_M2I)
         partition[path->part].fop = &m2iops;
       else
 #endif
         {
+#ifdef CONFIG_IMAGE_DIRECT
+          /* Contiguous images can be accessed without FatFs */
+          partition[path->part].imagelba =
+            l_getlba(&partition[path->part].imagehandle);
+#endif
           if (d64_mount(path, dent->pvt.fat.realname))
             return 1;
           partition[path->part].fop = &d64ops;
@@ -1374,7 +1784,7 @@ void fat_rename(path_t *path, cbmdirent_t *dent, uint8_t *newname) {
 
   if (dent->opstype == OPSTYPE_FAT_X00) {
     /* [PSUR]00 rename, just change the internal file name */
-    p00cache_invalidate();
+    p00cache_remove(path->part, dent->pvt.fat.cluster);
 
     res = f_open(&partition[path->part].fatfs, &partition[path->part].imagehandle,
                  dent->pvt.fat.realname, FA_WRITE|FA_OPEN_EXISTING);
@@ -1477,6 +1887,11 @@ void fatops_init(uint8_t preserve_path) {
   /* Invalidate some caches */
   d64_invalidate();
   p00cache_invalidate();
+#ifdef CONFIG_IMAGE_DIRECT
+  imagesector_lba = 0;
+  for (part = 0; part < CONFIG_MAX_PARTITIONS; part++)
+    partition[part].imagelba = 0;
+#endif
 
 #ifndef HAVE_HOTPLUG
   if (!max_part) {
@@ -1516,6 +1931,10 @@ uint8_t image_unmount(uint8_t part) {
   }
 
   partition[part].fop = &fatops;
+#ifdef CONFIG_IMAGE_DIRECT
+  partition[part].imagelba = 0;
+  imagesector_lba = 0;
+#endif
   res = f_close(&partition[part].imagehandle);
   if (res != FR_OK) {
     parse_error(res,0);
@@ -1554,6 +1973,107 @@ void image_mkdir(path_t *path, uint8_t *dirname) {
   return;
 }
 
+#ifdef CONFIG_IMAGE_DIRECT
+/**
+ * image_direct - access a contiguous image without FatFs
+ * @part  : partition number
+ * @offset: offset in the image
+ * @buffer: pointer to the data buffer
+ * @bytes : number of bytes to transfer
+ * @write : flags if the data should be written instead of read
+ *
+ * This function transfers data between buffer and the image file
+ * in partition part by calculating the sector numbers from the base
+ * sector of the image, so neither the FAT nor the FatFs window are
+ * touched. Partial sectors go through a one-sector buffer that is
+ * written through on every change. If a request can't be handled
+ * this way, direct access is disabled until the image is mounted
+ * again. Returns 0 on success, 1 if the caller should use FatFs
+ * instead and 2 on failure.
+ */
+static uint8_t image_direct(uint8_t part, DWORD offset, uint8_t *buffer,
+                            uint16_t bytes, uint8_t write) {
+  FIL *fp = &partition[part].imagehandle;
+  BYTE drive = partition[part].fatfs.drive;
+  DWORD lba;
+  uint16_t ofs, len;
+  DRESULT res;
+
+  if (partition[part].imagelba == 0 ||
+      (write && !(fp->flag & FA_WRITE)))
+    return 1;
+
+  if (offset == (DWORD)-1 || offset + bytes > fp->fsize) {
+    /* Hand this image over to FatFs for the rest of the mount */
+    partition[part].imagelba = 0;
+    imagesector_lba = 0;
+    return 1;
+  }
+
+  while (bytes) {
+    lba = partition[part].imagelba + offset / 512;
+    ofs = offset & 511;
+
+    if (ofs == 0 && bytes >= 512) {
+      /* Whole sectors, transfer them without the sector buffer */
+      len = bytes / 512;
+      if (len > 255)
+        len = 255;
+
+      if (write)
+        res = disk_write(drive, buffer, lba, len);
+      else
+        res = disk_read(drive, buffer, lba, len);
+
+      if (imagesector_drive == drive &&
+          imagesector_lba >= lba && imagesector_lba < lba + len)
+        imagesector_lba = 0;
+
+      len *= 512;
+    } else {
+      len = 512 - ofs;
+      if (len > bytes)
+        len = bytes;
+
+      res = RES_OK;
+      if (imagesector_drive != drive || imagesector_lba != lba) {
+        imagesector_lba = 0;
+        res = disk_read(drive, imagesector, lba, 1);
+        if (res == RES_OK) {
+          imagesector_drive = drive;
+          imagesector_lba   = lba;
+        }
+      }
+
+      if (res == RES_OK) {
+        if (write) {
+          memcpy(imagesector + ofs, buffer, len);
+          res = disk_write(drive, imagesector, lba, 1);
+          if (res != RES_OK)
+            imagesector_lba = 0;
+        } else {
+          memcpy(buffer, imagesector + ofs, len);
+        }
+      }
+    }
+
+    if (res != RES_OK) {
+      parse_error(FR_RW_ERROR, 1);
+      return 2;
+    }
+
+    buffer += len;
+    offset += len;
+    bytes  -= len;
+  }
+
+  if (write)
+    fp->flag |= FA__WRITTEN;
+
+  return 0;
+}
+#endif
+
 /**
  * image_read - Seek to a specified image offset and read data
  * @part  : partition number
@@ -1569,6 +2089,15 @@ uint8_t image_read(uint8_t part, DWORD offset, void *buffer, uint16_t bytes) {
   FRESULT res;
   UINT bytesread;
 
+  PERF_INC(image_reads);
+  d64_writebehind_access(part, offset, bytes);
+
+#ifdef CONFIG_IMAGE_DIRECT
+  uint8_t direct = image_direct(part, offset, buffer, bytes, 0);
+  if (direct != 1)
+    return direct;
+#endif
+
   if (offset != -1) {
     res = f_lseek(&partition[part].imagehandle, offset);
     if (res != FR_OK) {
@@ -1605,6 +2134,15 @@ uint8_t image_write(uint8_t part, DWORD offset, void *buffer, uint16_t bytes, ui
   FRESULT res;
   UINT byteswritten;
 
+  d64_writebehind_access(part, offset, bytes);
+  d64_cache_invalidate(part);
+
+#ifdef CONFIG_IMAGE_DIRECT
+  uint8_t direct = image_direct(part, offset, buffer, bytes, 1);
+  if (direct != 1)
+    return direct;
+#endif
+
   if (offset != -1) {
     res = f_lseek(&partition[part].imagehandle, offset);
     if (res != FR_OK) {
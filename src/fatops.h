@@ -44,6 +44,9 @@ uint8_t  fat_getid(path_t *path, uint8_t *id);
 uint16_t fat_freeblocks(uint8_t part);
 uint8_t  fat_opendir(dh_t *dh, path_t *dir);
 int8_t   fat_readdir(dh_t *dh, cbmdirent_t *dent);
+#ifdef CONFIG_FAT_DIRHASH
+int8_t   fat_readname(dh_t *dh, uint8_t *name, cbmdirent_t *dent);
+#endif
 void     fat_read_sector(buffer_t *buf, uint8_t part, uint8_t track, uint8_t sector);
 void     fat_write_sector(buffer_t *buf, uint8_t part, uint8_t track, uint8_t sector);
 void     format_dummy(uint8_t drive, uint8_t *name, uint8_t *id);
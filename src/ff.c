@@ -58,6 +58,7 @@
 #include "config.h"
 #include "ff.h"         /* FatFs declarations */
 #include "diskio.h"     /* Include file for user provided disk functions */
+#include "perfcount.h"
 #include "progmem.h"
 
 
@@ -132,6 +133,7 @@ BOOL move_window (      /* TRUE: successful, FALSE: failed */
     }
 #endif
     if (sector) {
+      PERF_INC(window_misses);
       if (disk_read(fs->drive, buf->data, sector, 1) != RES_OK)
         return FALSE;
       buf->sect = sector;
@@ -139,6 +141,8 @@ BOOL move_window (      /* TRUE: successful, FALSE: failed */
       buf->fs=fs;
 #endif
     }
+  } else if (sector) {
+    PERF_INC(window_hits);
   }
   return TRUE;
 }
@@ -441,6 +445,173 @@ BOOL next_dir_entry (   /* TRUE: successful, FALSE: could not move next */
 
 
 
+#if _USE_DIRHASH
+/*-----------------------------------------------------------------------*/
+/* Directory name hash                                                   */
+/*-----------------------------------------------------------------------*/
+/* dirhash_slot holds the index of the first entry (LFN or SFN) of the   */
+/* names of one directory. It is found by a hash of the SFN and, if the  */
+/* file has one, by a hash of the LFN, probing up to _DIRHASH_PROBES     */
+/* following slots. A name whose slots are all taken is left out. Once   */
+/* a scan has passed all entries, a name whose probing ends at an empty  */
+/* slot does not exist. Only the final path segment switches the hashed  */
+/* directory, so lookups in the current directory keep it.               */
+
+#define _DIRHASH_PROBES 8
+
+static FATFS *dirhash_fs;                 /* File system of the hashed directory, NULL: none */
+static DWORD dirhash_clust;               /* Start cluster of the hashed directory */
+static CACHE_ATTRIB WORD dirhash_slot[_DIRHASH_SLOTS]; /* Entry index by name hash, 0xFFFF: empty */
+static WORD dirhash_next;                 /* Next slot to try for the current name */
+static BYTE dirhash_tries;                /* Number of slots tried for the current name */
+static BOOL dirhash_complete;             /* TRUE: all entries of the directory were hashed */
+static BOOL dirhash_gap;                  /* TRUE: probing for the current name reached an empty slot */
+static BOOL dirhash_alias;                /* TRUE: a hashed name may be listed as another name */
+
+static
+WORD dirhash_char (     /* Hash value of a name character at a position */
+  BYTE c,
+  UINT pos
+)
+{
+  WORD h;
+
+  if (c >= 'a' && c <= 'z') c -= 0x20;    /* Names are compared ignoring case */
+  h = (WORD)(c | (pos << 8)) * 40503U;     /* Summed up, so mix each term well */
+  h ^= h >> 8;
+  h *= 11291U;
+  return h ^ (h >> 7);
+}
+
+static
+WORD dirhash_sfn (      /* Hash value of a short name {file(8),ext(3)} */
+  const BYTE *name
+)
+{
+  WORD h = 0;
+  BYTE i;
+
+  for (i = 0; i < 8+3; i++)
+    h += dirhash_char(name[i], i);
+  return h;
+}
+
+static
+WORD dirhash_home (     /* First slot to try for a hash value */
+  WORD h
+)
+{
+  h *= 40503U;
+  return (h ^ (h >> 8)) & (_DIRHASH_SLOTS - 1);
+}
+
+static
+void dirhash_insert (   /* Store an entry index in the first free slot, if any */
+  WORD h,               /* Hash value of the name */
+  WORD idx              /* Index of the first entry of the name */
+)
+{
+  WORD i = dirhash_home(h);
+  BYTE n;
+
+
+  for (n = 0; n < _DIRHASH_PROBES; n++) {
+    if (dirhash_slot[i] == 0xffff || dirhash_slot[i] == idx) {
+      dirhash_slot[i] = idx;
+      return;
+    }
+    i = (i + 1) & (_DIRHASH_SLOTS - 1);
+  }
+}
+
+static
+void dirhash_switch (   /* Start hashing the directory of dj if it is not already */
+  DIR *dj
+)
+{
+  if (dirhash_fs == dj->fs && dirhash_clust == dj->sclust) return;
+  dirhash_fs = dj->fs;
+  dirhash_clust = dj->sclust;
+  dirhash_complete = FALSE;
+  dirhash_alias = FALSE;
+  memset(dirhash_slot, 0xff, sizeof(dirhash_slot));
+}
+
+static
+BOOL is_alias (         /* TRUE: short name has a P00-style extension or non-ASCII characters */
+  const BYTE *sfn       /* {file(8),ext(3)} */
+)
+{
+  const BYTE *ext = sfn + 8;
+  BYTE i;
+
+
+  if ((ext[0] == 'P' || ext[0] == 'S' || ext[0] == 'U' || ext[0] == 'R') &&
+      ext[1] >= '0' && ext[1] <= '9' && ext[2] >= '0' && ext[2] <= '9')
+    return TRUE;
+  for (i = 0; i < 8+3; i++)
+    if (sfn[i] >= 0x80) return TRUE;
+  return FALSE;
+}
+
+static
+BOOL dir_seek (         /* TRUE: successful, FALSE: entry does not exist */
+  DIR *dj,              /* Pointer to directory object with sclust set */
+  WORD idx              /* Entry index to move to */
+)
+{
+  FATFS *fs = dj->fs;
+  DWORD clust = dj->sclust, sect;
+  WORD n;
+
+
+  n = idx / (SS(fs) / 32);                           /* Sector offset in the table */
+  if (clust == 0) {                                  /* In static table */
+    if (idx >= fs->n_rootdir) return FALSE;
+    sect = fs->dirbase + n;
+  } else {                                           /* In dynamic table */
+    for (n /= fs->csize; n; n--) {                   /* Follow the chain to the cluster */
+      clust = get_cluster(fs, clust);
+      if (clust < 2 || clust >= fs->max_clust) return FALSE;
+    }
+    sect = clust2sect(fs, clust) + ((idx / (SS(fs) / 32)) & (fs->csize - 1));
+  }
+  dj->clust = clust;
+  dj->sect = sect;
+  dj->index = idx;
+  return TRUE;
+}
+
+static
+BOOL dirhash_seek (     /* TRUE: moved to the next candidate, FALSE: none left */
+  DIR *dj               /* Pointer to directory object */
+)
+{
+  WORD idx;
+
+
+  while (dirhash_tries < _DIRHASH_PROBES) {
+    idx = dirhash_slot[dirhash_next];
+    if (idx == 0xffff) {
+      dirhash_gap = TRUE;
+      break;
+    }
+    dirhash_next = (dirhash_next + 1) & (_DIRHASH_SLOTS - 1);
+    dirhash_tries++;
+    if (dir_seek(dj, idx)) return TRUE;
+  }
+  dirhash_tries = _DIRHASH_PROBES;
+  return FALSE;
+}
+
+#  define dirhash_clear() do { dirhash_fs = NULL; } while (0)
+#else
+#  define dirhash_clear() do {} while (0)
+#endif
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Get file status from directory entry                                  */
 /*-----------------------------------------------------------------------*/
@@ -599,6 +770,12 @@ FRESULT trace_path (     /* FR_OK(0): successful, !=0: error code */
   UINT l;
   BOOL store=TRUE;
 #endif
+#if _USE_DIRHASH
+  BOOL hashing, hinted, hasl;
+  WORD h, sidx;
+  DWORD ssect;
+  UINT hpos;
+#endif
 
   /* Initialize directory object */
 #if _USE_CHDIR != 0 || _USE_CURR_DIR != 0
@@ -648,6 +825,31 @@ FRESULT trace_path (     /* FR_OK(0): successful, !=0: error code */
       *len=0;
 #endif
     if (ds == 1) return FR_INVALID_NAME;
+#if _USE_DIRHASH
+    ssect = dj->sect;                    /* Start of the directory for a full scan */
+    sidx = dj->index;
+    hinted = hasl = FALSE;
+    h = 0;
+    if (!ds) dirhash_switch(dj);
+    hashing = (dirhash_fs == fs && dirhash_clust == dj->sclust);
+    dirhash_tries = _DIRHASH_PROBES;
+    dirhash_gap = FALSE;
+    if (hashing) {
+      if (lfn) {
+        for (hpos = 0; hpos < *len; hpos++)
+          h += dirhash_char((*spath)[hpos], hpos);
+      } else
+        h = dirhash_sfn(fn);
+      dirhash_next = dirhash_home(h);
+      dirhash_tries = 0;
+      h = 0;
+      if (dirhash_seek(dj)) {            /* Start at an entry found in the hash */
+        hinted = TRUE;
+        store = TRUE;
+      } else if (dirhash_complete && dirhash_gap)  /* Not in the table, no need to scan */
+        return !ds ? FR_NO_FILE : FR_NO_PATH;
+    }
+#endif
     for (;;) {
       if (!move_fs_window(fs, dj->sect)) return FR_RW_ERROR;
 #if _USE_LFN != 0
@@ -659,14 +861,36 @@ FRESULT trace_path (     /* FR_OK(0): successful, !=0: error code */
         if (!lfn)
           /* We don't know the length of the LFN, estimate it */
           *len = 0;
+#if _USE_DIRHASH
+        h = 0;
+        hasl = FALSE;
+#endif
       }
 #endif
       dptr = &FSBUF.data[(dj->index & ((SS(fs) - 1) / 32)) * 32];  /* Pointer to the directory entry */
-      if (dptr[DIR_Name] == 0)            /* Has it reached to end of dir? */
+      if (dptr[DIR_Name] == 0) {          /* Has it reached to end of dir? */
+#if _USE_DIRHASH
+        if (hinted) goto rescan;
+        if (hashing && sidx == 0) dirhash_complete = TRUE;
+#endif
         return !ds ? FR_NO_FILE : FR_NO_PATH;
+      }
 #if _USE_LFN != 0
       if (dptr[DIR_Name] != 0xE5) {            /* Matched? */
         if((dptr[DIR_Attr] & AM_LFN) == AM_LFN) {
+#if _USE_DIRHASH
+          if (hashing) {
+            hasl = TRUE;
+            hpos = ((dptr[0] & 0x1f) - 1) * 13;
+            for (j = 0; j < 13; j++) {
+              a = dptr[pgm_read_byte(LFN_pos+j)];
+              b = dptr[pgm_read_byte(LFN_pos+j)+1];
+              if (!a && !b) break;
+              if (a >= 0x80 || b) dirhash_alias = TRUE;
+              h += dirhash_char(a, hpos + j);
+            }
+          }
+#endif
           if (lfn) {
             i=((dptr[0]&0x1f)-1)*13;
             j=0;
@@ -694,6 +918,13 @@ FRESULT trace_path (     /* FR_OK(0): successful, !=0: error code */
             *len = *len + 13;
           }
         } else if ((dptr[DIR_Attr] & AM_LFN) != AM_LFN) {  /* we're a normal entry */
+#if _USE_DIRHASH
+          if (hashing && !(dptr[DIR_Attr] & AM_VOL)) {
+            if (hasl) dirhash_insert(h, fileobj->index);
+            dirhash_insert(dirhash_sfn(dptr), fileobj->index);
+            if (is_alias(dptr)) dirhash_alias = TRUE;
+          }
+#endif
           if (lfn) {
             if(lfn && (match && l == *len)) { /* match */
                 memcpy(fn,&dptr[DIR_Name], 8+3);
@@ -721,14 +952,39 @@ FRESULT trace_path (     /* FR_OK(0): successful, !=0: error code */
           && !memcmp(&dptr[DIR_Name], fn, 8+3) ) {
         break;
       }
+#endif
+#if _USE_DIRHASH
+      if (hinted && store) goto rescan;           /* The hinted name does not match */
 #endif
       if (!next_dir_entry(dj)) {                  /* Next directory pointer */
+#if _USE_DIRHASH
+        if (hinted) goto rescan;
+        if (hashing && sidx == 0) dirhash_complete = TRUE;
+#endif
 #if _USE_LFN != 0
         if (!lfn)
           *len = 0;
 #endif
         return !ds ? FR_NO_FILE : FR_NO_PATH;
       }
+#if _USE_DIRHASH
+      continue;
+    rescan:                                       /* Try the next hint or scan everything */
+      store = TRUE;
+      match = TRUE;
+      l = 0;
+      hinted = dirhash_seek(dj);
+      if (!hinted) {
+        if (dirhash_complete && dirhash_gap) {    /* Not in the table, no need to scan */
+          if (!lfn)
+            *len = 0;
+          return !ds ? FR_NO_FILE : FR_NO_PATH;
+        }
+        dj->clust = dj->sclust;
+        dj->sect = ssect;
+        dj->index = sidx;
+      }
+#endif
     }
     if (!ds) { *dir = dptr; return FR_OK; }             /* Matched with end of path */
     if (!(dptr[DIR_Attr] & AM_DIR)) return FR_NO_PATH;  /* Cannot trace because it is a file */
@@ -768,6 +1024,8 @@ FRESULT reserve_direntry (  /* FR_OK: successful, FR_DENIED: no free entry, FR_R
 
   len=(len+25)/13;
 #endif
+  dirhash_clear();      /* Entries are added to the directory */
+
   /* Re-initialize directory object */
   clust = dj->sclust;
   if (clust != 0) {     /* Dynamic directory table */
@@ -889,6 +1147,7 @@ FRESULT mount_drv(
   DWORD bootsect, fatsize, totalsect, maxclust;
 
   memset(fs, 0, sizeof(FATFS));       /* Clean-up the file system object */
+  dirhash_clear();
   fs->drive = LD2PD(drv);             /* Bind the logical drive and a physical drive */
   stat = disk_initialize(fs->drive);  /* Initialize low level disk I/O layer */
   if (stat & STA_NOINIT)              /* Check if the drive is ready */
@@ -1512,6 +1771,9 @@ FRESULT f_open (
   fp->fptr = 0;                                     /* Initialize file pointer */
   fp->csect = 1;                                    /* Sector counter */
   fp->fs = fs; //fp->id = fs->id;       /* Owner file system object of the file */
+#if _USE_FASTSEEK
+  fp->map = NULL;                                   /* No cluster run map yet */
+#endif
 
 #if !_FS_READONLY
   if (mode & (FA_CREATE_ALWAYS|FA_OPEN_ALWAYS|FA_CREATE_NEW))
@@ -1533,12 +1795,296 @@ FRESULT l_opencluster (
   fp->fptr = 0;
   fp->csect = 1;
   fp->fs = fs;
+#if _USE_FASTSEEK
+  fp->map = NULL;
+#endif
 
   return FR_OK;
 }
 
 
 
+/*-----------------------------------------------------------------------*/
+/* Get the first sector of a contiguously stored file                    */
+/*-----------------------------------------------------------------------*/
+
+DWORD l_getlba (        /* First sector of the file, 0 if it is fragmented or empty */
+  FIL *fp               /* Pointer to the open file object */
+)
+{
+  DWORD clust, next, sect, count;
+  FATFS *fs = fp->fs;
+
+
+  if (validate(fs /*, fp->id*/) != FR_OK) return 0;
+
+  clust = fp->org_clust;
+  if (clust < 2 || fp->fsize == 0) return 0;
+
+  count = (fp->fsize - 1) / ((DWORD)fs->csize * SS(fs));
+  while (count--) {
+    next = get_cluster(fs, clust);
+    if (next != clust + 1) return 0;        /* Fragmented or broken chain */
+    clust = next;
+  }
+
+  /* The caller will bypass the window, make sure it holds no file data */
+  sect = clust2sect(fs, fp->org_clust);
+  if (FPBUF.sect >= sect && FPBUF.sect < clust2sect(fs, clust) + fs->csize
+#if _USE_1_BUF != 0
+      && FPBUF.fs == fs
+#endif
+     ) {
+    if (!move_fp_window(fp, 0)) return 0;
+    FPBUF.sect = 0;
+  }
+
+  return sect;
+}
+
+
+
+#if _USE_FASTSEEK
+/*-----------------------------------------------------------------------*/
+/* Build the cluster run map of a file                                   */
+/*-----------------------------------------------------------------------*/
+
+FRESULT l_mkmap (
+  FIL *fp,             /* Pointer to the open file object */
+  CLMAP *map           /* Pointer to the map to be filled */
+)
+{
+  FRESULT res;
+  DWORD clust;
+  WORD idx;
+  CLRUN *run = NULL;
+  FATFS *fs = fp->fs;
+
+
+  res = validate(fs /*, fp->id*/);          /* Check validity of the object */
+  if (res != FR_OK) return res;
+
+  fp->map = NULL;
+  map->runs = 0;
+  map->end = 0;
+  clust = fp->org_clust;
+  if (clust == 0) return FR_OK;             /* No cluster chain yet */
+
+  for (idx = 0; idx != 0xFFFF; idx++) {
+    if (clust < 2 || clust >= fs->max_clust)
+      return FR_RW_ERROR;
+    if (!run || clust != run->clust + (idx - run->idx)) {
+      if (map->runs >= _FASTSEEK_RUNS) break;   /* Map is full, leave the rest to the chain */
+      run = &map->run[map->runs++];         /* Start a new run */
+      run->idx = idx;
+      run->clust = clust;
+    }
+    map->end = idx + 1;
+    clust = get_cluster(fs, clust);
+    if (clust >= fs->max_clust) break;      /* End of the chain */
+  }
+
+  fp->map = map;
+  return FR_OK;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Look up a cluster in the cluster run map                              */
+/*-----------------------------------------------------------------------*/
+
+static
+DWORD map_cluster (     /* Cluster number */
+  const CLMAP *map,     /* Pointer to the cluster run map */
+  WORD idx              /* Cluster index in the file, must be < map->end */
+)
+{
+  BYTE lo = 0, hi = map->runs - 1, mid;
+
+
+  while (lo < hi) {                         /* Find the last run starting at or before idx */
+    mid = (lo + hi + 1) / 2;
+    if (map->run[mid].idx <= idx)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+  return map->run[lo].clust + (idx - map->run[lo].idx);
+}
+#endif /* _USE_FASTSEEK */
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Get the cluster that follows a cluster of a file                      */
+/*-----------------------------------------------------------------------*/
+
+static
+DWORD next_cluster (    /* 0,>=2: successful, 1: failed */
+  FIL *fp,              /* Pointer to the file object */
+  DWORD clust,          /* Cluster number */
+  DWORD idx             /* Index of the following cluster in the file */
+)
+{
+#if _USE_FASTSEEK
+  if (fp->map && idx < fp->map->end)        /* Skip the FAT if the map knows it */
+    return map_cluster(fp->map, (WORD)idx);
+#endif
+  return get_cluster(fp->fs, clust);
+}
+
+
+
+#if _USE_RESERVE && !_FS_READONLY
+/*-----------------------------------------------------------------------*/
+/* Reserve a contiguous cluster run behind the file pointer              */
+/*-----------------------------------------------------------------------*/
+
+DWORD l_reserve (       /* End of the allocated clusters in bytes, 0 if failed */
+  FIL *fp,              /* Pointer to the file object */
+  DWORD btr             /* Number of bytes needed behind the file pointer */
+)
+{
+  DWORD clust, next, end, need, ncl, scl, first, cnt, n, csz, left;
+  FATFS *fs = fp->fs;
+
+
+  if (validate(fs /*, fp->id*/) != FR_OK) return 0;
+  if ((fp->flag & (FA__ERROR | FA_WRITE)) != FA_WRITE) return 0;
+
+  csz = (DWORD)fs->csize * SS(fs);
+  need = fp->fptr + btr;
+
+  /* Find the end of the existing chain */
+  end = 0;
+  clust = fp->org_clust;
+  if (clust) {
+    if (fp->fptr) {                         /* Start at the current cluster */
+      clust = fp->curr_clust;
+      end = (fp->fptr - 1) / csz * csz;
+    }
+    for (;;) {
+      end += csz;
+      next = get_cluster(fs, clust);
+      if (next < 2) return 0;               /* Broken chain or error */
+      if (next >= fs->max_clust) break;     /* End of the chain */
+      clust = next;
+    }
+  }
+  if (end >= need) return end;              /* Already allocated */
+
+  n = (need - end + csz - 1) / csz;
+  if (fs->free_clust != 0xFFFFFFFF && fs->free_clust < n) return 0;
+
+  /* Look for n free clusters in a row, preferably right behind the chain */
+  scl = clust ? clust : fs->last_clust;
+  if (scl == 0 || scl >= fs->max_clust) scl = 1;
+  ncl = scl;
+  first = cnt = 0;
+  left = _RESERVE_SCAN;                     /* Don't read the whole FAT */
+  for (;;) {
+    ncl++;
+    if (ncl >= fs->max_clust) {             /* Wrap around, a run can't */
+      ncl = 2;
+      cnt = 0;
+      if (ncl > scl) return 0;
+    }
+    next = get_cluster(fs, ncl);
+    if (next == 1) return 0;                /* Any error occured */
+    if (next == 0) {
+      if (cnt++ == 0) first = ncl;
+      if (cnt == n) break;                  /* Found a large enough run */
+    } else {
+      cnt = 0;
+    }
+    if (ncl == scl || --left == 0) return 0; /* No run found */
+  }
+
+  /* Chain the run and append it to the file */
+  for (ncl = first; ncl < first + n - 1; ncl++)
+    if (!put_cluster(fs, ncl, ncl + 1)) goto fr_error;
+  if (!put_cluster(fs, ncl, 0x0FFFFFFF)) goto fr_error;
+  if (clust) {
+    if (!put_cluster(fs, clust, first)) goto fr_error;
+  } else {
+    fp->org_clust = first;
+  }
+
+  fs->last_clust = ncl;                     /* Update fsinfo */
+  if (fs->free_clust != 0xFFFFFFFF) {
+    fs->free_clust -= n;
+#if _USE_FSINFO
+    fs->fsi_flag = 1;
+#endif
+  }
+  fp->flag |= FA__WRITTEN;
+
+  return end + n * csz;
+
+fr_error: /* Abort this file due to an unrecoverable error */
+  fp->flag |= FA__ERROR;
+  return 0;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Release the clusters behind the end of a file                         */
+/*-----------------------------------------------------------------------*/
+
+FRESULT l_trim (
+  FIL *fp       /* Pointer to the file object */
+)
+{
+  FRESULT res;
+  DWORD clust, next, cnt;
+  FATFS *fs = fp->fs;
+
+
+  res = validate(fs /*, fp->id*/);          /* Check validity of the object */
+  if (res != FR_OK) return res;
+  if (fp->flag & FA__ERROR) return FR_RW_ERROR; /* Check error flag */
+  if (!(fp->flag & FA_WRITE)) return FR_DENIED; /* Check access mode */
+
+  if (fp->fsize == 0) {                     /* Remove the entire chain */
+    if (fp->org_clust) {
+      if (!remove_chain(fs, fp->org_clust)) goto ft_error;
+      fp->org_clust = 0;
+      fp->flag |= FA__WRITTEN;
+    }
+    return FR_OK;
+  }
+
+  /* Find the cluster that holds the last byte of the file */
+  if (fp->fptr == fp->fsize) {
+    clust = fp->curr_clust;
+  } else {
+    clust = fp->org_clust;
+    cnt = (fp->fsize - 1) / ((DWORD)fs->csize * SS(fs));
+    while (cnt--) {
+      clust = get_cluster(fs, clust);
+      if (clust < 2 || clust >= fs->max_clust) goto ft_error;
+    }
+  }
+
+  next = get_cluster(fs, clust);
+  if (next < 2) goto ft_error;
+  if (next < fs->max_clust) {               /* Cut the chain behind it */
+    if (!put_cluster(fs, clust, 0x0FFFFFFF)) goto ft_error;
+    if (!remove_chain(fs, next)) goto ft_error;
+  }
+
+  return FR_OK;
+
+ft_error: /* Abort this file due to an unrecoverable error */
+  fp->flag |= FA__ERROR;
+  return FR_RW_ERROR;
+}
+#endif /* _USE_RESERVE */
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Read File                                                             */
 /*-----------------------------------------------------------------------*/
@@ -1551,7 +2097,7 @@ FRESULT f_read (
 )
 {
   FRESULT res;
-  DWORD clust, sect, remain;
+  DWORD clust, sect, remain, csz, idx;
   UINT rcnt, cc;
   BYTE *rbuff = buff;
   FATFS *fs = fp->fs;
@@ -1564,6 +2110,7 @@ FRESULT f_read (
   if (!(fp->flag & FA_READ)) return FR_DENIED;  /* Check access mode */
   remain = fp->fsize - fp->fptr;
   if (btr > remain) btr = (UINT)remain;         /* Truncate read count by number of bytes left */
+  csz = (DWORD)fs->csize * SS(fs);
 
   for ( ;  btr;                                 /* Repeat until all data transferred */
     rbuff += rcnt, fp->fptr += rcnt, *br += rcnt, btr -= rcnt) {
@@ -1572,7 +2119,7 @@ FRESULT f_read (
         sect = fp->curr_sect + 1;               /* Get current sector */
       } else {                                  /* On the cluster boundary, get next cluster */
         clust = (fp->fptr == 0) ?
-          fp->org_clust : get_cluster(fs, fp->curr_clust);
+          fp->org_clust : next_cluster(fp, fp->curr_clust, fp->fptr / csz);
         if (clust < 2 || clust >= fs->max_clust)
           goto fr_error;
         fp->curr_clust = clust;                 /* Current cluster */
@@ -1585,10 +2132,18 @@ FRESULT f_read (
       fp->curr_sect = sect;           /* Update current sector */
       cc = btr / SS(fs);              /* When left bytes >= SS(fs), */
       if (cc) {                       /* Read maximum contiguous sectors directly */
-        if (cc > fp->csect) cc = fp->csect;
+        remain = fp->csect;           /* Sectors available in this run */
+        idx = fp->fptr / csz;         /* Index of the current cluster */
+        while (remain < cc && remain + fs->csize <= 255) {
+          clust = next_cluster(fp, fp->curr_clust, ++idx);
+          if (clust != fp->curr_clust + 1) break; /* Run ends at a fragment */
+          fp->curr_clust = clust;
+          remain += fs->csize;
+        }
+        if (cc > remain) cc = (UINT)remain;
         if (disk_read(fs->drive, rbuff, sect, (BYTE)cc) != RES_OK)
           goto fr_error;
-        fp->csect -= (BYTE)(cc - 1);
+        fp->csect = (BYTE)(remain - cc + 1);
         fp->curr_sect += cc - 1;
         rcnt = cc * SS(fs);
         continue;
@@ -1625,7 +2180,7 @@ FRESULT f_write (
 )
 {
   FRESULT res;
-  DWORD clust, sect;
+  DWORD clust, sect, remain;
   UINT wcnt, cc;
   const BYTE *wbuff = buff;
   FATFS *fs = fp->fs;
@@ -1661,10 +2216,23 @@ FRESULT f_write (
       fp->curr_sect = sect;                       /* Update current sector */
       cc = btw / SS(fs);                          /* When left bytes >= SS(fs), */
       if (cc) {                                   /* Write maximum contiguous sectors directly */
-        if (cc > fp->csect) cc = fp->csect;
+        remain = fp->csect;                       /* Sectors available in this run */
+        while (remain < cc && remain + fs->csize <= 255) {
+          clust = create_chain(fs, fp->curr_clust);  /* Trace or stretch, stop at a fragment */
+          if (clust != fp->curr_clust + 1) break;
+          fp->curr_clust = clust;
+          remain += fs->csize;
+        }
+        if (cc > remain) cc = (UINT)remain;
         if (disk_write(fs->drive, wbuff, sect, (BYTE)cc) != RES_OK)
           goto fw_error;
-        fp->csect -= (BYTE)(cc - 1);
+        if (FPBUF.sect - sect < cc            /* Window holds an overwritten sector */
+#if _USE_1_BUF != 0
+            && FPBUF.fs == fs
+#endif
+           )
+          FPBUF.sect = 0;
+        fp->csect = (BYTE)(remain - cc + 1);
         fp->curr_sect += cc - 1;
         wcnt = cc * SS(fs);
         continue;
@@ -1798,6 +2366,15 @@ FRESULT f_lseek (
     } else {
       fp->csect = 1;
 
+#if _USE_FASTSEEK
+      if (fp->map && (ofs - 1) / csize < fp->map->end) {
+        /* Target cluster is covered by the run map, no need to follow the chain */
+        clust = (ofs - 1) / csize;
+        fp->curr_clust = map_cluster(fp->map, (WORD)clust);
+        fp->fptr = ofs;
+        ofs -= clust * csize;
+      } else {
+#endif
       if(fp->fptr && ofs > fp->fptr) {
         fp->fptr = (((DWORD)((fp->fptr-1)/csize))*csize);  /* Set file R/W pointer to start of cluster */
         ofs-=fp->fptr;            /* subtract off clusters traversed */
@@ -1833,6 +2410,9 @@ FRESULT f_lseek (
         }
         fp->fptr += ofs;                            /* Update file R/W pointer */
       }
+#if _USE_FASTSEEK
+      }
+#endif
     }
     csect = (CHAR)((ofs - 1) / SS(fs));         /* Sector offset in the cluster */
     fp->curr_sect = clust2sect(fs, fp->curr_clust) + csect;  /* Current sector */
@@ -1957,6 +2537,66 @@ FRESULT l_opendir(FATFS* fs, DWORD cluster, DIR *dj) {
 
 
 
+#if _USE_DIRHASH
+/**
+ * l_seekname - move a directory object to a name
+ * @dj  : Pointer to a DIR structure set up by l_opendir
+ * @name: Name of a file or directory in it, without a path
+ *
+ * This function looks up name in the directory of dj like f_stat does,
+ * using the directory hash, and moves dj to the first entry (LFN or SFN)
+ * of the name so the next f_readdir returns it. Returns FR_OK if
+ * successful, FR_NO_FILE if the name does not exist or another error
+ * code if the lookup failed.
+ */
+FRESULT l_seekname(DIR *dj, const UCHAR *name) {
+  FATFS *fs = dj->fs;
+  FRESULT res;
+  DIR sj, fileobj;
+  BYTE *dir;
+  UCHAR fn[8+3+1];
+  const UCHAR *spath, *p;
+  UINT len;
+  DWORD cdir;
+
+  res = validate(fs /*, dj->id*/);
+  if (res != FR_OK) return res;
+  for (p = name; *p; p++)
+    if (*p == '/') return FR_INVALID_NAME;
+
+  cdir = fs->curr_dir;                    /* Trace relative to the directory of dj */
+  fs->curr_dir = dj->sclust;
+  sj.fs = fs;
+  res = trace_path(&sj, fn, name, &dir, &fileobj, &spath, &len);
+  fs->curr_dir = cdir;
+  if (res != FR_OK) return res;
+  if (!dir) return FR_NO_FILE;
+
+  dj->clust = fileobj.clust;
+  dj->sect  = fileobj.sect;
+  dj->index = fileobj.index;
+  return FR_OK;
+}
+
+/**
+ * l_hasalias - check if a directory may list files under other names
+ * @dj: Pointer to the DIR structure passed to l_seekname
+ *
+ * This function returns FALSE if the directory of dj has been hashed
+ * completely and none of its names has non-ASCII characters or a short
+ * name extension made of P, S, U or R and two digits, which sd2iec
+ * lists under the name in the P00 header. Names that do not exist then
+ * can't appear in a listing either. It returns TRUE otherwise, also when
+ * the directory has not been scanned to its end yet.
+ */
+BOOL l_hasalias(DIR *dj) {
+  return !(dirhash_fs == dj->fs && dirhash_clust == dj->sclust &&
+           dirhash_complete && !dirhash_alias);
+}
+#endif
+
+
+
 
 
 /*-----------------------------------------------------------------------*/
@@ -2322,6 +2962,7 @@ FRESULT f_unlink (
   dir[DIR_Name] = 0xE5;
   FSBUF.dirty = TRUE;
 #endif
+  dirhash_clear();
   if (!remove_chain(fs, dclust)) return FR_RW_ERROR;  /* Remove the cluster chain */
 
   return sync(fs);
@@ -2661,6 +3302,7 @@ FRESULT f_rename (
   if (!move_fs_window(fs, sect_old)) return FR_RW_ERROR;          /* Remove old entry */
   dir_old[DIR_Name] = 0xE5;
 #endif
+  dirhash_clear();
 
   return sync(fs);
 }
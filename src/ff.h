@@ -112,6 +112,42 @@
 #define _USE_TRUNCATE 0
 #define _USE_UTIME   0
 
+/* When CONFIG_IMAGE_RUNS is set, a file object can be given a map of its
+/  cluster runs (see l_mkmap) so f_lseek and f_read do not need to follow
+/  the FAT chain. _FASTSEEK_RUNS is the number of runs a map can hold. */
+#ifdef CONFIG_IMAGE_RUNS
+#  define _USE_FASTSEEK  1
+#  define _FASTSEEK_RUNS CONFIG_IMAGE_RUNS
+#else
+#  define _USE_FASTSEEK  0
+#endif
+
+/* When CONFIG_FAT_RESERVE is set, l_reserve allocates a contiguous run of
+/  clusters for the data that will be written to a file and l_trim releases
+/  the clusters left unused at the end. The search for a free run looks
+/  at no more than _RESERVE_SCAN FAT entries, the file grows one cluster
+/  at a time when none is found there. */
+#ifdef CONFIG_FAT_RESERVE
+#  define _USE_RESERVE   1
+#  define _RESERVE_SCAN  4096
+#else
+#  define _USE_RESERVE   0
+#endif
+
+/* When CONFIG_FAT_DIRHASH is set, trace_path remembers where the names of
+/  the directory searched last start, in a table of that many slots indexed
+/  by a hash of the name (a power of two). A slot is only a hint, names are
+/  still compared and a full scan is done when it does not match. */
+#ifdef CONFIG_FAT_DIRHASH
+#  define _USE_DIRHASH   1
+#  define _DIRHASH_SLOTS CONFIG_FAT_DIRHASH
+#  if _USE_LFN == 0
+#    error "CONFIG_FAT_DIRHASH needs _USE_LFN"
+#  endif
+#else
+#  define _USE_DIRHASH   0
+#endif
+
 #include "integer.h"
 
 #if _USE_LFN_DBCS != 0
@@ -189,6 +225,21 @@ typedef struct _DIR {
 } DIR;
 
 
+#if _USE_FASTSEEK
+/* Cluster run map structure */
+typedef struct _CLRUN {
+    WORD    idx;            /* Index of the first cluster of the run in the file */
+    DWORD   clust;          /* First cluster of the run */
+} CLRUN;
+
+typedef struct _CLMAP {
+    BYTE    runs;           /* Number of valid runs */
+    WORD    end;            /* Index of the first cluster not covered by the map */
+    CLRUN   run[_FASTSEEK_RUNS];
+} CLMAP;
+#endif
+
+
 /* File object structure */
 typedef struct _FIL {
   //WORD    id;             /* Owner file system mount ID */
@@ -204,6 +255,9 @@ typedef struct _FIL {
     DWORD   dir_sect;       /* Sector containing the directory entry */
     BYTE*   dir_ptr;        /* Ponter to the directory entry in the window */
 #endif
+#if _USE_FASTSEEK
+    CLMAP*  map;            /* Cluster run map, NULL if none */
+#endif
 #if _USE_LESS_BUF == 0 && _USE_1_BUF == 0
     BUF   buf;              /* File R/W buffer */
 #endif
@@ -314,7 +368,19 @@ FRESULT f_chdir (const UCHAR*);                             /* Change current di
 /* Low Level functions */
 FRESULT l_opendir(FATFS* fs, DWORD cluster, DIR *dirobj);   /* Open an existing directory by its start cluster */
 FRESULT l_opencluster(FATFS *fs, FIL *fp, DWORD clust);     /* Open a cluster by number as a read-only file */
+#if _USE_DIRHASH
+FRESULT l_seekname(DIR *dirobj, const UCHAR *name);         /* Move a directory object to a name */
+BOOL l_hasalias(DIR *dirobj);                               /* Check if a hashed directory may list other names */
+#endif
 FRESULT l_getfree (FATFS*, const UCHAR*, DWORD*, DWORD);    /* Get number of free clusters on the drive, limited */
+DWORD l_getlba (FIL*);                                      /* Get the first sector of a contiguous file */
+#if _USE_FASTSEEK
+FRESULT l_mkmap (FIL*, CLMAP*);                             /* Build the cluster run map of an open file */
+#endif
+#if _USE_RESERVE
+DWORD l_reserve (FIL*, DWORD);                              /* Allocate a contiguous cluster run for a file */
+FRESULT l_trim (FIL*);                                      /* Release the unused clusters of a file */
+#endif
 
 #if _USE_STRFUNC
 #define feof(fp) ((fp)->fptr == (fp)->fsize)
@@ -119,26 +119,36 @@ const PROGMEM uint8_t filetypes[] = {
 /* ------------------------------------------------------------------------- */
 
 /**
- * createentry - create a single directory entry in buf
- * @dent  : directory entry to be added
- * @buf   : buffer to be used
+ * entry_size - size of a directory entry
  * @format: entry format
  *
- * This function creates a directory entry for dent in the selected format
- * in the given buffer.
+ * This function returns the number of bytes used by a directory
+ * entry in the selected format.
  */
-static void createentry(cbmdirent_t *dent, buffer_t *buf, dirformat_t format) {
-  uint8_t i;
-  uint8_t *data = buf->data;
-
+static uint8_t entry_size(dirformat_t format) {
   if(format == DIR_FMT_CMD_LONG)
-    i=63;
+    return 64;
   else if(format == DIR_FMT_CMD_SHORT)
-    i=41;
+    return 42;
   else
-    i=31;
+    return 32;
+}
+
+/**
+ * createentry - create a single directory entry
+ * @dent  : directory entry to be added
+ * @data  : pointer to where the entry should be stored
+ * @format: entry format
+ *
+ * This function creates a directory entry for dent in the selected format
+ * at the given location. Returns the offset of the final byte of the
+ * entry, i.e. its length minus one.
+ */
+static uint8_t createentry(cbmdirent_t *dent, uint8_t *data, dirformat_t format) {
+  uint8_t i, last;
+
+  i = last = entry_size(format) - 1;
 
-  buf->lastused  = i;
   /* Clear the line */
   memset(data, ' ', i);
   /* Line end marker */
@@ -223,6 +233,8 @@ static void createentry(cbmdirent_t *dent, buffer_t *buf, dirformat_t format) {
     if (dent->typeflags & FLAG_HIDDEN)
       data[5] = 'H';
   }
+
+  return last;
 }
 
 /* ------------------------------------------------------------------------- */
@@ -231,24 +243,25 @@ static void createentry(cbmdirent_t *dent, buffer_t *buf, dirformat_t format) {
 
 /**
  * dir_footer - generate the directory footer
- * @buf: buffer to be used
+ * @buf   : buffer to be used
+ * @offset: offset in the buffer where the footer should be stored
  *
- * This is the final callback used during directory generation. It generates
- * the "BLOCKS FREE" message and indicates that this is the final buffer to
- * be sent. Always returns 0 for success.
+ * This function generates the "BLOCKS FREE" message at the end of the
+ * directory lines in the buffer and indicates that this is the final
+ * buffer to be sent. Always returns 0 for success.
  */
-static uint8_t dir_footer(buffer_t *buf) {
+static uint8_t dir_footer(buffer_t *buf, uint8_t offset) {
+  uint8_t *data = buf->data + offset;
   uint16_t blocks;
 
   /* Copy the "BLOCKS FREE" message */
-  memcpy_P(buf->data, dirfooter, sizeof(dirfooter));
+  memcpy_P(data, dirfooter, sizeof(dirfooter));
 
   blocks = disk_free(buf->pvt.dir.dh.part);
-  buf->data[2] = blocks & 0xff;
-  buf->data[3] = blocks >> 8;
+  data[2] = blocks & 0xff;
+  data[3] = blocks >> 8;
 
-  buf->position = 0;
-  buf->lastused = 31;
+  buf->lastused = offset + 31;
   buf->sendeoi  = 1;
 
   return 0;
@@ -285,7 +298,7 @@ static uint8_t pdir_refill(buffer_t* buf) {
         !match_name(buf->pvt.pdir.matchstr, &dent, 0))
       continue;
 
-    createentry(&dent, buf, DIR_FMT_CBM);
+    buf->lastused = createentry(&dent, buf->data, DIR_FMT_CBM);
     return 0;
   }
   buf->lastused = 1;
@@ -295,58 +308,62 @@ static uint8_t pdir_refill(buffer_t* buf) {
 }
 
 /**
- * dir_refill - generate the next directory entry
+ * dir_refill - generate the next directory entries
  * @buf: buffer to be used
  *
- * This function generates a single directory entry with the next matching
- * file. If there is no more matching file the footer will be generated
- * instead. Used as a callback during directory generation.
+ * This function fills the buffer with as many directory entries of the
+ * next matching files as fit into it. If there are no more matching
+ * files, the footer is added after the entries. Used as a callback
+ * during directory generation.
  */
 static uint8_t dir_refill(buffer_t *buf) {
   cbmdirent_t dent;
+  uint16_t pos = 0;
+  uint8_t  linesize = entry_size(buf->pvt.dir.format);
 
   uart_putc('+');
 
   buf->position = 0;
 
-  if (buf->pvt.dir.counter) {
-    /* Redisplay image file as directory */
-    buf->pvt.dir.counter = 0;
-    memcpy(&dent, buf->data+256-sizeof(dent), sizeof(dent));
-    dent.typeflags = TYPE_DIR;
-    createentry(&dent, buf, buf->pvt.dir.format);
-    return 0;
-  }
-
-  switch (next_match(&buf->pvt.dir.dh,
-                     buf->pvt.dir.matchstr,
-                     buf->pvt.dir.match_start,
-                     buf->pvt.dir.match_end,
-                     buf->pvt.dir.filetype,
-                     &dent)) {
-  case 0:
-    if (image_as_dir != IMAGE_DIR_NORMAL &&
-        dent.opstype == OPSTYPE_FAT &&
-        check_imageext(dent.pvt.fat.realname) != IMG_UNKNOWN) {
-      if (image_as_dir == IMAGE_DIR_DIR) {
-        dent.typeflags = (dent.typeflags & 0xf0) | TYPE_DIR;
-      } else {
-        /* Prepare to redisplay image file as directory */
-        buf->pvt.dir.counter = 1;
-        /* Use the end of the buffer as temporary storage */
-        memcpy(buf->data+256-sizeof(dent), &dent, sizeof(dent));
+  /* keep room for two lines, an image file may be shown twice */
+  while (pos + 2 * linesize <= 256) {
+    switch (next_match(&buf->pvt.dir.dh,
+                       buf->pvt.dir.matchstr,
+                       buf->pvt.dir.match_start,
+                       buf->pvt.dir.match_end,
+                       buf->pvt.dir.filetype,
+                       &dent)) {
+    case 0:
+      if (image_as_dir != IMAGE_DIR_NORMAL &&
+          dent.opstype == OPSTYPE_FAT &&
+          check_imageext(dent.pvt.fat.realname) != IMG_UNKNOWN) {
+        if (image_as_dir == IMAGE_DIR_DIR) {
+          dent.typeflags = (dent.typeflags & 0xf0) | TYPE_DIR;
+        } else {
+          /* Show the image file normally and again as directory */
+          pos += createentry(&dent, buf->data + pos, buf->pvt.dir.format) + 1;
+          dent.typeflags = TYPE_DIR;
+        }
       }
-    }
-    createentry(&dent, buf, buf->pvt.dir.format);
-    return 0;
+      pos += createentry(&dent, buf->data + pos, buf->pvt.dir.format) + 1;
+      break;
 
-  case -1:
-    return dir_footer(buf);
+    case -1:
+      return dir_footer(buf, pos);
 
-  default:
-    free_buffer(buf);
-    return 1;
+    default:
+      if (pos)
+        /* send the entries created so far first */
+        goto done;
+
+      free_buffer(buf);
+      return 1;
+    }
   }
+
+ done:
+  buf->lastused = pos - 1;
+  return 0;
 }
 
 /**
@@ -0,0 +1,268 @@
+/* sd2iec - SD/MMC to Commodore serial bus interface/controller
+   Copyright (C) 2007-2017  Ingo Korb <ingo@akana.de>
+
+   Inspired by MMC2IEC by Lars Pontoppidan et al.
+
+   FAT filesystem access based on code from ChaN and Jim Brain, see ff.c|h.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License only.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+   iec-engine.c: Interrupt-driven sender for the standard IEC protocol
+
+   The talk handler queues the bytes of a buffer here and this code
+   sends them from timer interrupts, so the main loop is free to refill
+   the buffer while the bus transfer goes on. The timing is the same as
+   in iec_putc, every delay and every wait for a DATA edge ends in an
+   interrupt from the architecture code (engine_ll_*).
+
+*/
+
+#include "config.h"
+#include "atomic.h"
+#include "flags.h"
+#include "iec-bus.h"
+#include "iec-engine.h"
+
+#define RING_MASK (IEC_ENGINE_RING - 1)
+
+/* Steps of a byte transfer, numbers in comments refer to iec_putc */
+typedef enum {
+  ST_START,           // E916, sample DATA before releasing CLOCK
+  ST_READY,           // release CLOCK
+  ST_LISTENER_READY,  // E925, DATA was released
+  ST_EOI_ACK,         // E941, listener acknowledged the EOI
+  ST_CLOCK_LOW,       // E94B
+  ST_RELEASE,         // wait until DATA is released
+  ST_BITS,            // delay before the first bit
+  ST_BIT_CHECK,       // E95C
+  ST_BIT_DATA,
+  ST_BIT_CLOCK,
+  ST_BIT_HOLD,        // FEFB
+  ST_BIT_RELEASE,     // FEFE
+  ST_FRAME_ACK,       // listener pulls DATA after the byte
+  ST_SENT             // gap of up to 250us between two bytes
+} engine_state_t;
+
+volatile engine_status_t iec_engine_status;
+uint8_t iec_engine_owner = 0xff;
+
+static uint16_t ring[IEC_ENGINE_RING];
+static volatile uint8_t head, tail;
+
+static engine_state_t state;
+static uint16_t entry;
+static uint8_t  bit;
+static uint8_t  listener_early;
+
+/* ------------------------------------------------------------------------- */
+/*  Queue, main loop side                                                    */
+/* ------------------------------------------------------------------------- */
+
+/* Number of queued bytes including the one that is being sent */
+uint8_t iec_engine_queued(void) {
+  return (uint8_t)(head - tail);
+}
+
+/* Start sending the queue, interrupts must be disabled */
+static void engine_start(void) {
+  if (head == tail)
+    return;
+
+  iec_engine_status = ENGINE_SENDING;
+  state = ST_START;
+  engine_ll_start();
+  iec_engine_event();
+}
+
+/**
+ * iec_engine_put - queue one byte
+ * @entry: data byte, optionally with IEC_ENGINE_EOI
+ *
+ * This function adds a byte to the queue and starts the transfer if the
+ * engine was idle. The caller must make sure there is room in the queue.
+ */
+void iec_engine_put(uint16_t entry) {
+  ring[head & RING_MASK] = entry;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    head++;
+    if (iec_engine_status == ENGINE_IDLE)
+      engine_start();
+  }
+}
+
+/**
+ * iec_engine_unput - remove bytes from the end of the queue
+ * @count: number of bytes
+ *
+ * This function removes the most recently queued bytes again. It may
+ * only be called while the engine is stopped.
+ */
+void iec_engine_unput(uint8_t count) {
+  head -= count;
+}
+
+/**
+ * iec_engine_drop - discard the queued bytes of a channel
+ * @sa: secondary address, 15 to discard the bytes of any channel
+ *
+ * This function is called when a channel is opened or closed, bytes that
+ * were left over from an aborted transfer on it are no longer valid then.
+ */
+void iec_engine_drop(uint8_t sa) {
+  if (sa != 0x0f && sa != iec_engine_owner)
+    return;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    engine_ll_stop();
+    head = tail;
+    iec_engine_status = ENGINE_IDLE;
+    iec_engine_owner  = 0xff;
+  }
+}
+
+/* Restart sending after the engine was stopped */
+void iec_engine_resume(void) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    iec_engine_status = ENGINE_IDLE;
+    engine_start();
+  }
+}
+
+/* ATN interrupt: stop at once, the unsent bytes stay queued */
+void iec_engine_atn(void) {
+  if (iec_engine_status != ENGINE_SENDING)
+    return;
+
+  engine_ll_stop();
+  iec_engine_status = ENGINE_ATN;
+}
+
+/* ------------------------------------------------------------------------- */
+/*  Byte transfer, interrupt side                                            */
+/* ------------------------------------------------------------------------- */
+
+/* Run one step, returns nonzero if the next one can run immediately */
+static uint8_t engine_step(void) {
+  switch (state) {
+  case ST_START:
+    if (head == tail) {
+      iec_engine_status = ENGINE_IDLE;
+      return 0;
+    }
+    entry = ring[tail & RING_MASK];
+    bit   = 0;
+    listener_early = IEC_DATA;
+    state = ST_READY;
+    engine_ll_after(60); // Fudged delay
+    return 0;
+
+  case ST_READY:
+    set_clock(1);
+    state = ST_LISTENER_READY;
+    return engine_ll_data(1, 0);
+
+  case ST_LISTENER_READY:
+    if ((entry & IEC_ENGINE_EOI) || listener_early) {
+      state = ST_EOI_ACK;
+      return engine_ll_data(0, 0);
+    }
+    state = ST_CLOCK_LOW;
+    return 1;
+
+  case ST_EOI_ACK:
+    state = ST_CLOCK_LOW;
+    return 1;
+
+  case ST_CLOCK_LOW:
+    set_clock(0);
+    state = ST_RELEASE;
+    engine_ll_after(40); // estimated
+    return 0;
+
+  case ST_RELEASE:
+    state = ST_BITS;
+    return engine_ll_data(1, 0);
+
+  case ST_BITS:
+    state = ST_BIT_CHECK;
+    engine_ll_after(21); // calculated
+    return 0;
+
+  case ST_BIT_CHECK:
+    if (!IEC_DATA) {
+      engine_ll_stop();
+      iec_engine_status = ENGINE_CLEANUP;
+      return 0;
+    }
+    state = ST_BIT_DATA;
+    engine_ll_after(45); // calculated
+    return 0;
+
+  case ST_BIT_DATA:
+    set_data(entry & (1 << bit));
+    state = ST_BIT_CLOCK;
+    engine_ll_after(22); // calculated
+    return 0;
+
+  case ST_BIT_CLOCK:
+    set_clock(1);
+    state = ST_BIT_HOLD;
+    if (globalflags & VC20MODE)
+      engine_ll_after(34);
+    else
+      engine_ll_after(75);
+    return 0;
+
+  case ST_BIT_HOLD:
+    set_clock(0);
+    state = ST_BIT_RELEASE;
+    engine_ll_after(22); // calculated
+    return 0;
+
+  case ST_BIT_RELEASE:
+    set_data(1);
+    if (++bit < 8)
+      state = ST_BIT_CHECK;
+    else
+      state = ST_FRAME_ACK;
+    engine_ll_after(14); // Settle time, approximate
+    return 0;
+
+  case ST_FRAME_ACK:
+    state = ST_SENT;
+    return engine_ll_data(0, 0);
+
+  case ST_SENT:
+    /* The listener has the byte now */
+    tail++;
+    state = ST_START;
+    /* See iec_putc: wait for 250us or until DATA is high */
+    return engine_ll_data(1, 250);
+  }
+
+  return 0;
+}
+
+/**
+ * iec_engine_event - continue the transfer
+ *
+ * This function is called by the architecture code when the delay or
+ * the DATA edge requested by the last step has happened. It runs as
+ * many steps as possible until the next one has to wait.
+ */
+void iec_engine_event(void) {
+  while (iec_engine_status == ENGINE_SENDING && engine_step()) ;
+}
@@ -0,0 +1,70 @@
+/* sd2iec - SD/MMC to Commodore serial bus interface/controller
+   Copyright (C) 2007-2017  Ingo Korb <ingo@akana.de>
+
+   Inspired by MMC2IEC by Lars Pontoppidan et al.
+
+   FAT filesystem access based on code from ChaN and Jim Brain, see ff.c|h.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License only.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+   iec-engine.h: Interrupt-driven sender for the standard IEC protocol
+
+*/
+
+#ifndef IEC_ENGINE_H
+#define IEC_ENGINE_H
+
+#ifdef CONFIG_IEC_ENGINE
+
+/* Number of queued bytes, must be a power of two below 256 */
+#define IEC_ENGINE_RING 32
+
+/* Flag in a queue entry: send this byte with EOI */
+#define IEC_ENGINE_EOI  0x100
+
+typedef enum {
+  ENGINE_IDLE,     /* queue is empty, nothing to send        */
+  ENGINE_SENDING,  /* interrupts are sending the queue       */
+  ENGINE_ATN,      /* stopped by ATN, queue kept             */
+  ENGINE_CLEANUP   /* stopped by a listener error, queue kept */
+} engine_status_t;
+
+extern volatile engine_status_t iec_engine_status;
+
+/* Secondary address the queued bytes belong to, 0xff if none */
+extern uint8_t iec_engine_owner;
+
+uint8_t iec_engine_queued(void);
+void    iec_engine_put(uint16_t entry);
+void    iec_engine_unput(uint8_t count);
+void    iec_engine_drop(uint8_t sa);
+void    iec_engine_resume(void);
+void    iec_engine_atn(void);
+void    iec_engine_event(void);
+
+/* Timing and line events, implemented by the architecture */
+void    engine_ll_start(void);
+void    engine_ll_after(unsigned int us);
+uint8_t engine_ll_data(uint8_t state, unsigned int timeout);
+void    engine_ll_stop(void);
+
+#else
+
+#  define iec_engine_drop(sa) do {} while (0)
+#  define iec_engine_atn()    do {} while (0)
+
+#endif
+
+#endif
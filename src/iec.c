@@ -47,7 +47,9 @@
 #include "fileops.h"
 #include "filesystem.h"
 #include "iec-bus.h"
+#include "iec-engine.h"
 #include "led.h"
+#include "perfcount.h"
 #include "system.h"
 #include "timer.h"
 #include "uart.h"
@@ -98,6 +100,7 @@ uint8_t iec_check_atn(void) {
 IEC_ATN_HANDLER {
   if (!IEC_ATN) {
     set_data(0);
+    iec_engine_atn();
   }
 }
 #endif
@@ -300,6 +303,107 @@ static uint8_t iec_putc(uint8_t data, const uint8_t with_eoi) {
 }
 
 
+#ifdef CONFIG_IEC_ENGINE
+/**
+ * engine_wait - wait until the engine has sent enough bytes
+ * @level: maximum number of bytes that may still be queued
+ *
+ * This function waits until at most level bytes are left in the queue
+ * of the interrupt-driven sender. Returns 0 normally or -1 if the
+ * transfer was aborted, the bus state has been changed in that case.
+ */
+static int8_t engine_wait(uint8_t level) {
+  while (iec_engine_queued() > level) {
+    if (iec_engine_status == ENGINE_CLEANUP) {
+      iec_data.bus_state = BUS_CLEANUP;
+      return -1;
+    }
+    if (iec_check_atn()) {
+      iec_engine_atn();
+      return -1;
+    }
+    system_sleep();
+  }
+  return 0;
+}
+
+/**
+ * iec_talk_engine - send a buffer with the interrupt-driven sender
+ * @cmd: command byte received from the bus
+ * @buf: buffer to send
+ *
+ * This function is the standard protocol part of iec_talk_handler for
+ * normal files. The buffer is queued for iec-engine.c, which sends it
+ * from interrupts while this function refills the buffer. If the
+ * transfer is aborted, the unsent bytes of the current buffer contents
+ * are returned to the buffer. Unsent bytes from before the last refill
+ * stay queued and are sent first on the next TALK for the channel.
+ */
+static uint8_t iec_talk_engine(uint8_t cmd, buffer_t *buf) {
+  uint8_t fresh = 0; /* bytes queued since the last refill */
+  uint8_t unsent;
+
+  iec_engine_owner = cmd & 0x0f;
+  iec_engine_resume();
+
+  while (buf->read) {
+    perf_bus_begin(buf->position);
+    do {
+      uint16_t entry = buf->data[buf->position];
+
+      if (buf->position == buf->lastused && buf->sendeoi)
+        entry |= IEC_ENGINE_EOI;
+
+      if (engine_wait(IEC_ENGINE_RING - 1))
+        goto aborted;
+
+      iec_engine_put(entry);
+      fresh++;
+    } while (buf->position++ < buf->lastused);
+
+    if (buf->sendeoi) {
+      if (engine_wait(0))
+        goto aborted;
+
+      perf_bus_end(PERF_BUS_IEC, buf->lastused);
+      buf->read = 0;
+      break;
+    }
+
+    perf_bus_end(PERF_BUS_IEC, buf->lastused);
+
+    /* The queued bytes are sent while the buffer is refilled */
+    fresh = 0;
+    if (perf_refill(buf)) {
+      if (!engine_wait(0))
+        iec_data.bus_state = BUS_CLEANUP;
+      iec_engine_drop(cmd & 0x0f);
+      return 1;
+    }
+
+    /* Search the buffer again, it can change when using large buffers */
+    buf = find_buffer(cmd & 0x0f);
+  }
+
+  if (engine_wait(0))
+    goto aborted;
+
+  iec_engine_owner = 0xff;
+  return 0;
+
+ aborted:
+  unsent = iec_engine_queued();
+  if (unsent <= fresh) {
+    buf->position -= unsent;
+    iec_engine_drop(cmd & 0x0f);
+  } else {
+    buf->position -= fresh;
+    iec_engine_unput(fresh);
+  }
+  return 1;
+}
+#endif
+
 /* ------------------------------------------------------------------------- */
 /*  Listen+Talk-Handling                                                     */
 /* ------------------------------------------------------------------------- */
@@ -356,7 +460,7 @@ static uint8_t iec_listen_handler(const uint8_t cmd) {
     } else {
       /* Flush buffer if full */
       if (buf->mustflush) {
-        if (buf->refill(buf))
+        if (perf_refill(buf))
           return 1;
         /* Search the buffer again, it can change when using large buffers. */
         buf = find_buffer(cmd & 0x0f);
@@ -375,7 +479,7 @@ static uint8_t iec_listen_handler(const uint8_t cmd) {
 
       /* REL files must be syncronized on EOI */
       if(buf->recordlen && (iec_data.iecflags & EOI_RECVD))
-        if (buf->refill(buf))
+        if (perf_refill(buf))
           return 1;
     }
   }
@@ -396,6 +500,17 @@ static uint8_t iec_talk_handler(uint8_t cmd) {
   if (buf == NULL)
     return 0; /* 0 because we didn't change the state here */
 
+#ifdef CONFIG_IEC_ENGINE
+  /* Normal files use the interrupt-driven sender unless another */
+  /* channel still has unsent bytes queued there.                */
+  if (!(iec_data.iecflags & (JIFFY_ACTIVE | JIFFY_LOAD | DOLPHIN_ACTIVE)) &&
+      (cmd & 0x0f) != 0x0f &&
+      !buf->recordlen &&
+      buf->refill != directbuffer_refill &&
+      (iec_engine_owner == 0xff || iec_engine_owner == (cmd & 0x0f)))
+    return iec_talk_engine(cmd, buf);
+#endif
+
   if (iec_data.iecflags & JIFFY_ACTIVE)
     /* wait 360us (J1541 E781) to make sure the C64 is at fbb7/fb0c */
     delay_us(360);
@@ -419,6 +534,7 @@ static uint8_t iec_talk_handler(uint8_t cmd) {
   }
 
   while (buf->read) {
+    perf_bus_begin(buf->position);
     do {
       uint8_t finalbyte = (buf->position == buf->lastused);
       if (iec_data.iecflags & JIFFY_LOAD) {
@@ -481,6 +597,11 @@ static uint8_t iec_talk_handler(uint8_t cmd) {
       }
     } while (buf->position++ < buf->lastused);
 
+    perf_bus_end(iec_data.iecflags & DOLPHIN_ACTIVE ? PERF_BUS_DOLPHIN :
+                 iec_data.iecflags & (JIFFY_ACTIVE | JIFFY_LOAD) ?
+                   PERF_BUS_JIFFY : PERF_BUS_IEC,
+                 buf->lastused);
+
     if (buf->sendeoi &&
         (cmd & 0x0f) != 0x0f &&
         !buf->recordlen &&
@@ -489,7 +610,7 @@ static uint8_t iec_talk_handler(uint8_t cmd) {
       break;
     }
 
-    if (buf->refill(buf)) {
+    if (perf_refill(buf)) {
       iec_data.bus_state = BUS_CLEANUP;
       return 1;
     }
@@ -660,6 +781,7 @@ void iec_mainloop(void) {
         iec_data.secondary_address = cmd & 0x0f;
         /* 1571 handles close (0xe0-0xef) here, so we do that too. */
         if ((cmd & 0xf0) == 0xe0) {
+          iec_engine_drop(iec_data.secondary_address);
           if (cmd == 0xef) {
             /* Close all buffers if sec. 15 is closed */
             if (free_multiple_buffers(FMB_USER_CLEAN)) {
@@ -779,6 +901,7 @@ void iec_mainloop(void) {
         } else {
           /* Filename in command buffer */
           datacrc = 0xffff;
+          iec_engine_drop(iec_data.secondary_address);
           file_open(iec_data.secondary_address);
         }
         command_length = 0;
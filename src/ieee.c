@@ -43,6 +43,7 @@
 #include "fileops.h"
 #include "filesystem.h"
 #include "led.h"
+#include "perfcount.h"
 #include "ieee.h"
 #include "fastloader.h"
 #include "errormsg.h"
@@ -456,7 +457,7 @@ static int16_t ieee_listen_handler (uint8_t cmd)
     } else {
       /* Flush buffer if full */
       if (buf->mustflush) {
-        if (buf->refill(buf)) return -2;
+        if (perf_refill(buf)) return -2;
         /* Search the buffer again,                     */
         /* it can change when using large buffers       */
         buf = find_buffer(ieee_data.secondary_address);
@@ -473,7 +474,7 @@ static int16_t ieee_listen_handler (uint8_t cmd)
 
       /* REL files must be syncronized on EOI */
       if(buf->recordlen && (ieee_data.ieeeflags & EOI_RECVD)) {
-        if (buf->refill(buf)) return -2;
+        if (perf_refill(buf)) return -2;
       }
     }   /* else-buffer */
   }     /* for(;;) */
@@ -490,6 +491,7 @@ static uint8_t ieee_talk_handler (void)
   if(buf == NULL) return -1;
 
   while (buf->read) {
+    perf_bus_begin(buf->position);
     do {
       finalbyte = (buf->position == buf->lastused);
       c = buf->data[buf->position];
@@ -517,13 +519,15 @@ static uint8_t ieee_talk_handler (void)
       }
     } while (buf->position++ < buf->lastused);
 
+    perf_bus_end(PERF_BUS_IEEE, buf->lastused);
+
     if(buf->sendeoi && ieee_data.secondary_address != 0x0f &&
       !buf->recordlen && buf->refill != directbuffer_refill) {
       buf->read = 0;
       break;
     }
 
-    if (buf->refill(buf)) {
+    if (perf_refill(buf)) {
       return -1;
     }
 
@@ -138,3 +138,23 @@ void start_timeout(unsigned int usecs) {
 unsigned int has_timed_out(void) {
   return !BITBAND(TIMEOUT_TIMER->TCR, 0);
 }
+
+/**
+ * getmicros - return the current time in microseconds
+ *
+ * This function returns the time since timer_init in microseconds,
+ * calculated from the tick counter and the SysTick timer.
+ */
+uint32_t getmicros(void) {
+  uint32_t t, count;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    t     = ticks;
+    count = SysTick->LOAD - SysTick->VAL;
+    /* SysTick has wrapped, but its interrupt hasn't run yet */
+    if ((SCB->ICSR & SCB_ICSR_PENDSTSET_Msk) && count < SysTick->LOAD / 2)
+      t++;
+  }
+
+  return t * 10000 + count / (CONFIG_MCU_FREQ / 1000000);
+}
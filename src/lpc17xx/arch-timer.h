@@ -35,6 +35,9 @@ typedef int32_t stick_t;
 void delay_us(unsigned int time);
 void delay_ms(unsigned int time);
 
+/* Microseconds since timer_init */
+uint32_t getmicros(void);
+
 /* Timeout functions */
 // FIXME: Accurate enough as function?
 void start_timeout(unsigned int usecs);
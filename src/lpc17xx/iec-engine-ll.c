@@ -0,0 +1,145 @@
+/* sd2iec - SD/MMC to Commodore serial bus interface/controller
+   Copyright (C) 2007-2017  Ingo Korb <ingo@akana.de>
+
+   Inspired by MMC2IEC by Lars Pontoppidan et al.
+
+   FAT filesystem access based on code from ChaN and Jim Brain, see ff.c|h.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License only.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+   iec-engine-ll.c: Timer events for the interrupt-driven IEC sender
+
+   Built on the timer primitives of the low-level fastloaders: delays
+   are counted from llfl_reference_time and use the match register of
+   the SRQ output (llfl_set_srq_at), DATA edges use the capture input
+   of the DATA line (llfl_capture_data). Instead of polling the flags
+   like the fastloaders, the interrupts of both are enabled while an
+   event is pending. The match only releases SRQ, which is released
+   during the standard protocol anyway.
+
+*/
+
+#include "config.h"
+#include <arm/NXP/LPC17xx/LPC17xx.h>
+#include <arm/bits.h>
+#include "iec-bus.h"
+#include "iec-engine.h"
+#include "llfl-common.h"
+
+/* Timer ticks per microsecond */
+#define TICKS_US 10
+
+static uint8_t match_armed, data_armed;
+
+static void stop_match(void) {
+  BITBAND(IEC_MTIMER_SRQ->MCR, 3 * IEC_OPIN_SRQ) = 0;
+  IEC_MTIMER_SRQ->EMR &= ~(3 << (4 + IEC_OPIN_SRQ * 2));
+  IEC_MTIMER_SRQ->IR = BV(IEC_OPIN_SRQ);
+  match_armed = 0;
+}
+
+static void stop_data(void) {
+  IEC_TIMER_DATA->CCR &= ~(3 << (3 * IEC_CAPTURE_DATA));
+  IEC_TIMER_DATA->IR = BV(4 + IEC_CAPTURE_DATA);
+  data_armed = 0;
+}
+
+/* Request the match interrupt at the reference time */
+static void start_match(void) {
+  llfl_set_srq_at(0, 1, NO_WAIT);
+  BITBAND(IEC_MTIMER_SRQ->MCR, 3 * IEC_OPIN_SRQ) = 1;
+  match_armed = 1;
+
+  /* A match time that has already passed would only trigger after */
+  /* the timer wrapped around, move it to just after now instead.   */
+  if ((int32_t)(llfl_now() - llfl_reference_time) >= 0) {
+    llfl_reference_time = llfl_now() + TICKS_US;
+    llfl_set_srq_at(0, 1, NO_WAIT);
+  }
+}
+
+/* Use the current time as reference for the following delays */
+void engine_ll_start(void) {
+  llfl_reference_time = llfl_now();
+}
+
+/**
+ * engine_ll_after - request an event after a delay
+ * @us: delay in microseconds after the previous event
+ *
+ * The delay is counted from the time of the previous event instead of
+ * the time of the call, so interrupt latency does not add up over the
+ * bits of a byte.
+ */
+void engine_ll_after(unsigned int us) {
+  llfl_reference_time += us * TICKS_US;
+  start_match();
+}
+
+/**
+ * engine_ll_data - request an event when DATA has a certain level
+ * @state  : level to wait for (0 low, 1 high)
+ * @timeout: maximum waiting time in microseconds, 0 for none
+ *
+ * Returns 1 without requesting an event if DATA already has the
+ * requested level or 0 if the event will be sent later.
+ */
+uint8_t engine_ll_data(uint8_t state, unsigned int timeout) {
+  llfl_capture_data(state);
+  data_armed = 1;
+
+  /* The edge may have happened before the capture was enabled */
+  if (!IEC_DATA == !state) {
+    stop_data();
+    return 1;
+  }
+
+  if (timeout)
+    engine_ll_after(timeout);
+
+  return 0;
+}
+
+void engine_ll_stop(void) {
+  stop_match();
+  stop_data();
+}
+
+/* Match interrupt of the SRQ timer */
+void iec_engine_match_handler(void) {
+  if (!match_armed)
+    return;
+
+  stop_match();
+  if (data_armed)
+    /* timeout of a DATA wait */
+    stop_data();
+  iec_engine_event();
+}
+
+/* Capture interrupt of the DATA input */
+void iec_engine_data_handler(void) {
+  if (!data_armed)
+    return;
+
+  /* Both IEC timers run in step (see timer_init), so the capture */
+  /* time can be used as reference for the match timer.           */
+  llfl_captured_data();
+
+  stop_data();
+  if (match_armed)
+    stop_match();
+  iec_engine_event();
+}
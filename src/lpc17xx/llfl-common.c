@@ -154,13 +154,34 @@ void llfl_wait_clock(unsigned int state, llfl_atnabort_t atnabort) {
   IEC_TIMER_CLOCK->CCR = 0b100100;
 }
 
-/* llfl_wait_data - see llfl_wait_atn */
-void llfl_wait_data(unsigned int state, llfl_atnabort_t atnabort) {
+/**
+ * llfl_capture_data - start capturing the time of a DATA change
+ * @state: line level to capture the change to (0 low, 1 high)
+ *
+ * This function sets up the capture input of the DATA line and clears
+ * its interrupt flag, which is set when the line changes to the
+ * specified level. Also used by the interrupt-driven IEC sender.
+ */
+void llfl_capture_data(unsigned int state) {
   /* set up capture */
   BITBAND(IEC_TIMER_DATA->CCR, 3*IEC_CAPTURE_DATA + IEC_IN_COND_INV(!state)) = 1;
 
   /* clear interrupt flag */
   IEC_TIMER_DATA->IR = BV(4 + IEC_CAPTURE_DATA);
+}
+
+/* llfl_captured_data - use the captured DATA change as reference time */
+void llfl_captured_data(void) {
+  if (IEC_CAPTURE_DATA == 0) {
+    llfl_reference_time = IEC_TIMER_DATA->CR0;
+  } else {
+    llfl_reference_time = IEC_TIMER_DATA->CR1;
+  }
+}
+
+/* llfl_wait_data - see llfl_wait_atn */
+void llfl_wait_data(unsigned int state, llfl_atnabort_t atnabort) {
+  llfl_capture_data(state);
 
   /* wait until interrupt flag is set */
   while (!BITBAND(IEC_TIMER_DATA->IR, 4+IEC_CAPTURE_DATA))
@@ -172,11 +193,7 @@ void llfl_wait_data(unsigned int state, llfl_atnabort_t atnabort) {
     llfl_reference_time = IEC_TIMER_DATA->TC;
   } else {
     /* read event time */
-    if (IEC_CAPTURE_DATA == 0) {
-      llfl_reference_time = IEC_TIMER_DATA->CR0;
-    } else {
-      llfl_reference_time = IEC_TIMER_DATA->CR1;
-    }
+    llfl_captured_data();
   }
 
   /* reset capture mode */
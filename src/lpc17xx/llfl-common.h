@@ -45,6 +45,8 @@ void llfl_teardown(void);
 void llfl_wait_atn(unsigned int state);
 void llfl_wait_clock(unsigned int state, llfl_atnabort_t atnabort);
 void llfl_wait_data(unsigned int state, llfl_atnabort_t atnabort);
+void llfl_capture_data(unsigned int state);
+void llfl_captured_data(void);
 void llfl_set_clock_at(uint32_t time, unsigned int state, llfl_wait_t wait);
 void llfl_set_data_at(uint32_t time, unsigned int state, llfl_wait_t wait);
 void llfl_set_srq_at(uint32_t time, unsigned int state, llfl_wait_t wait);
@@ -108,9 +108,13 @@ void spi_tx_block(const void *ptr, unsigned int length) {
   }
 }
 
-void spi_rx_block(void *ptr, unsigned int length) {
-  uint8_t *data = (uint8_t *)ptr;
-  unsigned int txlen = length;
+/* Source of the dummy bytes clocked out while receiving via DMA, */
+/* kept in RAM because the GPDMA can't read from the flash */
+static uint32_t dummy_tx = 0xffffffff;
+
+void spi_rx_block_start(void *ptr, unsigned int length) {
+  /* Use word writes if the buffer allows it */
+  uint32_t width = (((length | (uint32_t)ptr) & 3) == 0) ? 2 : 0;
 
   /* Wait until SSP is not busy */
   while (BITBAND(SSP_REGS->SR, SSP_BSY)) ;
@@ -119,8 +123,100 @@ void spi_rx_block(void *ptr, unsigned int length) {
   while (BITBAND(SSP_REGS->SR, SSP_RNE))
     (void) SSP_REGS->DR;
 
+  /* Clear interrupt flags of DMA channels 0 and 1 */
+  LPC_GPDMA->DMACIntTCClear = BV(0) | BV(1);
+  LPC_GPDMA->DMACIntErrClr  = BV(0) | BV(1);
+
+  /* Set up RX DMA channel, it has the higher priority */
+  LPC_GPDMACH0->DMACCSrcAddr  = (uint32_t)&SSP_REGS->DR;
+  LPC_GPDMACH0->DMACCDestAddr = (uint32_t)ptr;
+  LPC_GPDMACH0->DMACCLLI      = 0; // no linked list
+  LPC_GPDMACH0->DMACCControl  = length
+    | (0 << 12)     // source burst size 1
+    | (0 << 15)     // destination burst size 1
+    | (0 << 18)     // source transfer width 1 byte
+    | (width << 21) // destination transfer width 1 or 4 bytes
+    | (0 << 26)     // source address not incremented
+    | (1 << 27)     // destination address incremented
+    ;
+  LPC_GPDMACH0->DMACCConfig = 1 // enable channel
+    | (SSP_DMAID_RX << 1) // data source SSP RX
+    | (2 << 11) // transfer from peripheral to memory
+    ;
+
+  /* Set up TX DMA channel for the dummy bytes */
+  LPC_GPDMACH1->DMACCSrcAddr  = (uint32_t)&dummy_tx;
+  LPC_GPDMACH1->DMACCDestAddr = (uint32_t)&SSP_REGS->DR;
+  LPC_GPDMACH1->DMACCLLI      = 0; // no linked list
+  LPC_GPDMACH1->DMACCControl  = length
+    | (0 << 12) // source burst size 1
+    | (0 << 15) // destination burst size 1
+    | (0 << 18) // source transfer width 1 byte
+    | (0 << 21) // destination transfer width 1 byte
+    | (0 << 26) // source address not incremented
+    | (0 << 27) // destination address not incremented
+    ;
+  LPC_GPDMACH1->DMACCConfig = 1 // enable channel
+    | (SSP_DMAID_TX << 6) // data destination SSP TX
+    | (1 << 11) // transfer from memory to peripheral
+    ;
+
+  /* Enable RX and TX FIFO DMA, starts the transfer */
+  SSP_REGS->DMACR = 3;
+}
+
+void spi_tx_block_start(const void *ptr, unsigned int length) {
+  /* Clear interrupt flags of DMA channel 1 */
+  LPC_GPDMA->DMACIntTCClear = BV(1);
+  LPC_GPDMA->DMACIntErrClr  = BV(1);
+
+  /* Set up TX DMA channel */
+  LPC_GPDMACH1->DMACCSrcAddr  = (uint32_t)ptr;
+  LPC_GPDMACH1->DMACCDestAddr = (uint32_t)&SSP_REGS->DR;
+  LPC_GPDMACH1->DMACCLLI      = 0; // no linked list
+  LPC_GPDMACH1->DMACCControl  = length
+    | (0 << 12) // source burst size 1
+    | (0 << 15) // destination burst size 1
+    | (0 << 18) // source transfer width 1 byte
+    | (0 << 21) // destination transfer width 1 byte
+    | (1 << 26) // source address incremented
+    | (0 << 27) // destination address not incremented
+    ;
+  LPC_GPDMACH1->DMACCConfig = 1 // enable channel
+    | (SSP_DMAID_TX << 6) // data destination SSP TX
+    | (1 << 11) // transfer from memory to peripheral
+    ;
+
+  /* Enable TX FIFO DMA, starts the transfer */
+  SSP_REGS->DMACR = 2;
+}
+
+uint8_t spi_block_busy(void) {
+  return (LPC_GPDMACH0->DMACCConfig | LPC_GPDMACH1->DMACCConfig) & 1;
+}
+
+void spi_block_wait(void) {
+  /* Wait until both DMA channels disable themselves */
+  while (spi_block_busy()) ;
+
+  /* Disable FIFO DMA */
+  SSP_REGS->DMACR = 0;
+}
+
+void spi_rx_block(void *ptr, unsigned int length) {
+  uint8_t *data = (uint8_t *)ptr;
+  unsigned int txlen = length;
+
   if ((length & 3) != 0 || ((uint32_t)ptr & 3) != 0) {
     /* Odd length or unaligned buffer */
+
+    /* Wait until SSP is not busy */
+    while (BITBAND(SSP_REGS->SR, SSP_BSY)) ;
+
+    /* Clear RX fifo */
+    while (BITBAND(SSP_REGS->SR, SSP_RNE))
+      (void) SSP_REGS->DR;
+
     while (length > 0) {
       /* Wait until TX or RX FIFO are ready */
       while (txlen > 0 && !BITBAND(SSP_REGS->SR, SSP_TNF) &&
@@ -139,43 +235,8 @@ void spi_rx_block(void *ptr, unsigned int length) {
       }
     }
   } else {
-    /* Clear interrupt flags of DMA channels 0 */
-    LPC_GPDMA->DMACIntTCClear = BV(0);
-    LPC_GPDMA->DMACIntErrClr  = BV(0);
-
-    /* Set up RX DMA channel */
-    LPC_GPDMACH0->DMACCSrcAddr  = (uint32_t)&SSP_REGS->DR;
-    LPC_GPDMACH0->DMACCDestAddr = (uint32_t)ptr;
-    LPC_GPDMACH0->DMACCLLI      = 0; // no linked list
-    LPC_GPDMACH0->DMACCControl  = length
-      | (0 << 12) // source burst size 1
-      | (0 << 15) // destination burst size 1
-      | (0 << 18) // source transfer width 1 byte
-      | (2 << 21) // destination transfer width 4 bytes
-      | (0 << 26) // source address not incremented
-      | (1 << 27) // destination address incremented
-      ;
-    LPC_GPDMACH0->DMACCConfig = 1 // enable channel
-      | (SSP_DMAID_RX << 1) // data source SSP RX
-      | (2 << 11) // transfer from peripheral to memory
-      ;
-
-    /* Enable RX FIFO DMA */
-    SSP_REGS->DMACR = 1;
-
-    /* Write <length> bytes into TX FIFO */
-    while (txlen > 0) {
-      while (txlen > 0 && BITBAND(SSP_REGS->SR, SSP_TNF)) {
-        txlen--;
-        SSP_REGS->DR = 0xff;
-      }
-    }
-
-    /* Wait until DMA channel disables itself */
-    while (LPC_GPDMACH0->DMACCConfig & 1) ;
-
-    /* Disable RX FIFO DMA */
-    SSP_REGS->DMACR = 0;
+    spi_rx_block_start(ptr, length);
+    spi_block_wait();
   }
 }
 
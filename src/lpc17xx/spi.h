@@ -53,6 +53,21 @@ uint8_t spi_rx_byte(void);
 /* Receive a data block */
 void spi_rx_block(void *data, unsigned int length);
 
+/* Block transfers can run in the background using DMA */
+#define HAVE_SPI_ASYNC
+
+/* Start receiving a data block, any length up to 4095 and alignment */
+void spi_rx_block_start(void *data, unsigned int length);
+
+/* Start transmitting a data block, up to 4095 bytes */
+void spi_tx_block_start(const void *data, unsigned int length);
+
+/* Check if a block transfer is still running */
+uint8_t spi_block_busy(void);
+
+/* Wait until the current block transfer has finished */
+void spi_block_wait(void);
+
 /* Switch speed of SPI interface */
 void spi_set_speed(spi_speed_t speed);
 
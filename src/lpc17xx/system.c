@@ -129,6 +129,10 @@ SD_CHANGE_HANDLER;
 PARALLEL_HANDLER;
 IEC_ATN_HANDLER;
 IEC_CLOCK_HANDLER;
+#ifdef CONFIG_IEC_ENGINE
+void iec_engine_match_handler(void);
+void iec_engine_data_handler(void);
+#endif
 
 /* timer interrupts, used to detect IEC pin changes */
 void IEC_TIMER_A_HANDLER(void) {
@@ -147,6 +151,22 @@ void IEC_TIMER_A_HANDLER(void) {
     }
   }
 #endif
+
+#ifdef CONFIG_IEC_ENGINE
+  if (IEC_TIMER_DATA == IEC_TIMER_A) {
+    if (BITBAND(IEC_TIMER_DATA->IR, 4 + IEC_CAPTURE_DATA)) {
+      IEC_TIMER_DATA->IR = 1 << (4 + IEC_CAPTURE_DATA);
+      iec_engine_data_handler();
+    }
+  }
+
+  if (IEC_MTIMER_SRQ == IEC_TIMER_A) {
+    if (BITBAND(IEC_MTIMER_SRQ->IR, IEC_OPIN_SRQ)) {
+      IEC_MTIMER_SRQ->IR = 1 << IEC_OPIN_SRQ;
+      iec_engine_match_handler();
+    }
+  }
+#endif
 }
 
 void IEC_TIMER_B_HANDLER(void) {
@@ -165,6 +185,22 @@ void IEC_TIMER_B_HANDLER(void) {
     }
   }
 #endif
+
+#ifdef CONFIG_IEC_ENGINE
+  if (IEC_TIMER_DATA == IEC_TIMER_B) {
+    if (BITBAND(IEC_TIMER_DATA->IR, 4 + IEC_CAPTURE_DATA)) {
+      IEC_TIMER_DATA->IR = 1 << (4 + IEC_CAPTURE_DATA);
+      iec_engine_data_handler();
+    }
+  }
+
+  if (IEC_MTIMER_SRQ == IEC_TIMER_B) {
+    if (BITBAND(IEC_MTIMER_SRQ->IR, IEC_OPIN_SRQ)) {
+      IEC_MTIMER_SRQ->IR = 1 << IEC_OPIN_SRQ;
+      iec_engine_match_handler();
+    }
+  }
+#endif
 }
 
 /* GPIO interrupt handler, shared with EINT3 */
@@ -193,6 +193,7 @@ static void open_existing(path_t *path, cbmdirent_t *dent, uint8_t type, buffer_
 
 static uint8_t m2i_opendir(dh_t *dh, path_t *path) {
   dh->part    = path->part;
+  reset_match(dh);
   dh->dir.m2i = M2I_ENTRY_OFFSET;
   return 0;
 }
@@ -32,50 +32,108 @@
 
 #include "uart.h"
 
+/* number of hash chains, must be a power of two */
+#define P00CACHE_BUCKETS 128
+
+/* marks the end of a hash chain */
+#define NO_ENTRY 0xffff
+
 typedef struct {
   uint32_t cluster;
+  uint16_t next;       // next entry in the same hash chain
+  uint8_t  part;       // 255 if unused
+  uint8_t  referenced; // cleared when the clock hand passes
   uint8_t  name[CBM_NAME_LENGTH];
 } p00name_t;
 
-static P00CACHE_ATTRIB p00name_t p00cache[CONFIG_P00CACHE_SIZE / sizeof(p00name_t)];
-static uint8_t      cache_part;
-static unsigned int entries;
+#define P00CACHE_ENTRIES ((CONFIG_P00CACHE_SIZE - P00CACHE_BUCKETS * sizeof(uint16_t)) / sizeof(p00name_t))
+
+static P00CACHE_ATTRIB p00name_t p00cache[P00CACHE_ENTRIES];
+static P00CACHE_ATTRIB uint16_t  buckets[P00CACHE_BUCKETS];
+static uint16_t entries; // number of entries used at least once
+static uint16_t hand;    // next entry checked for replacement
+
+static uint8_t hash(uint8_t part, uint32_t cluster) {
+  return (cluster ^ (cluster >> 7) ^ (part << 4)) & (P00CACHE_BUCKETS - 1);
+}
+
+/* find an entry, returns its index or NO_ENTRY */
+static uint16_t find_entry(uint8_t part, uint32_t cluster) {
+  uint16_t i = buckets[hash(part, cluster)];
+
+  while (i != NO_ENTRY) {
+    if (p00cache[i].cluster == cluster && p00cache[i].part == part)
+      break;
+    i = p00cache[i].next;
+  }
+
+  return i;
+}
+
+/* remove an entry from its hash chain and mark it as unused */
+static void unlink_entry(uint16_t entry) {
+  uint16_t *link = &buckets[hash(p00cache[entry].part, p00cache[entry].cluster)];
+
+  while (*link != entry)
+    link = &p00cache[*link].next;
+
+  *link = p00cache[entry].next;
+  p00cache[entry].part       = 255;
+  p00cache[entry].referenced = 0;
+}
 
 void p00cache_invalidate(void) {
-  cache_part = -1;
-  entries    = 0;
+  entries = 0;
+  hand    = 0;
+  memset(buckets, 0xff, sizeof(buckets));
 }
 
 uint8_t *p00cache_lookup(uint8_t part, uint32_t cluster) {
-  /* fail if it's for a different partition */
-  if (part != cache_part)
-    return NULL;
+  uint16_t i = find_entry(part, cluster);
 
-  /* linear search for the correct cluster number */
-  /* (binary search was only 6-8% faster overall) */
-  for (unsigned int i=0; i<entries; i++) {
-    if (p00cache[i].cluster == cluster)
-      return p00cache[i].name;
-  }
+  if (i == NO_ENTRY)
+    return NULL;
 
-  /* noting found */
-  return NULL;
+  p00cache[i].referenced = 1;
+  return p00cache[i].name;
 }
 
 void p00cache_add(uint8_t part, uint32_t cluster, uint8_t *name) {
-  /* don't add if the cache is full */
-  if (entries == sizeof(p00cache)/sizeof(p00cache[0]))
-    return;
-
-  /* invalidate if it's for a different partition */
-  // FIXME: ignore instead and add invalidate to CP?
-  if (part != cache_part) {
-    p00cache_invalidate();
-    cache_part = part;
+  uint16_t i;
+  uint8_t  h;
+
+  if (entries < P00CACHE_ENTRIES) {
+    /* use a fresh entry */
+    i = entries++;
+  } else {
+    /* replace the first entry not looked up since the hand passed it */
+    while (p00cache[hand].referenced) {
+      p00cache[hand].referenced = 0;
+      if (++hand == P00CACHE_ENTRIES)
+        hand = 0;
+    }
+
+    i = hand;
+    if (++hand == P00CACHE_ENTRIES)
+      hand = 0;
+
+    if (p00cache[i].part != 255)
+      unlink_entry(i);
   }
 
-  /* add entry at end of list */
-  p00cache[entries].cluster = cluster;
-  memcpy(p00cache[entries].name, name, CBM_NAME_LENGTH);
-  entries++;
+  /* add entry at the start of its hash chain */
+  h = hash(part, cluster);
+  p00cache[i].cluster    = cluster;
+  p00cache[i].part       = part;
+  p00cache[i].referenced = 1;
+  p00cache[i].next       = buckets[h];
+  memcpy(p00cache[i].name, name, CBM_NAME_LENGTH);
+  buckets[h] = i;
+}
+
+void p00cache_remove(uint8_t part, uint32_t cluster) {
+  uint16_t i = find_entry(part, cluster);
+
+  if (i != NO_ENTRY)
+    unlink_entry(i);
 }
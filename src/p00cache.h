@@ -33,12 +33,14 @@
 void     p00cache_invalidate(void);
 uint8_t *p00cache_lookup(uint8_t part, uint32_t cluster);
 void     p00cache_add(uint8_t part, uint32_t cluster, uint8_t *name);
+void     p00cache_remove(uint8_t part, uint32_t cluster);
 
 #else
 
 #  define p00cache_invalidate() do {} while (0)
 #  define p00cache_lookup(p,c)  NULL
 #  define p00cache_add(p,c,n)   do {} while (0)
+#  define p00cache_remove(p,c)  do {} while (0)
 
 #endif
 
@@ -121,77 +121,192 @@ uint8_t parse_partition(uint8_t **buf) {
 
 
 /**
- * match_name - Match a pattern against a file name
- * @matchstr  : pattern to be matched
+ * compile_match - prepare a pattern for matching
+ * @nm      : pointer to the compiled pattern
+ * @matchstr: pattern to be matched
+ *
+ * This function splits matchstr at its first '*' into a prefix and (if
+ * POSTMATCH is enabled) a suffix, keeps a case-folded copy of the prefix
+ * and notes the positions of '?' so match_compiled can test file names
+ * without interpreting the pattern again.
+ */
+static void compile_match(namematch_t *nm, uint8_t *matchstr) {
+  uint8_t i, c;
+
+  memset(nm, 0, sizeof(namematch_t));
+  nm->compiled = 1;
+
+  for (i = 0; i < CBM_NAME_LENGTH && *matchstr && *matchstr != '*'; i++) {
+    c = *matchstr++;
+    if (c == '?')
+      nm->pwild |= 1U << i;
+    nm->prefix[i] = tolower_pet(c);
+  }
+  nm->plen = i;
+
+  if (i == CBM_NAME_LENGTH || *matchstr != '*')
+    return;
+
+  nm->star = 1;
+  if (!(globalflags & POSTMATCH))
+    return;
+
+  /* Only '?' is a wildcard in the suffix, further '*' are literals */
+  matchstr++;
+  for (i = 0; *matchstr; i++) {
+    if (i == CBM_NAME_LENGTH) {
+      /* longer than any name */
+      nm->slen = 0xff;
+      return;
+    }
+    if (*matchstr++ == '?')
+      nm->swild |= 1U << i;
+  }
+  nm->slen = i;
+}
+
+/**
+ * match_compiled - Match a compiled pattern against a file name
+ * @nm        : pointer to the compiled pattern
+ * @matchstr  : pattern nm was compiled from
  * @dent      : pointer to the directory entry to be matched against
  * @ignorecase: ignore the case of the file names
  *
- * This function tests if matchstr matches name in dent.
+ * This function tests if the pattern in nm matches the name in dent.
+ * The case-sensitive prefix and the suffix are read from matchstr.
  * Returns 1 for a match, 0 otherwise.
  */
-uint8_t match_name(uint8_t *matchstr, cbmdirent_t *dent, uint8_t ignorecase) {
+static uint8_t match_compiled(namematch_t *nm, uint8_t *matchstr,
+                              cbmdirent_t *dent, uint8_t ignorecase) {
   uint8_t *filename = dent->name;
-  uint8_t *starpos;
-  uint8_t m,f;
-  uint8_t chars_remain = 16;
+  uint16_t wild = nm->pwild;
+  uint8_t i, f, m, len;
+
+  for (i = 0; i < nm->plen; i++, wild >>= 1) {
+    f = filename[i];
+    if (!f)
+      /* name shorter than the prefix */
+      return 0;
+    if (wild & 1)
+      continue;
+    if (ignorecase) {
+      if (tolower_pet(f) != nm->prefix[i])
+        return 0;
+    } else if (f != matchstr[i])
+      return 0;
+  }
 
-#if 0
-  /* Shortcut for chaining fastloaders ("!*file") */
-  if (*filename == *matchstr && matchstr[1] == '*')
+  /* A name that ends right before the '*' matches without the suffix */
+  if (!filename[i])
     return 1;
-#endif
 
-  while (chars_remain && *filename) {
+  if (!nm->star)
+    return 0;
+
+  if (nm->slen == 0)
+    return 1;
+
+  len = i + ustrlen(filename + i);
+  if (nm->slen > len)
+    return 0;
+
+  filename += len - nm->slen;
+  matchstr += nm->plen + 1;
+  wild = nm->swild;
+  for (i = 0; i < nm->slen; i++, wild >>= 1) {
+    if (wild & 1)
+      continue;
+    f = filename[i];
+    m = matchstr[i];
     if (ignorecase) {
-      m = tolower_pet(*matchstr);
-      f = tolower_pet(*filename);
-    } else {
-      m = *matchstr;
-      f = *filename;
+      f = tolower_pet(f);
+      m = tolower_pet(m);
     }
-    switch (m) {
-    case '?':
-      filename++;
-      matchstr++;
-      chars_remain--;
-      break;
-
-    case '*':
-      if (globalflags & POSTMATCH) {
-        starpos = matchstr;
-        matchstr += ustrlen(matchstr)-1;
-        filename += ustrlen(filename)-1;
-        while (matchstr != starpos) {
-          if (ignorecase) {
-            m = tolower_pet(*matchstr);
-            f = tolower_pet(*filename);
-          } else {
-            m = *matchstr;
-            f = *filename;
-          }
-          if (m != f && m != '?')
-            return 0;
-          filename--;
-          matchstr--;
-        }
-      }
-      return 1;
+    if (f != m)
+      return 0;
+  }
+  return 1;
+}
 
-    default:
-      if (m != f)
-        return 0;
-      matchstr++;
-      filename++;
-      chars_remain--;
-      break;
-    }
+/**
+ * match_name - Match a pattern against a file name
+ * @matchstr  : pattern to be matched
+ * @dent      : pointer to the directory entry to be matched against
+ * @ignorecase: ignore the case of the file names
+ *
+ * This function tests if matchstr matches name in dent.
+ * Returns 1 for a match, 0 otherwise. next_match compiles its
+ * pattern only once per call (per handle with CONFIG_MATCH_CACHE).
+ */
+uint8_t match_name(uint8_t *matchstr, cbmdirent_t *dent, uint8_t ignorecase) {
+  namematch_t nm;
+
+  compile_match(&nm, matchstr);
+  return match_compiled(&nm, matchstr, dent, ignorecase);
+}
+
+/**
+ * check_match - test a directory entry against the criteria of next_match
+ * @nm      : compiled pattern
+ * @matchstr: pattern to be matched
+ * @start   : start date
+ * @end     : end date
+ * @type    : required file type (0 for any)
+ * @dent    : pointer to the directory entry to be tested
+ *
+ * This function tests if dent matches type, matchstr and the date range
+ * given to next_match. matchstr is compiled into nm on the first call
+ * that compares a name. Returns 1 for a match, 0 otherwise.
+ */
+static uint8_t check_match(namematch_t *nm, uint8_t *matchstr, date_t *start,
+                           date_t *end, uint8_t type, cbmdirent_t *dent) {
+  /* Skip if the type doesn't match */
+  if ((type & TYPE_MASK) &&
+      (dent->typeflags & TYPE_MASK) != (type & TYPE_MASK))
+    return 0;
+
+  /* Skip hidden files */
+  if ((dent->typeflags & FLAG_HIDDEN) &&
+      !(type & FLAG_HIDDEN))
+    return 0;
+
+  /* Skip if the name doesn't match */
+  if (matchstr) {
+    if (!nm->compiled)
+      compile_match(nm, matchstr);
+
+    /* FAT: Ignore case, everything else: Honor case */
+    if (!match_compiled(nm, matchstr, dent,
+                        dent->opstype == OPSTYPE_FAT))
+      return 0;
   }
-  if (*matchstr && *matchstr != '*' && chars_remain != 0)
+
+  /* skip if earlier than start date */
+  if (start &&
+      memcmp(&dent->date, start, sizeof(date_t)) < 0)
     return 0;
-  else
-    return 1;
+
+  /* skip if later than end date */
+  if (end &&
+      memcmp(&dent->date, end, sizeof(date_t)) > 0)
+    return 0;
+
+  return 1;
 }
 
+#ifdef CONFIG_FAT_DIRHASH
+/* Check if a pattern can only match a single FAT name */
+static uint8_t is_exact_name(uint8_t *matchstr) {
+  uint8_t i;
+
+  for (i = 0; matchstr[i]; i++)
+    if (i == CBM_NAME_LENGTH || matchstr[i] == '*' || matchstr[i] == '?' ||
+        matchstr[i] == '/')
+      return 0;
+  return i != 0;
+}
+#endif
+
 /**
  * next_match - get next matching directory entry
  * @dh        : directory handle
@@ -204,47 +319,45 @@ uint8_t match_name(uint8_t *matchstr, cbmdirent_t *dent, uint8_t ignorecase) {
  * This function looks for the next directory entry matching matchstr and
  * type (if != 0) and returns it in dent. Return values of the function are
  * -1 if no match could be found, 1 if an error occured or 0 if a match was
- * found.
+ * found. With CONFIG_MATCH_CACHE, matchstr is compiled into dh on the
+ * first call, so it must not change until dh is opened again. Otherwise
+ * it is compiled once per call.
+ *
+ * On FAT, a pattern without wildcards is first looked up by its FAT name
+ * through the directory hash. If that entry matches, it is returned before
+ * all others, even if another entry with the same CBM name (e.g. from a
+ * P00 header) comes earlier in the directory. If the hash shows that no
+ * entry can have that name, -1 is returned without reading the directory.
  */
 int8_t next_match(dh_t *dh, uint8_t *matchstr, date_t *start, date_t *end, uint8_t type, cbmdirent_t *dent) {
   int8_t res;
+#ifdef CONFIG_MATCH_CACHE
+  namematch_t *nm = &dh->match;
+#else
+  namematch_t match, *nm = &match;
 
-  while (1) {
-    res = readdir(dh, dent);
-    if (res == 0) {
-      /* Skip if the type doesn't match */
-      if ((type & TYPE_MASK) &&
-          (dent->typeflags & TYPE_MASK) != (type & TYPE_MASK))
-        continue;
-
-      /* Skip hidden files */
-      if ((dent->typeflags & FLAG_HIDDEN) &&
-          !(type & FLAG_HIDDEN))
-        continue;
-
-      /* Skip if the name doesn't match */
-      if (matchstr) {
-        if (dent->opstype == OPSTYPE_FAT) {
-          /* FAT: Ignore case */
-          if (!match_name(matchstr, dent, 1))
-            continue;
-        } else {
-          /* Honor case */
-          if (!match_name(matchstr, dent, 0))
-            continue;
-        }
-      }
-
-      /* skip if earlier than start date */
-      if (start &&
-          memcmp(&dent->date, start, sizeof(date_t)) < 0)
-        continue;
+  match.compiled = 0;
+#endif
 
-      /* skip if later than end date */
-      if (end &&
-          memcmp(&dent->date, end, sizeof(date_t)) > 0)
-        continue;
+#ifdef CONFIG_FAT_DIRHASH
+  if (dh->lookup && partition[dh->part].fop == &fatops) {
+    dh->lookup = 0;
+    if (matchstr && is_exact_name(matchstr)) {
+      res = fat_readname(dh, matchstr, dent);
+      if (res == 1 || res == -1)
+        return res;
+      if (res == 0 &&
+          check_match(nm, matchstr, start, end, type, dent))
+        return 0;
     }
+  }
+#endif
+
+  while (1) {
+    res = readdir(dh, dent);
+    if (res == 0 &&
+        !check_match(nm, matchstr, start, end, type, dent))
+      continue;
 
     return res;
   }
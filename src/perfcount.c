@@ -0,0 +1,94 @@
+/* sd2iec - SD/MMC to Commodore serial bus interface/controller
+   Copyright (C) 2007-2017  Ingo Korb <ingo@akana.de>
+
+   Inspired by MMC2IEC by Lars Pontoppidan et al.
+
+   FAT filesystem access based on code from ChaN and Jim Brain, see ff.c|h.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License only.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+   perfcount.c: Performance counters
+
+*/
+
+#include <string.h>
+#include "config.h"
+#include "buffers.h"
+#include "timer.h"
+#include "perfcount.h"
+
+perfcounters_t perfcounters;
+
+/* start of the block currently sent by a talk handler */
+static uint32_t bus_start;
+static uint8_t  bus_position;
+
+/* microseconds since start, a value returned by getmicros */
+static uint32_t micros_since(uint32_t start) {
+  uint32_t elapsed = getmicros() - start;
+
+#ifdef MICROS_WRAP
+  if (elapsed >= MICROS_WRAP)
+    elapsed += MICROS_WRAP;
+#endif
+  return elapsed;
+}
+
+/**
+ * perf_reset - clear all performance counters
+ */
+void perf_reset(void) {
+  memset(&perfcounters, 0, sizeof(perfcounters));
+}
+
+/**
+ * perf_refill - refill a buffer and account for it
+ * @buf: buffer to refill
+ *
+ * This function calls the refill callback of @buf and adds the time
+ * spent in it to the refill counters. Returns the result of the
+ * callback.
+ */
+uint8_t perf_refill(buffer_t *buf) {
+  uint32_t start = getmicros();
+  uint8_t  res   = buf->refill(buf);
+
+  perfcounters.refills++;
+  perfcounters.refill_us += micros_since(start);
+  return res;
+}
+
+/**
+ * perf_bus_begin - mark the start of a block transfer
+ * @position: buffer position of the first byte to be sent
+ */
+void perf_bus_begin(uint8_t position) {
+  bus_start    = getmicros();
+  bus_position = position;
+}
+
+/**
+ * perf_bus_end - account for a completed block transfer
+ * @protocol: PERF_BUS_* index of the protocol that was used
+ * @lastused: buffer position of the last byte that was sent
+ *
+ * This function adds the bytes and the time since the last call of
+ * perf_bus_begin to the bus counters. Transfers aborted in the middle
+ * of a block are not counted.
+ */
+void perf_bus_end(uint8_t protocol, uint8_t lastused) {
+  perfcounters.bus_us += micros_since(bus_start);
+  perfcounters.bus_bytes[protocol] += (uint8_t)(lastused - bus_position) + 1;
+}
@@ -0,0 +1,75 @@
+/* sd2iec - SD/MMC to Commodore serial bus interface/controller
+   Copyright (C) 2007-2017  Ingo Korb <ingo@akana.de>
+
+   Inspired by MMC2IEC by Lars Pontoppidan et al.
+
+   FAT filesystem access based on code from ChaN and Jim Brain, see ff.c|h.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License only.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+   perfcount.h: Performance counters
+
+*/
+
+#ifndef PERFCOUNT_H
+#define PERFCOUNT_H
+
+#include <stdint.h>
+#include "buffers.h"
+
+/* indices into perfcounters.bus_bytes */
+enum { PERF_BUS_IEC, PERF_BUS_JIFFY, PERF_BUS_DOLPHIN, PERF_BUS_IEEE,
+       PERF_BUS_COUNT };
+
+#ifdef CONFIG_PERFCOUNTERS
+
+typedef struct {
+  uint32_t sd_read_sectors;     // sectors requested from sd_read
+  uint32_t sd_read_cmds;        // read commands sent to the card
+  uint32_t sd_write_sectors;    // sectors passed to sd_write
+  uint32_t sd_write_cmds;       // write commands sent to the card
+  uint32_t sd_crc_errors;       // command/data CRC and data response errors
+  uint32_t sd_retries;          // transfers restarted after an error
+  uint32_t window_hits;         // move_window calls without disk access
+  uint32_t window_misses;       // move_window calls that read a sector
+  uint32_t image_reads;         // calls to image_read
+  uint32_t refills;             // buffer refills from the bus handlers
+  uint32_t refill_us;           // microseconds spent in those refills
+  uint32_t bus_us;              // microseconds spent sending buffers
+  uint32_t bus_bytes[PERF_BUS_COUNT]; // bytes sent, per protocol
+} perfcounters_t;
+
+extern perfcounters_t perfcounters;
+
+#  define PERF_INC(x)   (perfcounters.x++)
+#  define PERF_ADD(x,n) (perfcounters.x += (n))
+
+void    perf_reset(void);
+uint8_t perf_refill(buffer_t *buf);
+void    perf_bus_begin(uint8_t position);
+void    perf_bus_end(uint8_t protocol, uint8_t lastused);
+
+#else
+
+#  define PERF_INC(x)              do {} while (0)
+#  define PERF_ADD(x,n)            do {} while (0)
+#  define perf_reset()             do {} while (0)
+#  define perf_refill(buf)         ((buf)->refill(buf))
+#  define perf_bus_begin(pos)      do {} while (0)
+#  define perf_bus_end(proto,last) do {} while (0)
+
+#endif
+
+#endif
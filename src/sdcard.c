@@ -28,12 +28,14 @@
 
 */
 
+#include <stddef.h>
 #include "config.h"
 #include "crc.h"
 #include "diskio.h"
 #include "spi.h"
 #include "timer.h"
 #include "uart.h"
+#include "perfcount.h"
 #include "sdcard.h"
 
 #ifdef CONFIG_TWINSD
@@ -264,6 +266,10 @@ static uint8_t send_command(const uint8_t  card,
     spi_tx_block(&tmp, 4);
     spi_tx_byte(crc);
 
+    /* skip the stuff byte that follows STOP_TRANSMISSION */
+    if (cmd == STOP_TRANSMISSION)
+      spi_rx_byte();
+
     /* wait up to 500ms for a valid response */
     timeout = getticks() + HZ/2;
     do {
@@ -274,6 +280,7 @@ static uint8_t send_command(const uint8_t  card,
     /* check for CRC error */
     if (res & STATUS_CRC_ERROR) {
       uart_putc('x');
+      PERF_INC(sd_crc_errors);
       deselect_card();
       errors++;
       continue;
@@ -487,6 +494,76 @@ DSTATUS sd_initialize(BYTE drv) {
 DSTATUS disk_initialize(BYTE drv) __attribute__ ((weak, alias("sd_initialize")));
 
 
+/**
+ * stop_transmission - terminate a multi-block transfer
+ * @drv: drive
+ *
+ * This function sends STOP_TRANSMISSION to end a running
+ * READ_MULTIPLE_BLOCK command and waits until the card has left its
+ * busy state. The card is left selected. Returns the R1 response of
+ * the card. WRITE_MULTIPLE_BLOCK is ended with a stop tran token
+ * instead, see sd_write.
+ */
+static uint8_t stop_transmission(const uint8_t drv) {
+  uint8_t res;
+
+  res = send_command(drv, STOP_TRANSMISSION, 0);
+
+  /* R1b response, wait until the card is no longer busy */
+  expect_byte(0xff);
+
+  return res;
+}
+
+#ifndef HAVE_SPI_ASYNC
+/**
+ * receive_block - receive a single data block from the card
+ * @buffer: pointer to the buffer
+ *
+ * This function receives 512 bytes of data and the following
+ * data CRC from the card into buffer. The start block token must
+ * have been read already. Returns 0 if the CRC matched or 1 if not.
+ */
+static uint8_t receive_block(BYTE *buffer) {
+  uint16_t crc, recvcrc;
+
+  crc = 0;
+#ifdef CONFIG_SD_BLOCKTRANSFER
+  /* transfer data first, calculate CRC afterwards */
+  spi_rx_block(buffer, 512);
+
+  recvcrc = spi_rx_byte() << 8 | spi_rx_byte();
+  crc = crc_xmodem_block(0, buffer, 512);
+#else
+  /* interleave transfer/CRC calculation, AVR-optimized */
+  uint16_t i;
+  uint8_t  tmp;
+  BYTE     *ptr = buffer;
+
+  /* start SPI data exchange */
+  SPDR = 0xff;
+
+  for (i=0; i<512; i++) {
+    /* wait until byte available */
+    loop_until_bit_is_set(SPSR, SPIF);
+    tmp = SPDR;
+    /* transmit the next byte while the current one is processed */
+    SPDR = 0xff;
+
+    *ptr++ = tmp;
+    crc = crc_xmodem_update(crc, tmp);
+  }
+  /* wait for the first CRC byte */
+  loop_until_bit_is_set(SPSR, SPIF);
+
+  recvcrc  = SPDR << 8;
+  recvcrc |= spi_rx_byte();
+#endif
+
+  return recvcrc != crc;
+}
+#endif
+
 /**
  * sd_read - reads sectors from the SD card to buffer
  * @drv   : drive
@@ -496,14 +573,21 @@ DSTATUS disk_initialize(BYTE drv) __attribute__ ((weak, alias("sd_initialize")))
  *
  * This function reads count sectors from the SD card starting
  * at sector to buffer. Returns RES_ERROR if an error occured or
- * RES_OK if successful. Up to SD_AUTO_RETRIES will be made if
- * the calculated data CRC does not match the one sent by the
- * card. If there were errors during the command transmission
+ * RES_OK if successful. Runs of more than one sector are streamed
+ * with a single READ_MULTIPLE_BLOCK command. Up to SD_AUTO_RETRIES
+ * will be made per sector if the calculated data CRC does not match
+ * the one sent by the card, restarting the transfer at the failed
+ * sector. If there were errors during the command transmission
  * disk_state will be set to DISK_ERROR and no retries are made.
+ * If the SPI code can transfer blocks in the background, the CRC
+ * of each block is checked while the next one is received.
  */
 DRESULT sd_read(BYTE drv, BYTE *buffer, DWORD sector, BYTE count) {
-  uint8_t  res, sec, errors;
-  uint16_t crc, recvcrc;
+  uint8_t  res, sec, errors, multi;
+#ifdef HAVE_SPI_ASYNC
+  const BYTE *prevbuf;
+  uint16_t prevcrc = 0;
+#endif
 
   if (drv >= MAX_CARDS)
     return RES_PARERR;
@@ -512,79 +596,102 @@ DRESULT sd_read(BYTE drv, BYTE *buffer, DWORD sector, BYTE count) {
   if (cardtype[drv] == CARD_MMCSD)
     sector <<= 9;
 
-  for (sec = 0; sec < count; sec++) {
-    errors = 0;
-    while (errors < CONFIG_SD_AUTO_RETRIES) {
-      /* send read command */
-      if (cardtype[drv] & CARD_SDHC)
-        res = send_command(drv, READ_SINGLE_BLOCK, sector + sec);
-      else
-        res = send_command(drv, READ_SINGLE_BLOCK, sector + (sec << 9));
-
-      /* fail if the command wasn't accepted */
-      if (res != 0) {
-        deselect_card();
-        disk_state = DISK_ERROR;
-        return RES_ERROR;
-      }
+  PERF_ADD(sd_read_sectors, count);
+
+  sec    = 0;
+  errors = 0;
+  while (sec < count) {
+    multi = (count - sec > 1);
 
+    if (errors)
+      PERF_INC(sd_retries);
+
+    /* send read command */
+    if (cardtype[drv] & CARD_SDHC)
+      res = send_command(drv, multi ? READ_MULTIPLE_BLOCK : READ_SINGLE_BLOCK,
+                         sector + sec);
+    else
+      res = send_command(drv, multi ? READ_MULTIPLE_BLOCK : READ_SINGLE_BLOCK,
+                         sector + ((DWORD)sec << 9));
+    PERF_INC(sd_read_cmds);
+
+    /* fail if the command wasn't accepted */
+    if (res != 0) {
+      deselect_card();
+      disk_state = DISK_ERROR;
+      return RES_ERROR;
+    }
+
+#ifdef HAVE_SPI_ASYNC
+    prevbuf = NULL;
+#endif
+    do {
       /* wait for start block token */
       if (!expect_byte(0xfe)) {
+        if (multi)
+          stop_transmission(drv);
         deselect_card();
         disk_state = DISK_ERROR;
         return RES_ERROR;
       }
 
-      /* transfer data */
-      crc = 0;
-#ifdef CONFIG_SD_BLOCKTRANSFER
-      /* transfer data first, calculate CRC afterwards */
-      spi_rx_block(buffer, 512);
+#ifdef HAVE_SPI_ASYNC
+      /* transfer data, check the CRC of the previous block meanwhile */
+      spi_rx_block_start(buffer, 512);
+      if (prevbuf != NULL) {
+        if (crc_xmodem_block(0, prevbuf, 512) != prevcrc) {
+          /* restart at the previous block */
+          spi_block_wait();
+          prevbuf = NULL;
+          buffer -= 512;
+          sec--;
+          uart_putc('X');
+          PERF_INC(sd_crc_errors);
+          errors++;
+          break;
+        }
+        errors = 0;
+      }
+      spi_block_wait();
 
-      recvcrc = spi_rx_byte() << 8 | spi_rx_byte();
-      crc = crc_xmodem_block(0, buffer, 512);
+      prevcrc  = spi_rx_byte() << 8;
+      prevcrc |= spi_rx_byte();
+      prevbuf  = buffer;
 #else
-      /* interleave transfer/CRC calculation, AVR-optimized */
-      uint16_t i;
-      uint8_t  tmp;
-      BYTE     *ptr = buffer;
-
-      /* start SPI data exchange */
-      SPDR = 0xff;
-
-      for (i=0; i<512; i++) {
-        /* wait until byte available */
-        loop_until_bit_is_set(SPSR, SPIF);
-        tmp = SPDR;
-        /* transmit the next byte while the current one is processed */
-        SPDR = 0xff;
-
-        *ptr++ = tmp;
-        crc = crc_xmodem_update(crc, tmp);
+      /* transfer data and check CRC */
+      if (receive_block(buffer)) {
+        uart_putc('X');
+        PERF_INC(sd_crc_errors);
+        errors++;
+        break;
       }
-      /* wait for the first CRC byte */
-      loop_until_bit_is_set(SPSR, SPIF);
 
-      recvcrc  = SPDR << 8;
-      recvcrc |= spi_rx_byte();
+      errors  = 0;
 #endif
+      buffer += 512;
+      sec++;
+    } while (multi && sec < count);
+
+    if (multi)
+      stop_transmission(drv);
+    deselect_card();
 
-      /* check CRC */
-      if (recvcrc != crc) {
+#ifdef HAVE_SPI_ASYNC
+    /* the CRC of the last block is still unchecked */
+    if (prevbuf != NULL) {
+      if (crc_xmodem_block(0, prevbuf, 512) != prevcrc) {
+        buffer -= 512;
+        sec--;
         uart_putc('X');
-        deselect_card();
+        PERF_INC(sd_crc_errors);
         errors++;
-        continue;
-      }
-
-      break; // FIXME: Ugly control flow
+      } else
+        errors = 0;
     }
-    deselect_card();
+#endif
 
     if (errors >= CONFIG_SD_AUTO_RETRIES)
       return RES_ERROR;
-
-    buffer += 512;
   }
 
   return RES_OK;
@@ -592,6 +699,53 @@ DRESULT sd_read(BYTE drv, BYTE *buffer, DWORD sector, BYTE count) {
 DRESULT disk_read(BYTE drv, BYTE *buffer, DWORD sector, BYTE count) __attribute__ ((weak, alias("sd_read")));
 
 
+/**
+ * transmit_block - send a single data block to the card
+ * @drv   : drive
+ * @buffer: pointer to the buffer
+ * @token : start block token
+ *
+ * This function sends token, 512 bytes of data from buffer and
+ * the data CRC to the card. Returns the data response token.
+ */
+static uint8_t transmit_block(const uint8_t drv, const BYTE *buffer,
+                              const uint8_t token) {
+  uint16_t crc;
+
+  /* send data token */
+  spi_tx_byte(token);
+
+  /* transfer data */
+#if defined(CONFIG_SD_BLOCKTRANSFER) && defined(HAVE_SPI_ASYNC)
+  /* calculate the CRC while the data is sent */
+  spi_tx_block_start(buffer, 512);
+  crc = crc_xmodem_block(0, buffer, 512);
+  spi_block_wait();
+#elif defined(CONFIG_SD_BLOCKTRANSFER)
+  spi_tx_block(buffer, 512);
+  crc = crc_xmodem_block(0, buffer, 512);
+#else
+  /* interleave transfer/CRC calculations, AVR-optimized */
+  uint16_t i;
+  const BYTE *ptr = buffer;
+
+  crc = 0;
+  spi_select_device(drv+1);
+  for (i=0; i<512; i++) {
+    SPDR = *ptr;
+    crc = crc_xmodem_update(crc, *ptr++);
+    loop_until_bit_is_set(SPSR, SPIF);
+  }
+#endif
+
+  /* send CRC */
+  spi_tx_byte(crc >> 8);
+  spi_tx_byte(crc & 0xff);
+
+  /* read status byte */
+  return spi_rx_byte();
+}
+
 /**
  * sd_write - writes sectors from buffer to the SD card
  * @drv   : drive
@@ -602,14 +756,16 @@ DRESULT disk_read(BYTE drv, BYTE *buffer, DWORD sector, BYTE count) __attribute_
  * This function writes count sectors from buffer to the SD card
  * starting at sector. Returns RES_ERROR if an error occured,
  * RES_WPRT if the card is currently write-protected or RES_OK
- * if successful. Up to SD_AUTO_RETRIES will be made if the card
- * signals a CRC error. If there were errors during the command
- * transmission disk_state will be set to DISK_ERROR and no retries
- * are made.
+ * if successful. Runs of more than one sector are written with
+ * a single WRITE_MULTIPLE_BLOCK command, preceded by a pre-erase
+ * hint for SD cards. Up to SD_AUTO_RETRIES will be made per sector
+ * if the card signals a CRC error, restarting the transfer at the
+ * failed sector after the card has been stopped with a stop tran
+ * token. If there were errors during the command transmission
+ * disk_state will be set to DISK_ERROR and no retries are made.
  */
 DRESULT sd_write(BYTE drv, const BYTE *buffer, DWORD sector, BYTE count) {
-  uint8_t  res, sec, errors;
-  uint16_t crc;
+  uint8_t  res, sec, errors, multi;
 
   if (drv >= MAX_CARDS)
     return RES_PARERR;
@@ -622,56 +778,51 @@ DRESULT sd_write(BYTE drv, const BYTE *buffer, DWORD sector, BYTE count) {
   if (cardtype[drv] == CARD_MMCSD)
     sector <<= 9;
 
-  for (sec = 0; sec < count; sec++) {
-    errors = 0;
-    while (errors < CONFIG_SD_AUTO_RETRIES) {
-      /* send write command */
-      if (cardtype[drv] & CARD_SDHC)
-        res = send_command(drv, WRITE_BLOCK, sector + sec);
-      else
-        res = send_command(drv, WRITE_BLOCK, sector + (sec << 9));
-
-      /* fail if the command wasn't accepted */
-      if (res != 0) {
-        deselect_card();
-        disk_state = DISK_ERROR;
-        return RES_ERROR;
-      }
+  PERF_ADD(sd_write_sectors, count);
+
+  sec    = 0;
+  errors = 0;
+  while (sec < count) {
+    multi = (count - sec > 1);
 
-      /* send data token */
-      spi_tx_byte(0xfe);
+    if (errors)
+      PERF_INC(sd_retries);
 
-      /* transfer data */
-#ifdef CONFIG_SD_BLOCKTRANSFER
-      spi_tx_block(buffer, 512);
-      crc = crc_xmodem_block(0, buffer, 512);
-#else
-      /* interleave transfer/CRC calculations, AVR-optimized */
-      uint16_t i;
-      const BYTE *ptr = buffer;
-
-      crc = 0;
-      spi_select_device(drv+1);
-      for (i=0; i<512; i++) {
-        SPDR = *ptr;
-        crc = crc_xmodem_update(crc, *ptr++);
-        loop_until_bit_is_set(SPSR, SPIF);
+    if (multi) {
+      /* tell SD cards how many blocks will follow (MMC rejects APP_CMD) */
+      res = send_command(drv, APP_CMD, 0);
+      deselect_card();
+      if (res == 0) {
+        send_command(drv, SD_SET_WR_BLK_ERASE_COUNT, count - sec);
+        deselect_card();
       }
-#endif
+    }
 
-      /* send CRC */
-      spi_tx_byte(crc >> 8);
-      spi_tx_byte(crc & 0xff);
+    /* send write command */
+    if (cardtype[drv] & CARD_SDHC)
+      res = send_command(drv, multi ? WRITE_MULTIPLE_BLOCK : WRITE_BLOCK,
+                         sector + sec);
+    else
+      res = send_command(drv, multi ? WRITE_MULTIPLE_BLOCK : WRITE_BLOCK,
+                         sector + ((DWORD)sec << 9));
+    PERF_INC(sd_write_cmds);
 
-      /* read status byte */
-      res = spi_rx_byte();
+    /* fail if the command wasn't accepted */
+    if (res != 0) {
+      deselect_card();
+      disk_state = DISK_ERROR;
+      return RES_ERROR;
+    }
+
+    do {
+      res = transmit_block(drv, buffer, multi ? 0xfc : 0xfe);
 
       /* retry on error */
       if ((res & 0x0f) != 0x05) {
         uart_putc('X');
-        deselect_card();
+        PERF_INC(sd_crc_errors);
         errors++;
-        continue;
+        break;
       }
 
       /* wait until write is finished */
@@ -680,15 +831,24 @@ DRESULT sd_write(BYTE drv, const BYTE *buffer, DWORD sector, BYTE count) {
         res = spi_rx_byte();
       } while (res == 0);
 
-      break; // FIXME: Ugly control flow
+      errors  = 0;
+      buffer += 512;
+      sec++;
+    } while (multi && sec < count);
+
+    if (multi) {
+      /* A write is always ended with the stop tran token, also after */
+      /* a rejected block - STOP_TRANSMISSION is only valid for reads. */
+      /* The card may still be busy with the rejected block here.      */
+      expect_byte(0xff);
+      spi_tx_byte(0xfd);
+      spi_rx_byte();
+      expect_byte(0xff);
     }
     deselect_card();
 
-    if (errors >= CONFIG_SD_AUTO_RETRIES) {
+    if (errors >= CONFIG_SD_AUTO_RETRIES)
       return RES_ERROR;
-    }
-
-    buffer += 512;
   }
 
   return RES_OK;
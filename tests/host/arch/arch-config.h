@@ -0,0 +1,120 @@
+/* sd2iec - SD/MMC to Commodore serial bus interface/controller
+   Copyright (C) 2007-2017  Ingo Korb <ingo@akana.de>
+
+   Inspired by MMC2IEC by Lars Pontoppidan et al.
+
+   FAT filesystem access based on code from ChaN and Jim Brain, see ff.c|h.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License only.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+   arch-config.h: Hardware definitions for the host test programs
+
+   The host "hardware" has no SD card, its disk is the RAM disk in
+   tests/host/ramdisk.c. The IEC lines are simulated in hostsim.c,
+   reading them costs virtual time just like a poll loop on a real
+   microcontroller.
+
+*/
+
+#ifndef ARCH_CONFIG_H
+#define ARCH_CONFIG_H
+
+#include <stdint.h>
+#include "hostsim.h"
+
+/* Return value of buttons_read() */
+typedef uint8_t rawbutton_t;
+
+/* Interrupt handlers are called directly by the simulation */
+#define SYSTEM_TICK_HANDLER void host_tick_handler(void)
+#define IEC_ATN_HANDLER     void iec_atn_handler(void)
+#define IEC_CLOCK_HANDLER   void iec_clock_handler(void)
+
+/* EEPROMFS is not supported on the host, but the values are needed */
+#define EEPROMFS_OFFSET     512
+#define EEPROMFS_SIZE       3584
+#define EEPROMFS_ENTRIES    8
+#define EEPROMFS_SECTORSIZE 64
+
+static inline void leds_init(void) {}
+static inline void set_busy_led(uint8_t state) { (void)state; }
+static inline void set_dirty_led(uint8_t state) { (void)state; }
+static inline void toggle_dirty_led(void) {}
+
+static inline void device_hw_address_init(void) {}
+static inline uint8_t device_hw_address(void) {
+  return 8;
+}
+
+static inline void buttons_init(void) {}
+static inline rawbutton_t buttons_read(void) {
+  return 0;
+}
+#define BUTTON_NEXT 1
+#define BUTTON_PREV 2
+
+/* --- SD card, emulated in sdemu.c --- */
+static inline void sdcard_interface_init(void) {}
+static inline uint8_t sdcard_detect(void) {
+  return 1;
+}
+static inline uint8_t sdcard_wp(void) {
+  return 0;
+}
+
+/* --- IEC --- */
+#define IEC_BIT_ATN   SIM_ATN
+#define IEC_BIT_CLOCK SIM_CLOCK
+#define IEC_BIT_DATA  SIM_DATA
+#define IEC_BIT_SRQ   SIM_SRQ
+
+/* Return type of iec_bus_read() */
+typedef uint8_t iec_bus_t;
+
+/* Every read of the input port advances the virtual time */
+#define IEC_INPUT sim_bus_poll()
+
+static inline void set_atn(uint8_t state) {
+  sim_drive_line(SIM_ATN, state);
+}
+
+static inline void set_clock(uint8_t state) {
+  sim_drive_line(SIM_CLOCK, state);
+}
+
+static inline void set_data(uint8_t state) {
+  sim_drive_line(SIM_DATA, state);
+}
+
+static inline void set_srq(uint8_t state) {
+  sim_drive_line(SIM_SRQ, state);
+}
+
+#define set_atn_irq(x) sim_set_atn_irq(x)
+
+static inline void iec_interrupts_init(void) {}
+static inline void iec_interface_init(void) {}
+static inline void bus_interface_init(void) {}
+
+/* Data buffers and caches stay in normal RAM, with CONFIG_XMEM they */
+/* go to an "xmem" section like on AVR, see config-xmem.             */
+#ifdef CONFIG_XMEM
+#  define XMEM_ATTRIB     __attribute__((section("xmem")))
+#  define BUFFER_ATTRIB   XMEM_ATTRIB
+#  define CACHE_ATTRIB    XMEM_ATTRIB
+#  define P00CACHE_ATTRIB XMEM_ATTRIB
+#else
+#  define P00CACHE_ATTRIB
+#endif
+
+#endif
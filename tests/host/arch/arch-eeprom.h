@@ -0,0 +1,62 @@
+/* sd2iec - SD/MMC to Commodore serial bus interface/controller
+   Copyright (C) 2007-2017  Ingo Korb <ingo@akana.de>
+
+   Inspired by MMC2IEC by Lars Pontoppidan et al.
+
+   FAT filesystem access based on code from ChaN and Jim Brain, see ff.c|h.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License only.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+   arch-eeprom.h: EEPROM access on the host, the variables are plain RAM
+
+*/
+
+#ifndef ARCH_EEPROM_H
+#define ARCH_EEPROM_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define EEMEM
+
+#define eeprom_safety() do {} while (0)
+
+static inline uint8_t eeprom_read_byte(void *addr) {
+  return *(uint8_t *)addr;
+}
+
+static inline uint16_t eeprom_read_word(void *addr) {
+  uint16_t val;
+  memcpy(&val, addr, 2);
+  return val;
+}
+
+static inline void eeprom_read_block(void *destptr, void *addr, unsigned int length) {
+  memcpy(destptr, addr, length);
+}
+
+static inline void eeprom_write_byte(void *addr, uint8_t value) {
+  *(uint8_t *)addr = value;
+}
+
+static inline void eeprom_write_word(void *addr, uint16_t value) {
+  memcpy(addr, &value, 2);
+}
+
+static inline void eeprom_write_block(void *srcptr, void *addr, unsigned int length) {
+  memcpy(addr, srcptr, length);
+}
+
+#endif
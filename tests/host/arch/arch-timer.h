@@ -0,0 +1,49 @@
+/* sd2iec - SD/MMC to Commodore serial bus interface/controller
+   Copyright (C) 2007-2017  Ingo Korb <ingo@akana.de>
+
+   Inspired by MMC2IEC by Lars Pontoppidan et al.
+
+   FAT filesystem access based on code from ChaN and Jim Brain, see ff.c|h.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License only.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+   arch-timer.h: Timer functions on the host, based on the virtual time
+
+*/
+
+#ifndef ARCH_TIMER_H
+#define ARCH_TIMER_H
+
+#include "hostsim.h"
+
+#define delay_ms(x) sim_advance((uint64_t)(x) * 1000000)
+#define delay_us(x) sim_advance((uint64_t)(x) * 1000)
+
+/* Types for unsigned and signed tick values */
+typedef uint16_t tick_t;
+typedef int16_t stick_t;
+
+static inline uint32_t getmicros(void) {
+  return sim_now / 1000;
+}
+
+static inline void start_timeout(unsigned int usecs) {
+  sim_timeout_end = sim_now + usecs * 1000ULL;
+}
+
+static inline uint8_t has_timed_out(void) {
+  sim_advance(SIM_POLL_NS);
+  return sim_now >= sim_timeout_end;
+}
+
+#endif
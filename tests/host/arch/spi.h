@@ -0,0 +1,57 @@
+/* sd2iec - SD/MMC to Commodore serial bus interface/controller
+   Copyright (C) 2007-2017  Ingo Korb <ingo@akana.de>
+
+   Inspired by MMC2IEC by Lars Pontoppidan et al.
+
+   FAT filesystem access based on code from ChaN and Jim Brain, see ff.c|h.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License only.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+   spi.h: SPI interface of the emulated SD card, see sdemu.c
+
+*/
+
+#ifndef SPI_H
+#define SPI_H
+
+#include <stdint.h>
+
+/* Low speed 400kHz for init, fast speed <=20MHz (MMC limit) */
+typedef enum { SPI_SPEED_FAST, SPI_SPEED_SLOW } spi_speed_t;
+
+/* Available SPI devices - special case to select all SD cards for initialisation */
+/* Note: SD cards must be 1 and 2 */
+typedef enum { SPIDEV_NONE     = 0,
+               SPIDEV_CARD0    = 1,
+               SPIDEV_CARD1    = 2,
+               SPIDEV_ALLCARDS = 3 } spi_device_t;
+
+void    spi_init(spi_speed_t speed);
+void    spi_select_device(spi_device_t dev);
+void    spi_tx_byte(uint8_t data);
+void    spi_tx_block(const void *data, unsigned int length);
+uint8_t spi_rx_byte(void);
+void    spi_rx_block(void *data, unsigned int length);
+void    spi_set_speed(spi_speed_t speed);
+
+/* Same interface as the DMA transfers on LPC17xx, but synchronous */
+#define HAVE_SPI_ASYNC
+
+void    spi_rx_block_start(void *data, unsigned int length);
+void    spi_tx_block_start(const void *data, unsigned int length);
+uint8_t spi_block_busy(void);
+void    spi_block_wait(void);
+
+#endif
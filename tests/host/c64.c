@@ -0,0 +1,496 @@
+/* sd2iec - SD/MMC to Commodore serial bus interface/controller
+   Copyright (C) 2007-2017  Ingo Korb <ingo@akana.de>
+
+   Inspired by MMC2IEC by Lars Pontoppidan et al.
+
+   FAT filesystem access based on code from ChaN and Jim Brain, see ff.c|h.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License only.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+   c64.c: KERNAL serial bus routines of the simulated computer
+
+   The routines follow the C64 KERNAL (ISOUR at $ED40, ACPTR at $EE13
+   and their callers), with the delays of the ROM code rounded to whole
+   microseconds. Anything that would hang a real C64 or set an error in
+   ST is reported as a protocol violation.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hostsim.h"
+#include "c64.h"
+
+#define US 1000ULL
+#define MS 1000000ULL
+
+/* Reaction time of a KERNAL polling loop */
+#define T_REACT     (8 * US)
+/* Bit setup and valid times when sending */
+#define T_SETUP     (20 * US)
+#define T_VALID     (20 * US)
+/* Time between ATN and the first check for a device (W1MS) */
+#define T_ATN       (1 * MS)
+/* Frame handshake timeout */
+#define T_FRAME     (1 * MS)
+/* EOI timeout and EOI acknowledge time when receiving */
+#define T_EOI       (256 * US)
+#define T_EOI_ACK   (60 * US)
+/* Time spent in the LOAD/SAVE loops per byte, including STOP checks */
+#define T_LOOP      (50 * US)
+/* Minimum time between two KERNAL bus calls */
+#define T_CALL      (200 * US)
+
+uint8_t    c64_status;
+uint64_t   c64_hang = 200 * MS;
+c64_xfer_t c64_xfer;
+
+static int16_t buffered = -1;   // byte held back by CIOUT (C3P0/BSOUR)
+
+static void clock_out(uint8_t released) {
+  sim_c64_line(SIM_CLOCK, released);
+}
+
+static void data_out(uint8_t released) {
+  sim_c64_line(SIM_DATA, released);
+}
+
+static void atn_out(uint8_t released) {
+  sim_c64_line(SIM_ATN, released);
+}
+
+/* Wait for a line, reports a violation on timeout */
+static uint8_t wait_line(uint8_t line, uint8_t released, uint64_t timeout,
+                         const char *what) {
+  if (!sim_c64_wait(line, released ? line : 0, timeout)) {
+    sim_violation("%s", what);
+    return 0;
+  }
+  sim_c64_delay(T_REACT);
+  return 1;
+}
+
+static void xfer_start(void) {
+  free(c64_xfer.gaps);
+  memset(&c64_xfer, 0, sizeof(c64_xfer));
+}
+
+static void xfer_byte(void) {
+  if (c64_xfer.bytes == 0) {
+    c64_xfer.start = sim_now;
+  } else {
+    if ((c64_xfer.bytes & 1023) == 1)
+      c64_xfer.gaps = realloc(c64_xfer.gaps,
+                              (c64_xfer.bytes + 1023) * sizeof(uint32_t));
+    c64_xfer.gaps[c64_xfer.bytes - 1] = sim_now - c64_xfer.end;
+  }
+  c64_xfer.end = sim_now;
+  c64_xfer.bytes++;
+}
+
+/* ------------------------------------------------------------------------- */
+/*  Byte transfer                                                            */
+/* ------------------------------------------------------------------------- */
+
+/* Send one byte, optionally with EOI (ISOUR, $ED40) */
+static void isour(uint8_t byte, uint8_t eoi) {
+  uint8_t i;
+
+  data_out(1);
+  sim_c64_delay(T_REACT);
+  if (sim_lines() & SIM_DATA) {
+    c64_status |= ST_NODEVICE;
+    sim_violation("device not present");
+    return;
+  }
+
+  /* Ready to send */
+  clock_out(1);
+
+  if (eoi) {
+    if (!wait_line(SIM_DATA, 1, c64_hang, "listener not ready for EOI") ||
+        !wait_line(SIM_DATA, 0, c64_hang, "EOI not acknowledged"))
+      return;
+  }
+  if (!wait_line(SIM_DATA, 1, c64_hang, "listener not ready for data"))
+    return;
+
+  clock_out(0);
+  for (i = 0; i < 8; i++) {
+    sim_c64_delay(T_REACT);
+    if (!(sim_lines() & SIM_DATA)) {
+      c64_status |= ST_WRITE_TIMEOUT;
+      sim_violation("DATA pulled low during a byte");
+      return;
+    }
+    data_out(byte & 1);
+    byte >>= 1;
+    sim_c64_delay(T_SETUP);
+    clock_out(1);
+    sim_c64_delay(T_VALID);
+    clock_out(0);
+    data_out(1);
+  }
+
+  if (!sim_c64_wait(SIM_DATA, 0, T_FRAME)) {
+    c64_status |= ST_WRITE_TIMEOUT;
+    sim_violation("frame handshake timeout");
+  }
+}
+
+/* Send a byte under ATN (LIST1/ISOURA, $ED11/$ED36) */
+static void send_atn(uint8_t byte) {
+  if (buffered >= 0) {
+    isour(buffered, 1);
+    buffered = -1;
+  }
+
+  data_out(1);
+  if (byte == 0x3f)
+    clock_out(1);
+  atn_out(0);
+
+  clock_out(0);
+  data_out(1);
+  sim_c64_delay(T_ATN);
+  isour(byte, 0);
+}
+
+void c64_listen(uint8_t device) {
+  sim_c64_delay(T_CALL);
+  c64_status = 0;
+  send_atn(0x20 | device);
+}
+
+void c64_talk(uint8_t device) {
+  sim_c64_delay(T_CALL);
+  c64_status = 0;
+  send_atn(0x40 | device);
+}
+
+/* SECOND, $EDB9 */
+void c64_second(uint8_t secondary) {
+  clock_out(0);
+  data_out(1);
+  sim_c64_delay(T_ATN);
+  isour(secondary, 0);
+  atn_out(1);
+}
+
+/* TKSA, $EDC7 - turn the device into a talker */
+void c64_tksa(uint8_t secondary) {
+  clock_out(0);
+  data_out(1);
+  sim_c64_delay(T_ATN);
+  isour(secondary, 0);
+
+  data_out(0);
+  atn_out(1);
+  clock_out(1);
+  wait_line(SIM_CLOCK, 0, c64_hang, "talker did not take over the bus");
+}
+
+/* CIOUT, $EDDD - the last byte is held back to send it with EOI */
+void c64_ciout(uint8_t byte) {
+  if (buffered >= 0)
+    isour(buffered, 0);
+  buffered = byte;
+}
+
+/* ACPTR, $EE13 */
+uint8_t c64_acptr(void) {
+  uint8_t i, byte = 0, eoi = 0;
+
+  if (!wait_line(SIM_CLOCK, 1, c64_hang, "talker not ready to send"))
+    return 0;
+
+  while (1) {
+    /* Ready for data */
+    data_out(1);
+    if (sim_c64_wait(SIM_CLOCK, 0, T_EOI))
+      break;
+
+    if (eoi) {
+      /* Not an error, this is how a missing file is signalled */
+      c64_status |= ST_READ_TIMEOUT;
+      return 0;
+    }
+
+    /* Acknowledge EOI */
+    data_out(0);
+    sim_c64_delay(T_EOI_ACK);
+    c64_status |= ST_EOI;
+    eoi = 1;
+  }
+
+  sim_check_data(1);
+  for (i = 0; i < 8; i++) {
+    if (!sim_c64_wait(SIM_CLOCK, SIM_CLOCK, T_FRAME)) {
+      c64_status |= ST_READ_TIMEOUT;
+      sim_violation("talker stopped in the middle of a byte");
+      break;
+    }
+    byte = (byte >> 1) | ((sim_lines() & SIM_DATA) ? 0x80 : 0);
+    if (!sim_c64_wait(SIM_CLOCK, 0, T_FRAME)) {
+      c64_status |= ST_READ_TIMEOUT;
+      sim_violation("talker stopped in the middle of a byte");
+      break;
+    }
+  }
+  sim_check_data(0);
+
+  /* Frame handshake */
+  data_out(0);
+  return byte;
+}
+
+/* UNLSN/UNTLK, $EDFE/$EDEF */
+static void unlisten_untalk(uint8_t cmd) {
+  send_atn(cmd);
+  atn_out(1);
+  sim_c64_delay(40 * US);
+  clock_out(1);
+  data_out(1);
+}
+
+void c64_unlisten(void) {
+  unlisten_untalk(0x3f);
+}
+
+void c64_untalk(void) {
+  clock_out(0);
+  atn_out(0);
+  unlisten_untalk(0x5f);
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*  File level                                                               */
+/* ------------------------------------------------------------------------- */
+
+/* OPENI, $F3D5 */
+int c64_open(uint8_t device, uint8_t secondary, const char *name) {
+  c64_listen(device);
+  c64_second(0xf0 | secondary);
+  if (c64_status & ST_NODEVICE)
+    return -1;
+
+  while (*name)
+    c64_ciout(*name++);
+  c64_unlisten();
+  return 0;
+}
+
+/* CLSEI, $F642 */
+void c64_close(uint8_t device, uint8_t secondary) {
+  c64_listen(device);
+  c64_second(0xe0 | secondary);
+  c64_unlisten();
+}
+
+/**
+ * c64_read - read from an open channel like CHKIN and CHRIN
+ * @device   : device address
+ * @secondary: secondary address of the channel
+ * @data     : buffer for the data
+ * @len      : number of bytes to read
+ *
+ * Returns the number of bytes read, which is less than len if the
+ * drive signalled EOI or an error occured.
+ */
+long c64_read(uint8_t device, uint8_t secondary, uint8_t *data, long len) {
+  long done = 0;
+
+  c64_talk(device);
+  c64_tksa(0x60 | secondary);
+  while (done < len) {
+    uint8_t byte = c64_acptr();
+
+    if (c64_status & ~ST_EOI)
+      break;
+    data[done++] = byte;
+    if (c64_status & ST_EOI)
+      break;
+    sim_c64_delay(T_LOOP);
+  }
+  sim_c64_delay(T_LOOP);
+  c64_untalk();
+
+  return done;
+}
+
+/**
+ * c64_write - write to an open channel like CKOUT and CHROUT
+ * @device   : device address
+ * @secondary: secondary address of the channel
+ * @data     : data to be written
+ * @len      : number of bytes
+ *
+ * Returns 0 if successful or -1 if the drive didn't respond.
+ */
+int c64_write(uint8_t device, uint8_t secondary, const uint8_t *data, long len) {
+  c64_listen(device);
+  c64_second(0x60 | secondary);
+  if (c64_status & ST_NODEVICE)
+    return -1;
+
+  while (len--)
+    c64_ciout(*data++);
+  c64_unlisten();
+
+  return (c64_status & ~ST_EOI) ? -1 : 0;
+}
+
+/**
+ * c64_load - LOAD a file like the KERNAL ($F4A5)
+ * @device: device address
+ * @name  : file name
+ * @data  : buffer for the file contents, including the load address
+ * @maxlen: size of the buffer
+ *
+ * Returns the number of bytes loaded or -1 if the file wasn't found.
+ */
+long c64_load(uint8_t device, const char *name, uint8_t *data, long maxlen) {
+  long len = 0;
+
+  if (c64_open(device, 0, name))
+    return -1;
+
+  c64_talk(device);
+  c64_tksa(0x60);
+
+  xfer_start();
+  do {
+    uint8_t byte = c64_acptr();
+
+    if (c64_status & ~ST_EOI) {
+      len = -1;
+      break;
+    }
+    xfer_byte();
+    if (len == maxlen) {
+      /* A real C64 would overwrite whatever follows */
+      sim_violation("LOAD did not end within %ld bytes", maxlen);
+      break;
+    }
+    data[len++] = byte;
+    sim_c64_delay(T_LOOP);
+  } while (!(c64_status & ST_EOI));
+
+  c64_untalk();
+  c64_close(device, 0);
+  return len;
+}
+
+/**
+ * c64_save - SAVE a file like the KERNAL ($F5ED)
+ * @device: device address
+ * @name  : file name
+ * @data  : file contents, including the load address
+ * @len   : length of the file
+ *
+ * Returns 0 if successful or -1 if the bus reported an error.
+ */
+int c64_save(uint8_t device, const char *name, const uint8_t *data, long len) {
+  if (c64_open(device, 1, name))
+    return -1;
+
+  c64_listen(device);
+  c64_second(0x61);
+
+  xfer_start();
+  while (len--) {
+    c64_ciout(*data++);
+    xfer_byte();
+    sim_c64_delay(T_LOOP);
+  }
+
+  c64_unlisten();
+  c64_close(device, 1);
+  return c64_status ? -1 : 0;
+}
+
+/**
+ * c64_read_error - read the error channel
+ * @device: device address
+ * @buffer: buffer for the message
+ * @maxlen: size of the buffer
+ *
+ * Returns the error number from the message.
+ */
+int c64_read_error(uint8_t device, char *buffer, int maxlen) {
+  int len = 0;
+
+  c64_talk(device);
+  c64_tksa(0x6f);
+  do {
+    uint8_t byte = c64_acptr();
+
+    if (c64_status & ~ST_EOI)
+      break;
+    if (len < maxlen - 1 && byte != 13)
+      buffer[len++] = byte;
+  } while (!(c64_status & ST_EOI));
+  c64_untalk();
+
+  buffer[len] = 0;
+  return atoi(buffer);
+}
+
+static int cmp_gap(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+  return (x > y) - (x < y);
+}
+
+/**
+ * c64_report - print the timing of the last transfer
+ * @title: description of the transfer
+ *
+ * A stall is a gap between two bytes that is more than twice as long
+ * as the median gap, i.e. the time the bus waits for the drive to
+ * read or write a block.
+ */
+void c64_report(const char *title) {
+  uint32_t *sorted, median, maxgap = 0, stalls = 0, i, n;
+  uint64_t stalltime = 0, elapsed = c64_xfer.end - c64_xfer.start;
+
+  n = c64_xfer.bytes > 1 ? c64_xfer.bytes - 1 : 0;
+  if (n == 0) {
+    printf("%-24s no data\n", title);
+    return;
+  }
+
+  sorted = malloc(n * sizeof(uint32_t));
+  memcpy(sorted, c64_xfer.gaps, n * sizeof(uint32_t));
+  qsort(sorted, n, sizeof(uint32_t), cmp_gap);
+  median = sorted[n / 2];
+  free(sorted);
+
+  for (i = 0; i < n; i++) {
+    if (c64_xfer.gaps[i] > 2 * median) {
+      stalls++;
+      stalltime += c64_xfer.gaps[i];
+      if (c64_xfer.gaps[i] > maxgap)
+        maxgap = c64_xfer.gaps[i];
+    }
+  }
+
+  printf("%-24s %6u bytes %8.1f bytes/s, %3u stalls, avg %6.2fms, max %6.2fms\n",
+         title, (unsigned)c64_xfer.bytes,
+         c64_xfer.bytes * 1e9 / (elapsed ? elapsed : 1), (unsigned)stalls,
+         stalls ? stalltime / 1e6 / stalls : 0.0, maxgap / 1e6);
+}
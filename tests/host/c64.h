@@ -0,0 +1,81 @@
+/* sd2iec - SD/MMC to Commodore serial bus interface/controller
+   Copyright (C) 2007-2017  Ingo Korb <ingo@akana.de>
+
+   Inspired by MMC2IEC by Lars Pontoppidan et al.
+
+   FAT filesystem access based on code from ChaN and Jim Brain, see ff.c|h.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License only.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+   c64.h: KERNAL serial bus routines of the simulated computer
+
+*/
+
+#ifndef C64_H
+#define C64_H
+
+#include <stdint.h>
+
+/* Bits of the KERNAL status variable ST */
+#define ST_WRITE_TIMEOUT 0x01
+#define ST_READ_TIMEOUT  0x02
+#define ST_EOI           0x40
+#define ST_NODEVICE      0x80
+
+extern uint8_t c64_status;
+
+/* Limit in ns for waits that never time out on a real C64 */
+extern uint64_t c64_hang;
+
+/**
+ * struct c64_xfer_t - timing of the last LOAD or SAVE
+ * @bytes : number of bytes transferred
+ * @start : virtual time of the first byte
+ * @end   : virtual time of the last byte
+ * @gaps  : time between each byte and its predecessor
+ *
+ * Filled by c64_load and c64_save, evaluated by c64_report.
+ */
+typedef struct {
+  uint32_t bytes;
+  uint64_t start;
+  uint64_t end;
+  uint32_t *gaps;
+} c64_xfer_t;
+
+extern c64_xfer_t c64_xfer;
+
+/* Low level routines, named like their KERNAL counterparts */
+void    c64_listen(uint8_t device);
+void    c64_second(uint8_t secondary);
+void    c64_talk(uint8_t device);
+void    c64_tksa(uint8_t secondary);
+void    c64_ciout(uint8_t byte);
+uint8_t c64_acptr(void);
+void    c64_unlisten(void);
+void    c64_untalk(void);
+
+/* High level routines, return 0 if successful */
+int     c64_open(uint8_t device, uint8_t secondary, const char *name);
+void    c64_close(uint8_t device, uint8_t secondary);
+long    c64_read(uint8_t device, uint8_t secondary, uint8_t *data, long len);
+int     c64_write(uint8_t device, uint8_t secondary, const uint8_t *data, long len);
+long    c64_load(uint8_t device, const char *name, uint8_t *data, long maxlen);
+int     c64_save(uint8_t device, const char *name, const uint8_t *data, long len);
+int     c64_read_error(uint8_t device, char *buffer, int maxlen);
+
+void    c64_report(const char *title);
+
+#endif
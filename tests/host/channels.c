@@ -0,0 +1,165 @@
+/* sd2iec - SD/MMC to Commodore serial bus interface/controller
+   Copyright (C) 2007-2017  Ingo Korb <ingo@akana.de>
+
+   Inspired by MMC2IEC by Lars Pontoppidan et al.
+
+   FAT filesystem access based on code from ChaN and Jim Brain, see ff.c|h.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License only.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+   channels.c: Open files on all channels at the same time
+
+   Opens a file on every secondary address the bus offers for files,
+   which needs every buffer of the drive. The channels are read in
+   small, interleaved pieces, which also aborts the interrupt-driven
+   sender in the middle of its queue when it is enabled.
+
+   The same is done with new files written on all channels. Their
+   batched writes borrow the following buffers, which must be given
+   back without corrupting the files they came from when another
+   channel is opened.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "config.h"
+#include "c64.h"
+#include "hostsim.h"
+#include "hosttest.h"
+
+#define DEVICE    8
+#define FIRST     2
+#define LAST      14
+#define FILESIZE  2000
+
+static uint8_t source[LAST + 1][FILESIZE];
+static uint8_t data[LAST + 1][FILESIZE];
+static long    done[LAST + 1];
+
+static void expect_error(int code) {
+  char msg[64];
+  int  res = c64_read_error(DEVICE, msg, sizeof(msg));
+
+  check(res == code, "error channel: expected %02d, got \"%s\"", code, msg);
+}
+
+static void read_channel(uint8_t sa, long len) {
+  if (done[sa] + len > FILESIZE)
+    len = FILESIZE - done[sa];
+  done[sa] += c64_read(DEVICE, sa, data[sa] + done[sa], len);
+}
+
+static void write_channel(uint8_t sa, long len) {
+  if (done[sa] + len > FILESIZE)
+    len = FILESIZE - done[sa];
+  c64_write(DEVICE, sa, source[sa] + done[sa], len);
+  done[sa] += len;
+}
+
+static void write_all(void) {
+  char    name[16];
+  uint8_t sa;
+  int     busy;
+  long    len;
+
+  memset(done, 0, sizeof(done));
+
+  /* Open all channels for writing, leaving the channels that were */
+  /* opened before with one or more blocks collected               */
+  for (sa = FIRST; sa <= LAST; sa++) {
+    sprintf(name, "NEW%d,P,W", sa);
+    c64_open(DEVICE, sa, name);
+    expect_error(0);
+    write_channel(sa, (sa & 1) ? 100 : 600);
+  }
+
+  do {
+    busy = 0;
+    for (sa = FIRST; sa <= LAST; sa++) {
+      if (done[sa] < FILESIZE) {
+        write_channel(sa, 97);
+        busy = 1;
+      }
+    }
+  } while (busy);
+
+  for (sa = FIRST; sa <= LAST; sa++)
+    c64_close(DEVICE, sa);
+  expect_error(0);
+
+  for (sa = FIRST; sa <= LAST; sa++) {
+    sprintf(name, "NEW%d", sa);
+    memset(data[sa], 0, FILESIZE);
+    len = c64_load(DEVICE, name, data[sa], FILESIZE);
+    check(len == FILESIZE && !memcmp(data[sa], source[sa], FILESIZE),
+          "channel %d wrote wrong data (%ld bytes)", sa, len);
+  }
+  expect_error(0);
+}
+
+static void script(void) {
+  char    name[16];
+  uint8_t sa;
+  int     busy;
+
+  expect_error(73);
+
+  /* Open all channels for reading, leaving the channels that were */
+  /* opened before in the middle of their first or second block    */
+  for (sa = FIRST; sa <= LAST; sa++) {
+    sprintf(name, "FILE%d.PRG", sa);
+    c64_open(DEVICE, sa, name);
+    expect_error(0);
+    read_channel(sa, (sa & 1) ? 100 : 300);
+  }
+
+  /* Read everything in small pieces */
+  do {
+    busy = 0;
+    for (sa = FIRST; sa <= LAST; sa++) {
+      if (done[sa] < FILESIZE) {
+        read_channel(sa, 97);
+        busy = 1;
+      }
+    }
+  } while (busy);
+
+  for (sa = FIRST; sa <= LAST; sa++) {
+    check(!memcmp(data[sa], source[sa], FILESIZE),
+          "channel %d read wrong data", sa);
+    c64_close(DEVICE, sa);
+  }
+  expect_error(0);
+
+  write_all();
+}
+
+int main(void) {
+  char    name[16];
+  uint8_t sa;
+
+  host_boot("channels.img", 65536);
+  for (sa = FIRST; sa <= LAST; sa++) {
+    host_fill(source[sa], FILESIZE, sa);
+    sprintf(name, "FILE%d.PRG", sa);
+    check(host_put_file(name, source[sa], FILESIZE) == 0,
+          "can't create %s", name);
+  }
+
+  check(sim_run(script, 600000000000ULL) == 0, "bus script did not finish");
+
+  return host_result("channels");
+}
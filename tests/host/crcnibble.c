@@ -0,0 +1,95 @@
+/* sd2iec - SD/MMC to Commodore serial bus interface/controller
+   Copyright (C) 2007-2017  Ingo Korb <ingo@akana.de>
+
+   Inspired by MMC2IEC by Lars Pontoppidan et al.
+
+   FAT filesystem access based on code from ChaN and Jim Brain, see ff.c|h.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License only.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+   crcnibble.c: CONFIG_CRC_NIBBLE against a bitwise CRC-XModem
+
+   Compares the nibble table version of crc_xmodem_update from
+   avr/crc.h with a bit-at-a-time reference for every combination
+   of CRC register and data byte, then checks crc_xmodem_block on
+   blocks of all lengths up to a sector and the standard check value.
+
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "avr/crc.h"
+
+/* MSB first, polynomial 0x1021, one bit per step */
+static uint16_t crc_bitwise(uint16_t crc, uint8_t data) {
+  uint8_t bit;
+
+  for (bit = 0x80; bit != 0; bit >>= 1) {
+    uint16_t msb = crc & 0x8000;
+
+    crc <<= 1;
+    if (!!msb != !!(data & bit))
+      crc ^= 0x1021;
+  }
+  return crc;
+}
+
+int main(void) {
+  static uint8_t block[512];
+  unsigned long errors = 0;
+  unsigned int crc, data, len;
+  uint16_t ref;
+
+  for (crc = 0; crc < 0x10000; crc++) {
+    for (data = 0; data < 0x100; data++) {
+      if (crc_xmodem_update(crc, data) != crc_bitwise(crc, data)) {
+        if (errors++ < 10)
+          printf("update(%04x, %02x): %04x, expected %04x\n", crc, data,
+                 crc_xmodem_update(crc, data), crc_bitwise(crc, data));
+      }
+    }
+  }
+  printf("%lu of 16777216 updates differ\n", errors);
+
+  srand(1541);
+  for (len = 0; len < sizeof(block); len++)
+    block[len] = rand();
+
+  for (len = 0; len <= sizeof(block); len++) {
+    ref = 0;
+    for (data = 0; data < len; data++)
+      ref = crc_bitwise(ref, block[data]);
+    if (crc_xmodem_block(0, block, len) != ref) {
+      printf("block of %u bytes: %04x, expected %04x\n", len,
+             crc_xmodem_block(0, block, len), ref);
+      errors++;
+    }
+  }
+
+  /* CRC-16/XMODEM check value */
+  if (crc_xmodem_block(0, (const uint8_t *)"123456789", 9) != 0x31c3) {
+    printf("check value: %04x, expected 31c3\n",
+           crc_xmodem_block(0, (const uint8_t *)"123456789", 9));
+    errors++;
+  }
+
+  if (errors) {
+    printf("crcnibble: %lu mismatches\n", errors);
+    return 1;
+  }
+  printf("crcnibble: OK\n");
+  return 0;
+}
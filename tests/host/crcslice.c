@@ -0,0 +1,206 @@
+/* sd2iec - SD/MMC to Commodore serial bus interface/controller
+   Copyright (C) 2007-2017  Ingo Korb <ingo@akana.de>
+
+   Inspired by MMC2IEC by Lars Pontoppidan et al.
+
+   FAT filesystem access based on code from ChaN and Jim Brain, see ff.c|h.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License only.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+   crcslice.c: C model of the CONFIG_CRC_SLICES kernel in lpc17xx/crc.S
+
+   Reads the CRC-XModem tables from lpc17xx/crc.S and checks each
+   entry, then runs a step by step C model of crc_xmodem_block for
+   four and eight slices against a bit-at-a-time CRC. Random buffers
+   are checked with every start alignment and every length up to a
+   sector plus one slice, so each alignment and tail loop count is
+   covered.
+
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TABLES 8
+
+static uint16_t table[TABLES * 256];
+
+/* MSB first, polynomial 0x1021, one bit per step */
+static uint16_t crc_bitwise(uint16_t crc, uint8_t data) {
+  uint8_t bit;
+
+  for (bit = 0x80; bit != 0; bit >>= 1) {
+    uint16_t msb = crc & 0x8000;
+
+    crc <<= 1;
+    if (!!msb != !!(data & bit))
+      crc ^= 0x1021;
+  }
+  return crc;
+}
+
+/* Collects the .short values from crc_xmodem_table on, returns their number */
+static unsigned read_tables(const char *name) {
+  char     line[256];
+  unsigned count = 0;
+  int      found = 0;
+  FILE    *file  = fopen(name, "r");
+
+  if (file == NULL) {
+    perror(name);
+    exit(2);
+  }
+
+  while (fgets(line, sizeof(line), file)) {
+    char *ptr = line + strspn(line, " \t");
+
+    if (!found) {
+      found = !strncmp(ptr, "crc_xmodem_table:", 17);
+      continue;
+    }
+    if (strncmp(ptr, ".short", 6))
+      continue;
+
+    ptr += 6;
+    while (count < TABLES * 256) {
+      char *end;
+
+      table[count] = strtoul(ptr, &end, 0);
+      if (end == ptr)
+        break;
+      count++;
+      ptr = end + strspn(end, " \t,");
+    }
+  }
+  fclose(file);
+  return count;
+}
+
+/* crcbyte */
+static uint16_t crcbyte(uint16_t crc, const uint8_t **data) {
+  return table[*(*data)++ ^ (crc >> 8)] ^ (uint16_t)(crc << 8);
+}
+
+/* crcword: table tab+3 for the lowest byte, table tab for the highest */
+static uint16_t crcword(uint16_t crc, uint32_t word, unsigned tab) {
+  crc ^= table[(tab + 3) * 256 + ( word        & 0xff)];
+  crc ^= table[(tab + 2) * 256 + ((word >>  8) & 0xff)];
+  crc ^= table[(tab + 1) * 256 + ((word >> 16) & 0xff)];
+  crc ^= table[ tab      * 256 +  (word >> 24)];
+  return crc;
+}
+
+/* ldr r3, [r1], #4 on the little-endian Cortex M3 */
+static uint32_t ldr(const uint8_t **data) {
+  const uint8_t *p = *data;
+
+  *data += 4;
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/* crc_xmodem_block with CONFIG_CRC_SLICES set to slices */
+static uint16_t crc_model(uint16_t crc, const uint8_t *data, uint32_t len,
+                          unsigned slices) {
+  /* alignloop */
+  while ((uintptr_t)data & 3) {
+    if (len == 0)
+      return crc;
+    crc = crcbyte(crc, &data);
+    len--;
+  }
+
+  /* slicecheck, sliceloop */
+  while (len >= slices) {
+    uint32_t word = ldr(&data);
+    /* rev16: the CRC high byte goes to the lowest data byte */
+    word ^= (crc >> 8) | (crc & 0xff) << 8;
+    crc = 0;
+    if (slices > 4) {
+      crc  = crcword(crc, word, 4);
+      word = ldr(&data);
+    }
+    crc = crcword(crc, word, 0);
+    len -= slices;
+  }
+
+  /* tailloop */
+  while (len--)
+    crc = crcbyte(crc, &data);
+
+  return crc;
+}
+
+int main(void) {
+  static uint32_t words[(512 + 16) / 4];
+  uint8_t *block = (uint8_t *)words;
+  unsigned long errors = 0, blocks = 0;
+  unsigned int count, tab, i, slices, offset, len, round;
+  uint16_t ref;
+
+  count = read_tables("../../src/lpc17xx/crc.S");
+  if (count != TABLES * 256) {
+    printf("crc.S: %u table entries, expected %u\n", count, TABLES * 256);
+    return 1;
+  }
+
+  /* table t: CRC of the index byte followed by t zero bytes */
+  for (tab = 0; tab < TABLES; tab++) {
+    for (i = 0; i < 256; i++) {
+      ref = crc_bitwise(0, i);
+      for (count = 0; count < tab; count++)
+        ref = crc_bitwise(ref, 0);
+      if (table[tab * 256 + i] != ref) {
+        if (errors++ < 10)
+          printf("table %u entry %02x: %04x, expected %04x\n", tab, i,
+                 table[tab * 256 + i], ref);
+      }
+    }
+  }
+
+  srand(1541);
+  for (round = 0; round < 16; round++) {
+    for (i = 0; i < sizeof(words); i++)
+      block[i] = rand();
+
+    for (offset = 0; offset < 8; offset++) {
+      for (len = 0; offset + len <= sizeof(words); len++) {
+        uint16_t start = rand();
+
+        ref = start;
+        for (i = 0; i < len; i++)
+          ref = crc_bitwise(ref, block[offset + i]);
+
+        for (slices = 4; slices <= 8; slices += 4) {
+          uint16_t crc = crc_model(start, block + offset, len, slices);
+
+          blocks++;
+          if (crc != ref && errors++ < 10)
+            printf("%u slices, offset %u, %u bytes: %04x, expected %04x\n",
+                   slices, offset, len, crc, ref);
+        }
+      }
+    }
+  }
+  printf("%lu blocks checked\n", blocks);
+
+  if (errors) {
+    printf("crcslice: %lu mismatches\n", errors);
+    return 1;
+  }
+  printf("crcslice: OK\n");
+  return 0;
+}
@@ -0,0 +1,139 @@
+/* sd2iec - SD/MMC to Commodore serial bus interface/controller
+   Copyright (C) 2007-2017  Ingo Korb <ingo@akana.de>
+
+   Inspired by MMC2IEC by Lars Pontoppidan et al.
+
+   FAT filesystem access based on code from ChaN and Jim Brain, see ff.c|h.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License only.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+   d64queue.c: Open channels while saved image sectors are queued
+
+   Writes a file into a D64 image on channel 2 and opens another file
+   on the next channel before ending the LISTEN, which runs the OPEN
+   while the write-behind queue still holds every free buffer. This is
+   repeated until all channels are open, followed by a directory LOAD
+   in the same situation. The queue must give its buffers back instead
+   of failing with 70,NO CHANNEL. All files are read back and compared.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "config.h"
+#include "c64.h"
+#include "hostsim.h"
+#include "hosttest.h"
+
+#define DEVICE    8
+#define FIRST     3
+#define LAST      14
+#define FILESIZE  600
+#define CHUNK     (254 * CONFIG_D64_WRITEBEHIND)
+#define BIGSIZE   (CHUNK * (LAST - FIRST + 2))
+
+static uint8_t source[LAST + 1][FILESIZE];
+static uint8_t data[FILESIZE];
+static uint8_t big[BIGSIZE];
+static uint8_t loaded[BIGSIZE + 256];
+static uint8_t image[HOST_D64_SIZE];
+
+static void expect_error(int code) {
+  char msg[64];
+  int  res = c64_read_error(DEVICE, msg, sizeof(msg));
+
+  check(res == code, "error channel: expected %02d, got \"%s\"", code, msg);
+}
+
+/* Send a part of the big file without ending the LISTEN */
+static void send_chunk(long *pos) {
+  long i;
+
+  c64_listen(DEVICE);
+  c64_second(0x60 | 2);
+  for (i = 0; i < CHUNK; i++)
+    c64_ciout(big[(*pos)++]);
+}
+
+static void script(void) {
+  char    name[16];
+  long    pos = 0, len;
+  uint8_t sa;
+
+  expect_error(73);
+
+  c64_open(DEVICE, 15, "CD:QUEUE.D64");
+  c64_close(DEVICE, 15);
+  expect_error(0);
+
+  for (sa = FIRST; sa <= LAST; sa++) {
+    sprintf(name, "FILE%02u", sa);
+    check(c64_save(DEVICE, name, source[sa], FILESIZE) == 0,
+          "SAVE of %s failed", name);
+  }
+  expect_error(0);
+
+  c64_open(DEVICE, 2, "BIG,S,W");
+  expect_error(0);
+
+  /* OPEN runs before the drive sees the end of the LISTEN */
+  for (sa = FIRST; sa <= LAST; sa++) {
+    send_chunk(&pos);
+    sprintf(name, "FILE%02u", sa);
+    c64_open(DEVICE, sa, name);
+    expect_error(0);
+  }
+
+  /* A directory needs a buffer as well */
+  send_chunk(&pos);
+  c64_unlisten();
+  len = c64_load(DEVICE, "$", loaded, sizeof(loaded));
+  check(len > 0, "directory LOAD returned %ld bytes", len);
+  expect_error(0);
+
+  for (sa = FIRST; sa <= LAST; sa++) {
+    memset(data, 0, sizeof(data));
+    len = c64_read(DEVICE, sa, data, FILESIZE);
+    check(len == FILESIZE && !memcmp(data, source[sa], FILESIZE),
+          "channel %u: data mismatch", sa);
+    c64_close(DEVICE, sa);
+  }
+  c64_close(DEVICE, 2);
+  expect_error(0);
+
+  c64_open(DEVICE, 2, "BIG,S,R");
+  len = c64_read(DEVICE, 2, loaded, sizeof(loaded));
+  c64_close(DEVICE, 2);
+  check(len == BIGSIZE, "read %ld bytes of BIG", len);
+  check(!memcmp(loaded, big, BIGSIZE), "BIG data mismatch");
+  expect_error(0);
+}
+
+int main(void) {
+  uint8_t sa;
+
+  for (sa = FIRST; sa <= LAST; sa++)
+    host_fill(source[sa], FILESIZE, sa);
+  host_fill(big, BIGSIZE, 99);
+  host_boot("d64queue.img", 65536);
+
+  host_blank_d64(image, "QUEUETEST");
+  check(host_put_file("QUEUE.D64", image, HOST_D64_SIZE) == 0,
+        "can't create QUEUE.D64");
+
+  check(sim_run(script, 600000000000ULL) == 0, "bus script did not finish");
+
+  return host_result("d64queue");
+}
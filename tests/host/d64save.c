@@ -0,0 +1,161 @@
+/* sd2iec - SD/MMC to Commodore serial bus interface/controller
+   Copyright (C) 2007-2017  Ingo Korb <ingo@akana.de>
+
+   Inspired by MMC2IEC by Lars Pontoppidan et al.
+
+   FAT filesystem access based on code from ChaN and Jim Brain, see ff.c|h.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License only.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+   d64save.c: SAVE into a D64 image
+
+   Saves a 160 block file into an empty D64 image and reports the
+   throughput and the card accesses. Built with and without
+   CONFIG_D64_WRITEBEHIND to compare the queued sector writes with
+   a synchronised write of every sector. With the queue, sectors that
+   share a card sector must reach the card in one write, which also
+   saves reading the other half first. The file is loaded back and
+   the image is checked for the directory entry, the BAM and the
+   sector chain.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "config.h"
+#include "c64.h"
+#include "hostsim.h"
+#include "hosttest.h"
+#include "ramdisk.h"
+
+#define DEVICE   8
+#define BLOCKS   160
+#define FILESIZE (BLOCKS * 254)
+
+static uint8_t source[FILESIZE];
+static uint8_t loaded[FILESIZE + 256];
+static uint8_t image[HOST_D64_SIZE];
+static ramdisk_stats_t save_io;
+
+static void expect_error(int code) {
+  char msg[64];
+  int  res = c64_read_error(DEVICE, msg, sizeof(msg));
+
+  check(res == code, "error channel: expected %02d, got \"%s\"", code, msg);
+}
+
+static void script(void) {
+  ramdisk_stats_t start;
+  long len;
+
+  expect_error(73);
+
+  c64_open(DEVICE, 15, "CD:SAVE.D64");
+  c64_close(DEVICE, 15);
+  expect_error(0);
+
+  start = ramdisk_stats;
+  check(c64_save(DEVICE, "SAVED", source, FILESIZE) == 0, "SAVE failed");
+  save_io.write_cmds    = ramdisk_stats.write_cmds    - start.write_cmds;
+  save_io.write_sectors = ramdisk_stats.write_sectors - start.write_sectors;
+  save_io.read_cmds     = ramdisk_stats.read_cmds     - start.read_cmds;
+  c64_report("SAVE");
+  expect_error(0);
+
+  len = c64_load(DEVICE, "SAVED", loaded, sizeof(loaded));
+  check(len == FILESIZE, "LOAD of saved file returned %ld bytes", len);
+  check(!memcmp(loaded, source, FILESIZE), "LOAD of saved file data mismatch");
+  expect_error(0);
+
+  c64_open(DEVICE, 15, "CD:\x5f");
+  c64_close(DEVICE, 15);
+  expect_error(0);
+}
+
+static uint8_t *sector(uint8_t track, uint8_t sec) {
+  unsigned ofs = 0, t;
+
+  for (t = 1; t < track; t++)
+    ofs += t <= 17 ? 21 : t <= 24 ? 19 : t <= 30 ? 18 : 17;
+  return image + 256 * (ofs + sec);
+}
+
+static void check_image(void) {
+  uint8_t *bam = image + HOST_D64_BAM;
+  uint8_t *dir = sector(18, 1);
+  uint8_t  used[35 * 21];
+  unsigned blocks = 0, unused = 0, t;
+  uint8_t  tr, se;
+
+  memset(used, 0, sizeof(used));
+  check(host_get_file("SAVE.D64", image, sizeof(image)) == HOST_D64_SIZE,
+        "can't read the image");
+
+  check(dir[2] == 0x82 && !memcmp(dir + 5, "SAVED\xa0", 6),
+        "no directory entry");
+  check(dir[0x1e] + 256 * dir[0x1f] == BLOCKS,
+        "directory entry has %u blocks", dir[0x1e] + 256 * dir[0x1f]);
+
+  tr = dir[3];
+  se = dir[4];
+  while (tr && blocks <= BLOCKS) {
+    uint8_t *data = sector(tr, se);
+    uint8_t *entry = bam + 4 * tr;
+    unsigned len = data[0] ? 254 : data[1] - 1;
+
+    check(!(entry[1 + se / 8] & (1 << (se & 7))),
+          "sector %u/%u is free in the BAM", tr, se);
+    check(!used[(tr - 1) * 21 + se], "sector %u/%u used twice", tr, se);
+    used[(tr - 1) * 21 + se] = 1;
+    check(!memcmp(data + 2, source + 254 * blocks, len),
+          "block %u at %u/%u has wrong data", blocks, tr, se);
+
+    blocks++;
+    tr = data[0];
+    se = data[1];
+  }
+  check(blocks == BLOCKS, "sector chain has %u blocks", blocks);
+
+  for (t = 1; t <= 35; t++)
+    if (t != 18)
+      unused += bam[4 * t];
+  check(unused == 664 - BLOCKS, "BAM has %u blocks free", unused);
+}
+
+int main(void) {
+  host_fill(source, FILESIZE, 18);
+  host_boot("d64save.img", 65536);
+
+  host_blank_d64(image, "SAVETEST");
+  check(host_put_file("SAVE.D64", image, HOST_D64_SIZE) == 0,
+        "can't create SAVE.D64");
+
+  check(sim_run(script, 600000000000ULL) == 0, "bus script did not finish");
+  check_image();
+
+  printf("disk: %u reads, %u writes (%u sectors) for %u blocks\n",
+         (unsigned)save_io.read_cmds, (unsigned)save_io.write_cmds,
+         (unsigned)save_io.write_sectors, BLOCKS);
+
+#ifdef CONFIG_D64_WRITEBEHIND
+  /* Sectors sharing a card sector must be merged into one write */
+  check(save_io.write_cmds < BLOCKS * 2 / 3,
+        "%u card writes for %u blocks", (unsigned)save_io.write_cmds, BLOCKS);
+  check(save_io.read_cmds < BLOCKS / 3,
+        "%u card reads for %u blocks", (unsigned)save_io.read_cmds, BLOCKS);
+#endif
+
+  return host_result("d64save");
+}
@@ -0,0 +1,193 @@
+/* sd2iec - SD/MMC to Commodore serial bus interface/controller
+   Copyright (C) 2007-2017  Ingo Korb <ingo@akana.de>
+
+   Inspired by MMC2IEC by Lars Pontoppidan et al.
+
+   FAT filesystem access based on code from ChaN and Jim Brain, see ff.c|h.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License only.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+   dirhash.c: Random opens in a large FAT directory
+
+   Creates 1800 files in a subdirectory, two thirds of them with long
+   names, for about 4200 directory entries, and deletes every seventh
+   one. Then files are loaded over
+   the bus in random order, existing and deleted ones, with a rename
+   and a SAVE in between that change the directory. The card reads
+   per open are reported, built with and without CONFIG_FAT_DIRHASH.
+   Once the hash covers the whole directory, a missing name must be
+   rejected without a scan. The SAVE creates a P00 file, whose CBM
+   name only a scan can find, so later misses are counted apart.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "config.h"
+#include "c64.h"
+#include "hostsim.h"
+#include "hosttest.h"
+#include "ramdisk.h"
+
+#define DEVICE   8
+#define FILES    1800
+#define OPENS    600
+
+static ramdisk_stats_t found_io, missing_io[2];
+static unsigned found, missing[2];
+static int      renamed;
+static int      changed;   /* 1 after the rename, the P00 file follows */
+static uint32_t seed = 12345;
+
+static void expect_error(int code) {
+  char msg[64];
+  int  res = c64_read_error(DEVICE, msg, sizeof(msg));
+
+  check(res == code, "error channel: expected %02d, got \"%s\"", code, msg);
+}
+
+static void add_stats(ramdisk_stats_t *sum, const ramdisk_stats_t *start) {
+  sum->read_cmds    += ramdisk_stats.read_cmds    - start->read_cmds;
+  sum->read_sectors += ramdisk_stats.read_sectors - start->read_sectors;
+}
+
+static unsigned random_file(void) {
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 8) % FILES;
+}
+
+static int is_deleted(unsigned i) {
+  return i % 7 == 3;
+}
+
+/* Name of file i: 8.3 only for every third, long for the others */
+static void file_name(char *name, unsigned i) {
+  if (i % 3 == 0)
+    sprintf(name, "G%04u", i);
+  else
+    sprintf(name, "GAME NUMBER %04u", i);
+}
+
+static void command(const char *cmd) {
+  c64_open(DEVICE, 15, cmd);
+  c64_close(DEVICE, 15);
+}
+
+static void load(const char *name, int exists, unsigned i) {
+  ramdisk_stats_t start = ramdisk_stats;
+  uint8_t data[16];
+  long    len;
+
+  len = c64_load(DEVICE, name, data, sizeof(data));
+  if (exists) {
+    add_stats(&found_io, &start);
+    found++;
+    check(len == 4 && data[2] == (i & 0xff) && data[3] == (i >> 8),
+          "wrong contents of %s", name);
+    expect_error(0);
+  } else {
+    add_stats(&missing_io[changed], &start);
+    missing[changed]++;
+    check(len < 0, "%s should not exist", name);
+    expect_error(62);
+  }
+}
+
+static void random_loads(unsigned count) {
+  char     name[20];
+  unsigned i;
+
+  while (count--) {
+    i = random_file();
+    file_name(name, i);
+    load(name, !is_deleted(i) && !(renamed && i == 5), i);
+  }
+}
+
+static void script(void) {
+  static const uint8_t saved[4] = { 0x01, 0x08, FILES & 0xff, FILES >> 8 };
+
+  expect_error(73);
+  command("CD:GAMES");
+  expect_error(0);
+
+  /* The first miss reads the whole directory and completes the hash */
+  load("NO SUCH GAME", 0, 0);
+  memset(&missing_io[0], 0, sizeof(missing_io[0]));
+  missing[0] = 0;
+
+  random_loads(OPENS / 2);
+  changed = 1;
+
+  /* Both change the directory, so its hash must be built again */
+  command("R:RENAMED 0005=GAME NUMBER 0005");
+  expect_error(0);
+  renamed = 1;
+  load("GAME NUMBER 0005", 0, 5);
+  load("RENAMED 0005", 1, 5);
+
+  check(c64_save(DEVICE, "NEW GAME", saved, sizeof(saved)) == 0,
+        "SAVE failed");
+  expect_error(0);
+  load("NEW GAME", 1, FILES);
+
+  random_loads(OPENS / 2);
+}
+
+int main(void) {
+  uint8_t  data[4] = { 0x01, 0x08, 0, 0 };
+  char     name[32];
+  unsigned i;
+
+  host_boot("dirhash.img", 65536);
+
+  /* Without the hash, an open scans the directory while the bus waits */
+  c64_hang = 10000000000ULL;
+
+  check(host_mkdir("GAMES") == 0, "can't create GAMES");
+  for (i = 0; i < FILES; i++) {
+    strcpy(name, "GAMES/");
+    file_name(name + 6, i);
+    data[2] = i & 0xff;
+    data[3] = i >> 8;
+    check(host_put_file(name, data, sizeof(data)) == 0,
+          "can't create %s", name);
+  }
+  for (i = 0; i < FILES; i++) {
+    if (!is_deleted(i))
+      continue;
+    strcpy(name, "GAMES/");
+    file_name(name + 6, i);
+    check(host_delete(name) == 0, "can't delete %s", name);
+  }
+
+  check(sim_run(script, 6000000000000ULL) == 0, "bus script did not finish");
+
+  printf("%u opens of existing files: %.1f card reads (%.1f sectors) each\n",
+         found, (double)found_io.read_cmds / found,
+         (double)found_io.read_sectors / found);
+  printf("%u opens of missing files: %.1f card reads (%.1f sectors) each\n",
+         missing[0], (double)missing_io[0].read_cmds / missing[0],
+         (double)missing_io[0].read_sectors / missing[0]);
+  printf("%u after the changes (P00 file): %.1f card reads (%.1f sectors) each\n",
+         missing[1], (double)missing_io[1].read_cmds / missing[1],
+         (double)missing_io[1].read_sectors / missing[1]);
+#ifdef CONFIG_FAT_DIRHASH
+  check(missing_io[0].read_cmds < 4 * missing[0],
+        "missing names were searched in the directory");
+#endif
+
+  return host_result("dirhash");
+}
@@ -0,0 +1,147 @@
+/* sd2iec - SD/MMC to Commodore serial bus interface/controller
+   Copyright (C) 2007-2017  Ingo Korb <ingo@akana.de>
+
+   Inspired by MMC2IEC by Lars Pontoppidan et al.
+
+   FAT filesystem access based on code from ChaN and Jim Brain, see ff.c|h.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License only.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+   dirlist.c: Directory listing of 2000 FAT files
+
+   Creates 2000 files in a subdirectory, two thirds of them with long
+   names, and loads its directory listing over the bus. Every file
+   must be listed in the order it was created. The time, the stalls
+   of the bus and the card reads of the listing are reported.
+   The simulation advances the time for bus delays and card transfers
+   only, so the work of dir_refill per line is not part of the time.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "config.h"
+#include "c64.h"
+#include "hostsim.h"
+#include "hosttest.h"
+#include "ramdisk.h"
+
+#define DEVICE   8
+#define FILES    2000
+/* BASIC line of each file, header and "BLOCKS FREE." */
+#define LISTSIZE ((FILES + 2) * 32 + 2)
+
+static uint8_t         listing[LISTSIZE];
+static ramdisk_stats_t list_io;
+static uint64_t        list_time;
+
+static void expect_error(int code) {
+  char msg[64];
+  int  res = c64_read_error(DEVICE, msg, sizeof(msg));
+
+  check(res == code, "error channel: expected %02d, got \"%s\"", code, msg);
+}
+
+static void command(const char *cmd) {
+  c64_open(DEVICE, 15, cmd);
+  c64_close(DEVICE, 15);
+}
+
+/* Name of file i: 8.3 only for every third, long for the others */
+static void file_name(char *name, unsigned i) {
+  if (i % 3 == 0)
+    sprintf(name, "G%04u", i);
+  else
+    sprintf(name, "game number %04u", i);
+}
+
+/* Name of file i in the listing, long names are lower case ASCII */
+static void listed_name(char *name, unsigned i) {
+  if (i % 3 == 0)
+    sprintf(name, "\"G%04u\"", i);
+  else
+    sprintf(name, "\"GAME NUMBER %04u\"", i);
+}
+
+/* Checks that the listing has all files in the order they were created */
+static void check_listing(long len) {
+  char     name[32];
+  unsigned line = 0, files = 0;
+  long     pos = 2;
+
+  check(len > 2, "no directory listing");
+  while (pos + 4 < len && (listing[pos] || listing[pos + 1])) {
+    uint8_t *text  = listing + pos + 4;
+    uint8_t *quote = memchr(text, '"', len - pos - 4);
+
+    /* The first line is the header, the last one has no quotes */
+    if (line++ > 0 && quote != NULL && quote - text < 8) {
+      listed_name(name, files);
+      if (memcmp(quote, name, strlen(name))) {
+        check(0, "entry %u is not %s", files, name);
+        return;
+      }
+      files++;
+    }
+
+    while (pos < len && listing[pos + 4])
+      pos++;
+    pos += 5;
+  }
+  check(files == FILES, "listing has %u files", files);
+}
+
+static void script(void) {
+  ramdisk_stats_t start;
+  uint64_t        begin;
+  long            len;
+
+  expect_error(73);
+  command("CD:GAMES");
+  expect_error(0);
+
+  start = ramdisk_stats;
+  begin = sim_now;
+  len = c64_load(DEVICE, "$", listing, sizeof(listing));
+  list_time         = sim_now - begin;
+  list_io.read_cmds = ramdisk_stats.read_cmds - start.read_cmds;
+  c64_report("listing");
+  expect_error(0);
+  check_listing(len);
+}
+
+int main(void) {
+  uint8_t  data[4] = { 0x01, 0x08, 0, 0 };
+  char     name[32];
+  unsigned i;
+
+  host_boot("dirlist.img", 65536);
+
+  check(host_mkdir("GAMES") == 0, "can't create GAMES");
+  for (i = 0; i < FILES; i++) {
+    strcpy(name, "GAMES/");
+    file_name(name + 6, i);
+    check(host_put_file(name, data, sizeof(data)) == 0,
+          "can't create %s", name);
+  }
+
+  check(sim_run(script, 6000000000000ULL) == 0, "bus script did not finish");
+
+  printf("%u lines: %8.1fms, %.3fms and %.2f card reads per line\n",
+         FILES, list_time / 1e6, list_time / 1e6 / FILES,
+         (double)list_io.read_cmds / FILES);
+
+  return host_result("dirlist");
+}
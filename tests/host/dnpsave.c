@@ -0,0 +1,176 @@
+/* sd2iec - SD/MMC to Commodore serial bus interface/controller
+   Copyright (C) 2007-2017  Ingo Korb <ingo@akana.de>
+
+   Inspired by MMC2IEC by Lars Pontoppidan et al.
+
+   FAT filesystem access based on code from ChaN and Jim Brain, see ff.c|h.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License only.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+   dnpsave.c: SAVE of a 1 MB file into a DNP image
+
+   Formats an empty 2 MB DNP image over the bus and saves a 1 MB file
+   into it. The BAM of a DNP spans 32 sectors (1/2 to 1/33) and the
+   file covers the BAM entries of three of them. The card writes to
+   the BAM sectors during the SAVE are counted, built without the
+   write-behind queue and the free sector summary so every BAM access
+   goes through the BAM buffers, with CONFIG_D64_BAM_BUFFERS=4 and
+   with two buffers (bam2 variant). Each BAM sector must be written
+   at most twice instead of once per allocated block. The image is
+   checked for the directory entry, the sector chain and the BAM
+   afterwards.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "config.h"
+#include "c64.h"
+#include "hostsim.h"
+#include "hosttest.h"
+#include "ramdisk.h"
+
+#define DEVICE    8
+#define TRACKS    32
+#define DNP_SIZE  (TRACKS * 65536)
+#define FILESIZE  (1024 * 1024)
+#define BLOCKS    ((FILESIZE + 253) / 254)
+/* BAM sectors holding the entries of tracks 2 to the last file track */
+#define BAM_SECTORS ((2 + BLOCKS / 256) / 8 + 1)
+
+static uint8_t source[FILESIZE];
+static uint8_t image[DNP_SIZE];
+static ramdisk_stats_t save_io;
+
+static void expect_error(int code) {
+  char msg[64];
+  int  res = c64_read_error(DEVICE, msg, sizeof(msg));
+
+  check(res == code, "error channel: expected %02d, got \"%s\"", code, msg);
+}
+
+static void command(const char *cmd) {
+  c64_open(DEVICE, 15, cmd);
+  c64_close(DEVICE, 15);
+}
+
+static void script(void) {
+  ramdisk_stats_t start;
+
+  expect_error(73);
+
+  command("CD:SAVE.DNP");
+  expect_error(0);
+  command("N:DNPTEST,ID");
+  expect_error(0);
+
+  /* The BAM is written back when the bus is idle, which is counted too */
+  start = ramdisk_stats;
+  check(c64_save(DEVICE, "BIG", source, FILESIZE) == 0, "SAVE failed");
+  c64_report("SAVE");
+  expect_error(0);
+  save_io.write_cmds   = ramdisk_stats.write_cmds   - start.write_cmds;
+  save_io.watch_writes = ramdisk_stats.watch_writes - start.watch_writes;
+
+  command("CD:\x5f");
+  expect_error(0);
+}
+
+static uint8_t *sector(uint8_t track, uint8_t sec) {
+  return image + 256 * ((track - 1) * 256 + sec);
+}
+
+/* DNP BAM: one bit per sector, most significant bit first, set if free */
+static int is_free(uint8_t track, uint8_t sec) {
+  uint8_t *bam = sector(1, 2) + 32 * track;
+
+  return bam[sec / 8] & (0x80 >> (sec & 7));
+}
+
+static void check_image(void) {
+  uint8_t *dir = sector(1, 34);
+  static uint8_t used[TRACKS * 256];
+  unsigned blocks = 0, used_blocks = 0, t, s;
+  uint8_t  tr, se;
+
+  check(host_get_file("SAVE.DNP", image, sizeof(image)) == DNP_SIZE,
+        "can't read the image");
+
+  check(dir[2] == 0x82 && !memcmp(dir + 5, "BIG\xa0", 4),
+        "no directory entry");
+  check(dir[0x1e] + 256 * dir[0x1f] == BLOCKS,
+        "directory entry has %u blocks", dir[0x1e] + 256 * dir[0x1f]);
+
+  tr = dir[3];
+  se = dir[4];
+  while (tr && blocks <= BLOCKS) {
+    uint8_t *data = sector(tr, se);
+    unsigned len = data[0] ? 254 : data[1] - 1;
+
+    if (tr > TRACKS) {
+      check(0, "block %u is on track %u", blocks, tr);
+      break;
+    }
+    check(!is_free(tr, se), "sector %u/%u is free in the BAM", tr, se);
+    check(!used[(tr - 1) * 256 + se], "sector %u/%u used twice", tr, se);
+    used[(tr - 1) * 256 + se] = 1;
+    check(!memcmp(data + 2, source + 254 * blocks, len),
+          "block %u at %u/%u has wrong data", blocks, tr, se);
+
+    blocks++;
+    tr = data[0];
+    se = data[1];
+  }
+  check(blocks == BLOCKS, "sector chain has %u blocks", blocks);
+
+  /* Track 1 holds the system sectors, everything else is the file */
+  for (t = 2; t <= TRACKS; t++)
+    for (s = 0; s < 256; s++)
+      if (!is_free(t, s))
+        used_blocks++;
+  check(used_blocks == BLOCKS, "BAM has %u blocks in use outside track 1",
+        used_blocks);
+}
+
+int main(void) {
+  long lba;
+
+  host_fill(source, FILESIZE, 6);
+  host_boot("dnpsave.img", 65536);
+
+  check(host_put_file("SAVE.DNP", image, DNP_SIZE) == 0,
+        "can't create SAVE.DNP");
+  lba = host_file_lba("SAVE.DNP");
+  check(lba > 0, "SAVE.DNP is fragmented");
+
+  /* BAM sectors 1/2 to 1/33 are bytes 512 to 8703 of the image */
+  ramdisk_watch_first = lba + 1;
+  ramdisk_watch_count = 16;
+
+  /* Formatting and allocating wait for the card while the bus is busy */
+  c64_hang = 600000000000ULL;
+  check(sim_run(script, 60000000000000ULL) == 0, "bus script did not finish");
+  check_image();
+
+  printf("disk: %u writes, %u of them to the BAM, for %u blocks\n",
+         (unsigned)save_io.write_cmds, (unsigned)save_io.watch_writes,
+         BLOCKS);
+  check(save_io.watch_writes > 0 &&
+        save_io.watch_writes <= 2 * BAM_SECTORS,
+        "%u BAM writes for %u BAM sectors",
+        (unsigned)save_io.watch_writes, BAM_SECTORS);
+
+  return host_result("dnpsave");
+}
@@ -0,0 +1,119 @@
+/* sd2iec - SD/MMC to Commodore serial bus interface/controller
+   Copyright (C) 2007-2017  Ingo Korb <ingo@akana.de>
+
+   Inspired by MMC2IEC by Lars Pontoppidan et al.
+
+   FAT filesystem access based on code from ChaN and Jim Brain, see ff.c|h.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License only.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+   fatfrag.c: SAVE onto a fragmented FAT file system
+
+   Fills the file system with small files and deletes every other
+   one, so the free space is split into gaps of one to three
+   clusters. Then a program and a D64 image are saved over the bus
+   and the number of cluster runs of both files is reported. Built
+   with and without CONFIG_FAT_RESERVE. The clusters in use must
+   match the file sizes, so nothing of the reservations is left
+   behind when the files are closed.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "config.h"
+#include "filesystem.h"
+#include "c64.h"
+#include "hostsim.h"
+#include "hosttest.h"
+#include "ramdisk.h"
+
+#define DEVICE   8
+#define SMALL    500   /* the FAT16 root directory holds 512 entries */
+#define PROGRAM  60000
+#define CLUSTER  1024  /* cluster size of the 32MB RAM disk */
+
+static uint8_t source[HOST_D64_SIZE];
+static uint8_t saved[HOST_D64_SIZE + 256];
+
+static void expect_error(int code) {
+  char msg[64];
+  int  res = c64_read_error(DEVICE, msg, sizeof(msg));
+
+  check(res == code, "error channel: expected %02d, got \"%s\"", code, msg);
+}
+
+static void script(void) {
+  expect_error(73);
+
+  check(c64_save(DEVICE, "PROGRAM", source, PROGRAM) == 0, "SAVE failed");
+  expect_error(0);
+
+  check(c64_save(DEVICE, "IMAGE.D64", source, HOST_D64_SIZE) == 0,
+        "SAVE of the image failed");
+  expect_error(0);
+}
+
+static void check_file(const char *name, long size) {
+  long len = host_get_file(name, saved, sizeof(saved));
+  int runs = host_file_runs(name);
+
+  check(len == size && !memcmp(saved, source, size),
+        "%s is wrong (%ld bytes)", name, len);
+  printf("%-9s %6ld bytes in %2d cluster runs\n", name, size, runs);
+#ifdef CONFIG_FAT_RESERVE
+  check(runs == 1, "%s is stored in %d runs", name, runs);
+#endif
+}
+
+int main(void) {
+  char     name[16];
+  unsigned i;
+  long     before, used;
+
+  host_fill(source, HOST_D64_SIZE, 20);
+  host_boot("fatfrag.img", 65536);
+
+  for (i = 0; i < SMALL; i++) {
+    sprintf(name, "F%u.BIN", i);
+    check(host_put_file(name, source, CLUSTER * (1 + i % 3)) == 0,
+          "can't create %s", name);
+  }
+  for (i = 0; i < SMALL; i += 2) {
+    sprintf(name, "F%u.BIN", i);
+    check(host_delete(name) == 0, "can't delete %s", name);
+  }
+
+  /* Mount again, so FatFs looks for free clusters from the start */
+  filesystem_init(0);
+
+  memset(&ramdisk_stats, 0, sizeof(ramdisk_stats));
+  before = host_free_clusters();
+  check(sim_run(script, 6000000000000ULL) == 0, "bus script did not finish");
+
+  /* Nothing of the reservations may be left behind */
+  used = before - host_free_clusters();
+  check(used == (PROGRAM + CLUSTER - 1) / CLUSTER +
+               (HOST_D64_SIZE + CLUSTER - 1) / CLUSTER,
+        "the files use %ld clusters", used);
+
+  check_file("PROGRAM", PROGRAM);
+  check_file("IMAGE.D64", HOST_D64_SIZE);
+  printf("disk: %u reads (%u FAT), %u writes\n",
+         (unsigned)ramdisk_stats.read_cmds, (unsigned)ramdisk_stats.fat_sectors,
+         (unsigned)ramdisk_stats.write_cmds);
+
+  return host_result("fatfrag");
+}
@@ -0,0 +1,226 @@
+/* sd2iec - SD/MMC to Commodore serial bus interface/controller
+   Copyright (C) 2007-2017  Ingo Korb <ingo@akana.de>
+
+   Inspired by MMC2IEC by Lars Pontoppidan et al.
+
+   FAT filesystem access based on code from ChaN and Jim Brain, see ff.c|h.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License only.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+   fatrel.c: REL file in the FAT file system
+
+   Creates a REL file on a fragmented file system, writes the first
+   records one after the other and then a record far behind them, so
+   the file is expanded over several cluster runs. After reopening,
+   10000 records are read in random order, counting the card reads and
+   FAT sector reads per record, and some records are changed. Built
+   with and without cluster run map. At the end the R00 file is taken
+   from the RAM disk and compared byte by byte with the records that
+   were written.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "filesystem.h"
+#include "c64.h"
+#include "hostsim.h"
+#include "hosttest.h"
+#include "ramdisk.h"
+
+#define DEVICE   8
+#define SA       2
+#define RECLEN   40
+#define FIRST    30     /* records written one after the other */
+#define LAST     30000  /* record written to expand the file */
+#define RANDOM   10000  /* positioned reads */
+#define REWRITE  200    /* positioned writes */
+#define HEADER   26     /* P00 header in front of the records */
+
+#define GAPFILES 24     /* files of GAPSIZE bytes, every other is deleted */
+#define GAPSIZE  (64 * 1024L)
+
+static uint8_t written[LAST + 1]; /* generation of each record, 0: empty */
+static uint8_t file[HEADER + LAST * RECLEN + 256];
+static uint8_t filler[GAPSIZE];
+
+static ramdisk_stats_t expand_io, random_io;
+
+static void expect_error(int code) {
+  char msg[64];
+  int  res = c64_read_error(DEVICE, msg, sizeof(msg));
+
+  check(res == code, "error channel: expected %02d, got \"%s\"", code, msg);
+}
+
+static void record_data(uint16_t rec, uint8_t gen, uint8_t *data) {
+  uint8_t i;
+
+  for (i = 0; i < RECLEN; i++)
+    data[i] = ((rec * 7 + i * 13 + gen * 101) & 0x7f) | 1;
+}
+
+static void stats_since(ramdisk_stats_t *res, const ramdisk_stats_t *start) {
+  res->read_cmds   = ramdisk_stats.read_cmds   - start->read_cmds;
+  res->write_cmds  = ramdisk_stats.write_cmds  - start->write_cmds;
+  res->fat_sectors = ramdisk_stats.fat_sectors - start->fat_sectors;
+}
+
+static void position(uint16_t rec) {
+  uint8_t cmd[5] = { 'P', 0x60 | SA, rec & 0xff, rec >> 8, 1 };
+
+  c64_write(DEVICE, 15, cmd, sizeof(cmd));
+}
+
+static void write_record(uint16_t rec, uint8_t gen) {
+  uint8_t data[RECLEN];
+
+  record_data(rec, gen, data);
+  position(rec);
+  c64_write(DEVICE, SA, data, RECLEN);
+  written[rec] = gen;
+}
+
+static void read_record(uint16_t rec) {
+  uint8_t data[RECLEN + 1], expected[RECLEN];
+  long len;
+
+  position(rec);
+  len = c64_read(DEVICE, SA, data, sizeof(data));
+
+  if (written[rec]) {
+    record_data(rec, written[rec], expected);
+    check(len == RECLEN && !memcmp(data, expected, RECLEN),
+          "record %u read wrong data (%ld bytes)", rec, len);
+  } else {
+    check(len == 1 && data[0] == 0xff,
+          "empty record %u read %ld bytes, first %02x", rec, len, data[0]);
+  }
+}
+
+static void script(void) {
+  ramdisk_stats_t start;
+  uint16_t rec;
+  unsigned i;
+
+  expect_error(73);
+
+  c64_open(DEVICE, 15, "I");
+  c64_open(DEVICE, SA, "DATA,L," "\x28");
+  expect_error(0);
+
+  for (rec = 1; rec <= FIRST; rec++)
+    write_record(rec, 1);
+
+  /* A record far behind the end is reported, but written anyway */
+  start = ramdisk_stats;
+  write_record(LAST, 1);
+  stats_since(&expand_io, &start);
+  expect_error(50);
+
+  c64_close(DEVICE, SA);
+  expect_error(0);
+
+  /* Reopen, read and change records in random order */
+  c64_open(DEVICE, SA, "DATA");
+  expect_error(0);
+
+  srand(16);
+  start = ramdisk_stats;
+  for (i = 0; i < RANDOM; i++)
+    read_record(1 + rand() % LAST);
+  stats_since(&random_io, &start);
+
+  for (i = 0; i < REWRITE; i++)
+    write_record(1 + rand() % LAST, 2);
+
+  for (rec = 1; rec <= LAST; rec += 97)
+    read_record(rec);
+  read_record(LAST);
+  expect_error(0);
+
+  c64_close(DEVICE, SA);
+  c64_close(DEVICE, 15);
+  expect_error(0);
+}
+
+static void check_file(void) {
+  uint8_t  expected[RECLEN];
+  unsigned rec, bad = 0;
+  long     len;
+
+  len = host_get_file("DATA.R00", file, sizeof(file));
+  check(len == HEADER + (long)LAST * RECLEN, "DATA.R00 has %ld bytes", len);
+  if (len != HEADER + (long)LAST * RECLEN)
+    return;
+
+  check(!memcmp(file, "C64File", 8) && !memcmp(file + 8, "DATA", 5) &&
+        file[HEADER - 1] == RECLEN, "DATA.R00 has a wrong P00 header");
+
+  for (rec = 1; rec <= LAST; rec++) {
+    if (written[rec])
+      record_data(rec, written[rec], expected);
+    else {
+      memset(expected, 0, RECLEN);
+      expected[0] = 0xff;
+    }
+    if (memcmp(file + HEADER + (rec - 1) * RECLEN, expected, RECLEN))
+      bad++;
+  }
+  check(bad == 0, "%u records differ in DATA.R00", bad);
+}
+
+int main(void) {
+  char     name[16];
+  unsigned i;
+
+  host_boot("fatrel.img", 65536);
+
+  /* The drive holds the bus while it expands the file */
+  c64_hang = 600000000000ULL;
+
+  /* Leave gaps in front of the free space */
+  for (i = 0; i < GAPFILES; i++) {
+    sprintf(name, "F%u.BIN", i);
+    check(host_put_file(name, filler, GAPSIZE) == 0, "can't create %s", name);
+  }
+  for (i = 0; i < GAPFILES; i += 2) {
+    sprintf(name, "F%u.BIN", i);
+    check(host_delete(name) == 0, "can't delete %s", name);
+  }
+  filesystem_init(0);
+
+  check(sim_run(script, 60000000000000ULL) == 0, "bus script did not finish");
+
+  check_file();
+  printf("DATA.R00 %ld bytes in %d cluster runs\n",
+         HEADER + (long)LAST * RECLEN, host_file_runs("DATA.R00"));
+  printf("expand to record %u: %u card reads (%u FAT), %u writes\n", LAST,
+         (unsigned)expand_io.read_cmds, (unsigned)expand_io.fat_sectors,
+         (unsigned)expand_io.write_cmds);
+  printf("%u random records: %.2f card reads (%.2f FAT) per record\n", RANDOM,
+         (double)random_io.read_cmds / RANDOM,
+         (double)random_io.fat_sectors / RANDOM);
+
+#ifdef CONFIG_IMAGE_RUNS
+  /* Only building the map on the first P command reads the FAT */
+  check(random_io.fat_sectors * 100 < RANDOM,
+        "%u FAT sector reads with cluster run map", (unsigned)random_io.fat_sectors);
+#endif
+
+  return host_result("fatrel");
+}
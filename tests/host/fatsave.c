@@ -0,0 +1,87 @@
+/* sd2iec - SD/MMC to Commodore serial bus interface/controller
+   Copyright (C) 2007-2017  Ingo Korb <ingo@akana.de>
+
+   Inspired by MMC2IEC by Lars Pontoppidan et al.
+
+   FAT filesystem access based on code from ChaN and Jim Brain, see ff.c|h.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License only.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+   fatsave.c: SAVE into the FAT file system
+
+   Saves a 40KB file into a directory on the FAT file system and
+   reports the card accesses per saved KB. Built with and without
+   CONFIG_WRITE_BATCH to compare writes collected into whole sectors
+   with a f_write call per block.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "config.h"
+#include "c64.h"
+#include "hostsim.h"
+#include "hosttest.h"
+#include "ramdisk.h"
+
+#define DEVICE   8
+#define FILESIZE 40960
+
+static uint8_t source[FILESIZE];
+static uint8_t saved[FILESIZE + 256];
+static ramdisk_stats_t save_io;
+
+static void expect_error(int code) {
+  char msg[64];
+  int  res = c64_read_error(DEVICE, msg, sizeof(msg));
+
+  check(res == code, "error channel: expected %02d, got \"%s\"", code, msg);
+}
+
+static void script(void) {
+  ramdisk_stats_t start;
+
+  expect_error(73);
+
+  start = ramdisk_stats;
+  check(c64_save(DEVICE, "SAVED", source, FILESIZE) == 0, "SAVE failed");
+  save_io.write_cmds    = ramdisk_stats.write_cmds    - start.write_cmds;
+  save_io.write_sectors = ramdisk_stats.write_sectors - start.write_sectors;
+  save_io.read_cmds     = ramdisk_stats.read_cmds     - start.read_cmds;
+  save_io.fat_sectors   = ramdisk_stats.fat_sectors   - start.fat_sectors;
+  c64_report("SAVE");
+  expect_error(0);
+}
+
+int main(void) {
+  long len;
+
+  host_fill(source, FILESIZE, 40);
+  host_boot("fatsave.img", 65536);
+
+  check(sim_run(script, 600000000000ULL) == 0, "bus script did not finish");
+
+  len = host_get_file("SAVED", saved, sizeof(saved));
+  check(len == FILESIZE && !memcmp(saved, source, FILESIZE),
+        "saved file is wrong (%ld bytes)", len);
+
+  printf("disk: %u reads (%u FAT), %u writes (%u sectors) for %u KB\n",
+         (unsigned)save_io.read_cmds, (unsigned)save_io.fat_sectors,
+         (unsigned)save_io.write_cmds, (unsigned)save_io.write_sectors,
+         FILESIZE / 1024);
+  printf("%.2f card writes per KB\n", (double)save_io.write_cmds * 1024 / FILESIZE);
+
+  return host_result("fatsave");
+}
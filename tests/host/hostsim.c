@@ -0,0 +1,458 @@
+/* sd2iec - SD/MMC to Commodore serial bus interface/controller
+   Copyright (C) 2007-2017  Ingo Korb <ingo@akana.de>
+
+   Inspired by MMC2IEC by Lars Pontoppidan et al.
+
+   FAT filesystem access based on code from ChaN and Jim Brain, see ff.c|h.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License only.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+   hostsim.c: Virtual time, interrupts and bus lines for the host tests
+
+   The firmware runs on the main stack and the computer on the other end
+   of the bus runs as a coroutine (see c64.c). Both share a virtual clock
+   in nanoseconds: the firmware side advances it with every delay, every
+   timeout check and every read of the bus lines, the computer side
+   sleeps until a deadline or until the drive changes a line it is
+   waiting for. Interrupts are delivered at the exact virtual time they
+   would happen on real hardware, unless the firmware has blocked them.
+
+*/
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ucontext.h>
+#include "config.h"
+#include "bus.h"
+#include "crc.h"
+#include "fastloader-ll.h"
+#include "iec-bus.h"
+#include "iec-engine.h"
+#include "system.h"
+#include "timer.h"
+#include "hostsim.h"
+
+/* One system tick of the firmware, 100Hz */
+#define TICK_NS 10000000ULL
+
+uint64_t sim_now;
+uint64_t sim_timeout_end;
+uint8_t  sim_irq_enabled;
+unsigned sim_violations;
+
+static uint64_t sim_limit = UINT64_MAX;
+static uint64_t next_tick = TICK_NS;
+static uint8_t  drive_lines = SIM_LINES;
+static uint8_t  c64_lines   = SIM_LINES;
+static uint8_t  atn_irq_enabled, atn_irq_pending;
+static uint8_t  data_check;
+static uint8_t  trace;
+static jmp_buf  sim_exit;
+
+#ifdef CONFIG_IEC_ENGINE
+/* Events requested by iec-engine.c, see engine_ll_* below */
+static uint64_t engine_reference;
+static uint64_t engine_deadline = UINT64_MAX;
+static uint8_t  engine_data_wait, engine_data_state;
+#endif
+
+/* State of the computer coroutine */
+static enum { C64_IDLE, C64_WAITING, C64_DONE } c64_state;
+static ucontext_t drive_ctx, c64_ctx;
+static uint8_t    c64_mask, c64_value;
+static uint64_t   c64_deadline;
+static void       (*c64_script)(void);
+static char       c64_stack[256 * 1024];
+
+void sim_violation(const char *fmt, ...) {
+  va_list ap;
+
+  printf("  VIOLATION at %10.3fms: ", sim_now / 1000000.0);
+  va_start(ap, fmt);
+  vprintf(fmt, ap);
+  va_end(ap);
+  putchar('\n');
+  sim_violations++;
+}
+
+uint8_t sim_lines(void) {
+  return drive_lines & c64_lines;
+}
+
+/* Log line changes to stderr, enabled by setting SIM_TRACE */
+static void trace_line(char side, uint8_t line, uint8_t released) {
+  fprintf(stderr, "%14.3fus %c %s %s, bus %c%c%c\n", sim_now / 1000.0, side,
+          line == SIM_ATN ? "ATN  " : line == SIM_CLOCK ? "CLOCK" :
+          line == SIM_DATA ? "DATA " : "SRQ  ",
+          released ? "high" : "low ",
+          sim_lines() & SIM_ATN   ? 'a' : 'A',
+          sim_lines() & SIM_CLOCK ? 'c' : 'C',
+          sim_lines() & SIM_DATA  ? 'd' : 'D');
+}
+
+/* ------------------------------------------------------------------------- */
+/*  Scheduler                                                                */
+/* ------------------------------------------------------------------------- */
+
+static uint8_t c64_ready(void) {
+  return c64_state == C64_WAITING &&
+    (sim_lines() & c64_mask) == c64_value;
+}
+
+static void c64_resume(void) {
+  swapcontext(&drive_ctx, &c64_ctx);
+}
+
+#ifdef CONFIG_IEC_ENGINE
+/* Deliver the event the engine waits for if it has happened */
+static void engine_interrupt(void) {
+  if (engine_data_wait &&
+      !(sim_lines() & SIM_DATA) == !engine_data_state) {
+    engine_data_wait = 0;
+    engine_deadline  = UINT64_MAX;
+    engine_reference = sim_now;
+    iec_engine_event();
+  } else if (engine_deadline <= sim_now) {
+    engine_data_wait = 0;
+    engine_deadline  = UINT64_MAX;
+    iec_engine_event();
+  }
+}
+#else
+static void engine_interrupt(void) {}
+#  define engine_deadline UINT64_MAX
+#endif
+
+/* Run the interrupt handlers that are due */
+static void sim_interrupts(void) {
+  if (!sim_irq_enabled)
+    return;
+
+  sim_irq_enabled = 0;
+  if (atn_irq_pending && atn_irq_enabled) {
+    atn_irq_pending = 0;
+    iec_atn_handler();
+  }
+  engine_interrupt();
+  while (next_tick <= sim_now) {
+    next_tick += TICK_NS;
+    host_tick_handler();
+  }
+  sim_irq_enabled = 1;
+}
+
+/**
+ * sim_advance - let virtual time pass on the drive side
+ * @ns: time in nanoseconds
+ *
+ * Everything that happens in the meantime - the computer waking up,
+ * interrupts - is handled at its own point in time.
+ */
+void sim_advance(uint64_t ns) {
+  uint64_t target = sim_now + ns;
+
+  while (1) {
+    uint64_t next = target;
+
+    if (c64_state == C64_WAITING && c64_deadline < next)
+      next = c64_deadline;
+    if (sim_irq_enabled && next_tick < next)
+      next = next_tick;
+    if (sim_irq_enabled && engine_deadline < next)
+      next = engine_deadline;
+
+    if (next > sim_now)
+      sim_now = next;
+
+    if (c64_state == C64_WAITING && c64_deadline <= sim_now)
+      c64_resume();
+    sim_interrupts();
+
+    if (sim_now >= target)
+      break;
+  }
+
+  if (sim_now > sim_limit) {
+    sim_violation("simulation did not finish in time");
+    longjmp(sim_exit, 1);
+  }
+}
+
+uint8_t sim_bus_poll(void) {
+  sim_advance(SIM_POLL_NS);
+  return sim_lines();
+}
+
+/* Read of ticks in the sources built with pollticks.h */
+volatile tick_t *sim_poll_ticks(void) {
+  if (sim_irq_enabled)
+    sim_advance(SIM_POLL_NS);
+  return &ticks;
+}
+
+void sim_drive_line(uint8_t line, uint8_t released) {
+  uint8_t before = sim_lines();
+
+  if (released)
+    drive_lines |= line;
+  else
+    drive_lines &= (uint8_t)~line;
+
+  if (trace)
+    trace_line('D', line, released);
+
+  if (data_check && (sim_lines() & SIM_CLOCK) &&
+      ((before ^ sim_lines()) & SIM_DATA))
+    sim_violation("DATA changed while CLOCK was released");
+
+  if (c64_ready())
+    c64_resume();
+}
+
+void sim_set_atn_irq(uint8_t state) {
+  atn_irq_enabled = state;
+  sim_interrupts();
+}
+
+void sim_irq_restore(const uint8_t *state) {
+  sim_irq_enabled = *state;
+  sim_interrupts();
+}
+
+void sim_irq_forceon(const uint8_t *state) {
+  (void)state;
+  sim_irq_enabled = 1;
+  sim_interrupts();
+}
+
+/* ------------------------------------------------------------------------- */
+/*  Computer side                                                            */
+/* ------------------------------------------------------------------------- */
+
+static void c64_yield(void) {
+  swapcontext(&c64_ctx, &drive_ctx);
+}
+
+/**
+ * sim_c64_line - change a line driven by the computer
+ * @line    : SIM_* bit of the line
+ * @released: 1 to release the line, 0 to pull it low
+ */
+void sim_c64_line(uint8_t line, uint8_t released) {
+  uint8_t before = sim_lines();
+
+  if (released)
+    c64_lines |= line;
+  else
+    c64_lines &= (uint8_t)~line;
+
+  if (trace)
+    trace_line('C', line, released);
+
+  /* The ATN interrupt triggers on the falling edge */
+  if ((before & SIM_ATN) && !(sim_lines() & SIM_ATN))
+    atn_irq_pending = 1;
+}
+
+/**
+ * sim_c64_wait - wait until the bus lines have a certain state
+ * @mask   : lines to check
+ * @value  : expected state of those lines
+ * @timeout: maximum waiting time in nanoseconds
+ *
+ * Returns 1 if the lines have reached the expected state or 0 if the
+ * timeout has passed first.
+ */
+uint8_t sim_c64_wait(uint8_t mask, uint8_t value, uint64_t timeout) {
+  if ((sim_lines() & mask) == value)
+    return 1;
+
+  c64_mask     = mask;
+  c64_value    = value;
+  c64_deadline = sim_now + timeout;
+  c64_state    = C64_WAITING;
+  c64_yield();
+  c64_state    = C64_IDLE;
+
+  return (sim_lines() & mask) == value;
+}
+
+void sim_c64_delay(uint64_t ns) {
+  /* SIM_SRQ is never pulled by the firmware, so this can't match */
+  sim_c64_wait(SIM_SRQ, 0, ns);
+}
+
+/* Enable the check for DATA changes while CLOCK is released */
+void sim_check_data(uint8_t enable) {
+  data_check = enable;
+}
+
+static void c64_entry(void) {
+  c64_script();
+  c64_state = C64_DONE;
+}
+
+/**
+ * sim_run - run the firmware main loop against a computer script
+ * @script: function that runs as the computer
+ * @limit : maximum virtual time in nanoseconds
+ *
+ * The main loop is left when the script has finished and the firmware
+ * waits for the next ATN. Returns 0 if the script finished or -1 if it
+ * did not finish within the time limit.
+ */
+int sim_run(void (*script)(void), uint64_t limit) {
+  getcontext(&c64_ctx);
+  c64_ctx.uc_stack.ss_sp   = c64_stack;
+  c64_ctx.uc_stack.ss_size = sizeof(c64_stack);
+  c64_ctx.uc_link          = &drive_ctx;
+  makecontext(&c64_ctx, c64_entry, 0);
+
+  c64_script   = script;
+  c64_state    = C64_WAITING;
+  c64_mask     = 0;
+  c64_value    = 1;
+  c64_deadline = sim_now;
+  sim_limit    = sim_now + limit;
+  trace        = getenv("SIM_TRACE") != NULL;
+
+  if (setjmp(sim_exit))
+    return c64_state == C64_DONE ? 0 : -1;
+
+  bus_mainloop();
+}
+
+/* ------------------------------------------------------------------------- */
+/*  Platform functions                                                       */
+/* ------------------------------------------------------------------------- */
+
+void system_init_early(void) {}
+void system_init_late(void) {}
+void timer_init(void) {}
+
+void system_sleep(void) {
+  uint64_t next = next_tick;
+
+  if (c64_state == C64_DONE)
+    longjmp(sim_exit, 1);
+
+  if (c64_state == C64_WAITING && c64_deadline < next)
+    next = c64_deadline;
+  if (engine_deadline < next)
+    next = engine_deadline;
+
+  sim_advance(next > sim_now ? next - sim_now : SIM_POLL_NS);
+}
+
+void system_reset(void) {
+  printf("system_reset called\n");
+  exit(1);
+}
+
+void disable_interrupts(void) {
+  sim_irq_enabled = 0;
+}
+
+void enable_interrupts(void) {
+  sim_irq_enabled = 1;
+  sim_interrupts();
+}
+
+/* Bitwise versions of the CRC functions in avr-libc */
+uint8_t crc7update(uint8_t crc, uint8_t data) {
+  uint8_t i;
+
+  for (i = 0; i < 8; i++) {
+    crc <<= 1;
+    if ((data & 0x80) ^ (crc & 0x80))
+      crc ^= 0x09;
+    data <<= 1;
+  }
+  return crc & 0x7f;
+}
+
+uint16_t crc_xmodem_update(uint16_t crc, uint8_t data) {
+  uint8_t i;
+
+  crc ^= (uint16_t)data << 8;
+  for (i = 0; i < 8; i++) {
+    if (crc & 0x8000)
+      crc = (crc << 1) ^ 0x1021;
+    else
+      crc <<= 1;
+  }
+  return crc;
+}
+
+uint16_t crc_xmodem_block(uint16_t crc, const uint8_t *data, unsigned int length) {
+  while (length--)
+    crc = crc_xmodem_update(crc, *data++);
+  return crc;
+}
+
+uint16_t crc16_update(uint16_t crc, uint8_t data) {
+  uint8_t i;
+
+  crc ^= data;
+  for (i = 0; i < 8; i++) {
+    if (crc & 1)
+      crc = (crc >> 1) ^ 0xa001;
+    else
+      crc >>= 1;
+  }
+  return crc;
+}
+
+#ifdef CONFIG_IEC_ENGINE
+/* Timing for iec-engine.c, see src/lpc17xx/iec-engine-ll.c */
+void engine_ll_start(void) {
+  engine_reference = sim_now;
+}
+
+void engine_ll_after(unsigned int us) {
+  engine_reference += us * 1000ULL;
+  if (engine_reference < sim_now)
+    engine_reference = sim_now;
+  engine_deadline = engine_reference;
+}
+
+uint8_t engine_ll_data(uint8_t state, unsigned int timeout) {
+  if (!(sim_bus_poll() & SIM_DATA) == !state)
+    return 1;
+
+  engine_data_wait  = 1;
+  engine_data_state = state;
+  if (timeout)
+    engine_ll_after(timeout);
+  return 0;
+}
+
+void engine_ll_stop(void) {
+  engine_data_wait = 0;
+  engine_deadline  = UINT64_MAX;
+}
+#endif
+
+/* The fast loaders are not simulated, the main loop only needs the symbols */
+uint8_t jiffy_receive(iec_bus_t *busstate) {
+  *busstate = 0;
+  return 0;
+}
+
+uint8_t jiffy_send(uint8_t value, uint8_t eoi, uint8_t loadflags) {
+  return 1;
+}
@@ -0,0 +1,79 @@
+/* sd2iec - SD/MMC to Commodore serial bus interface/controller
+   Copyright (C) 2007-2017  Ingo Korb <ingo@akana.de>
+
+   Inspired by MMC2IEC by Lars Pontoppidan et al.
+
+   FAT filesystem access based on code from ChaN and Jim Brain, see ff.c|h.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License only.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+   hostsim.h: Virtual time, interrupts and bus lines for the host tests
+
+*/
+
+#ifndef HOSTSIM_H
+#define HOSTSIM_H
+
+#include <stdint.h>
+
+/* IEC lines, a set bit means the line is released (high) */
+#define SIM_ATN   (1<<0)
+#define SIM_CLOCK (1<<1)
+#define SIM_DATA  (1<<2)
+#define SIM_SRQ   (1<<3)
+#define SIM_LINES (SIM_ATN | SIM_CLOCK | SIM_DATA | SIM_SRQ)
+
+/* Virtual time in nanoseconds since the start of the program */
+extern uint64_t sim_now;
+
+/* End of the timeout started with start_timeout */
+extern uint64_t sim_timeout_end;
+
+/* Interrupt flag of the simulated drive CPU */
+extern uint8_t sim_irq_enabled;
+
+/* Time charged for one read of the bus lines by the drive */
+#define SIM_POLL_NS 250
+
+void    sim_advance(uint64_t ns);
+uint8_t sim_bus_poll(void);
+void    sim_drive_line(uint8_t line, uint8_t released);
+void    sim_set_atn_irq(uint8_t state);
+void    sim_irq_restore(const uint8_t *state);
+void    sim_irq_forceon(const uint8_t *state);
+
+static inline uint8_t sim_irq_save(void) {
+  uint8_t state = sim_irq_enabled;
+  sim_irq_enabled = 0;
+  return state;
+}
+
+/* Number of protocol violations seen so far */
+extern unsigned sim_violations;
+
+void    sim_violation(const char *fmt, ...)
+  __attribute__((format(printf, 1, 2)));
+uint8_t sim_lines(void);
+int     sim_run(void (*script)(void), uint64_t limit);
+
+/* Only callable from the computer side */
+void    sim_c64_line(uint8_t line, uint8_t released);
+uint8_t sim_c64_wait(uint8_t mask, uint8_t value, uint64_t timeout);
+void    sim_c64_delay(uint64_t ns);
+void    sim_check_data(uint8_t enable);
+
+/* Interrupt handlers of the firmware */
+void host_tick_handler(void);
+void iec_atn_handler(void);
+
+#endif
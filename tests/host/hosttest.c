@@ -0,0 +1,355 @@
+/* sd2iec - SD/MMC to Commodore serial bus interface/controller
+   Copyright (C) 2007-2017  Ingo Korb <ingo@akana.de>
+
+   Inspired by MMC2IEC by Lars Pontoppidan et al.
+
+   FAT filesystem access based on code from ChaN and Jim Brain, see ff.c|h.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License only.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+   hosttest.c: Common helpers for the host test programs
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "buffers.h"
+#include "bus.h"
+#include "diskchange.h"
+#include "diskio.h"
+#include "eeprom-conf.h"
+#include "fatops.h"
+#include "ff.h"
+#include "filesystem.h"
+#include "led.h"
+#include "parser.h"
+#include "system.h"
+#include "timer.h"
+#include "hostsim.h"
+#include "ramdisk.h"
+#include "hosttest.h"
+
+unsigned test_failures;
+
+/**
+ * host_boot - create a disk image and initialise the firmware
+ * @image  : file name of the disk image
+ * @sectors: size of the image in 512 byte sectors
+ *
+ * This function follows main() up to the point where the bus main loop
+ * would be called.
+ */
+void host_boot(const char *image, uint32_t sectors) {
+  if (ramdisk_create(image, sectors))
+    exit(2);
+
+  system_init_early();
+  leds_init();
+  timer_init();
+  bus_interface_init();
+  system_init_late();
+  enable_interrupts();
+
+  buffers_init();
+  buttons_init();
+  bus_init();
+  disk_init();
+  read_configuration();
+
+  filesystem_init(0);
+  change_init();
+}
+
+/**
+ * host_put_file - write a file on the first partition directly
+ * @name: path of the file
+ * @data: contents
+ * @len : length of the file
+ *
+ * Returns 0 if successful or the FatFs error code.
+ */
+int host_put_file(const char *name, const void *data, unsigned int len) {
+  const uint8_t *ptr = data;
+  FIL     fh;
+  UINT    written;
+  FRESULT res;
+
+  partition[0].fatfs.curr_dir = 0;
+  res = f_open(&partition[0].fatfs, &fh, (const UCHAR *)name,
+               FA_WRITE | FA_CREATE_ALWAYS);
+  if (res != FR_OK)
+    return res;
+
+  while (len && res == FR_OK) {
+    /* f_write can't handle more than 64K at once */
+    UINT part = len < 32768 ? len : 32768;
+
+    res = f_write(&fh, ptr, part, &written);
+    if (res == FR_OK && written != part)
+      res = FR_DENIED;
+    ptr += part;
+    len -= part;
+  }
+  if (res == FR_OK)
+    res = f_close(&fh);
+  return res;
+}
+
+/**
+ * host_put_fragmented - write a file that is split into several pieces
+ * @name : path of the file
+ * @data : contents
+ * @len  : length of the file
+ * @chunk: length of each piece
+ *
+ * The pieces are separated by a cluster of another file, which is
+ * deleted afterwards, so the file is stored in len/chunk runs.
+ * Returns 0 if successful or the FatFs error code.
+ */
+int host_put_fragmented(const char *name, const void *data, unsigned int len,
+                        unsigned int chunk) {
+  const uint8_t *ptr = data;
+  FIL     fh, gap;
+  UINT    written;
+  FRESULT res;
+
+  partition[0].fatfs.curr_dir = 0;
+  res = f_open(&partition[0].fatfs, &fh, (const UCHAR *)name,
+               FA_WRITE | FA_CREATE_ALWAYS);
+  if (res != FR_OK)
+    return res;
+
+  res = f_open(&partition[0].fatfs, &gap, (const UCHAR *)"GAP.TMP",
+               FA_WRITE | FA_CREATE_ALWAYS);
+  if (res != FR_OK)
+    return res;
+
+  while (len && res == FR_OK) {
+    unsigned int piece = len < chunk ? len : chunk;
+
+    len -= piece;
+    while (piece && res == FR_OK) {
+      /* f_write can't handle more than 64K at once */
+      UINT part = piece < 32768 ? piece : 32768;
+
+      res = f_write(&fh, ptr, part, &written);
+      if (res == FR_OK && written != part)
+        res = FR_DENIED;
+      ptr   += part;
+      piece -= part;
+    }
+
+    /* allocate a cluster behind the piece */
+    if (res == FR_OK && len)
+      res = f_write(&gap, data, partition[0].fatfs.csize * 512, &written);
+  }
+
+  if (res == FR_OK)
+    res = f_close(&fh);
+  if (res == FR_OK)
+    res = f_close(&gap);
+  if (res == FR_OK)
+    res = f_unlink(&partition[0].fatfs, (const UCHAR *)"GAP.TMP");
+  return res;
+}
+
+/**
+ * host_get_file - read a file on the first partition directly
+ * @name  : path of the file
+ * @data  : buffer for the contents
+ * @maxlen: size of the buffer
+ *
+ * Returns the number of bytes read or -1 if the file can't be read.
+ */
+long host_get_file(const char *name, void *data, unsigned int maxlen) {
+  uint8_t *ptr = data;
+  long total = 0;
+  FIL  fh;
+  UINT len;
+
+  partition[0].fatfs.curr_dir = 0;
+  if (f_open(&partition[0].fatfs, &fh, (const UCHAR *)name,
+             FA_READ | FA_OPEN_EXISTING) != FR_OK)
+    return -1;
+
+  do {
+    UINT part = maxlen < 32768 ? maxlen : 32768;
+
+    if (f_read(&fh, ptr, part, &len) != FR_OK)
+      return -1;
+    ptr    += len;
+    total  += len;
+    maxlen -= len;
+  } while (len == 32768 && maxlen);
+
+  f_close(&fh);
+  return total;
+}
+
+/**
+ * host_delete - delete a file on the first partition directly
+ * @name: path of the file
+ *
+ * Returns 0 if successful or the FatFs error code.
+ */
+int host_delete(const char *name) {
+  partition[0].fatfs.curr_dir = 0;
+  return f_unlink(&partition[0].fatfs, (const UCHAR *)name);
+}
+
+/**
+ * host_mkdir - create a directory on the first partition directly
+ * @name: path of the directory
+ *
+ * Returns 0 if successful or the FatFs error code.
+ */
+int host_mkdir(const char *name) {
+  partition[0].fatfs.curr_dir = 0;
+  return f_mkdir(&partition[0].fatfs, (const UCHAR *)name);
+}
+
+/**
+ * host_file_runs - count the cluster runs of a file
+ * @name: path of the file
+ *
+ * Returns the number of runs of consecutive clusters the file is
+ * stored in or -1 if the file can't be opened.
+ */
+int host_file_runs(const char *name) {
+  FIL      fh;
+  DWORD    pos, clustersize, last = 0;
+  int      runs = 0;
+
+  partition[0].fatfs.curr_dir = 0;
+  if (f_open(&partition[0].fatfs, &fh, (const UCHAR *)name,
+             FA_READ | FA_OPEN_EXISTING) != FR_OK)
+    return -1;
+
+  /* Position in every cluster to make FatFs follow the chain */
+  clustersize = partition[0].fatfs.csize * 512;
+  for (pos = 1; pos <= fh.fsize; pos += clustersize) {
+    if (f_lseek(&fh, pos) != FR_OK) {
+      runs = -1;
+      break;
+    }
+    if (fh.curr_clust != last + 1)
+      runs++;
+    last = fh.curr_clust;
+  }
+
+  f_close(&fh);
+  return runs;
+}
+
+/**
+ * host_file_lba - find the first sector of a contiguous file
+ * @name: path of the file
+ *
+ * Returns the first sector of the file on the RAM disk or -1 if the
+ * file can't be opened or is not stored in one run of clusters.
+ */
+long host_file_lba(const char *name) {
+  FIL   fh;
+  DWORD lba;
+
+  partition[0].fatfs.curr_dir = 0;
+  if (f_open(&partition[0].fatfs, &fh, (const UCHAR *)name,
+             FA_READ | FA_OPEN_EXISTING) != FR_OK)
+    return -1;
+
+  lba = l_getlba(&fh);
+  f_close(&fh);
+  return lba ? (long)lba : -1;
+}
+
+/**
+ * host_free_clusters - count the free clusters of the first partition
+ *
+ * Returns the number of free clusters or -1 if an error occured.
+ */
+long host_free_clusters(void) {
+  DWORD clusters;
+
+  if (f_getfree(&partition[0].fatfs, (const UCHAR *)"", &clusters) != FR_OK)
+    return -1;
+  return clusters;
+}
+
+/**
+ * host_blank_d64 - build an empty 35 track D64 image
+ * @data: buffer for the image, at least HOST_D64_SIZE bytes
+ * @name: disk name
+ *
+ * Returns the size of the image.
+ */
+unsigned int host_blank_d64(uint8_t *data, const char *name) {
+  uint8_t *bam = data + HOST_D64_BAM;
+  uint8_t  t, s, count;
+
+  memset(data, 0, HOST_D64_SIZE);
+
+  bam[0] = 18;
+  bam[1] = 1;
+  bam[2] = 'A';
+  for (t = 1; t <= 35; t++) {
+    uint8_t *entry = bam + 4 * t;
+
+    count = t <= 17 ? 21 : t <= 24 ? 19 : t <= 30 ? 18 : 17;
+    entry[0] = count;
+    for (s = 0; s < count; s++)
+      entry[1 + s / 8] |= 1 << (s & 7);
+  }
+
+  /* BAM and first directory sector */
+  bam[4 * 18]     -= 2;
+  bam[4 * 18 + 1] &= 0xfc;
+  data[HOST_D64_BAM + 256 + 1] = 0xff;
+
+  memset(bam + 0x90, 0xa0, 0xab - 0x90);
+  memcpy(bam + 0x90, name, strlen(name));
+  bam[0xa2] = 'I'; bam[0xa3] = 'D';
+  bam[0xa5] = '2'; bam[0xa6] = 'A';
+
+  return HOST_D64_SIZE;
+}
+
+/* Fill a buffer with reproducible pseudo-random data */
+void host_fill(uint8_t *data, unsigned int len, uint32_t seed) {
+  while (len--) {
+    seed = seed * 1103515245 + 12345;
+    *data++ = seed >> 16;
+  }
+}
+
+/**
+ * host_result - print the result of a test program
+ * @name: name of the test program
+ *
+ * Returns the exit code for main().
+ */
+int host_result(const char *name) {
+  unsigned errors = test_failures + sim_violations;
+
+  if (errors) {
+    printf("%s: %u failed checks, %u protocol violations\n",
+           name, test_failures, sim_violations);
+    return 1;
+  }
+
+  printf("%s: OK\n", name);
+  return 0;
+}
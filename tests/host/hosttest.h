@@ -0,0 +1,61 @@
+/* sd2iec - SD/MMC to Commodore serial bus interface/controller
+   Copyright (C) 2007-2017  Ingo Korb <ingo@akana.de>
+
+   Inspired by MMC2IEC by Lars Pontoppidan et al.
+
+   FAT filesystem access based on code from ChaN and Jim Brain, see ff.c|h.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License only.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+   hosttest.h: Common helpers for the host test programs
+
+*/
+
+#ifndef HOSTTEST_H
+#define HOSTTEST_H
+
+#include <stdint.h>
+
+extern unsigned test_failures;
+
+/* Size of a 35 track D64 image and offset of its BAM sector (18/0) */
+#define HOST_D64_SIZE 174848
+#define HOST_D64_BAM  0x16500
+
+/* Count a failed check and print the message */
+#define check(cond, ...) do {                                   \
+    if (!(cond)) {                                              \
+      printf("  FAILED %s:%d: ", __FILE__, __LINE__);           \
+      printf(__VA_ARGS__);                                      \
+      putchar('\n');                                            \
+      test_failures++;                                          \
+    }                                                           \
+  } while (0)
+
+void host_boot(const char *image, uint32_t sectors);
+int  host_put_file(const char *name, const void *data, unsigned int len);
+int  host_put_fragmented(const char *name, const void *data, unsigned int len,
+                         unsigned int chunk);
+long host_get_file(const char *name, void *data, unsigned int maxlen);
+int  host_delete(const char *name);
+int  host_mkdir(const char *name);
+int  host_file_runs(const char *name);
+long host_file_lba(const char *name);
+long host_free_clusters(void);
+unsigned int host_blank_d64(uint8_t *data, const char *name);
+void host_fill(uint8_t *data, unsigned int len, uint32_t seed);
+int  host_result(const char *name);
+
+#endif
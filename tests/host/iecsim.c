@@ -0,0 +1,103 @@
+/* sd2iec - SD/MMC to Commodore serial bus interface/controller
+   Copyright (C) 2007-2017  Ingo Korb <ingo@akana.de>
+
+   Inspired by MMC2IEC by Lars Pontoppidan et al.
+
+   FAT filesystem access based on code from ChaN and Jim Brain, see ff.c|h.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License only.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+   iecsim.c: LOAD/SAVE/OPEN over the simulated IEC bus
+
+   Replays the bus traffic of a C64 using the KERNAL routines against
+   iec_mainloop and reports the throughput and the stalls while the
+   drive reads or writes the disk.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "config.h"
+#include "perfcount.h"
+#include "c64.h"
+#include "hostsim.h"
+#include "hosttest.h"
+#include "ramdisk.h"
+
+#define DEVICE   8
+#define FILESIZE 20000
+
+static uint8_t source[FILESIZE];
+static uint8_t loaded[FILESIZE + 256];
+
+static void expect_error(int code) {
+  char msg[64];
+  int  res = c64_read_error(DEVICE, msg, sizeof(msg));
+
+  check(res == code, "error channel: expected %02d, got \"%s\"", code, msg);
+}
+
+static void script(void) {
+  long len;
+
+  /* The drive reports its version after power on */
+  expect_error(73);
+
+  /* Standard LOAD of a file that was put on the disk directly */
+  len = c64_load(DEVICE, "PRELOAD.PRG", loaded, sizeof(loaded));
+  check(len == FILESIZE, "LOAD returned %ld bytes", len);
+  check(!memcmp(loaded, source, FILESIZE), "LOAD data mismatch");
+  c64_report("LOAD");
+  expect_error(0);
+
+  /* SAVE a file and read it back */
+  check(c64_save(DEVICE, "SAVED", source, FILESIZE) == 0, "SAVE failed");
+  c64_report("SAVE");
+  expect_error(0);
+
+  memset(loaded, 0, sizeof(loaded));
+  len = c64_load(DEVICE, "SAVED", loaded, sizeof(loaded));
+  check(len == FILESIZE, "LOAD of saved file returned %ld bytes", len);
+  check(!memcmp(loaded, source, FILESIZE), "LOAD of saved file data mismatch");
+  expect_error(0);
+
+  /* Missing files are reported on the error channel */
+  len = c64_load(DEVICE, "MISSING", loaded, sizeof(loaded));
+  check(len < 0, "LOAD of a missing file returned %ld bytes", len);
+  expect_error(62);
+
+  /* Commands on channel 15 */
+  c64_open(DEVICE, 15, "S:SAVED");
+  c64_close(DEVICE, 15);
+  expect_error(1);
+}
+
+int main(void) {
+  host_fill(source, FILESIZE, 1);
+  host_boot("iecsim.img", 65536);
+
+  check(host_put_file("PRELOAD.PRG", source, FILESIZE) == 0,
+        "can't create test file");
+  memset(&ramdisk_stats, 0, sizeof(ramdisk_stats));
+  perf_reset();
+
+  check(sim_run(script, 600000000000ULL) == 0, "bus script did not finish");
+
+  printf("disk: %u reads (%u sectors), %u writes (%u sectors)\n",
+         (unsigned)ramdisk_stats.read_cmds, (unsigned)ramdisk_stats.read_sectors,
+         (unsigned)ramdisk_stats.write_cmds, (unsigned)ramdisk_stats.write_sectors);
+
+  return host_result("iecsim");
+}
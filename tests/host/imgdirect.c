@@ -0,0 +1,186 @@
+/* sd2iec - SD/MMC to Commodore serial bus interface/controller
+   Copyright (C) 2007-2017  Ingo Korb <ingo@akana.de>
+
+   Inspired by MMC2IEC by Lars Pontoppidan et al.
+
+   FAT filesystem access based on code from ChaN and Jim Brain, see ff.c|h.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License only.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+   imgdirect.c: Image access with and without FatFs
+
+   Mounts a D64 image that is stored in one piece and one that is
+   split into several pieces, then reads and writes both at random
+   offsets with random lengths, including whole sectors and requests
+   that go beyond the end of the image. Every result is compared with
+   a copy kept in memory, and after unmounting each image file must be
+   byte-identical to that copy. Built with CONFIG_IMAGE_DIRECT, where
+   the contiguous image bypasses FatFs and the fragmented one must
+   fall back to it, and without, where both use FatFs.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "config.h"
+#include "dirent.h"
+#include "doscmd.h"
+#include "errormsg.h"
+#include "fatops.h"
+#include "parser.h"
+#include "hostsim.h"
+#include "hosttest.h"
+#include "ramdisk.h"
+
+#define SIZE     HOST_D64_SIZE
+#define PIECE    (16 * 1024)
+#define ACCESSES 2000
+#define HOT      4096
+
+static uint8_t model[SIZE];
+static uint8_t file[SIZE + 256];
+static uint8_t data[2048];
+static uint32_t seed = 4;
+
+static uint32_t random(uint32_t range) {
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 8) % range;
+}
+
+static const char *cur;
+static unsigned reads, writes, bad;
+
+static void read_at(DWORD offset, uint16_t len) {
+  uint8_t res = image_read(0, offset, data, len);
+
+  check(res == 0, "%s: read of %u+%u failed with %u", cur,
+        (unsigned)offset, len, res);
+  if (memcmp(data, model + offset, len))
+    bad++;
+  reads++;
+}
+
+static void write_at(DWORD offset, uint16_t len, uint8_t flush) {
+  uint8_t res;
+
+  host_fill(data, len, seed);
+  res = image_write(0, offset, data, len, flush);
+  check(res == 0, "%s: write of %u+%u failed with %u", cur,
+        (unsigned)offset, len, res);
+  memcpy(model + offset, data, len);
+  writes++;
+}
+
+static void access_image(const char *name, int fragmented) {
+  DWORD    offset;
+  uint16_t len;
+  unsigned i;
+  uint8_t  res;
+
+  cur   = name;
+  reads = writes = bad = 0;
+
+  set_error(ERROR_OK);
+  do_chdir((uint8_t *)name);
+  check(current_error == ERROR_OK, "%s: mount failed with error %d",
+        name, current_error);
+#ifdef CONFIG_IMAGE_DIRECT
+  check((partition[0].imagelba == 0) == fragmented,
+        "%s: direct access %s", name,
+        fragmented ? "enabled for a fragmented image" : "not enabled");
+#endif
+
+  memset(&ramdisk_stats, 0, sizeof(ramdisk_stats));
+
+  /* Whole sectors must not leave an old copy of a partial one behind */
+  read_at(5 * 512 + 17, 100);
+  write_at(5 * 512, 512, 0);
+  read_at(5 * 512 + 17, 100);
+  write_at(6 * 512 + 40, 10, 0);
+  read_at(6 * 512, 1024);
+  write_at(6 * 512 + 300, 10, 1);
+  read_at(6 * 512 + 200, 200);
+
+  for (i = 0; i < ACCESSES; i++) {
+    /* Half of the accesses hit the same few sectors again and again */
+    DWORD span = random(2) ? HOT : SIZE;
+
+    switch (random(4)) {
+    case 0:
+      /* whole sectors */
+      offset = random(span / 512 - 3) * 512;
+      len    = 512 * (1 + random(3));
+      break;
+
+    case 1:
+      /* a D64 sector */
+      offset = random(span / 256) * 256;
+      len    = 256;
+      break;
+
+    default:
+      offset = random(span);
+      len    = 1 + random(sizeof(data) - 1);
+      if (offset + len > SIZE)
+        len = SIZE - offset;
+      break;
+    }
+
+    if (random(3) == 0)
+      write_at(offset, len, random(2));
+    else
+      read_at(offset, len);
+  }
+  check(bad == 0, "%s: %u of %u reads returned wrong data", name, bad, reads);
+
+  printf("%-9s %4u reads, %4u writes: %.2f card reads, %.2f card writes per access\n",
+         name, reads, writes, (double)ramdisk_stats.read_cmds / ACCESSES,
+         (double)ramdisk_stats.write_cmds / ACCESSES);
+
+  /* Short read at the end of the image */
+  res = image_read(0, SIZE - 100, data, 256);
+  check(res == 1, "%s: read beyond the end returned %u", name, res);
+  check(!memcmp(data, model + SIZE - 100, 100),
+        "%s: read beyond the end returned wrong data", name);
+
+  /* The image must still work after that */
+  res = image_read(0, 256, data, 256);
+  check(res == 0 && !memcmp(data, model + 256, 256),
+        "%s: read after the end failed", name);
+
+  set_error(ERROR_OK);
+  do_chdir((uint8_t *)"\x5f");
+  check(current_error == ERROR_OK, "%s: unmount failed with error %d",
+        name, current_error);
+
+  check(host_get_file(name, file, sizeof(file)) == SIZE &&
+        !memcmp(file, model, SIZE), "%s: file differs from the model", name);
+}
+
+int main(void) {
+  host_boot("imgdirect.img", 65536);
+
+  host_fill(model, SIZE, 11);
+  check(host_put_file("CONT.D64", model, SIZE) == 0, "can't create CONT.D64");
+  access_image("CONT.D64", 0);
+
+  host_fill(model, SIZE, 12);
+  check(host_put_fragmented("FRAG.D64", model, SIZE, PIECE) == 0,
+        "can't create FRAG.D64");
+  check(host_file_runs("FRAG.D64") > 1, "FRAG.D64 is not fragmented");
+  access_image("FRAG.D64", 1);
+
+  return host_result("imgdirect");
+}
@@ -0,0 +1,109 @@
+/* sd2iec - SD/MMC to Commodore serial bus interface/controller
+   Copyright (C) 2007-2017  Ingo Korb <ingo@akana.de>
+
+   Inspired by MMC2IEC by Lars Pontoppidan et al.
+
+   FAT filesystem access based on code from ChaN and Jim Brain, see ff.c|h.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License only.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+   imgseek.c: Random sector reads from a fragmented DNP image
+
+   Mounts a DNP image that is stored in several pieces and reads
+   sectors in random order, like a program using U1 on a native
+   partition. It reports the card accesses per sector, separately for
+   the FAT sectors that are needed to find the sector in the image.
+   The test is built with and without cluster run map.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "config.h"
+#include "buffers.h"
+#include "doscmd.h"
+#include "errormsg.h"
+#include "ff.h"
+#include "parser.h"
+#include "wrapops.h"
+#include "hostsim.h"
+#include "hosttest.h"
+#include "ramdisk.h"
+
+#define TRACKS   32
+#define IMAGE    (TRACKS * 256L * 256)
+#define PIECE    (256 * 1024L)
+#define ACCESSES 500
+
+static uint8_t image[IMAGE];
+
+int main(void) {
+  buffer_t *buf;
+  uint32_t  seed = 42;
+  uint64_t  start;
+  unsigned  i, bad = 0;
+  int       res;
+
+  host_fill(image, IMAGE, 3);
+  host_boot("imgseek.img", 65536);
+
+  res = host_put_fragmented("RANDOM.DNP", image, IMAGE, PIECE);
+  check(res == 0, "can't create image: %d", res);
+
+  set_error(ERROR_OK);
+  do_chdir((uint8_t *)"RANDOM.DNP");
+  check(current_error == ERROR_OK, "mount failed with error %d", current_error);
+#if _USE_FASTSEEK
+  printf("map: %u runs\n", partition[0].imagemap.runs);
+  check(partition[0].imagemap.runs == IMAGE / PIECE,
+        "image is stored in %u runs", partition[0].imagemap.runs);
+#endif
+
+  buf = alloc_buffer();
+  check(buf != NULL, "no buffer");
+
+  memset(&ramdisk_stats, 0, sizeof(ramdisk_stats));
+  start = sim_now;
+
+  for (i = 0; i < ACCESSES; i++) {
+    uint8_t track, sector;
+
+    seed   = seed * 1103515245 + 12345;
+    track  = 1 + (seed >> 16) % TRACKS;
+    sector = seed >> 8;
+    read_sector(buf, 0, track, sector);
+    if (memcmp(buf->data, image + ((track - 1) * 256L + sector) * 256, 256))
+      bad++;
+  }
+  check(bad == 0, "%u sectors read wrong data", bad);
+  check(current_error == ERROR_OK, "reads failed with error %d", current_error);
+
+  printf("%u random sectors: %.2f card reads, %.2f FAT reads, %.2f ms per sector\n",
+         ACCESSES, (double)ramdisk_stats.read_cmds / ACCESSES,
+         (double)ramdisk_stats.fat_sectors / ACCESSES,
+         (sim_now - start) / 1e6 / ACCESSES);
+#if _USE_FASTSEEK
+  check(ramdisk_stats.fat_sectors == 0,
+        "%u FAT reads with a complete run map",
+        (unsigned)ramdisk_stats.fat_sectors);
+#endif
+
+  free_buffer(buf);
+#if _USE_FASTSEEK
+  return host_result("imgseek");
+#else
+  return host_result("imgseek-chain");
+#endif
+}
@@ -0,0 +1,289 @@
+/* sd2iec - SD/MMC to Commodore serial bus interface/controller
+   Copyright (C) 2007-2017  Ingo Korb <ingo@akana.de>
+
+   Inspired by MMC2IEC by Lars Pontoppidan et al.
+
+   FAT filesystem access based on code from ChaN and Jim Brain, see ff.c|h.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License only.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+   matcher.c: next_match against the matcher it replaced
+
+   Feeds synthetic directory entries from a fake partition through
+   next_match and checks that it returns the same entries as the
+   pattern matcher that was used before patterns were compiled, which
+   is copied below. Random names and patterns are tried with and
+   without POSTMATCH and case folding. Then 100000 names are matched
+   against typical patterns with both. The best time per name of
+   five runs is reported, minus the time of the directory loop.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "config.h"
+#include "dirent.h"
+#include "flags.h"
+#include "parser.h"
+#include "wrapops.h"
+#include "hosttest.h"
+
+#define NAMES 100000
+#define PART  (CONFIG_MAX_PARTITIONS - 1)
+
+static uint8_t   names[NAMES][CBM_NAME_LENGTH + 1];
+static unsigned  count, next_entry;
+static opstype_t opstype;
+static uint32_t  seed = 4711;
+
+static uint32_t random_number(void) {
+  seed = seed * 1103515245 + 12345;
+  return seed >> 8;
+}
+
+/* Fake partition: only opendir and readdir are used by next_match */
+static uint8_t fake_opendir(dh_t *dh, path_t *path) {
+  dh->part = path->part;
+  reset_match(dh);
+  next_entry = 0;
+  return 0;
+}
+
+static int8_t fake_readdir(dh_t *dh, cbmdirent_t *dent) {
+  if (next_entry == count)
+    return -1;
+  memset(dent, 0, sizeof(cbmdirent_t));
+  memcpy(dent->name, names[next_entry++], CBM_NAME_LENGTH + 1);
+  dent->typeflags = TYPE_PRG;
+  dent->opstype   = opstype;
+  return 0;
+}
+
+static const fileops_t fakeops = {
+  .opendir = fake_opendir,
+  .readdir = fake_readdir,
+};
+
+/* The previous match_name, only over-long suffixes are rejected */
+static uint8_t tolower_pet(uint8_t c) {
+  if (c >= 0x61 && c <= 0x7a)
+    c -= 0x20;
+  else if (c >= 0xc1 && c <= 0xda)
+    c -= 0x80;
+  return c;
+}
+
+static uint8_t old_match(uint8_t *matchstr, uint8_t *filename, uint8_t ignorecase) {
+  uint8_t *starpos;
+  uint8_t m,f;
+  uint8_t chars_remain = 16;
+
+  while (chars_remain && *filename) {
+    if (ignorecase) {
+      m = tolower_pet(*matchstr);
+      f = tolower_pet(*filename);
+    } else {
+      m = *matchstr;
+      f = *filename;
+    }
+    switch (m) {
+    case '?':
+      filename++;
+      matchstr++;
+      chars_remain--;
+      break;
+
+    case '*':
+      if (globalflags & POSTMATCH) {
+        starpos = matchstr;
+        if (strlen((char *)starpos + 1) > strlen((char *)filename) + 16 - chars_remain)
+          /* the old code compared the bytes before the name */
+          return 0;
+        matchstr += strlen((char *)matchstr)-1;
+        filename += strlen((char *)filename)-1;
+        while (matchstr != starpos) {
+          if (ignorecase) {
+            m = tolower_pet(*matchstr);
+            f = tolower_pet(*filename);
+          } else {
+            m = *matchstr;
+            f = *filename;
+          }
+          if (m != f && m != '?')
+            return 0;
+          filename--;
+          matchstr--;
+        }
+      }
+      return 1;
+
+    default:
+      if (m != f)
+        return 0;
+      matchstr++;
+      filename++;
+      chars_remain--;
+      break;
+    }
+  }
+  if (*matchstr && *matchstr != '*' && chars_remain != 0)
+    return 0;
+  else
+    return 1;
+}
+
+/* Random string of 1 to max characters, upper and lower case PETSCII */
+static void random_string(uint8_t *buf, unsigned max, int wildcards) {
+  static const char chars[] = "ABCab.12";
+  unsigned len = 1 + random_number() % max;
+  unsigned i, r;
+
+  for (i = 0; i < len; i++) {
+    r = random_number() % (wildcards ? 12 : 10);
+    if (r < 8)
+      buf[i] = chars[r];
+    else if (r < 10)
+      buf[i] = 0xc1 + r - 8;    /* shifted A and B */
+    else
+      buf[i] = r == 10 ? '*' : '?';
+  }
+  buf[len] = 0;
+}
+
+/* Compare next_match on the first n names with the old matcher */
+static void compare(uint8_t *pattern, unsigned n) {
+  path_t      path;
+  dh_t        dh;
+  cbmdirent_t dent;
+  unsigned    i = 0;
+  int8_t      res;
+
+  count = n;
+  path.part = PART;
+  opendir(&dh, &path);
+  while ((res = next_match(&dh, pattern, NULL, NULL, 0, &dent)) == 0) {
+    while (i < next_entry - 1 &&
+           !old_match(pattern, names[i], opstype == OPSTYPE_FAT))
+      i++;
+    if (i != next_entry - 1) {
+      check(0, "\"%s\" matched \"%s\", expected \"%s\"", pattern,
+            dent.name, i < n ? (char *)names[i] : "nothing");
+      return;
+    }
+    i++;
+  }
+  for (; i < n; i++)
+    if (old_match(pattern, names[i], opstype == OPSTYPE_FAT)) {
+      check(0, "\"%s\" did not match \"%s\"", pattern, names[i]);
+      return;
+    }
+}
+
+static double now(void) {
+  struct timeval tv;
+
+  /* src/time.h hides the one of the C library */
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1e9 + tv.tv_usec * 1e3;
+}
+
+static double oldtime, newtime, oldloop, newloop;
+
+/* Time both matchers on all names, best of five runs. A NULL  */
+/* pattern times only the directory loop around the matcher.     */
+static void benchmark(const char *pattern) {
+  path_t      path;
+  dh_t        dh;
+  cbmdirent_t dent;
+  unsigned    run, old = 0, new = 0;
+  double      start, time;
+
+  count = NAMES;
+  path.part = PART;
+  for (run = 0; run < 5; run++) {
+    /* Both read the names through the fake partition */
+    old = new = 0;
+    start = now();
+    opendir(&dh, &path);
+    while (readdir(&dh, &dent) == 0)
+      old += pattern == NULL || old_match((uint8_t *)pattern, dent.name, 1);
+    time = now() - start;
+    if (run == 0 || time < oldtime)
+      oldtime = time;
+
+    start = now();
+    opendir(&dh, &path);
+    while (next_match(&dh, (uint8_t *)pattern, NULL, NULL, 0, &dent) == 0)
+      new++;
+    time = now() - start;
+    if (run == 0 || time < newtime)
+      newtime = time;
+  }
+
+  check(old == new, "\"%s\": %u matches, expected %u",
+        pattern ? pattern : "", new, old);
+  if (pattern == NULL) {
+    oldloop = oldtime;
+    newloop = newtime;
+    printf("  directory loop alone: %5.1f / %5.1f ns per name\n",
+           oldtime / NAMES, newtime / NAMES);
+  } else
+    printf("  %-12s %6u matches, %5.1f -> %5.1f ns per name\n",
+           pattern, new, (oldtime - oldloop) / NAMES,
+           (newtime - newloop) / NAMES);
+}
+
+int main(void) {
+  static const char *typical[] = {
+    "*", "GAME*", "A?C*", "*.D64", "ABCDEFGHIJ", "?B*0", "GAME 12345"
+  };
+  uint8_t  pattern[24];
+  unsigned i, n;
+
+  partition[PART].fop = &fakeops;
+
+  for (i = 0; i < 2000; i++)
+    random_string(names[i], CBM_NAME_LENGTH, 0);
+
+  for (n = 0; n < 4; n++) {
+    globalflags = (n & 1) ? globalflags | POSTMATCH : globalflags & ~POSTMATCH;
+    opstype     = (n & 2) ? OPSTYPE_FAT : OPSTYPE_DXX;
+    for (i = 0; i < 2000; i++) {
+      random_string(pattern, 20, 1);
+      compare(pattern, 2000);
+    }
+  }
+
+  /* Names like in a large game collection */
+  for (i = 0; i < NAMES; i++) {
+    if (i % 4 == 0)
+      sprintf((char *)names[i], "GAME %05u", i);
+    else if (i % 4 == 1)
+      sprintf((char *)names[i], "DISK%04u.D64", i % 10000);
+    else
+      random_string(names[i], CBM_NAME_LENGTH, 0);
+  }
+
+  globalflags |= POSTMATCH;
+  opstype = OPSTYPE_FAT;
+  printf("%u names, POSTMATCH, case folded:\n", NAMES);
+  benchmark(NULL);
+  for (i = 0; i < sizeof(typical) / sizeof(typical[0]); i++)
+    benchmark(typical[i]);
+
+  return host_result("matcher");
+}
@@ -0,0 +1,151 @@
+/* sd2iec - SD/MMC to Commodore serial bus interface/controller
+   Copyright (C) 2007-2017  Ingo Korb <ingo@akana.de>
+
+   Inspired by MMC2IEC by Lars Pontoppidan et al.
+
+   FAT filesystem access based on code from ChaN and Jim Brain, see ff.c|h.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License only.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+   p00list.c: Directory listing of 5000 P00 files
+
+   Creates 5000 P00 files in a subdirectory and loads its directory
+   listing twice over the bus. The CBM name of a P00 file is stored
+   in its header, so every name missing from the [PSUR]00 name cache
+   costs a read of the file while the bus waits. The time of each
+   listing, its stalls and the card reads per entry are reported, built with the default cache of
+   CONFIG_P00CACHE_SIZE=32768, which holds 1354 names, and with a
+   cache large enough for all of them (p00big variant). The second
+   listing of the p00big variant must find every name in the cache.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "config.h"
+#include "c64.h"
+#include "hostsim.h"
+#include "hosttest.h"
+#include "ramdisk.h"
+
+#define DEVICE   8
+#define FILES    5000
+/* BASIC line of each file, header and "BLOCKS FREE." */
+#define LISTSIZE ((FILES + 2) * 32 + 2)
+
+static uint8_t         listing[LISTSIZE];
+static ramdisk_stats_t list_io[2];
+static uint64_t        list_time[2];
+
+static void expect_error(int code) {
+  char msg[64];
+  int  res = c64_read_error(DEVICE, msg, sizeof(msg));
+
+  check(res == code, "error channel: expected %02d, got \"%s\"", code, msg);
+}
+
+static void command(const char *cmd) {
+  c64_open(DEVICE, 15, cmd);
+  c64_close(DEVICE, 15);
+}
+
+/* Checks that the listing has all files in the order they were created */
+static void check_listing(long len) {
+  char     name[20];
+  unsigned line = 0, files = 0;
+  long     pos = 2;
+
+  check(len > 2, "no directory listing");
+  while (pos + 4 < len && (listing[pos] || listing[pos + 1])) {
+    uint8_t *text  = listing + pos + 4;
+    uint8_t *quote = memchr(text, '"', len - pos - 4);
+
+    /* The first line is the header, the last one has no quotes */
+    if (line++ > 0 && quote != NULL && quote - text < 8) {
+      sprintf(name, "\"GAME %04u\"", files);
+      check(!memcmp(quote, name, strlen(name)),
+            "entry %u is not GAME %04u", files, files);
+      files++;
+    }
+
+    while (pos < len && listing[pos + 4])
+      pos++;
+    pos += 5;
+  }
+  check(files == FILES, "listing has %u files", files);
+}
+
+static void list(unsigned pass) {
+  ramdisk_stats_t start = ramdisk_stats;
+  uint64_t        begin = sim_now;
+  long            len;
+
+  len = c64_load(DEVICE, "$", listing, sizeof(listing));
+  list_time[pass]            = sim_now - begin;
+  list_io[pass].read_cmds    = ramdisk_stats.read_cmds    - start.read_cmds;
+  list_io[pass].read_sectors = ramdisk_stats.read_sectors - start.read_sectors;
+  c64_report(pass ? "listing 2" : "listing 1");
+  expect_error(0);
+  check_listing(len);
+}
+
+static void script(void) {
+  expect_error(73);
+  command("CD:ARCHIVE");
+  expect_error(0);
+
+  list(0);
+  list(1);
+}
+
+int main(void) {
+  uint8_t  data[28];
+  char     name[32];
+  unsigned i;
+
+  host_boot("p00list.img", 65536);
+
+  /* A name read from a P00 file keeps the bus waiting */
+  c64_hang = 10000000000ULL;
+
+  check(host_mkdir("ARCHIVE") == 0, "can't create ARCHIVE");
+  for (i = 0; i < FILES; i++) {
+    memset(data, 0, sizeof(data));
+    memcpy(data, "C64File", 7);
+    sprintf((char *)data + 8, "GAME %04u", i);
+    data[26] = 0x01;
+    data[27] = 0x08;
+    sprintf(name, "ARCHIVE/G%04u.P00", i);
+    check(host_put_file(name, data, sizeof(data)) == 0,
+          "can't create %s", name);
+  }
+
+  check(sim_run(script, 6000000000000ULL) == 0, "bus script did not finish");
+
+  for (i = 0; i < 2; i++)
+    printf("listing %u: %8.1fms, %.2f card reads (%.2f sectors) per entry\n",
+           i + 1, list_time[i] / 1e6,
+           (double)list_io[i].read_cmds / FILES,
+           (double)list_io[i].read_sectors / FILES);
+
+  /* The first listing reads each P00 header */
+  check(list_io[0].read_cmds >= FILES, "P00 names were not read");
+#if CONFIG_P00CACHE_SIZE >= 131072
+  check(list_io[1].read_cmds < FILES / 10,
+        "P00 names were read again");
+#endif
+
+  return host_result("p00list");
+}
@@ -0,0 +1,40 @@
+/* sd2iec - SD/MMC to Commodore serial bus interface/controller
+   Copyright (C) 2007-2017  Ingo Korb <ingo@akana.de>
+
+   Inspired by MMC2IEC by Lars Pontoppidan et al.
+
+   FAT filesystem access based on code from ChaN and Jim Brain, see ff.c|h.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License only.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+   pollticks.h: Let virtual time pass while the firmware polls ticks
+
+   Forced into the firmware sources that wait for the system tick in
+   an empty loop (see FIRMWARE_POLLTICKS in the Makefile). Nothing else
+   runs in such a loop, so every read of ticks outside an interrupt
+   handler costs one bus poll of virtual time. The tick interrupt
+   then keeps counting as it does on the drive.
+
+*/
+
+#ifndef POLLTICKS_H
+#define POLLTICKS_H
+
+/* Declares the real variable before it is replaced */
+#include "timer.h"
+
+volatile tick_t *sim_poll_ticks(void);
+
+#define ticks (*sim_poll_ticks())
+
+#endif
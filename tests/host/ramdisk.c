@@ -0,0 +1,273 @@
+/* sd2iec - SD/MMC to Commodore serial bus interface/controller
+   Copyright (C) 2007-2017  Ingo Korb <ingo@akana.de>
+
+   Inspired by MMC2IEC by Lars Pontoppidan et al.
+
+   FAT filesystem access based on code from ChaN and Jim Brain, see ff.c|h.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License only.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+   ramdisk.c: File-backed disk for the host test programs
+
+   The disk image is a plain file that is mapped into memory, so a test
+   can leave it behind for inspection. Every access is charged to the
+   virtual time with a rough model of an SD card in SPI mode, which
+   keeps the throughput numbers of the bus simulation meaningful.
+
+*/
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "config.h"
+#include "diskio.h"
+#include "hostsim.h"
+#include "ramdisk.h"
+
+volatile enum diskstates disk_state;
+
+ramdisk_stats_t ramdisk_stats;
+
+/* about 200us command overhead and 1.2ms per sector at 4MHz SPI */
+uint32_t ramdisk_cmd_ns    = 200000;
+uint32_t ramdisk_sector_ns = 1200000;
+
+uint32_t ramdisk_watch_first;
+uint32_t ramdisk_watch_count;
+
+static uint8_t *image;
+static uint32_t image_sectors;
+
+/* Store a little-endian value into a sector buffer */
+static void put16(uint8_t *ptr, uint16_t val) {
+  ptr[0] = val & 0xff;
+  ptr[1] = val >> 8;
+}
+
+static void put32(uint8_t *ptr, uint32_t val) {
+  put16(ptr, val & 0xffff);
+  put16(ptr + 2, val >> 16);
+}
+
+/**
+ * format_fat16 - create an empty FAT16 file system on the image
+ *
+ * The file system starts at sector 0 without a partition table, which
+ * FatFs accepts just like a formatted floppy. Returns 0 if successful
+ * or -1 if the image size is outside the range of FAT16.
+ */
+static int format_fat16(void) {
+  uint8_t  *bs = image;
+  uint32_t clusters, fatsize;
+  uint8_t  clustersize = 1;
+
+  /* Pick the smallest cluster size that keeps the count in range */
+  while (image_sectors / clustersize > 65000 && clustersize < 128)
+    clustersize *= 2;
+
+  fatsize  = ((image_sectors / clustersize + 2) * 2 + 511) / 512;
+  clusters = (image_sectors - 1 - 32 - 2 * fatsize) / clustersize;
+  if (clusters < 4085 || clusters > 65524)
+    return -1;
+
+  memset(image, 0, 3 * 512);
+  memcpy(bs, "\xeb\x3c\x90" "MSDOS5.0", 11);
+  put16(bs + 11, 512);            // bytes per sector
+  bs[13] = clustersize;
+  put16(bs + 14, 1);              // reserved sectors
+  bs[16] = 2;                     // number of FATs
+  put16(bs + 17, 512);            // root directory entries
+  if (image_sectors < 65536)
+    put16(bs + 19, image_sectors);
+  else
+    put32(bs + 32, image_sectors);
+  bs[21] = 0xf8;                  // media descriptor
+  put16(bs + 22, fatsize);
+  put16(bs + 24, 63);             // sectors per track
+  put16(bs + 26, 255);            // heads
+  bs[36] = 0x80;                  // drive number
+  bs[38] = 0x29;                  // extended boot signature
+  put32(bs + 39, 0x20071005);     // volume ID
+  memcpy(bs + 43, "HOSTTEST   FAT16   ", 19);
+  put16(bs + 510, 0xaa55);
+
+  /* Empty FATs and root directory */
+  memset(image + 512, 0, (2 * fatsize + 32) * 512);
+  put16(image + 512, 0xfff8);
+  put16(image + 514, 0xffff);
+  memcpy(image + 512 * (1 + fatsize), image + 512, 4);
+
+  return 0;
+}
+
+static int map_image(int fd) {
+  struct stat st;
+
+  if (fstat(fd, &st) < 0)
+    return -1;
+
+  image = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (image == MAP_FAILED) {
+    image = NULL;
+    return -1;
+  }
+
+  image_sectors = st.st_size / 512;
+  return 0;
+}
+
+/**
+ * ramdisk_create - create a new disk image
+ * @path   : file name of the image
+ * @sectors: size of the image in 512 byte sectors
+ *
+ * This function creates (or truncates) the image file and formats it
+ * with an empty FAT16 file system. Returns 0 if successful or -1 on
+ * failure.
+ */
+int ramdisk_create(const char *path, uint32_t sectors) {
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+  if (fd < 0 || ftruncate(fd, (off_t)sectors * 512) < 0 || map_image(fd)) {
+    perror(path);
+    return -1;
+  }
+
+  if (format_fat16()) {
+    fprintf(stderr, "%s: %u sectors can't be formatted as FAT16\n",
+            path, (unsigned)sectors);
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * ramdisk_open - open an existing disk image
+ * @path: file name of the image
+ *
+ * Returns 0 if successful or -1 on failure.
+ */
+int ramdisk_open(const char *path) {
+  int fd = open(path, O_RDWR);
+
+  if (fd < 0 || map_image(fd)) {
+    perror(path);
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * ramdisk_close - unmap the current disk image
+ *
+ * All changes have been written to the file when this function returns.
+ */
+void ramdisk_close(void) {
+  if (image != NULL) {
+    munmap(image, (size_t)image_sectors * 512);
+    image = NULL;
+    image_sectors = 0;
+  }
+}
+
+
+/* First sector of the FATs according to the boot sector */
+static uint32_t fat_start(void) {
+  return image[14] | image[15] << 8;
+}
+
+/* First sector behind the FATs */
+static uint32_t fat_end(void) {
+  return fat_start() + image[16] * (image[22] | image[23] << 8);
+}
+
+
+/* ------------------------------------------------------------------------- */
+/*  diskio interface                                                         */
+/* ------------------------------------------------------------------------- */
+
+void disk_init(void) {
+  disk_state = DISK_OK;
+}
+
+DSTATUS disk_status(BYTE drv) {
+  if (drv != 0 || image == NULL)
+    return STA_NOINIT | STA_NODISK;
+
+  return 0;
+}
+
+DSTATUS disk_initialize(BYTE drv) {
+  return disk_status(drv);
+}
+
+DRESULT disk_read(BYTE drv, BYTE *buffer, DWORD sector, BYTE count) {
+  if (disk_status(drv))
+    return RES_NOTRDY;
+
+  if (sector + count > image_sectors)
+    return RES_PARERR;
+
+  ramdisk_stats.read_cmds++;
+  ramdisk_stats.read_sectors += count;
+  if (sector >= fat_start() && sector < fat_end())
+    ramdisk_stats.fat_sectors++;
+  sim_advance(ramdisk_cmd_ns + (uint64_t)count * ramdisk_sector_ns);
+
+  memcpy(buffer, image + (size_t)sector * 512, (size_t)count * 512);
+  return RES_OK;
+}
+
+DRESULT disk_write(BYTE drv, const BYTE *buffer, DWORD sector, BYTE count) {
+  if (disk_status(drv))
+    return RES_NOTRDY;
+
+  if (sector + count > image_sectors)
+    return RES_PARERR;
+
+  ramdisk_stats.write_cmds++;
+  ramdisk_stats.write_sectors += count;
+  if (sector < ramdisk_watch_first + ramdisk_watch_count &&
+      sector + count > ramdisk_watch_first)
+    ramdisk_stats.watch_writes++;
+  sim_advance(ramdisk_cmd_ns + (uint64_t)count * ramdisk_sector_ns);
+
+  memcpy(image + (size_t)sector * 512, buffer, (size_t)count * 512);
+  return RES_OK;
+}
+
+DRESULT disk_getinfo(BYTE drv, BYTE page, void *buffer) {
+  diskinfo0_t *di = buffer;
+
+  if (page != 0)
+    return RES_ERROR;
+
+  if (disk_status(drv))
+    return RES_NOTRDY;
+
+  di->validbytes  = sizeof(diskinfo0_t);
+  di->maxpage     = 0;
+  di->disktype    = DISK_TYPE_SD;
+  di->sectorsize  = 2;
+  di->sectorcount = image_sectors;
+
+  return RES_OK;
+}
@@ -0,0 +1,66 @@
+/* sd2iec - SD/MMC to Commodore serial bus interface/controller
+   Copyright (C) 2007-2017  Ingo Korb <ingo@akana.de>
+
+   Inspired by MMC2IEC by Lars Pontoppidan et al.
+
+   FAT filesystem access based on code from ChaN and Jim Brain, see ff.c|h.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License only.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+   ramdisk.h: File-backed disk for the host test programs
+
+*/
+
+#ifndef RAMDISK_H
+#define RAMDISK_H
+
+#include <stdint.h>
+
+/**
+ * struct ramdisk_stats_t - access counters of the RAM disk
+ * @read_cmds    : calls to disk_read
+ * @read_sectors : sectors transferred by disk_read
+ * @write_cmds   : calls to disk_write
+ * @write_sectors: sectors transferred by disk_write
+ * @fat_sectors  : disk_read calls for a sector of the FAT
+ * @watch_writes : disk_write calls that touch the watched sectors
+ *
+ * A multi-sector call counts as one command, like a CMD18/CMD25
+ * on a real card.
+ */
+typedef struct {
+  uint32_t read_cmds;
+  uint32_t read_sectors;
+  uint32_t write_cmds;
+  uint32_t write_sectors;
+  uint32_t fat_sectors;
+  uint32_t watch_writes;
+} ramdisk_stats_t;
+
+extern ramdisk_stats_t ramdisk_stats;
+
+/* Sectors counted in watch_writes, none if ramdisk_watch_count is 0 */
+extern uint32_t ramdisk_watch_first;
+extern uint32_t ramdisk_watch_count;
+
+/* Virtual time charged per command and per sector, see ramdisk.c */
+extern uint32_t ramdisk_cmd_ns;
+extern uint32_t ramdisk_sector_ns;
+
+int  ramdisk_create(const char *path, uint32_t sectors);
+int  ramdisk_open(const char *path);
+void ramdisk_close(void);
+
+#endif
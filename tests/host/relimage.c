@@ -0,0 +1,483 @@
+/* sd2iec - SD/MMC to Commodore serial bus interface/controller
+   Copyright (C) 2007-2017  Ingo Korb <ingo@akana.de>
+
+   Inspired by MMC2IEC by Lars Pontoppidan et al.
+
+   FAT filesystem access based on code from ChaN and Jim Brain, see ff.c|h.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License only.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+   relimage.c: REL file in a hand-built D64 image
+
+   The image is put together by this program from the 1541 format
+   rules instead of by the firmware: 500 records of 64 bytes in 126
+   data sectors with two side sectors, allocated with interleave 10
+   from track 17 outwards, some records empty (0xff followed by
+   zeros) and the others padded with zeros like the 1541 does.
+
+   The firmware has to read every record exactly as stored. Then
+   some records are changed, which must give the same image byte for
+   byte as building it with the changed records, apart from the time
+   stamp of the directory entry. Finally the file is
+   expanded and its side sectors are compared byte for byte with ones
+   built from the new data chain, the records with the model.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "c64.h"
+#include "hostsim.h"
+#include "hosttest.h"
+
+#define DEVICE   8
+#define SA       3
+#define RECLEN   64
+#define RECORDS  500    /* fills 126 data sectors exactly */
+#define EXPAND   700    /* record written to expand the file */
+#define MAXREC   720
+
+#define SS_ENTRIES 120
+#define INTERLEAVE 10
+#define BLOCKSIZE  254
+
+#define MAXBLOCKS  ((MAXREC * RECLEN + BLOCKSIZE - 1) / BLOCKSIZE)
+#define MAXSS      ((MAXBLOCKS + SS_ENTRIES - 1) / SS_ENTRIES)
+
+static uint8_t image[HOST_D64_SIZE];
+static uint8_t fixture[HOST_D64_SIZE];
+static uint8_t records[MAXREC + 1][RECLEN];   /* as stored on the disk */
+static uint16_t nrecords;
+
+static uint8_t chain[MAXBLOCKS][2];
+static uint8_t sstab[MAXSS][2];
+static uint8_t side[MAXSS][256];
+
+/* ------------------------------------------------------------------------- */
+/*  Image builder                                                            */
+/* ------------------------------------------------------------------------- */
+
+static unsigned sectors(uint8_t track) {
+  if (track <= 17) return 21;
+  if (track <= 24) return 19;
+  if (track <= 30) return 18;
+  return 17;
+}
+
+static uint8_t *sector(uint8_t *img, uint8_t track, uint8_t sec) {
+  unsigned t, ofs = 0;
+
+  for (t = 1; t < track; t++)
+    ofs += sectors(t);
+  return img + 256 * (ofs + sec);
+}
+
+static uint8_t *bam_entry(uint8_t *img, uint8_t track) {
+  return img + HOST_D64_BAM + 4 * track;
+}
+
+static int bam_free(uint8_t *img, uint8_t track, uint8_t sec) {
+  return bam_entry(img, track)[1 + sec / 8] & (1 << (sec & 7));
+}
+
+static void bam_allocate(uint8_t *img, uint8_t track, uint8_t sec) {
+  uint8_t *entry = bam_entry(img, track);
+
+  entry[0]--;
+  entry[1 + sec / 8] &= ~(1 << (sec & 7));
+}
+
+/**
+ * next_sector - allocate the next sector of a file
+ * @img  : image
+ * @track: pointer to the track of the previous sector, 0 for the first
+ * @sec  : pointer to the sector of the previous sector
+ *
+ * Uses the allocation rule of the 1541: the next free sector at
+ * least INTERLEAVE sectors behind the previous one on the same track,
+ * otherwise the next track away from the directory track, starting
+ * at 17 and going down to 1, then from 19 up.
+ */
+static void next_sector(uint8_t *img, uint8_t *track, uint8_t *sec) {
+  uint8_t t = *track, s = *sec, i;
+
+  if (t == 0) {
+    t = 17;
+    s = 0;
+  } else
+    s += INTERLEAVE;
+
+  while (1) {
+    if (bam_entry(img, t)[0]) {
+      s %= sectors(t);
+      for (i = 0; i < sectors(t); i++, s = (s + 1) % sectors(t))
+        if (bam_free(img, t, s)) {
+          bam_allocate(img, t, s);
+          *track = t;
+          *sec   = s;
+          return;
+        }
+    }
+    t = t == 1 ? 19 : t < 18 ? t - 1 : t + 1;
+    check(t <= 35, "image is full");
+    s = 0;
+  }
+}
+
+/* Number of data sectors needed for the current records */
+static unsigned data_blocks(void) {
+  return (nrecords * RECLEN + BLOCKSIZE - 1) / BLOCKSIZE;
+}
+
+/* Build the side sectors of the data sectors in chain[] into side[] */
+static void build_side_sectors(unsigned blocks) {
+  unsigned count = (blocks + SS_ENTRIES - 1) / SS_ENTRIES, i, b;
+
+  memset(side, 0, sizeof(side));
+  for (i = 0; i < count; i++) {
+    uint8_t *ss = side[i];
+
+    if (i + 1 < count) {
+      ss[0] = sstab[i + 1][0];
+      ss[1] = sstab[i + 1][1];
+    } else
+      ss[1] = 15 + 2 * (blocks - i * SS_ENTRIES);
+    ss[2] = i;
+    ss[3] = RECLEN;
+    for (b = 0; b < count; b++) {
+      ss[4 + 2*b] = sstab[b][0];
+      ss[5 + 2*b] = sstab[b][1];
+    }
+    for (b = 0; b < SS_ENTRIES && i * SS_ENTRIES + b < blocks; b++) {
+      ss[16 + 2*b] = chain[i * SS_ENTRIES + b][0];
+      ss[17 + 2*b] = chain[i * SS_ENTRIES + b][1];
+    }
+  }
+}
+
+/* Copy the records into the data sectors in chain[] */
+static void put_records(uint8_t *img, unsigned blocks) {
+  unsigned pos, b;
+
+  for (b = 0; b < blocks; b++) {
+    uint8_t *data = sector(img, chain[b][0], chain[b][1]);
+
+    memset(data, 0, 256);
+    if (b + 1 < blocks) {
+      data[0] = chain[b + 1][0];
+      data[1] = chain[b + 1][1];
+    } else
+      data[1] = nrecords * RECLEN - b * BLOCKSIZE + 1;
+  }
+
+  for (pos = 0; pos < nrecords * RECLEN; pos++)
+    sector(img, chain[pos / BLOCKSIZE][0],
+           chain[pos / BLOCKSIZE][1])[2 + pos % BLOCKSIZE] =
+      records[1 + pos / RECLEN][pos % RECLEN];
+}
+
+/**
+ * build_fixture - build the image with the current records
+ * @img: image buffer
+ *
+ * The first side sector is allocated after the first data sector,
+ * each further one before the data sector it points to first.
+ */
+static void build_fixture(uint8_t *img) {
+  unsigned blocks = data_blocks(), count = 0, b, i;
+  uint8_t  t = 0, s = 0, *dir, *entry;
+
+  host_blank_d64(img, "RELIMAGE");
+
+  for (b = 0; b < blocks; b++) {
+    if (b && b % SS_ENTRIES == 0) {
+      next_sector(img, &t, &s);
+      sstab[count][0] = t;
+      sstab[count][1] = s;
+      count++;
+    }
+    next_sector(img, &t, &s);
+    chain[b][0] = t;
+    chain[b][1] = s;
+    if (b == 0) {
+      next_sector(img, &t, &s);
+      sstab[count][0] = t;
+      sstab[count][1] = s;
+      count++;
+    }
+  }
+
+  put_records(img, blocks);
+  build_side_sectors(blocks);
+  for (i = 0; i < count; i++)
+    memcpy(sector(img, sstab[i][0], sstab[i][1]), side[i], 256);
+
+  dir   = sector(img, 18, 1);
+  entry = dir;
+  entry[2] = 0x84;
+  entry[3] = chain[0][0];
+  entry[4] = chain[0][1];
+  memset(entry + 5, 0xa0, 16);
+  memcpy(entry + 5, "RELDATA", 7);
+  entry[0x15] = sstab[0][0];
+  entry[0x16] = sstab[0][1];
+  entry[0x17] = RECLEN;
+  entry[0x1e] = (blocks + count) & 0xff;
+  entry[0x1f] = (blocks + count) >> 8;
+}
+
+/* Record contents: every 9th empty, the others zero-padded */
+static void set_record(uint16_t rec, uint8_t gen) {
+  uint8_t *data = records[rec], len, i;
+
+  memset(data, 0, RECLEN);
+  if (rec % 9 == 0 && gen == 0) {
+    data[0] = 0xff;
+    return;
+  }
+  len = 1 + (rec * 5 + gen * 17) % RECLEN;
+  for (i = 0; i < len; i++)
+    data[i] = ((rec * 7 + i * 13 + gen * 101) & 0x7f) | 1;
+}
+
+/* Length of a record as read from the bus: the trailing nulls are stripped */
+static uint8_t record_length(uint16_t rec) {
+  uint8_t len = RECLEN;
+
+  while (len > 1 && !records[rec][len - 1])
+    len--;
+  return len;
+}
+
+/* ------------------------------------------------------------------------- */
+/*  Bus script                                                               */
+/* ------------------------------------------------------------------------- */
+
+static void expect_error(int code) {
+  char msg[64];
+  int  res = c64_read_error(DEVICE, msg, sizeof(msg));
+
+  check(res == code, "error channel: expected %02d, got \"%s\"", code, msg);
+}
+
+static void position(uint16_t rec, uint8_t index) {
+  uint8_t cmd[5] = { 'P', 0x60 | SA, rec & 0xff, rec >> 8, index };
+
+  c64_write(DEVICE, 15, cmd, sizeof(cmd));
+}
+
+static void read_record(uint16_t rec, uint8_t index) {
+  uint8_t data[RECLEN + 1];
+  uint8_t len = record_length(rec), ofs = index - 1;
+  long    res;
+
+  position(rec, index);
+  res = c64_read(DEVICE, SA, data, sizeof(data));
+
+  if (ofs >= len)
+    ofs = len - 1;
+  check(res == len - ofs && !memcmp(data, records[rec] + ofs, len - ofs),
+        "record %u from byte %u: read %ld bytes, expected %u", rec, index,
+        res, len - ofs);
+}
+
+static void write_record(uint16_t rec, uint8_t gen) {
+  set_record(rec, gen);
+  position(rec, 1);
+  c64_write(DEVICE, SA, records[rec], record_length(rec));
+}
+
+static void script(void) {
+  static uint16_t order[RECORDS];
+  uint16_t rec;
+  unsigned i;
+
+  expect_error(73);
+
+  c64_open(DEVICE, 15, "CD:RELIMAGE.D64");
+  expect_error(0);
+
+  /* Every record of the fixture, in random order */
+  c64_open(DEVICE, SA, "RELDATA");
+  expect_error(0);
+
+  for (i = 0; i < RECORDS; i++)
+    order[i] = i + 1;
+  srand(1541);
+  for (i = RECORDS - 1; i > 0; i--) {
+    unsigned j = rand() % (i + 1);
+    rec = order[i];
+    order[i] = order[j];
+    order[j] = rec;
+  }
+  for (i = 0; i < RECORDS; i++)
+    read_record(order[i], 1);
+  expect_error(0);
+
+  /* Within records, across sector boundaries */
+  for (rec = 3; rec <= RECORDS; rec += 41)
+    read_record(rec, 1 + rec % RECLEN);
+  expect_error(0);
+
+  position(RECORDS + 1, 1);
+  expect_error(50);
+
+  /* Change records, the image is compared with a rebuilt fixture */
+  for (rec = 5; rec <= RECORDS; rec += 23)
+    write_record(rec, 1);
+  expect_error(0);
+  c64_close(DEVICE, SA);
+  expect_error(0);
+
+  c64_open(DEVICE, 15, "CD:\x5f");
+  expect_error(0);
+  c64_close(DEVICE, 15);
+}
+
+static void expand_script(void) {
+  uint16_t rec;
+
+  c64_open(DEVICE, 15, "CD:RELIMAGE.D64");
+  expect_error(0);
+  c64_open(DEVICE, SA, "RELDATA");
+  expect_error(0);
+
+  write_record(EXPAND, 1);
+  expect_error(50);
+
+  for (rec = 1; rec <= EXPAND; rec += 37)
+    read_record(rec, 1);
+  read_record(EXPAND, 1);
+  expect_error(0);
+
+  c64_close(DEVICE, SA);
+  c64_open(DEVICE, 15, "CD:\x5f");
+  expect_error(0);
+  c64_close(DEVICE, 15);
+}
+
+/* ------------------------------------------------------------------------- */
+/*  Image checks                                                             */
+/* ------------------------------------------------------------------------- */
+
+static void compare_fixture(void) {
+  unsigned ofs;
+
+  build_fixture(fixture);
+
+  /* The drive stamps the changed file with its own clock */
+  memcpy(sector(fixture, 18, 1) + 0x19, sector(image, 18, 1) + 0x19, 5);
+
+  for (ofs = 0; ofs < HOST_D64_SIZE; ofs++)
+    if (image[ofs] != fixture[ofs]) {
+      check(0, "changed image differs from the fixture at offset %u: "
+            "%02x instead of %02x", ofs, image[ofs], fixture[ofs]);
+      break;
+    }
+}
+
+static void check_expanded(void) {
+  uint8_t *entry = sector(image, 18, 1), *data;
+  unsigned blocks = 0, count, i, pos;
+  uint8_t  t, s;
+
+  /* Data chain of the expanded file */
+  t = entry[3];
+  s = entry[4];
+  while (t && blocks < MAXBLOCKS) {
+    chain[blocks][0] = t;
+    chain[blocks][1] = s;
+    blocks++;
+    data = sector(image, t, s);
+    t = data[0];
+    s = data[1];
+  }
+  check(!t, "data chain longer than %u sectors", MAXBLOCKS);
+  check(blocks == data_blocks(), "%u data sectors instead of %u", blocks,
+        data_blocks());
+  check(s == nrecords * RECLEN - (blocks - 1) * BLOCKSIZE + 1,
+        "last data sector ends at %u", s);
+
+  /* Side sectors, byte for byte */
+  count = (blocks + SS_ENTRIES - 1) / SS_ENTRIES;
+  t = entry[0x15];
+  s = entry[0x16];
+  for (i = 0; i < count && t; i++) {
+    sstab[i][0] = t;
+    sstab[i][1] = s;
+    data = sector(image, t, s);
+    t = data[0];
+    s = data[1];
+  }
+  check(i == count, "%u side sectors instead of %u", i, count);
+  build_side_sectors(blocks);
+  for (i = 0; i < count; i++)
+    check(!memcmp(sector(image, sstab[i][0], sstab[i][1]), side[i], 256),
+          "side sector %u at %u/%u differs", i, sstab[i][0], sstab[i][1]);
+
+  check(entry[0x1e] + 256 * entry[0x1f] == blocks + count,
+        "directory entry has %u blocks instead of %u",
+        entry[0x1e] + 256 * entry[0x1f], blocks + count);
+
+  /* Records, byte for byte */
+  for (pos = 0; pos < nrecords * RECLEN; pos++)
+    if (sector(image, chain[pos / BLOCKSIZE][0],
+               chain[pos / BLOCKSIZE][1])[2 + pos % BLOCKSIZE] !=
+        records[1 + pos / RECLEN][pos % RECLEN]) {
+      check(0, "record %u differs at byte %u", 1 + pos / RECLEN,
+            pos % RECLEN);
+      break;
+    }
+
+  printf("expanded to %u records in %u data sectors, %u side sectors\n",
+         nrecords, blocks, count);
+}
+
+int main(void) {
+  uint16_t rec;
+  long len;
+
+  host_boot("relimage.img", 65536);
+
+  /* The drive holds the bus while it expands the file */
+  c64_hang = 60000000000ULL;
+
+  nrecords = RECORDS;
+  for (rec = 1; rec <= RECORDS; rec++)
+    set_record(rec, 0);
+  build_fixture(image);
+  check(host_put_file("RELIMAGE.D64", image, HOST_D64_SIZE) == 0,
+        "can't create RELIMAGE.D64");
+
+  check(sim_run(script, 6000000000000ULL) == 0, "bus script did not finish");
+  len = host_get_file("RELIMAGE.D64", image, sizeof(image));
+  check(len == HOST_D64_SIZE, "image has %ld bytes", len);
+  compare_fixture();
+
+  /* The file ends after the last record that fits into its sectors */
+  for (rec = RECORDS + 1; rec <= MAXREC; rec++)
+    records[rec][0] = 0xff;
+  nrecords = EXPAND;
+  nrecords = data_blocks() * BLOCKSIZE / RECLEN;
+
+  check(sim_run(expand_script, 6000000000000ULL) == 0, "bus script did not finish");
+  len = host_get_file("RELIMAGE.D64", image, sizeof(image));
+  check(len == HOST_D64_SIZE, "image has %ld bytes", len);
+  check_expanded();
+
+  return host_result("relimage");
+}
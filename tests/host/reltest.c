@@ -0,0 +1,443 @@
+/* sd2iec - SD/MMC to Commodore serial bus interface/controller
+   Copyright (C) 2007-2017  Ingo Korb <ingo@akana.de>
+
+   Inspired by MMC2IEC by Lars Pontoppidan et al.
+
+   FAT filesystem access based on code from ChaN and Jim Brain, see ff.c|h.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License only.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+   reltest.c: REL files in D64 and D81 images
+
+   Creates a REL file in an empty image, writes records one after
+   the other and then far beyond its end, so the file is expanded
+   over several side sectors (and side sector groups on D81). Then
+   the records are read back in random order, counting the card
+   reads per positioned record, and some of them are changed.
+
+   At the end the image is taken from the RAM disk and checked like
+   a disk validator would: the data chain, side sectors, super side
+   sector, block count, BAM and the record contents are compared
+   with what the 1541 would have written.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "c64.h"
+#include "hostsim.h"
+#include "hosttest.h"
+#include "ramdisk.h"
+
+#define DEVICE   8
+#define SA       2
+#define RECLEN   50
+#define FIRST    30     /* records written one after the other */
+#define RANDOM   300    /* positioned reads */
+#define REWRITE  40     /* positioned writes */
+
+#define D81_SIZE 819200
+
+#define SS_ENTRIES   120
+#define SS_PER_GROUP 6
+
+typedef struct {
+  const char *name;
+  uint8_t  d81;
+  uint16_t last;        /* record written to expand the file */
+} reltest_t;
+
+static const reltest_t tests[] = {
+  { "REL.D64", 0, 2000 },  /* 394 data sectors, 4 side sectors */
+  { "REL.D81", 1, 4000 },  /* 788 data sectors, 2 groups       */
+};
+
+static const reltest_t *cur;
+static uint8_t  image[D81_SIZE];
+static uint8_t *written;          /* generation of each record, 0: empty */
+
+/* Card accesses of the interesting steps */
+static ramdisk_stats_t create_io, expand_io, random_io;
+
+static void expect_error(int code) {
+  char msg[64];
+  int  res = c64_read_error(DEVICE, msg, sizeof(msg));
+
+  check(res == code, "error channel: expected %02d, got \"%s\"", code, msg);
+}
+
+static void record_data(uint16_t rec, uint8_t gen, uint8_t *data) {
+  uint8_t i;
+
+  for (i = 0; i < RECLEN; i++)
+    data[i] = ((rec * 7 + i * 13 + gen * 101) & 0x7f) | 1;
+}
+
+static void stats_since(ramdisk_stats_t *res, const ramdisk_stats_t *start) {
+  res->read_sectors  = ramdisk_stats.read_sectors  - start->read_sectors;
+  res->write_sectors = ramdisk_stats.write_sectors - start->write_sectors;
+  res->read_cmds     = ramdisk_stats.read_cmds     - start->read_cmds;
+  res->write_cmds    = ramdisk_stats.write_cmds    - start->write_cmds;
+}
+
+static void position(uint16_t rec) {
+  uint8_t cmd[5] = { 'P', 0x60 | SA, rec & 0xff, rec >> 8, 1 };
+
+  c64_write(DEVICE, 15, cmd, sizeof(cmd));
+}
+
+static void write_record(uint16_t rec, uint8_t gen) {
+  uint8_t data[RECLEN];
+
+  record_data(rec, gen, data);
+  position(rec);
+  c64_write(DEVICE, SA, data, RECLEN);
+  written[rec] = gen;
+}
+
+static void read_record(uint16_t rec) {
+  uint8_t data[RECLEN + 1], expected[RECLEN];
+  long len;
+
+  position(rec);
+  len = c64_read(DEVICE, SA, data, sizeof(data));
+
+  if (written[rec]) {
+    record_data(rec, written[rec], expected);
+    check(len == RECLEN && !memcmp(data, expected, RECLEN),
+          "%s: record %u read wrong data (%ld bytes)", cur->name, rec, len);
+  } else {
+    check(len == 1 && data[0] == 0xff,
+          "%s: empty record %u read %ld bytes, first %02x",
+          cur->name, rec, len, data[0]);
+  }
+}
+
+static void script(void) {
+  ramdisk_stats_t start;
+  uint16_t rec;
+  unsigned i;
+
+  expect_error(73);
+
+  c64_open(DEVICE, 15, cur->d81 ? "CD:REL.D81" : "CD:REL.D64");
+  expect_error(0);
+
+  /* Create */
+  start = ramdisk_stats;
+  c64_open(DEVICE, SA, "DATA,L," "\x32");
+  expect_error(0);
+  stats_since(&create_io, &start);
+
+  /* Each record behind the end is reported, but written anyway */
+  for (rec = 1; rec <= FIRST; rec++)
+    write_record(rec, 1);
+  expect_error(50);
+
+  /* Expand */
+  start = ramdisk_stats;
+  write_record(cur->last, 1);
+  stats_since(&expand_io, &start);
+  expect_error(50);
+
+  c64_close(DEVICE, SA);
+  expect_error(0);
+
+  /* Reopen, read and change records in random order */
+  c64_open(DEVICE, SA, "DATA");
+  expect_error(0);
+
+  srand(64);
+  start = ramdisk_stats;
+  for (i = 0; i < RANDOM; i++)
+    read_record(1 + rand() % cur->last);
+  stats_since(&random_io, &start);
+
+  for (i = 0; i < REWRITE; i++)
+    write_record(1 + rand() % cur->last, 2);
+
+  for (rec = 1; rec <= cur->last; rec += 97)
+    read_record(rec);
+  read_record(cur->last);
+  expect_error(0);
+
+  c64_close(DEVICE, SA);
+  c64_close(DEVICE, 15);
+
+  /* Leave the image */
+  c64_open(DEVICE, 15, "CD:\x5f");
+  expect_error(0);
+  c64_close(DEVICE, 15);
+}
+
+/* ------------------------------------------------------------------------- */
+/*  Image checks                                                             */
+/* ------------------------------------------------------------------------- */
+
+static unsigned sectors(uint8_t track) {
+  if (cur->d81)
+    return 40;
+  if (track <= 17) return 21;
+  if (track <= 24) return 19;
+  if (track <= 30) return 18;
+  return 17;
+}
+
+static uint8_t *sector(uint8_t track, uint8_t sec) {
+  unsigned t, ofs = 0;
+
+  for (t = 1; t < track; t++)
+    ofs += sectors(t);
+  return image + 256 * (ofs + sec);
+}
+
+static int valid_ts(uint8_t track, uint8_t sec) {
+  return track >= 1 && track <= (cur->d81 ? 80 : 35) && sec < sectors(track);
+}
+
+/* Returns 1 if the sector is marked as used in the BAM */
+static int bam_used(uint8_t track, uint8_t sec) {
+  uint8_t *entry;
+
+  if (cur->d81) {
+    entry = sector(40, track <= 40 ? 1 : 2) + 0x10 + 6 * ((track - 1) % 40);
+    return !(entry[1 + sec / 8] & (1 << (sec & 7)));
+  }
+  entry = sector(18, 0) + 4 * track;
+  return !(entry[1 + sec / 8] & (1 << (sec & 7)));
+}
+
+static void make_image(void) {
+  uint8_t *bam;
+  unsigned t, s;
+
+  memset(image, 0, sizeof(image));
+
+  if (cur->d81) {
+    bam = sector(40, 0);
+    bam[0] = 40; bam[1] = 3; bam[2] = 'D';
+    memset(bam + 4, 0xa0, 0x19 - 4);
+    memcpy(bam + 4, "RELTEST", 7);
+    bam[0x16] = 'I'; bam[0x17] = 'D';
+    bam[0x19] = '3'; bam[0x1a] = 'D';
+
+    for (s = 1; s <= 2; s++) {
+      bam = sector(40, s);
+      bam[0] = s == 1 ? 40 : 0;
+      bam[1] = s == 1 ? 2 : 0xff;
+      bam[2] = 'D'; bam[3] = 0xbb;
+      bam[4] = 'I'; bam[5] = 'D';
+      bam[6] = 0xc0;
+      for (t = 1; t <= 40; t++) {
+        uint8_t *entry = bam + 0x10 + 6 * (t - 1);
+        uint8_t  track = t + (s - 1) * 40;
+
+        entry[0] = 40;
+        memset(entry + 1, 0xff, 5);
+        if (track == 40) {
+          entry[0]  = 36;
+          entry[1] &= 0xf0;
+        }
+      }
+    }
+    sector(40, 3)[1] = 0xff;
+  } else
+    host_blank_d64(image, "RELTEST");
+}
+
+static uint8_t *find_entry(void) {
+  uint8_t t = cur->d81 ? 40 : 18, s = cur->d81 ? 3 : 1;
+  unsigned i;
+
+  while (t) {
+    uint8_t *dir = sector(t, s);
+
+    for (i = 0; i < 8; i++) {
+      uint8_t *entry = dir + 32 * i;
+
+      if (entry[2] && !memcmp(entry + 5, "DATA\xa0", 5))
+        return entry;
+    }
+    t = dir[0];
+    s = dir[1];
+  }
+  return NULL;
+}
+
+static void check_image(void) {
+  static uint8_t seen[80 * 40];
+  static uint8_t ts[4000][2];
+  uint8_t *entry, *ss, *super = NULL;
+  unsigned blocks = 0, sscount = 0, groups = 1, i, t, s;
+  unsigned lastbyte = 0, size, rec;
+  long len;
+
+  len = host_get_file(cur->name, image, sizeof(image));
+  check(len == (cur->d81 ? D81_SIZE : HOST_D64_SIZE), "%s: image has %ld bytes",
+        cur->name, len);
+
+  entry = find_entry();
+  check(entry != NULL, "%s: no directory entry", cur->name);
+  if (!entry)
+    return;
+
+  check(entry[2] == 0x84, "%s: file type %02x", cur->name, entry[2]);
+  check(entry[0x17] == RECLEN, "%s: record length %u", cur->name, entry[0x17]);
+  memset(seen, 0, sizeof(seen));
+
+  /* Data chain */
+  t = entry[3];
+  s = entry[4];
+  while (t) {
+    if (!valid_ts(t, s) || seen[(t - 1) * 40 + s] || blocks == 4000) {
+      check(0, "%s: bad data chain at %u/%u", cur->name, t, s);
+      return;
+    }
+    seen[(t - 1) * 40 + s] = 1;
+    check(bam_used(t, s), "%s: data sector %u/%u free in BAM", cur->name, t, s);
+    ts[blocks][0] = t;
+    ts[blocks][1] = s;
+    blocks++;
+    lastbyte = sector(t, s)[1];
+    s = sector(t, s)[1];
+    t = sector(t, ts[blocks - 1][1])[0];
+  }
+
+  /* Side sectors */
+  t = entry[0x15];
+  s = entry[0x16];
+  if (cur->d81) {
+    super = sector(t, s);
+    check(super[2] == 0xfe, "%s: no super side sector at %u/%u", cur->name, t, s);
+    seen[(t - 1) * 40 + s] = 1;
+    check(bam_used(t, s), "%s: super side sector free in BAM", cur->name);
+    t = super[0];
+    s = super[1];
+    check(t == super[3] && s == super[4], "%s: super side sector link", cur->name);
+  }
+
+  while (t) {
+    uint8_t idx = sscount % SS_PER_GROUP;
+
+    if (!valid_ts(t, s) || seen[(t - 1) * 40 + s]) {
+      check(0, "%s: bad side sector chain at %u/%u", cur->name, t, s);
+      return;
+    }
+    seen[(t - 1) * 40 + s] = 1;
+    check(bam_used(t, s), "%s: side sector %u/%u free in BAM", cur->name, t, s);
+    ss = sector(t, s);
+
+    check(ss[2] == idx, "%s: side sector %u has number %u", cur->name, sscount, ss[2]);
+    check(ss[3] == RECLEN, "%s: side sector %u record length", cur->name, sscount);
+    check(ss[4 + 2*idx] == t && ss[5 + 2*idx] == s,
+          "%s: side sector %u not in its own group list", cur->name, sscount);
+    if (super && idx == 0) {
+      check(super[3 + 2*(sscount / SS_PER_GROUP)] == t &&
+            super[4 + 2*(sscount / SS_PER_GROUP)] == s,
+            "%s: group %u missing in super side sector", cur->name,
+            sscount / SS_PER_GROUP);
+      if (sscount)
+        groups++;
+    }
+
+    for (i = 0; i < SS_ENTRIES; i++) {
+      unsigned block = sscount * SS_ENTRIES + i;
+
+      if (block < blocks)
+        check(ss[16 + 2*i] == ts[block][0] && ss[17 + 2*i] == ts[block][1],
+              "%s: side sector %u entry %u is %u/%u, data sector %u/%u",
+              cur->name, sscount, i, ss[16 + 2*i], ss[17 + 2*i],
+              ts[block][0], ts[block][1]);
+      else
+        check(ss[16 + 2*i] == 0 && ss[17 + 2*i] == 0,
+              "%s: side sector %u has extra entry %u", cur->name, sscount, i);
+    }
+    if (ss[0] == 0)
+      check(ss[1] == 15 + 2 * (blocks - sscount * SS_ENTRIES),
+            "%s: last side sector ends at %u", cur->name, ss[1]);
+
+    sscount++;
+    t = ss[0];
+    s = ss[1];
+  }
+
+  check(sscount == (blocks + SS_ENTRIES - 1) / SS_ENTRIES,
+        "%s: %u side sectors for %u data sectors", cur->name, sscount, blocks);
+  check(entry[0x1e] + 256 * entry[0x1f] == blocks + sscount + (super != NULL),
+        "%s: directory entry has %u blocks instead of %u", cur->name,
+        entry[0x1e] + 256 * entry[0x1f], blocks + sscount + (super != NULL));
+
+  /* Records, the file ends after the last record that fits completely */
+  size = (blocks - 1) * 254 + lastbyte - 1;
+  check(size == (blocks * 254) / RECLEN * RECLEN,
+        "%s: %u bytes in %u sectors", cur->name, size, blocks);
+
+  for (rec = 1; rec <= size / RECLEN; rec++) {
+    uint8_t data[RECLEN], expected[RECLEN];
+
+    for (i = 0; i < RECLEN; i++) {
+      unsigned pos = (rec - 1) * RECLEN + i;
+      data[i] = sector(ts[pos / 254][0], ts[pos / 254][1])[2 + pos % 254];
+    }
+
+    if (rec <= cur->last && written[rec])
+      record_data(rec, written[rec], expected);
+    else {
+      memset(expected, 0, RECLEN);
+      expected[0] = 0xff;
+    }
+    if (memcmp(data, expected, RECLEN)) {
+      check(0, "%s: record %u wrong in the image", cur->name, rec);
+      break;
+    }
+  }
+
+  printf("%s: %u data sectors, %u side sectors in %u group%s\n", cur->name,
+         blocks, sscount, groups, groups == 1 ? "" : "s");
+}
+
+int main(void) {
+  unsigned i;
+
+  host_boot("reltest.img", 65536);
+
+  /* The drive holds the bus while it expands the file */
+  c64_hang = 60000000000ULL;
+
+  for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+    cur = &tests[i];
+    written = calloc(cur->last + 1, 1);
+
+    make_image();
+    check(host_put_file(cur->name, image, cur->d81 ? D81_SIZE : HOST_D64_SIZE) == 0,
+          "can't create %s", cur->name);
+
+    check(sim_run(script, 6000000000000ULL) == 0, "bus script did not finish");
+    check_image();
+
+    printf("%s: create %u reads, %u writes; expand %u reads, %u writes\n",
+           cur->name, (unsigned)create_io.read_sectors,
+           (unsigned)create_io.write_sectors, (unsigned)expand_io.read_sectors,
+           (unsigned)expand_io.write_sectors);
+    printf("%s: %.2f card reads (%.2f sectors) per positioned record\n",
+           cur->name, (double)random_io.read_cmds / RANDOM,
+           (double)random_io.read_sectors / RANDOM);
+    free(written);
+  }
+
+  return host_result("reltest");
+}
@@ -0,0 +1,474 @@
+/* sd2iec - SD/MMC to Commodore serial bus interface/controller
+   Copyright (C) 2007-2017  Ingo Korb <ingo@akana.de>
+
+   Inspired by MMC2IEC by Lars Pontoppidan et al.
+
+   FAT filesystem access based on code from ChaN and Jim Brain, see ff.c|h.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License only.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+   sdemu.c: Emulated SD card behind the SPI functions
+
+   This implements the SPI interface of arch/spi.h with an SDHC card
+   in SPI mode, so sdcard.c can be tested without hardware. The card
+   checks the CRCs it receives, keeps its contents in memory and
+   holds DO low while it programs a block, charging the time to the
+   simulation. It counts every byte the host reads while it is busy,
+   which makes the cost of a command sequence visible. Anything that
+   a real card would reject is counted as a protocol error.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "crc.h"
+#include "hostsim.h"
+#include "spi.h"
+#include "sdemu.h"
+
+/* one SPI byte at 8MHz */
+#define BYTE_NS        1000
+/* programming one block and erasing its area, in ns */
+#define PROGRAM_NS     250000
+#define ERASE_NS       750000
+/* bytes between a read command and its data token */
+#define ACCESS_BYTES   20
+
+#define OUTQ_SIZE      600
+
+typedef enum {
+  CARD_IDLE,         // waiting for a command
+  CARD_READ_MULTI,   // streaming blocks until STOP_TRANSMISSION
+  CARD_WRITE_TOKEN,  // waiting for a start block token
+  CARD_WRITE_DATA,   // receiving a data block
+} card_state_t;
+
+sdemu_stats_t sdemu_stats;
+uint8_t      *sdemu_data;
+unsigned      sdemu_fail_writes;
+
+static uint32_t card_sectors;
+static uint8_t  selected, slow;
+static uint8_t  in_idle, app_cmd, crc_on;
+static uint8_t  multi;
+static uint32_t address, erase_count;
+
+static card_state_t state;
+static uint8_t  cmdbuf[6], cmdlen;
+static uint8_t  datbuf[514];
+static unsigned datlen;
+
+/* bytes that the card sends next */
+static uint8_t  outq[OUTQ_SIZE];
+static unsigned outq_head, outq_tail;
+
+/* DO stays low until this time */
+static uint64_t busy_until;
+
+static void out_byte(uint8_t b) {
+  if (outq_tail >= OUTQ_SIZE) {
+    fprintf(stderr, "sdemu: output queue overflow\n");
+    exit(1);
+  }
+  outq[outq_tail++] = b;
+}
+
+static void out_clear(void) {
+  outq_head = outq_tail = 0;
+}
+
+static void out_r1(void) {
+  out_byte(0xff); // Ncr
+  out_byte(in_idle ? 0x01 : 0x00);
+}
+
+static void out_block(uint32_t sector) {
+  uint16_t crc;
+
+  if (sector >= card_sectors) {
+    sdemu_stats.protocol_errors++;
+    sector = 0;
+  }
+  crc = crc_xmodem_block(0, sdemu_data + 512 * sector, 512);
+  out_byte(0xfe);
+  memcpy(outq + outq_tail, sdemu_data + 512 * sector, 512);
+  outq_tail += 512;
+  out_byte(crc >> 8);
+  out_byte(crc & 0xff);
+  sdemu_stats.blocks_read++;
+}
+
+static void stop_transmission(void) {
+  out_clear();
+  out_byte(0xff); // stuff byte
+  out_byte(0xff); // Ncr
+  out_byte(0x00);
+  state = CARD_IDLE;
+}
+
+static void do_command(void) {
+  uint8_t  cmd = cmdbuf[0] & 0x3f;
+  uint32_t arg = (uint32_t)cmdbuf[1] << 24 | (uint32_t)cmdbuf[2] << 16 |
+                 (uint32_t)cmdbuf[3] << 8  | cmdbuf[4];
+  uint8_t  crc = 0;
+  unsigned i;
+
+  sdemu_stats.commands++;
+
+  for (i = 0; i < 5; i++)
+    crc = crc7update(crc, cmdbuf[i]);
+  if ((cmd == 0 || crc_on) && ((crc << 1) | 1) != cmdbuf[5]) {
+    out_byte(0xff);
+    out_byte((in_idle ? 0x01 : 0x00) | 0x08);
+    app_cmd = 0;
+    return;
+  }
+
+  if (state == CARD_READ_MULTI) {
+    out_clear();
+    if (cmd == 12) {
+      stop_transmission();
+      return;
+    }
+    sdemu_stats.protocol_errors++;
+    state = CARD_IDLE;
+  }
+
+  if (app_cmd) {
+    app_cmd = 0;
+    switch (cmd) {
+    case 41: // SD_SEND_OP_COND
+      in_idle = 0;
+      out_r1();
+      return;
+
+    case 23: // SET_WR_BLK_ERASE_COUNT
+      erase_count = arg & 0x7fffff;
+      out_r1();
+      return;
+
+    default:
+      break;
+    }
+  }
+
+  switch (cmd) {
+  case 0:  // GO_IDLE_STATE
+    in_idle = 1;
+    crc_on  = 0;
+    out_r1();
+    break;
+
+  case 1:  // SEND_OP_COND
+    in_idle = 0;
+    out_r1();
+    break;
+
+  case 8:  // SEND_IF_COND
+    out_r1();
+    out_byte(0);
+    out_byte(0);
+    out_byte((arg >> 8) & 0x0f);
+    out_byte(arg & 0xff);
+    break;
+
+  case 9:  // SEND_CSD, version 2.0
+  {
+    uint8_t  csd[16];
+    uint32_t size = card_sectors / 1024 - 1;
+    uint16_t dcrc;
+
+    memset(csd, 0, sizeof(csd));
+    csd[0]  = 0x40;
+    csd[7]  = (size >> 16) & 0x3f;
+    csd[8]  = size >> 8;
+    csd[9]  = size;
+    out_r1();
+    out_byte(0xfe);
+    for (i = 0; i < 16; i++)
+      out_byte(csd[i]);
+    dcrc = crc_xmodem_block(0, csd, 16);
+    out_byte(dcrc >> 8);
+    out_byte(dcrc & 0xff);
+    break;
+  }
+
+  case 12: // STOP_TRANSMISSION outside of a read
+    sdemu_stats.protocol_errors++;
+    out_byte(0xff);
+    out_r1();
+    break;
+
+  case 16: // SET_BLOCKLEN
+    if (arg != 512)
+      sdemu_stats.protocol_errors++;
+    out_r1();
+    break;
+
+  case 17: // READ_SINGLE_BLOCK
+  case 18: // READ_MULTIPLE_BLOCK
+    out_r1();
+    for (i = 0; i < ACCESS_BYTES; i++)
+      out_byte(0xff);
+    address = arg;
+    out_block(address++);
+    if (cmd == 18)
+      state = CARD_READ_MULTI;
+    break;
+
+  case 24: // WRITE_BLOCK
+  case 25: // WRITE_MULTIPLE_BLOCK
+    out_r1();
+    address = arg;
+    multi   = (cmd == 25);
+    state   = CARD_WRITE_TOKEN;
+    if (!multi)
+      erase_count = 0;
+    break;
+
+  case 55: // APP_CMD
+    app_cmd = 1;
+    out_r1();
+    break;
+
+  case 58: // READ_OCR, powered up and high capacity
+    out_r1();
+    out_byte(0xc0);
+    out_byte(0xff);
+    out_byte(0x80);
+    out_byte(0x00);
+    break;
+
+  case 59: // CRC_ON_OFF
+    crc_on = arg & 1;
+    out_r1();
+    break;
+
+  default:
+    out_byte(0xff);
+    out_byte((in_idle ? 0x01 : 0x00) | 0x04);
+    break;
+  }
+}
+
+/* Program the received block, returns the data response token */
+static uint8_t write_block(void) {
+  uint64_t busy = PROGRAM_NS;
+
+  if (sdemu_fail_writes) {
+    sdemu_fail_writes--;
+    busy_until = sim_now + 8 * BYTE_NS;
+    return 0x0b;
+  }
+
+  if (crc_xmodem_block(0, datbuf, 512) != (datbuf[512] << 8 | datbuf[513])) {
+    busy_until = sim_now + 8 * BYTE_NS;
+    return 0x0b;
+  }
+
+  if (address >= card_sectors) {
+    sdemu_stats.protocol_errors++;
+    return 0x0d;
+  }
+
+  memcpy(sdemu_data + 512 * address, datbuf, 512);
+  address++;
+  sdemu_stats.blocks_written++;
+
+  /* without a pre-erase hint, every block erases its own area */
+  if (erase_count)
+    erase_count--;
+  else
+    busy += ERASE_NS;
+
+  busy_until = sim_now + busy;
+  return 0x05;
+}
+
+/* Feed a byte sent by the host into the card */
+static void card_receive(uint8_t b) {
+  switch (state) {
+  case CARD_WRITE_TOKEN:
+    if (b == 0xff)
+      break;
+
+    if (multi && b == 0xfc) {
+      state  = CARD_WRITE_DATA;
+      datlen = 0;
+    } else if (!multi && b == 0xfe) {
+      state  = CARD_WRITE_DATA;
+      datlen = 0;
+    } else if (multi && b == 0xfd) {
+      /* stop tran: one byte gap, then busy until the last block is done */
+      out_byte(0xff);
+      if (busy_until < sim_now)
+        busy_until = sim_now;
+      busy_until += 4 * BYTE_NS;
+      erase_count = 0;
+      state = CARD_IDLE;
+    } else {
+      /* most likely a command, which the card does not expect here */
+      sdemu_stats.protocol_errors++;
+      state  = CARD_IDLE;
+      cmdlen = 0;
+      if ((b & 0xc0) == 0x40)
+        cmdbuf[cmdlen++] = b;
+    }
+    break;
+
+  case CARD_WRITE_DATA:
+    datbuf[datlen++] = b;
+    if (datlen == sizeof(datbuf)) {
+      out_byte(write_block());
+      state = multi ? CARD_WRITE_TOKEN : CARD_IDLE;
+    }
+    break;
+
+  case CARD_IDLE:
+  case CARD_READ_MULTI:
+    if (cmdlen == 0 && (b & 0xc0) != 0x40)
+      break;
+
+    cmdbuf[cmdlen++] = b;
+    if (cmdlen == 6) {
+      cmdlen = 0;
+      out_clear();
+      do_command();
+    }
+    break;
+  }
+}
+
+/* Byte that the card drives on DO for the next clock */
+static uint8_t card_send(void) {
+  uint8_t b;
+
+  if (outq_head < outq_tail) {
+    b = outq[outq_head++];
+    if (outq_head == outq_tail)
+      out_clear();
+    return b;
+  }
+
+  if (sim_now < busy_until) {
+    sdemu_stats.busy_polls++;
+    return 0x00;
+  }
+
+  /* next block of a multi-block read, preceded by a short gap */
+  if (state == CARD_READ_MULTI) {
+    out_byte(0xff);
+    out_byte(0xff);
+    out_block(address++);
+  }
+
+  return 0xff;
+}
+
+/* Clock a full-duplex byte */
+static uint8_t transfer(uint8_t b) {
+  uint8_t res = 0xff;
+
+  sim_advance(slow ? 20 * BYTE_NS : BYTE_NS);
+  if (!selected)
+    return res;
+
+  res = card_send();
+  card_receive(b);
+  return res;
+}
+
+/**
+ * sdemu_init - insert a blank card
+ * @sectors: capacity, must be a multiple of 1024
+ */
+void sdemu_init(uint32_t sectors) {
+  free(sdemu_data);
+  sdemu_data = calloc(sectors, 512);
+  if (sdemu_data == NULL) {
+    perror("sdemu");
+    exit(1);
+  }
+  card_sectors = sectors;
+  state        = CARD_IDLE;
+  in_idle      = 1;
+  selected     = 0;
+  cmdlen       = 0;
+  busy_until   = 0;
+  out_clear();
+  memset(&sdemu_stats, 0, sizeof(sdemu_stats));
+}
+
+/* ------------------------------------------------------------------------- */
+/*  SPI interface                                                            */
+/* ------------------------------------------------------------------------- */
+
+void spi_init(spi_speed_t speed) {
+  spi_set_speed(speed);
+}
+
+void spi_set_speed(spi_speed_t speed) {
+  slow = (speed == SPI_SPEED_SLOW);
+}
+
+void spi_select_device(spi_device_t dev) {
+  uint8_t sel = (dev == SPIDEV_CARD0 || dev == SPIDEV_ALLCARDS);
+
+  /* a deselected card forgets everything but its busy state */
+  if (selected && !sel) {
+    out_clear();
+    cmdlen = 0;
+  }
+  selected = sel;
+}
+
+void spi_tx_byte(uint8_t data) {
+  transfer(data);
+}
+
+void spi_tx_block(const void *data, unsigned int length) {
+  const uint8_t *ptr = data;
+
+  while (length--)
+    transfer(*ptr++);
+}
+
+uint8_t spi_rx_byte(void) {
+  return transfer(0xff);
+}
+
+void spi_rx_block(void *data, unsigned int length) {
+  uint8_t *ptr = data;
+
+  while (length--)
+    *ptr++ = transfer(0xff);
+}
+
+void spi_rx_block_start(void *data, unsigned int length) {
+  spi_rx_block(data, length);
+}
+
+void spi_tx_block_start(const void *data, unsigned int length) {
+  spi_tx_block(data, length);
+}
+
+uint8_t spi_block_busy(void) {
+  return 0;
+}
+
+void spi_block_wait(void) {
+}
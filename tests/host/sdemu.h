@@ -0,0 +1,57 @@
+/* sd2iec - SD/MMC to Commodore serial bus interface/controller
+   Copyright (C) 2007-2017  Ingo Korb <ingo@akana.de>
+
+   Inspired by MMC2IEC by Lars Pontoppidan et al.
+
+   FAT filesystem access based on code from ChaN and Jim Brain, see ff.c|h.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License only.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+   sdemu.h: Emulated SD card behind the SPI functions
+
+*/
+
+#ifndef SDEMU_H
+#define SDEMU_H
+
+#include <stdint.h>
+
+/**
+ * struct sdemu_stats_t - counters of the emulated card
+ * @commands       : commands received
+ * @blocks_read    : data blocks sent to the host
+ * @blocks_written : data blocks programmed
+ * @busy_polls     : bytes read by the host while the card was busy
+ * @protocol_errors: things a real card would not accept
+ */
+typedef struct {
+  uint32_t commands;
+  uint32_t blocks_read;
+  uint32_t blocks_written;
+  uint32_t busy_polls;
+  uint32_t protocol_errors;
+} sdemu_stats_t;
+
+extern sdemu_stats_t sdemu_stats;
+
+/* Contents of the card */
+extern uint8_t *sdemu_data;
+
+/* Number of following data blocks that are answered with a CRC error */
+extern unsigned sdemu_fail_writes;
+
+void sdemu_init(uint32_t sectors);
+
+#endif
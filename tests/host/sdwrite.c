@@ -0,0 +1,124 @@
+/* sd2iec - SD/MMC to Commodore serial bus interface/controller
+   Copyright (C) 2007-2017  Ingo Korb <ingo@akana.de>
+
+   Inspired by MMC2IEC by Lars Pontoppidan et al.
+
+   FAT filesystem access based on code from ChaN and Jim Brain, see ff.c|h.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License only.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+   sdwrite.c: SD card driver against the emulated card
+
+   Writes and reads runs of sectors through sd_write and sd_read and
+   compares the card contents. It reports how long the host polled
+   the busy card for single and multi-block writes and checks that a
+   rejected block in a multi-block write is retried the way the SD
+   specification asks for: stop tran token, not STOP_TRANSMISSION.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "config.h"
+#include "diskio.h"
+#include "perfcount.h"
+#include "sdcard.h"
+#include "hostsim.h"
+#include "hosttest.h"
+#include "sdemu.h"
+
+#define SECTORS 16384
+#define RUN     32
+
+static uint8_t source[RUN * 512];
+static uint8_t readback[RUN * 512];
+
+/* Write RUN sectors in pieces of @count, returns the busy polls */
+static uint32_t write_run(DWORD start, BYTE count, uint32_t seed) {
+  uint32_t polls = sdemu_stats.busy_polls;
+  unsigned i;
+
+  host_fill(source, sizeof(source), seed);
+  for (i = 0; i < RUN; i += count)
+    check(sd_write(0, source + 512 * i, start + i, count) == RES_OK,
+          "sd_write of %u sectors at %u failed", count, (unsigned)(start + i));
+  check(!memcmp(sdemu_data + 512 * start, source, sizeof(source)),
+        "card contents differ after writes of %u sectors", count);
+  check(sdemu_stats.protocol_errors == 0,
+        "%u protocol errors after writes of %u sectors",
+        (unsigned)sdemu_stats.protocol_errors, count);
+
+  return sdemu_stats.busy_polls - polls;
+}
+
+int main(void) {
+  uint32_t single, multi, errors;
+  uint64_t start;
+
+  sdemu_init(SECTORS);
+  sd_init();
+  check(sd_initialize(0) == 0, "card initialisation failed");
+  check(disk_state == DISK_OK, "disk state is not OK after initialisation");
+
+  /* the same data with single and multi-block writes */
+  start  = sim_now;
+  single = write_run(100, 1, 1);
+  printf("single: %u busy polls, %.2f ms\n", (unsigned)single,
+         (sim_now - start) / 1e6);
+  start  = sim_now;
+  multi  = write_run(200, RUN, 2);
+  printf("multi:  %u busy polls, %.2f ms\n", (unsigned)multi,
+         (sim_now - start) / 1e6);
+  check(multi < single, "multi-block write was not faster");
+  printf("saved:  %u busy polls per sector\n", (unsigned)(single - multi) / RUN);
+
+  /* read both runs back in one command each */
+  check(sd_read(0, readback, 200, RUN) == RES_OK, "sd_read failed");
+  check(!memcmp(readback, source, sizeof(source)), "read data mismatch");
+
+  /* rejected blocks in the middle of a multi-block write */
+  perf_reset();
+  sdemu_stats.protocol_errors = 0;
+  sdemu_fail_writes = 0;
+  errors = sdemu_stats.blocks_written;
+  host_fill(source, sizeof(source), 3);
+  check(sd_write(0, source, 300, 8) == RES_OK, "sd_write failed");
+  sdemu_fail_writes = 2;
+  check(sd_write(0, source + 8 * 512, 308, RUN - 8) == RES_OK,
+        "sd_write with rejected blocks failed");
+  check(!memcmp(sdemu_data + 512 * 300, source, sizeof(source)),
+        "card contents differ after retried write");
+  check(sdemu_stats.protocol_errors == 0,
+        "%u protocol errors in the retried write",
+        (unsigned)sdemu_stats.protocol_errors);
+  check(perfcounters.sd_retries == 2, "%u retries instead of 2",
+        (unsigned)perfcounters.sd_retries);
+  check(sdemu_stats.blocks_written - errors == RUN,
+        "%u blocks programmed instead of %u",
+        (unsigned)(sdemu_stats.blocks_written - errors), RUN);
+
+  /* a card that keeps failing is given up on */
+  sdemu_fail_writes = 1000;
+  check(sd_write(0, source, 400, 4) == RES_ERROR,
+        "sd_write did not fail on a broken card");
+  check(sdemu_stats.protocol_errors == 0,
+        "%u protocol errors after giving up",
+        (unsigned)sdemu_stats.protocol_errors);
+  sdemu_fail_writes = 0;
+  check(sd_read(0, readback, 200, 1) == RES_OK,
+        "card unusable after a failed write");
+
+  return host_result("sdwrite");
+}
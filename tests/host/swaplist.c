@@ -0,0 +1,145 @@
+/* sd2iec - SD/MMC to Commodore serial bus interface/controller
+   Copyright (C) 2007-2017  Ingo Korb <ingo@akana.de>
+
+   Inspired by MMC2IEC by Lars Pontoppidan et al.
+
+   FAT filesystem access based on code from ChaN and Jim Brain, see ff.c|h.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License only.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+   swaplist.c: Disk changes through a long swap list
+
+   Sets a swap list with 250 D64 images and walks through it with
+   the NEXT, PREV and HOME keys, including the wrap-around at both
+   ends. After every change the directory header is loaded to see
+   if the right image is mounted. The card accesses of the changes
+   are reported, built with and without CONFIG_SWAPLIST_INDEX.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "config.h"
+#include "timer.h"
+#include "c64.h"
+#include "hostsim.h"
+#include "hosttest.h"
+#include "ramdisk.h"
+
+#define DEVICE   8
+#define ENTRIES  250
+
+static uint8_t image[HOST_D64_SIZE];
+static char    list[ENTRIES * 16];
+static ramdisk_stats_t set_io, change_io;
+static unsigned changes;
+
+static void expect_error(int code) {
+  char msg[64];
+  int  res = c64_read_error(DEVICE, msg, sizeof(msg));
+
+  check(res == code, "error channel: expected %02d, got \"%s\"", code, msg);
+}
+
+static void add_stats(ramdisk_stats_t *sum, const ramdisk_stats_t *start) {
+  sum->read_cmds    += ramdisk_stats.read_cmds    - start->read_cmds;
+  sum->read_sectors += ramdisk_stats.read_sectors - start->read_sectors;
+}
+
+/* Check the disk name in the directory header */
+static void expect_disk(unsigned entry) {
+  uint8_t dir[256];
+  char    name[17];
+  long    len;
+
+  len = c64_load(DEVICE, "$", dir, sizeof(dir));
+  sprintf(name, "DISK%03u", entry);
+  check(len > 8 + 7 && !memcmp(dir + 8, name, 7),
+        "expected %s, got %.7s", name, len > 8 ? (char *)dir + 8 : "");
+}
+
+static void press(uint8_t key) {
+  ramdisk_stats_t start = ramdisk_stats;
+
+  /* The drive blinks for 400ms after the change */
+  active_keys |= key;
+  sim_c64_delay(1000000000ULL);
+  check(!(active_keys & key), "key was not handled");
+
+  add_stats(&change_io, &start);
+  changes++;
+}
+
+static void script(void) {
+  ramdisk_stats_t start;
+  unsigned i;
+
+  expect_error(73);
+
+  start = ramdisk_stats;
+  c64_open(DEVICE, 15, "XS:SWAP.LST");
+  c64_close(DEVICE, 15);
+  sim_c64_delay(1000000000ULL);
+  add_stats(&set_io, &start);
+  expect_error(0);
+  expect_disk(0);
+
+  /* Through the list and back to the start */
+  for (i = 1; i <= ENTRIES; i++) {
+    press(KEY_NEXT);
+    expect_disk(i % ENTRIES);
+  }
+
+  /* Backwards over the start to the end */
+  press(KEY_PREV);
+  expect_disk(ENTRIES - 1);
+  press(KEY_PREV);
+  expect_disk(ENTRIES - 2);
+
+  press(KEY_HOME);
+  expect_disk(0);
+  expect_error(0);
+}
+
+int main(void) {
+  char     name[16];
+  unsigned i, len = 0;
+
+  host_boot("swaplist.img", 131072);
+
+  /* The drive holds the bus while it blinks after XS */
+  c64_hang = 2000000000ULL;
+
+  for (i = 0; i < ENTRIES; i++) {
+    sprintf(name, "DISK%03u", i);
+    host_blank_d64(image, name);
+    strcat(name, ".D64");
+    check(host_put_file(name, image, HOST_D64_SIZE) == 0,
+          "can't create %s", name);
+
+    len += sprintf(list + len, "%s\r\n", name);
+  }
+  check(host_put_file("SWAP.LST", list, len) == 0, "can't create SWAP.LST");
+
+  check(sim_run(script, 6000000000000ULL) == 0, "bus script did not finish");
+
+  printf("set list: %u card reads (%u sectors)\n",
+         (unsigned)set_io.read_cmds, (unsigned)set_io.read_sectors);
+  printf("%u changes: %.2f card reads (%.2f sectors) per change\n", changes,
+         (double)change_io.read_cmds / changes,
+         (double)change_io.read_sectors / changes);
+
+  return host_result("swaplist");
+}
@@ -0,0 +1,99 @@
+/* sd2iec - SD/MMC to Commodore serial bus interface/controller
+   Copyright (C) 2007-2017  Ingo Korb <ingo@akana.de>
+
+   Inspired by MMC2IEC by Lars Pontoppidan et al.
+
+   FAT filesystem access based on code from ChaN and Jim Brain, see ff.c|h.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License only.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+   talkgap.c: Bus idle time at the block boundaries of a LOAD
+
+   LOADs a file from the FAT file system over the standard protocol
+   and reports how much longer than a normal byte the computer waits
+   for the first byte of each new 254 byte block, which is the time
+   the drive spends on the card. The interrupt-driven sender reads the
+   next block while the queued bytes are still being sent, so there
+   the gap must be mostly gone.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "c64.h"
+#include "hostsim.h"
+#include "hosttest.h"
+
+#define DEVICE   8
+#define BLOCKS   64
+#define FILESIZE (BLOCKS * 254)
+
+static uint8_t source[FILESIZE];
+static uint8_t loaded[FILESIZE + 256];
+
+static int cmp_gap(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+  return (x > y) - (x < y);
+}
+
+static void script(void) {
+  uint32_t sorted[FILESIZE], median, gap, maxgap = 0;
+  uint64_t total = 0;
+  long     len;
+  unsigned i;
+
+  len = c64_load(DEVICE, "TALKGAP.PRG", loaded, sizeof(loaded));
+  check(len == FILESIZE, "LOAD returned %ld bytes", len);
+  check(!memcmp(loaded, source, FILESIZE), "LOAD data mismatch");
+  if (len != FILESIZE)
+    return;
+
+  memcpy(sorted, c64_xfer.gaps, (FILESIZE - 1) * sizeof(uint32_t));
+  qsort(sorted, FILESIZE - 1, sizeof(uint32_t), cmp_gap);
+  median = sorted[(FILESIZE - 1) / 2];
+
+  /* gaps[n] is the time between byte n and byte n+1 */
+  for (i = 1; i < BLOCKS; i++) {
+    gap = c64_xfer.gaps[i * 254 - 1];
+    gap = (gap > median ? gap - median : 0);
+    total += gap;
+    if (gap > maxgap)
+      maxgap = gap;
+  }
+
+  printf("%u blocks, %.2f ms per byte: idle gap per block avg %.2f ms, max %.2f ms, %.1f%% of the LOAD\n",
+         BLOCKS, median / 1e6, total / 1e6 / (BLOCKS - 1), maxgap / 1e6,
+         100.0 * total / (c64_xfer.end - c64_xfer.start));
+
+#ifdef CONFIG_IEC_ENGINE
+  check(total / (BLOCKS - 1) < median / 4,
+        "average idle gap of %.2f ms per block", total / 1e6 / (BLOCKS - 1));
+#endif
+}
+
+int main(void) {
+  host_fill(source, FILESIZE, 3);
+  host_boot("talkgap.img", 65536);
+
+  check(host_put_file("TALKGAP.PRG", source, FILESIZE) == 0,
+        "can't create test file");
+
+  check(sim_run(script, 600000000000ULL) == 0, "bus script did not finish");
+
+  return host_result("talkgap");
+}
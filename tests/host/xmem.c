@@ -0,0 +1,135 @@
+/* sd2iec - SD/MMC to Commodore serial bus interface/controller
+   Copyright (C) 2007-2017  Ingo Korb <ingo@akana.de>
+
+   Inspired by MMC2IEC by Lars Pontoppidan et al.
+
+   FAT filesystem access based on code from ChaN and Jim Brain, see ff.c|h.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License only.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+   xmem.c: Buffers and caches in a simulated external SRAM section
+
+   Built with CONFIG_XMEM, which puts the data buffers and the large
+   caches into the "xmem" section like on AVR. The link already fails
+   if the section is larger than the external memory, this checks
+   that the section starts out zeroed (the AVR startup code clears it
+   but loads no initial values), that the buffers are placed in it
+   and that files can be loaded and saved through the caches in it.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "config.h"
+#include "buffers.h"
+#include "c64.h"
+#include "hostsim.h"
+#include "hosttest.h"
+
+#define DEVICE   8
+#define FILESIZE 10000
+
+/* Same limit as the --defsym for the ATmega1280/2560 */
+#define XMEM_SIZE 0xde00
+
+/* Smallest size of the arrays that are placed in the section */
+#define XMEM_MIN (CONFIG_BUFFER_COUNT * 256 + CONFIG_P00CACHE_SIZE - 64 + \
+                  2 * CONFIG_FAT_DIRHASH + 512 + 2 * 255)
+
+extern uint8_t __start_xmem[], __stop_xmem[];
+
+static uint8_t source[FILESIZE];
+static uint8_t loaded[FILESIZE + 256];
+static uint8_t image[HOST_D64_SIZE];
+
+static void expect_error(int code) {
+  char msg[64];
+  int  res = c64_read_error(DEVICE, msg, sizeof(msg));
+
+  check(res == code, "error channel: expected %02d, got \"%s\"", code, msg);
+}
+
+static void check_load(const char *name) {
+  long len;
+
+  memset(loaded, 0, sizeof(loaded));
+  len = c64_load(DEVICE, name, loaded, sizeof(loaded));
+  check(len == FILESIZE, "LOAD of %s returned %ld bytes", name, len);
+  check(!memcmp(loaded, source, FILESIZE), "LOAD of %s data mismatch", name);
+  expect_error(0);
+}
+
+static void script(void) {
+  expect_error(73);
+
+  /* P00 name cache and directory hash */
+  check_load("XMEM P00 FILE");
+  check_load("PLAIN.PRG");
+
+  /* Sector buffers and direct image access */
+  c64_open(DEVICE, 15, "CD:XMEM.D64");
+  c64_close(DEVICE, 15);
+  expect_error(0);
+  check(c64_save(DEVICE, "SAVED", source, FILESIZE) == 0, "SAVE failed");
+  expect_error(0);
+  check_load("SAVED");
+
+  c64_open(DEVICE, 15, "CD:\x5f");
+  c64_close(DEVICE, 15);
+  expect_error(0);
+}
+
+int main(void) {
+  uint8_t *ptr;
+  unsigned size = __stop_xmem - __start_xmem;
+  unsigned i, nonzero = 0;
+
+  /* Only zero-initialised data may be put into the section */
+  for (ptr = __start_xmem; ptr != __stop_xmem; ptr++)
+    if (*ptr)
+      nonzero++;
+  check(nonzero == 0, "%u initialised bytes in the xmem section", nonzero);
+
+  printf("xmem section: %u bytes, %u free\n", size, XMEM_SIZE - size);
+  check(size >= XMEM_MIN, "xmem section has only %u bytes, expected %u",
+        size, (unsigned)XMEM_MIN);
+  check(size <= XMEM_SIZE, "xmem section is too large");
+
+  host_fill(source, FILESIZE, 24);
+  host_boot("xmem.img", 65536);
+
+  for (i = 0; i < CONFIG_BUFFER_COUNT; i++)
+    check(buffers[i].data >= __start_xmem &&
+          buffers[i].data + 256 <= __stop_xmem,
+          "buffer %u is outside the xmem section", i);
+
+  /* A P00 file: header with the CBM name, then the file data */
+  memset(image, 0, 26);
+  memcpy(image, "C64File", 7);
+  memcpy(image + 8, "XMEM P00 FILE", 13);
+  memcpy(image + 26, source, FILESIZE);
+  check(host_put_file("XMEMFILE.P00", image, 26 + FILESIZE) == 0,
+        "can't create the P00 file");
+  check(host_put_file("PLAIN.PRG", source, FILESIZE) == 0,
+        "can't create the PRG file");
+
+  host_blank_d64(image, "XMEMTEST");
+  check(host_put_file("XMEM.D64", image, HOST_D64_SIZE) == 0,
+        "can't create the image");
+
+  check(sim_run(script, 600000000000ULL) == 0, "bus script did not finish");
+
+  return host_result("xmem");
+}
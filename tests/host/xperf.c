@@ -0,0 +1,184 @@
+/* sd2iec - SD/MMC to Commodore serial bus interface/controller
+   Copyright (C) 2007-2017  Ingo Korb <ingo@akana.de>
+
+   Inspired by MMC2IEC by Lars Pontoppidan et al.
+
+   FAT filesystem access based on code from ChaN and Jim Brain, see ff.c|h.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; version 2 of the License only.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+
+   xperf.c: Performance counters on the error channel
+
+   Reads the counters with XP, XP1 and XP2 around a LOAD, a SAVE and
+   a LOAD from a D64 image and compares them with the transfers, then
+   checks that XP- clears all of them. The RAM disk replaces the SD
+   card driver here, so the SD card group stays zero; sdwrite checks
+   those counters. The bus time of XP2 is compared with the time the
+   C64 spent on the LOAD.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "c64.h"
+#include "hostsim.h"
+#include "hosttest.h"
+
+#define DEVICE   8
+#define FILESIZE 20000
+#define SAVESIZE 5000
+
+static uint8_t source[FILESIZE];
+static uint8_t dest[FILESIZE + 16];
+static uint8_t image[HOST_D64_SIZE];
+
+static void expect_error(int code) {
+  char msg[64];
+  int  res = c64_read_error(DEVICE, msg, sizeof(msg));
+
+  check(res == code, "error channel: expected %02d, got \"%s\"", code, msg);
+}
+
+static void command(const char *cmd) {
+  c64_open(DEVICE, 15, cmd);
+  c64_close(DEVICE, 15);
+}
+
+/**
+ * counters - send an XP command and parse its result
+ * @cmd   : command to send
+ * @group : expected group number in the sector field of the result
+ * @values: receives the counters in the order they are listed
+ * @count : number of counters expected
+ *
+ * The result looks like "03,P:R12/3:W0/0:E0/0,08,03", a pair counts as
+ * two values.
+ */
+static void counters(const char *cmd, int group, uint32_t *values, int count) {
+  char  msg[64];
+  char *ptr, *end;
+  int   n = 0;
+
+  command(cmd);
+  check(c64_read_error(DEVICE, msg, sizeof(msg)) == 3 && msg[3] == 'P',
+        "%s: \"%s\"", cmd, msg);
+  check(atoi(strrchr(msg, ',') + 1) == group, "%s: \"%s\"", cmd, msg);
+
+  ptr = msg + 4;
+  while (*ptr == ':' || *ptr == '/') {
+    if (*ptr == ':')
+      ptr++;
+    ptr++;
+    if (n < count)
+      values[n] = strtoul(ptr, &end, 10);
+    n++;
+    ptr = end;
+  }
+  check(n == count, "%s: %d counters in \"%s\"", cmd, n, msg);
+}
+
+static void script(void) {
+  /* XP: R sectors/cmds, W sectors/cmds, E errors/retries */
+  uint32_t sd[6];
+  /* XP1: F hits/misses, I image reads, B refills */
+  uint32_t fs[4];
+  /* XP2: S bytes, J bytes, T refill/bus microseconds */
+  uint32_t bus[4];
+  uint64_t load_time;
+  long     len;
+  int      i;
+
+  expect_error(73);
+
+  command("XP-");
+  expect_error(3);
+  counters("XP", 3, sd, 6);
+  for (i = 0; i < 6; i++)
+    check(sd[i] == 0, "XP counter %d is %u after XP-", i, (unsigned)sd[i]);
+
+  /* LOAD of a file */
+  len = c64_load(DEVICE, "SOURCE", dest, sizeof(dest));
+  load_time = c64_xfer.end - c64_xfer.start;
+  check(len == FILESIZE && !memcmp(dest, source, FILESIZE), "LOAD failed");
+  expect_error(0);
+
+  counters("XP1", 4, fs, 4);
+  check(fs[1] > 0, "no window misses counted");
+  check(fs[2] == 0, "%u image reads for a FAT file", (unsigned)fs[2]);
+  check(fs[3] >= FILESIZE / 254, "%u refills for %u blocks",
+        (unsigned)fs[3], FILESIZE / 254);
+
+  counters("XP2", 5, bus, 4);
+  check(bus[0] >= FILESIZE, "%u bytes sent for %u", (unsigned)bus[0],
+        FILESIZE);
+  check(bus[1] == 0, "%u JiffyDOS bytes", (unsigned)bus[1]);
+  check(bus[3] > load_time / 1000 / 2 && bus[3] <= load_time / 1000,
+        "bus time %uus for a LOAD of %uus", (unsigned)bus[3],
+        (unsigned)(load_time / 1000));
+  printf("LOAD of %u bytes in %.1fms: %u refills, %.1fms refilling, %.1fms on the bus\n",
+         FILESIZE, load_time / 1e6, (unsigned)fs[3], bus[2] / 1e3,
+         bus[3] / 1e3);
+
+  /* The SD card group doesn't see the RAM disk */
+  counters("XP", 3, sd, 6);
+  for (i = 0; i < 6; i++)
+    check(sd[i] == 0, "XP counter %d is %u", i, (unsigned)sd[i]);
+
+  /* LOAD from a D64 image after a SAVE into it */
+  command("CD:TEST.D64");
+  expect_error(0);
+  check(c64_save(DEVICE, "SAVED", source, SAVESIZE) == 0, "SAVE failed");
+  expect_error(0);
+  command("XP-");
+  expect_error(3);
+  len = c64_load(DEVICE, "SAVED", dest, sizeof(dest));
+  check(len == SAVESIZE && !memcmp(dest, source, SAVESIZE),
+        "LOAD from the image failed");
+  expect_error(0);
+  counters("XP1", 4, fs, 4);
+  /* The track read-ahead cache reads several blocks per image_read */
+  check(fs[2] > 0, "no image reads counted");
+  command("CD:\x5f");
+  expect_error(0);
+
+  /* XP- clears everything */
+  command("XP-");
+  expect_error(3);
+  counters("XP1", 4, fs, 4);
+  counters("XP2", 5, bus, 4);
+  for (i = 0; i < 4; i++) {
+    check(fs[i] == 0, "XP1 counter %d is %u after XP-", i, (unsigned)fs[i]);
+    check(bus[i] == 0, "XP2 counter %d is %u after XP-", i, (unsigned)bus[i]);
+  }
+
+  command("XP3");
+  expect_error(30);
+}
+
+int main(void) {
+  host_fill(source, FILESIZE, 7);
+  host_boot("xperf.img", 65536);
+
+  check(host_put_file("SOURCE", source, FILESIZE) == 0,
+        "can't create SOURCE");
+  check(host_put_file("TEST.D64", image, host_blank_d64(image, "PERF")) == 0,
+        "can't create TEST.D64");
+
+  check(sim_run(script, 600000000000ULL) == 0, "bus script did not finish");
+
+  return host_result("xperf");
+}